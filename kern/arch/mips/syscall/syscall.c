@@ -144,6 +144,10 @@ syscall(struct trapframe *tf)
 		err = sys___getcwd((userptr_t)tf->tf_a0, (size_t)tf->tf_a1, &retval1);
 		break;
 
+		case SYS_ioctl:
+		err = sys_ioctl(tf->tf_a0, tf->tf_a1, (userptr_t)tf->tf_a2);
+		break;
+
 		/* Process syscall */
 		case SYS_fork:
 		err = sys_fork(tf, &retval1);
@@ -153,6 +157,11 @@ syscall(struct trapframe *tf)
 		err = sys_execv((const_userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1);
 		break;
 
+		case SYS_spawn:
+		err = sys_spawn((const_userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1, 
+						(const_userptr_t)tf->tf_a2, tf->tf_a3, &retval1);
+		break;
+
 		case SYS_waitpid:
 		err = sys_waitpid((pid_t)tf->tf_a0, (userptr_t)tf->tf_a1, tf->tf_a2, &retval1);
 		break;
@@ -39,6 +39,16 @@
  * supported, although such support could be added without undue
  * difficulty.
  *
+ * Output sent with interrupts goes through a ring buffer: the first
+ * character is handed to the device, the rest are queued, and each
+ * write-done interrupt (con_start) sends the next. Writers only wait
+ * when the ring is full. Polled output first sends whatever is still
+ * queued, so output stays in order.
+ *
+ * Input from con_input is kept in a ring until read. User reads go
+ * through a small line discipline (see con_read): raw by default, or
+ * canonical, with line editing in the kernel, if set with ioctl.
+ *
  * Note that nothing happens until we have a device to write to. A
  * buffer of size DELAYBUFSIZE is used to hold output that is
  * generated before this point. This means that (1) using kprintf for
@@ -49,12 +59,15 @@
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/ioctl.h>
 #include <lib.h>
 #include <uio.h>
+#include <copyinout.h>
 #include <cpu.h>
 #include <thread.h>
 #include <current.h>
 #include <synch.h>
+#include <wchan.h>
 #include <generic/console.h>
 #include <vfs.h>
 #include <device.h>
@@ -117,11 +130,61 @@ static
 void
 putch_polled(struct con_softc *cs, int ch)
 {
+	if (spinlock_do_i_hold(&cs->cs_sendlock)) {
+		/* panic from inside the ring code; just print */
+		cs->cs_sendpolled(cs->cs_devdata, ch);
+		return;
+	}
+
+	spinlock_acquire(&cs->cs_sendlock);
+	while (cs->cs_sendbuf_tail != cs->cs_sendbuf_head) {
+		cs->cs_sendpolled(cs->cs_devdata,
+				  cs->cs_sendbuf[cs->cs_sendbuf_tail]);
+		cs->cs_sendbuf_tail =
+			(cs->cs_sendbuf_tail + 1) % CONSOLE_OUTPUT_BUFFER_SIZE;
+	}
 	cs->cs_sendpolled(cs->cs_devdata, ch);
+	/* cs_sendbusy stays set until the pending interrupt, if any */
+	spinlock_release(&cs->cs_sendlock);
 }
 
 //////////////////////////////////////////////////
 
+/*
+ * Queue a character for output, waiting if the ring is full.
+ * Call with cs_sendlock held.
+ */
+static
+void
+send_intr(struct con_softc *cs, int ch)
+{
+	unsigned nexthead;
+
+	KASSERT(spinlock_do_i_hold(&cs->cs_sendlock));
+
+	if (!cs->cs_sendbusy) {
+		/* idle; nothing can be queued */
+		KASSERT(cs->cs_sendbuf_head == cs->cs_sendbuf_tail);
+		cs->cs_sendbusy = true;
+		cs->cs_send(cs->cs_devdata, ch);
+		return;
+	}
+
+	nexthead = (cs->cs_sendbuf_head + 1) % CONSOLE_OUTPUT_BUFFER_SIZE;
+	while (nexthead == cs->cs_sendbuf_tail) {
+		wchan_sleep(cs->cs_sendwchan, &cs->cs_sendlock);
+		if (!cs->cs_sendbusy) {
+			/* drained while we slept */
+			send_intr(cs, ch);
+			return;
+		}
+		nexthead = (cs->cs_sendbuf_head + 1) %
+			CONSOLE_OUTPUT_BUFFER_SIZE;
+	}
+	cs->cs_sendbuf[cs->cs_sendbuf_head] = ch;
+	cs->cs_sendbuf_head = nexthead;
+}
+
 /*
  * Print a character, using interrupts to wait for I/O completion.
  */
@@ -129,8 +192,29 @@ static
 void
 putch_intr(struct con_softc *cs, int ch)
 {
-	P(cs->cs_wsem);
-	cs->cs_send(cs->cs_devdata, ch);
+	spinlock_acquire(&cs->cs_sendlock);
+	send_intr(cs, ch);
+	spinlock_release(&cs->cs_sendlock);
+}
+
+/*
+ * Print a buffer of user output, turning newlines into CR/LF, with
+ * only one trip through the lock.
+ */
+static
+void
+con_write(struct con_softc *cs, const char *buf, size_t len)
+{
+	size_t i;
+
+	spinlock_acquire(&cs->cs_sendlock);
+	for (i=0; i<len; i++) {
+		if (buf[i]=='\n') {
+			send_intr(cs, '\r');
+		}
+		send_intr(cs, buf[i]);
+	}
+	spinlock_release(&cs->cs_sendlock);
 }
 
 /*
@@ -178,13 +262,26 @@ con_input(void *vcs, int ch)
 
 /*
  * Called from underlying device when a write-done interrupt occurs.
+ * Send the next queued character, if any.
  */
 void
 con_start(void *vcs)
 {
 	struct con_softc *cs = vcs;
+	unsigned char ch;
 
-	V(cs->cs_wsem);
+	spinlock_acquire(&cs->cs_sendlock);
+	if (cs->cs_sendbuf_tail == cs->cs_sendbuf_head) {
+		cs->cs_sendbusy = false;
+	}
+	else {
+		ch = cs->cs_sendbuf[cs->cs_sendbuf_tail];
+		cs->cs_sendbuf_tail =
+			(cs->cs_sendbuf_tail + 1) % CONSOLE_OUTPUT_BUFFER_SIZE;
+		cs->cs_send(cs->cs_devdata, ch);
+	}
+	wchan_wakeall(cs->cs_sendwchan, &cs->cs_sendlock);
+	spinlock_release(&cs->cs_sendlock);
 }
 
 //////////////////////////////////////////////////
@@ -231,6 +328,139 @@ getch(void)
  * VFS interface functions
  */
 
+/* How much user I/O is copied at a time */
+#define CON_IOCHUNK  128
+
+/* Control characters for canonical mode */
+#define CON_CTRL_D   4		/* end of file */
+#define CON_CTRL_U   21		/* erase the line */
+#define CON_DEL      127
+
+/*
+ * Rub out the last character echoed.
+ */
+static
+void
+con_erase(void)
+{
+	putch('\b');
+	putch(' ');
+	putch('\b');
+}
+
+/*
+ * Read a line into cs_line for canonical mode, echoing it and
+ * handling erase (backspace or DEL), ^U and ^D. The line ends with a
+ * newline, unless ^D ended it; if ^D was typed on an empty line,
+ * it's left empty, which reads as end of file.
+ */
+static
+void
+con_getline(struct con_softc *cs)
+{
+	int ch;
+	bool done = false;
+
+	KASSERT(cs->cs_linelen == 0 && cs->cs_linepos == 0);
+
+	while (!done) {
+		ch = getch();
+		switch (ch) {
+		    case '\r':
+		    case '\n':
+			/* there's always room for the newline */
+			cs->cs_line[cs->cs_linelen++] = '\n';
+			putch('\r');
+			putch('\n');
+			done = true;
+			break;
+		    case '\b':
+		    case CON_DEL:
+			if (cs->cs_linelen > 0) {
+				cs->cs_linelen--;
+				con_erase();
+			}
+			break;
+		    case CON_CTRL_U:
+			while (cs->cs_linelen > 0) {
+				cs->cs_linelen--;
+				con_erase();
+			}
+			break;
+		    case CON_CTRL_D:
+			done = true;
+			break;
+		    default:
+			if (ch >= 32 && ch < 127 &&
+			    cs->cs_linelen < CONSOLE_LINE_SIZE - 1) {
+				cs->cs_line[cs->cs_linelen++] = ch;
+				putch(ch);
+			}
+			else {
+				/* alert (bell) */
+				putch('\a');
+			}
+			break;
+		}
+	}
+}
+
+/*
+ * Console read. Call with con_userlock_read held.
+ *
+ * In raw mode, characters are returned as typed, up to a newline,
+ * with CR turned into LF and no echo. In canonical mode a whole
+ * line is collected first and returned, as much as fits, with one
+ * uiomove; the rest is returned by the next read.
+ */
+static
+int
+con_read(struct con_softc *cs, struct uio *uio)
+{
+	char buf[CON_IOCHUNK];
+	size_t len;
+	int ch, result;
+
+	if (cs->cs_mode == TTY_CANON && cs->cs_linelen == 0) {
+		con_getline(cs);
+	}
+
+	if (cs->cs_linelen > 0) {
+		/* also drains a leftover line after switching to raw */
+		len = cs->cs_linelen - cs->cs_linepos;
+		if (len > uio->uio_resid) {
+			len = uio->uio_resid;
+		}
+		result = uiomove(cs->cs_line + cs->cs_linepos, len, uio);
+		if (result) {
+			return result;
+		}
+		cs->cs_linepos += len;
+		if (cs->cs_linepos == cs->cs_linelen) {
+			cs->cs_linelen = cs->cs_linepos = 0;
+		}
+		return 0;
+	}
+
+	if (cs->cs_mode == TTY_CANON) {
+		/* ^D on an empty line */
+		return 0;
+	}
+
+	len = 0;
+	while (len < uio->uio_resid && len < sizeof(buf)) {
+		ch = getch();
+		if (ch=='\r') {
+			ch = '\n';
+		}
+		buf[len++] = ch;
+		if (ch=='\n') {
+			break;
+		}
+	}
+	return uiomove(buf, len, uio);
+}
+
 static
 int
 con_eachopen(struct device *dev, int openflags)
@@ -245,11 +475,10 @@ int
 con_io(struct device *dev, struct uio *uio)
 {
 	int result;
-	char ch;
+	char buf[CON_IOCHUNK];
+	size_t len;
 	struct lock *lk;
 
-	(void)dev;  // unused
-
 	if (uio->uio_rw==UIO_READ) {
 		lk = con_userlock_read;
 	}
@@ -260,45 +489,58 @@ con_io(struct device *dev, struct uio *uio)
 	KASSERT(lk != NULL);
 	lock_acquire(lk);
 
+	if (uio->uio_rw==UIO_READ) {
+		result = con_read(dev->d_data, uio);
+		lock_release(lk);
+		return result;
+	}
+
 	while (uio->uio_resid > 0) {
-		if (uio->uio_rw==UIO_READ) {
-			ch = getch();
-			if (ch=='\r') {
-				ch = '\n';
-			}
-			result = uiomove(&ch, 1, uio);
-			if (result) {
-				lock_release(lk);
-				return result;
-			}
-			if (ch=='\n') {
-				break;
-			}
+		len = uio->uio_resid;
+		if (len > sizeof(buf)) {
+			len = sizeof(buf);
 		}
-		else {
-			result = uiomove(&ch, 1, uio);
-			if (result) {
-				lock_release(lk);
-				return result;
-			}
-			if (ch=='\n') {
-				putch('\r');
-			}
-			putch(ch);
+		result = uiomove(buf, len, uio);
+		if (result) {
+			lock_release(lk);
+			return result;
 		}
+		con_write(dev->d_data, buf, len);
 	}
 	lock_release(lk);
 	return 0;
 }
 
+/*
+ * Get or set the input mode. Setting it waits for any read in
+ * progress to finish.
+ */
 static
 int
 con_ioctl(struct device *dev, int op, userptr_t data)
 {
-	/* No ioctls. */
-	(void)dev;
-	(void)op;
-	(void)data;
+	struct con_softc *cs = dev->d_data;
+	int mode, result;
+
+	switch (op) {
+	    case TIOCGMODE:
+		lock_acquire(con_userlock_read);
+		mode = cs->cs_mode;
+		lock_release(con_userlock_read);
+		return copyout(&mode, data, sizeof(mode));
+	    case TIOCSMODE:
+		result = copyin(data, &mode, sizeof(mode));
+		if (result) {
+			return result;
+		}
+		if (mode != TTY_RAW && mode != TTY_CANON) {
+			return EINVAL;
+		}
+		lock_acquire(con_userlock_read);
+		cs->cs_mode = mode;
+		lock_release(con_userlock_read);
+		return 0;
+	}
 	return EINVAL;
 }
 
@@ -343,7 +585,8 @@ attach_console_to_vfs(struct con_softc *cs)
 int
 config_con(struct con_softc *cs, int unit)
 {
-	struct semaphore *rsem, *wsem;
+	struct semaphore *rsem;
+	struct wchan *wchan;
 	struct lock *rlk, *wlk;
 
 	/*
@@ -363,29 +606,36 @@ config_con(struct con_softc *cs, int unit)
 	if (rsem == NULL) {
 		return ENOMEM;
 	}
-	wsem = sem_create("console write", 1);
-	if (wsem == NULL) {
+	wchan = wchan_create("console write");
+	if (wchan == NULL) {
 		sem_destroy(rsem);
 		return ENOMEM;
 	}
 	rlk = lock_create("console-lock-read");
 	if (rlk == NULL) {
 		sem_destroy(rsem);
-		sem_destroy(wsem);
+		wchan_destroy(wchan);
 		return ENOMEM;
 	}
 	wlk = lock_create("console-lock-write");
 	if (wlk == NULL) {
 		lock_destroy(rlk);
 		sem_destroy(rsem);
-		sem_destroy(wsem);
+		wchan_destroy(wchan);
 		return ENOMEM;
 	}
 
 	cs->cs_rsem = rsem;
-	cs->cs_wsem = wsem;
 	cs->cs_gotchars_head = 0;
 	cs->cs_gotchars_tail = 0;
+	cs->cs_mode = TTY_RAW;
+	cs->cs_linelen = 0;
+	cs->cs_linepos = 0;
+	spinlock_init(&cs->cs_sendlock);
+	cs->cs_sendwchan = wchan;
+	cs->cs_sendbuf_head = 0;
+	cs->cs_sendbuf_tail = 0;
+	cs->cs_sendbusy = false;
 
 	the_console = cs;
 	con_userlock_read = rlk;
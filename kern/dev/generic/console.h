@@ -30,6 +30,8 @@
 #ifndef _GENERIC_CONSOLE_H_
 #define _GENERIC_CONSOLE_H_
 
+#include <spinlock.h>
+
 /*
  * Device data for the hardware-independent system console.
  *
@@ -37,7 +39,9 @@
  * device, and are to be initialized by the attach routine.
  */
 
-#define CONSOLE_INPUT_BUFFER_SIZE 32
+#define CONSOLE_INPUT_BUFFER_SIZE 256
+#define CONSOLE_LINE_SIZE 256
+#define CONSOLE_OUTPUT_BUFFER_SIZE 1024
 
 struct con_softc {
 	/* initialized by attach routine */
@@ -47,10 +51,23 @@ struct con_softc {
 
 	/* initialized by config routine */
 	struct semaphore *cs_rsem;
-	struct semaphore *cs_wsem;
 	unsigned char cs_gotchars[CONSOLE_INPUT_BUFFER_SIZE];
 	unsigned cs_gotchars_head;	/* next slot to put a char in */
 	unsigned cs_gotchars_tail;	/* next slot to take a char out */
+
+	/* line discipline; protected by the console read lock */
+	int cs_mode;			/* TTY_RAW or TTY_CANON */
+	char cs_line[CONSOLE_LINE_SIZE];
+	unsigned cs_linelen;		/* chars in the line */
+	unsigned cs_linepos;		/* chars of it already read */
+
+	/* output ring, drained by con_start */
+	struct spinlock cs_sendlock;	/* protects the following */
+	struct wchan *cs_sendwchan;	/* writers waiting for space */
+	unsigned char cs_sendbuf[CONSOLE_OUTPUT_BUFFER_SIZE];
+	unsigned cs_sendbuf_head;	/* next slot to put a char in */
+	unsigned cs_sendbuf_tail;	/* next slot to take a char out */
+	bool cs_sendbusy;		/* device is sending a char */
 };
 
 /*
@@ -49,6 +49,7 @@
 #include <uio.h>
 #include <membar.h>
 #include <synch.h>
+#include <vm.h>
 #include <lamebus/emu.h>
 #include <platform/bus.h>
 #include <vfs.h>
@@ -412,7 +413,441 @@ emu_trunc(struct emu_softc *sc, uint32_t handle, off_t len)
 // at bottom of this section
 
 static int emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
-			   struct emufs_vnode **ret);
+			   const char *path, struct emufs_vnode **ret);
+
+/*
+ * File cache.
+ *
+ * A file has one vnode however many times it's opened, found by its
+ * path from the root, so the vnode can remember the file's size and
+ * pages of its contents and a write through any open keeps them
+ * right. Stats and reads that hit don't go to the device, or take
+ * e_lock, at all; reads of different files only meet at the device.
+ * Misses are filled a whole transfer (EMU_MAXIO) at a time. Changes
+ * made on the host behind our back, or through a different path to
+ * the same file, aren't noticed.
+ *
+ * All files together cache at most EMU_CACHEPAGES pages, on one LRU
+ * list per device. A fill that would go over evicts the least
+ * recently used pages, whichever files they belong to. Pages being
+ * copied out are busy and are left alone; only if every page is busy
+ * does a read go straight to the device.
+ *
+ * A vnode's ev_lock covers its size and serializes its reads, writes,
+ * and fills; it's taken before e_lock. The LRU list, the page counts,
+ * and ev_pages (which eviction changes without ev_lock) are covered
+ * by e_cachelock.
+ */
+
+/*
+ * LRU list, with e_cachelock held.
+ */
+static
+void
+emufs_lru_remove(struct emu_softc *sc, struct emufs_page *ep)
+{
+	if (ep->ep_prev != NULL) {
+		ep->ep_prev->ep_next = ep->ep_next;
+	}
+	else {
+		sc->e_lruhead = ep->ep_next;
+	}
+	if (ep->ep_next != NULL) {
+		ep->ep_next->ep_prev = ep->ep_prev;
+	}
+	else {
+		sc->e_lrutail = ep->ep_prev;
+	}
+	ep->ep_prev = ep->ep_next = NULL;
+}
+
+static
+void
+emufs_lru_insert(struct emu_softc *sc, struct emufs_page *ep)
+{
+	ep->ep_prev = NULL;
+	ep->ep_next = sc->e_lruhead;
+	if (sc->e_lruhead != NULL) {
+		sc->e_lruhead->ep_prev = ep;
+	}
+	else {
+		sc->e_lrutail = ep;
+	}
+	sc->e_lruhead = ep;
+}
+
+static
+void
+emufs_freepage(struct emufs_page *ep)
+{
+	kfree(ep->ep_data);
+	kfree(ep);
+}
+
+/*
+ * Throw away the cache. Reading needs ev_lock, so none of the pages
+ * can be busy.
+ */
+static
+void
+emufs_dropcache(struct emufs_vnode *ev)
+{
+	struct emu_softc *sc = ev->ev_emu;
+	struct emufs_page **pages, *ep, *list;
+	unsigned i;
+
+	list = NULL;
+	spinlock_acquire(&sc->e_cachelock);
+	for (i=0; i<ev->ev_maxpages; i++) {
+		ep = ev->ev_pages[i];
+		if (ep == NULL) {
+			continue;
+		}
+		KASSERT(ep->ep_busy == 0);
+		emufs_lru_remove(sc, ep);
+		ep->ep_next = list;
+		list = ep;
+	}
+	KASSERT(sc->e_cachepages >= ev->ev_npages);
+	sc->e_cachepages -= ev->ev_npages;
+	pages = ev->ev_pages;
+	ev->ev_pages = NULL;
+	ev->ev_maxpages = 0;
+	ev->ev_npages = 0;
+	spinlock_release(&sc->e_cachelock);
+
+	while ((ep = list) != NULL) {
+		list = ep->ep_next;
+		emufs_freepage(ep);
+	}
+	kfree(pages);
+	ev->ev_sizevalid = false;
+}
+
+/*
+ * Call after writing or truncating the file.
+ */
+static
+void
+emufs_changed(struct emufs_vnode *ev)
+{
+	KASSERT(lock_do_i_hold(ev->ev_lock));
+
+	emufs_dropcache(ev);
+}
+
+/*
+ * Get the file size, from the cache if possible.
+ */
+static
+int
+emufs_getsize(struct emufs_vnode *ev, off_t *ret)
+{
+	int result;
+
+	KASSERT(lock_do_i_hold(ev->ev_lock));
+
+	if (!ev->ev_sizevalid) {
+		result = emu_getsize(ev->ev_emu, ev->ev_handle, &ev->ev_size);
+		if (result) {
+			return result;
+		}
+		ev->ev_sizevalid = true;
+	}
+	*ret = ev->ev_size;
+	return 0;
+}
+
+/*
+ * Make room in ev_pages for pages up to NPAGES.
+ */
+static
+int
+emufs_growcache(struct emufs_vnode *ev, unsigned npages)
+{
+	struct emu_softc *sc = ev->ev_emu;
+	struct emufs_page **newpages, **oldpages;
+	unsigned i;
+
+	if (npages <= ev->ev_maxpages) {
+		return 0;
+	}
+	newpages = kmalloc(npages * sizeof(struct emufs_page *));
+	if (newpages == NULL) {
+		return ENOMEM;
+	}
+
+	spinlock_acquire(&sc->e_cachelock);
+	for (i=0; i<npages; i++) {
+		newpages[i] = i < ev->ev_maxpages ? ev->ev_pages[i] : NULL;
+	}
+	oldpages = ev->ev_pages;
+	ev->ev_pages = newpages;
+	ev->ev_maxpages = npages;
+	spinlock_release(&sc->e_cachelock);
+
+	kfree(oldpages);
+	return 0;
+}
+
+/*
+ * Evict the least recently used page that isn't busy. Returns false
+ * if there isn't one.
+ */
+static
+bool
+emufs_evict(struct emu_softc *sc)
+{
+	struct emufs_page *ep;
+	struct emufs_vnode *owner;
+
+	spinlock_acquire(&sc->e_cachelock);
+	for (ep = sc->e_lrutail; ep != NULL; ep = ep->ep_prev) {
+		if (ep->ep_busy == 0) {
+			break;
+		}
+	}
+	if (ep == NULL) {
+		spinlock_release(&sc->e_cachelock);
+		return false;
+	}
+	emufs_lru_remove(sc, ep);
+	owner = ep->ep_vnode;
+	KASSERT(owner->ev_pages[ep->ep_index] == ep);
+	owner->ev_pages[ep->ep_index] = NULL;
+	owner->ev_npages--;
+	sc->e_cachepages--;
+	spinlock_release(&sc->e_cachelock);
+
+	emufs_freepage(ep);
+	return true;
+}
+
+/*
+ * Count N more pages against EMU_CACHEPAGES, evicting to make room.
+ * If everything is busy, settles for what's left. Returns how many
+ * it got, possibly 0.
+ */
+static
+unsigned
+emufs_reserve(struct emu_softc *sc, unsigned n)
+{
+	unsigned room;
+	bool evicted;
+
+	spinlock_acquire(&sc->e_cachelock);
+	while (sc->e_cachepages + n > EMU_CACHEPAGES) {
+		spinlock_release(&sc->e_cachelock);
+		evicted = emufs_evict(sc);
+		spinlock_acquire(&sc->e_cachelock);
+		if (!evicted) {
+			room = EMU_CACHEPAGES - sc->e_cachepages;
+			if (n > room) {
+				n = room;
+			}
+			break;
+		}
+	}
+	sc->e_cachepages += n;
+	spinlock_release(&sc->e_cachelock);
+	return n;
+}
+
+static
+void
+emufs_unreserve(struct emu_softc *sc, unsigned n)
+{
+	spinlock_acquire(&sc->e_cachelock);
+	KASSERT(sc->e_cachepages >= n);
+	sc->e_cachepages -= n;
+	spinlock_release(&sc->e_cachelock);
+}
+
+/*
+ * Get page PAGE from the cache, marked busy, or NULL if it isn't
+ * there.
+ */
+static
+struct emufs_page *
+emufs_getpage(struct emufs_vnode *ev, unsigned page)
+{
+	struct emu_softc *sc = ev->ev_emu;
+	struct emufs_page *ep;
+
+	spinlock_acquire(&sc->e_cachelock);
+	ep = page < ev->ev_maxpages ? ev->ev_pages[page] : NULL;
+	if (ep != NULL) {
+		ep->ep_busy++;
+		emufs_lru_remove(sc, ep);
+		emufs_lru_insert(sc, ep);
+	}
+	spinlock_release(&sc->e_cachelock);
+	return ep;
+}
+
+static
+void
+emufs_putpage(struct emu_softc *sc, struct emufs_page *ep)
+{
+	spinlock_acquire(&sc->e_cachelock);
+	KASSERT(ep->ep_busy > 0);
+	ep->ep_busy--;
+	spinlock_release(&sc->e_cachelock);
+}
+
+/*
+ * Read page PAGE, and as many uncached pages after it as fit in one
+ * transfer, into the cache, and hand back the first one busy. SIZE
+ * is the file size. Returns ENOSPC if there's no room even after
+ * evicting, in which case the caller should read directly.
+ */
+static
+int
+emufs_fillcache(struct emufs_vnode *ev, unsigned page, off_t size,
+		struct emufs_page **ret)
+{
+	struct emu_softc *sc = ev->ev_emu;
+	struct iovec iov[EMU_MAXIO / PAGE_SIZE];
+	struct emufs_page *eps[EMU_MAXIO / PAGE_SIZE];
+	struct uio ku;
+	unsigned filepages, n, i;
+	uint32_t len, got, start, skip;
+	int result;
+
+	KASSERT(lock_do_i_hold(ev->ev_lock));
+
+	filepages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+	KASSERT(page < filepages);
+
+	n = 0;
+	spinlock_acquire(&sc->e_cachelock);
+	while (n < EMU_MAXIO / PAGE_SIZE && page + n < filepages &&
+	       (page + n >= ev->ev_maxpages ||
+		ev->ev_pages[page + n] == NULL)) {
+		n++;
+	}
+	spinlock_release(&sc->e_cachelock);
+	KASSERT(n > 0);
+
+	n = emufs_reserve(sc, n);
+	if (n == 0) {
+		return ENOSPC;
+	}
+
+	result = emufs_growcache(ev, page + n);
+	if (result) {
+		emufs_unreserve(sc, n);
+		return result;
+	}
+	for (i=0; i<n; i++) {
+		eps[i] = kmalloc(sizeof(struct emufs_page));
+		if (eps[i] == NULL) {
+			result = ENOMEM;
+			goto fail;
+		}
+		eps[i]->ep_data = kmalloc(PAGE_SIZE);
+		if (eps[i]->ep_data == NULL) {
+			kfree(eps[i]);
+			result = ENOMEM;
+			goto fail;
+		}
+		eps[i]->ep_vnode = ev;
+		eps[i]->ep_index = page + i;
+		eps[i]->ep_busy = 0;
+		iov[i].iov_kbase = eps[i]->ep_data;
+		iov[i].iov_len = PAGE_SIZE;
+	}
+
+	len = n * PAGE_SIZE;
+	ku.uio_iov = iov;
+	ku.uio_iovcnt = n;
+	ku.uio_offset = (off_t)page * PAGE_SIZE;
+	ku.uio_resid = len;
+	ku.uio_segflg = UIO_SYSSPACE;
+	ku.uio_rw = UIO_READ;
+	ku.uio_space = NULL;
+
+	result = emu_read(sc, ev->ev_handle, len, &ku);
+	if (result) {
+		goto fail;
+	}
+
+	/* Zero whatever is past the end of what was read */
+	got = len - ku.uio_resid;
+	for (i=0; i<n; i++) {
+		start = i * PAGE_SIZE;
+		if (got < start + PAGE_SIZE) {
+			skip = got > start ? got - start : 0;
+			bzero(eps[i]->ep_data + skip, PAGE_SIZE - skip);
+		}
+	}
+
+	/* Only fills change our slots from NULL, and we have ev_lock */
+	spinlock_acquire(&sc->e_cachelock);
+	for (i=0; i<n; i++) {
+		KASSERT(ev->ev_pages[page + i] == NULL);
+		ev->ev_pages[page + i] = eps[i];
+		emufs_lru_insert(sc, eps[i]);
+	}
+	ev->ev_npages += n;
+	eps[0]->ep_busy++;
+	spinlock_release(&sc->e_cachelock);
+
+	*ret = eps[0];
+	return 0;
+
+ fail:
+	while (i-- > 0) {
+		emufs_freepage(eps[i]);
+	}
+	emufs_unreserve(sc, n);
+	return result;
+}
+
+/*
+ * Path from the root of NAME (which may have several components) in
+ * the directory at DIRPATH, with "." and ".." taken out, so each file
+ * has just one. Returns a kmalloc'd string, or NULL if out of memory.
+ */
+static
+char *
+emufs_mkpath(const char *dirpath, const char *name)
+{
+	char *path, *s;
+	size_t len, clen;
+
+	path = kmalloc(strlen(dirpath) + strlen(name) + 2);
+	if (path == NULL) {
+		return NULL;
+	}
+	strcpy(path, dirpath);
+	len = strlen(path);
+
+	while (*name != 0) {
+		for (clen = 0; name[clen] != 0 && name[clen] != '/'; clen++) {
+			/* nothing */
+		}
+		if (clen == 2 && name[0] == '.' && name[1] == '.') {
+			/* back up a component */
+			s = strrchr(path, '/');
+			len = s != NULL ? (size_t)(s - path) : 0;
+			path[len] = 0;
+		}
+		else if (clen > 0 && !(clen == 1 && name[0] == '.')) {
+			if (len > 0) {
+				path[len++] = '/';
+			}
+			memcpy(path + len, name, clen);
+			len += clen;
+			path[len] = 0;
+		}
+		name += clen;
+		if (*name == '/') {
+			name++;
+		}
+	}
+	return path;
+}
 
 /*
  * VOP_EACHOPEN on files
@@ -473,32 +908,25 @@ emufs_reclaim(struct vnode *v)
 	int result;
 
 	/*
-	 * Need all of these locks, e_lock to protect the device,
-	 * vfs_biglock to protect the fs-related material, and
-	 * vn_countlock for the reference count.
+	 * Need both of these locks, e_lock to protect the device and
+	 * vfs_biglock to protect the fs-related material.
 	 */
 
 	vfs_biglock_acquire();
 	lock_acquire(ef->ef_emu->e_lock);
-	spinlock_acquire(&ev->ev_v.vn_countlock);
-
-	if (ev->ev_v.vn_refcount > 1) {
-		/* consume the reference VOP_DECREF passed us */
-		ev->ev_v.vn_refcount--;
 
-		spinlock_release(&ev->ev_v.vn_countlock);
+	/*
+	 * New references are only made under e_lock, so if we're the
+	 * last ref nobody can increment the refcount.
+	 */
+	if (vnode_stillbusy(&ev->ev_v)) {
+		/* that consumed the reference VOP_DECREF passed us */
 		lock_release(ef->ef_emu->e_lock);
 		vfs_biglock_release();
 		return EBUSY;
 	}
 	KASSERT(ev->ev_v.vn_refcount == 1);
 
-	/*
-	 * Since we hold e_lock and are the last ref, nobody can increment
-	 * the refcount, so we can release vn_countlock.
-	 */
-	spinlock_release(&ev->ev_v.vn_countlock);
-
 	/* emu_close retries on I/O error */
 	result = emu_close(ev->ev_emu, ev->ev_handle);
 	if (result) {
@@ -529,24 +957,25 @@ emufs_reclaim(struct vnode *v)
 	lock_release(ef->ef_emu->e_lock);
 	vfs_biglock_release();
 
+	/* Last reference, so nobody else has ev_lock */
+	emufs_dropcache(ev);
+	lock_destroy(ev->ev_lock);
+	kfree(ev->ev_path);
 	kfree(ev);
 	return 0;
 }
 
 /*
- * VOP_READ
+ * Read straight from the device, EMU_MAXIO at a time.
  */
 static
 int
-emufs_read(struct vnode *v, struct uio *uio)
+emufs_readdirect(struct emufs_vnode *ev, struct uio *uio)
 {
-	struct emufs_vnode *ev = v->vn_data;
 	uint32_t amt;
 	size_t oldresid;
 	int result;
 
-	KASSERT(uio->uio_rw==UIO_READ);
-
 	while (uio->uio_resid > 0) {
 		amt = uio->uio_resid;
 		if (amt > EMU_MAXIO) {
@@ -569,6 +998,54 @@ emufs_read(struct vnode *v, struct uio *uio)
 	return 0;
 }
 
+/*
+ * VOP_READ
+ */
+static
+int
+emufs_read(struct vnode *v, struct uio *uio)
+{
+	struct emufs_vnode *ev = v->vn_data;
+	struct emufs_page *ep;
+	unsigned page;
+	size_t off, len;
+	off_t size;
+	int result;
+
+	KASSERT(uio->uio_rw==UIO_READ);
+
+	lock_acquire(ev->ev_lock);
+
+	result = emufs_getsize(ev, &size);
+	while (result == 0 && uio->uio_resid > 0 && uio->uio_offset < size) {
+		page = uio->uio_offset / PAGE_SIZE;
+		off = uio->uio_offset % PAGE_SIZE;
+		len = PAGE_SIZE - off;
+		if ((off_t)len > size - uio->uio_offset) {
+			len = size - uio->uio_offset;
+		}
+
+		ep = emufs_getpage(ev, page);
+		if (ep == NULL) {
+			result = emufs_fillcache(ev, page, size, &ep);
+			if (result == ENOSPC) {
+				/* every cached page is in use */
+				result = emufs_readdirect(ev, uio);
+				break;
+			}
+			if (result) {
+				break;
+			}
+		}
+
+		result = uiomove(ep->ep_data + off, len, uio);
+		emufs_putpage(ev->ev_emu, ep);
+	}
+
+	lock_release(ev->ev_lock);
+	return result;
+}
+
 /*
  * VOP_READDIR
  */
@@ -603,6 +1080,10 @@ emufs_write(struct vnode *v, struct uio *uio)
 
 	KASSERT(uio->uio_rw==UIO_WRITE);
 
+	vnode_modify(v);
+	lock_acquire(ev->ev_lock);
+
+	result = 0;
 	while (uio->uio_resid > 0) {
 		amt = uio->uio_resid;
 		if (amt > EMU_MAXIO) {
@@ -613,7 +1094,7 @@ emufs_write(struct vnode *v, struct uio *uio)
 
 		result = emu_write(ev->ev_emu, ev->ev_handle, amt, uio);
 		if (result) {
-			return result;
+			break;
 		}
 
 		if (uio->uio_resid == oldresid) {
@@ -622,7 +1103,10 @@ emufs_write(struct vnode *v, struct uio *uio)
 		}
 	}
 
-	return 0;
+	/* Even if it failed, some of it may have been written */
+	emufs_changed(ev);
+	lock_release(ev->ev_lock);
+	return vnode_modified(v, result);
 }
 
 /*
@@ -655,7 +1139,9 @@ emufs_stat(struct vnode *v, struct stat *statbuf)
 
 	bzero(statbuf, sizeof(struct stat));
 
-	result = emu_getsize(ev->ev_emu, ev->ev_handle, &statbuf->st_size);
+	lock_acquire(ev->ev_lock);
+	result = emufs_getsize(ev, &statbuf->st_size);
+	lock_release(ev->ev_lock);
 	if (result) {
 		return result;
 	}
@@ -725,7 +1211,14 @@ int
 emufs_truncate(struct vnode *v, off_t len)
 {
 	struct emufs_vnode *ev = v->vn_data;
-	return emu_trunc(ev->ev_emu, ev->ev_handle, len);
+	int result;
+
+	vnode_modify(v);
+	lock_acquire(ev->ev_lock);
+	result = emu_trunc(ev->ev_emu, ev->ev_handle, len);
+	emufs_changed(ev);
+	lock_release(ev->ev_lock);
+	return vnode_modified(v, result);
 }
 
 /*
@@ -740,16 +1233,28 @@ emufs_creat(struct vnode *dir, const char *name, bool excl, mode_t mode,
 	struct emufs_fs *ef = dir->vn_fs->fs_data;
 	struct emufs_vnode *newguy;
 	uint32_t handle;
+	char *path;
 	int result;
 	int isdir;
 
+	path = emufs_mkpath(ev->ev_path, name);
+	if (path == NULL) {
+		return ENOMEM;
+	}
+
 	result = emu_open(ev->ev_emu, ev->ev_handle, name, true, excl, mode,
 			  &handle, &isdir);
 	if (result) {
+		kfree(path);
 		return result;
 	}
+	/* The directory's cached size may be out of date now */
+	lock_acquire(ev->ev_lock);
+	emufs_dropcache(ev);
+	lock_release(ev->ev_lock);
 
-	result = emufs_loadvnode(ef, handle, isdir, &newguy);
+	result = emufs_loadvnode(ef, handle, isdir, path, &newguy);
+	kfree(path);
 	if (result) {
 		emu_close(ev->ev_emu, handle);
 		return result;
@@ -770,16 +1275,24 @@ emufs_lookup(struct vnode *dir, char *pathname, struct vnode **ret)
 	struct emufs_fs *ef = dir->vn_fs->fs_data;
 	struct emufs_vnode *newguy;
 	uint32_t handle;
+	char *path;
 	int result;
 	int isdir;
 
+	path = emufs_mkpath(ev->ev_path, pathname);
+	if (path == NULL) {
+		return ENOMEM;
+	}
+
 	result = emu_open(ev->ev_emu, ev->ev_handle, pathname, false, false, 0,
 			  &handle, &isdir);
 	if (result) {
+		kfree(path);
 		return result;
 	}
 
-	result = emufs_loadvnode(ef, handle, isdir, &newguy);
+	result = emufs_loadvnode(ef, handle, isdir, path, &newguy);
+	kfree(path);
 	if (result) {
 		emu_close(ev->ev_emu, handle);
 		return result;
@@ -1138,12 +1651,14 @@ static const struct vnode_ops emufs_dirops = {
 };
 
 /*
- * Function to load a vnode into memory.
+ * Function to load a vnode into memory. PATH is the file's path from
+ * the root; if there's already a vnode for it, that one is used and
+ * HANDLE is closed.
  */
 static
 int
 emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
-		struct emufs_vnode **ret)
+		const char *path, struct emufs_vnode **ret)
 {
 	struct vnode *v;
 	struct emufs_vnode *ev;
@@ -1157,9 +1672,13 @@ emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 	for (i=0; i<num; i++) {
 		v = vnodearray_get(ef->ef_vnodes, i);
 		ev = v->vn_data;
-		if (ev->ev_handle == handle) {
+		if (!strcmp(ev->ev_path, path)) {
 			/* Found */
 
+			if (ev->ev_handle != handle) {
+				/* Already open; drop the second handle */
+				emu_close(ef->ef_emu, handle);
+			}
 			VOP_INCREF(&ev->ev_v);
 
 			lock_release(ef->ef_emu->e_lock);
@@ -1174,17 +1693,41 @@ emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 	ev = kmalloc(sizeof(struct emufs_vnode));
 	if (ev==NULL) {
 		lock_release(ef->ef_emu->e_lock);
+		vfs_biglock_release();
 		return ENOMEM;
 	}
 
 	ev->ev_emu = ef->ef_emu;
 	ev->ev_handle = handle;
+	ev->ev_path = kstrdup(path);
+	if (ev->ev_path == NULL) {
+		lock_release(ef->ef_emu->e_lock);
+		vfs_biglock_release();
+		kfree(ev);
+		return ENOMEM;
+	}
+
+	ev->ev_lock = lock_create("emufs-vnode");
+	if (ev->ev_lock == NULL) {
+		lock_release(ef->ef_emu->e_lock);
+		vfs_biglock_release();
+		kfree(ev->ev_path);
+		kfree(ev);
+		return ENOMEM;
+	}
+	ev->ev_sizevalid = false;
+	ev->ev_size = 0;
+	ev->ev_pages = NULL;
+	ev->ev_maxpages = 0;
+	ev->ev_npages = 0;
 
 	result = vnode_init(&ev->ev_v, isdir ? &emufs_dirops : &emufs_fileops,
 			    &ef->ef_fs, ev);
 	if (result) {
 		lock_release(ef->ef_emu->e_lock);
 		vfs_biglock_release();
+		lock_destroy(ev->ev_lock);
+		kfree(ev->ev_path);
 		kfree(ev);
 		return result;
 	}
@@ -1195,6 +1738,8 @@ emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 		vnode_cleanup(&ev->ev_v);
 		lock_release(ef->ef_emu->e_lock);
 		vfs_biglock_release();
+		lock_destroy(ev->ev_lock);
+		kfree(ev->ev_path);
 		kfree(ev);
 		return result;
 	}
@@ -1301,6 +1846,9 @@ emufs_addtovfs(struct emu_softc *sc, const char *devname)
 
 	ef->ef_fs.fs_data = ef;
 	ef->ef_fs.fs_ops = &emufs_fsops;
+	/* each vnode holds a host handle and cached pages */
+	ef->ef_fs.fs_dcachemax = EMUFS_DCACHEMAX;
+	ef->ef_fs.fs_dcacheheld = 0;
 
 	ef->ef_emu = sc;
 	ef->ef_root = NULL;
@@ -1310,7 +1858,7 @@ emufs_addtovfs(struct emu_softc *sc, const char *devname)
 		return ENOMEM;
 	}
 
-	result = emufs_loadvnode(ef, EMU_ROOTHANDLE, 1, &ef->ef_root);
+	result = emufs_loadvnode(ef, EMU_ROOTHANDLE, 1, "", &ef->ef_root);
 	if (result) {
 		kfree(ef);
 		return result;
@@ -1350,6 +1898,9 @@ config_emu(struct emu_softc *sc, int emuno)
 		return ENOMEM;
 	}
 	sc->e_iobuf = bus_map_area(sc->e_busdata, sc->e_buspos, EMU_BUFFER);
+	spinlock_init(&sc->e_cachelock);
+	sc->e_lruhead = sc->e_lrutail = NULL;
+	sc->e_cachepages = 0;
 
 	snprintf(name, sizeof(name), "emu%d", emuno);
 
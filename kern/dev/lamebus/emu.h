@@ -31,9 +31,16 @@
 #define _LAMEBUS_EMU_H_
 
 
+#include <spinlock.h>
+
+struct emufs_page;	/* in emufs.h */
+
 #define EMU_MAXIO       16384
 #define EMU_ROOTHANDLE  0
 
+/* Most pages of file data emufs caches, for all files together */
+#define EMU_CACHEPAGES  128
+
 /*
  * The per-device data used by the emufs device driver.
  * (Note that this is only a small portion of its actual data;
@@ -51,6 +58,12 @@ struct emu_softc {
 	struct semaphore *e_sem;
 	void *e_iobuf;
 
+	/* File data cache (see emu.c) */
+	struct spinlock e_cachelock;	/* protects the following */
+	struct emufs_page *e_lruhead;	/* most recently used page */
+	struct emufs_page *e_lrutail;	/* least recently used page */
+	unsigned e_cachepages;		/* pages cached or being read */
+
 	/* Written by the interrupt handler */
 	uint32_t e_result;
 };
@@ -36,7 +36,9 @@
 #include <lib.h>
 #include <uio.h>
 #include <membar.h>
-#include <synch.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <clock.h>
 #include <platform/bus.h>
 #include <vfs.h>
 #include <lamebus/lhd.h>
@@ -96,27 +98,189 @@ int lhd_code_to_errno(struct lhd_softc *lh, int code)
 }
 
 /*
- * Record that an I/O has completed: save the result and poke the
- * completion semaphore.
+ * Request scheduling
+ *
+ * Waiting requests are kept sorted by sector and served C-LOOK
+ * style: the next one at or after the head, wrapping around to the
+ * lowest when there's nothing further along. A request that starts
+ * right where the head is costs neither a seek nor any rotational
+ * delay, so sequential streams go through back to back. To keep such
+ * a stream from starving everyone else, each request gets a deadline
+ * LHD_DEADLINEREVS revolutions after it's queued, and a request past
+ * its deadline goes next regardless of position.
+ *
+ * The interrupt handler moves each sector in or out of the on-card
+ * buffer and starts the next sector or request itself, so a request
+ * costs one wakeup however long it is.
+ */
+
+/* Revolutions a request may be passed over for */
+#define LHD_DEADLINEREVS  64
+
+/* Used if the disk doesn't say how fast it spins */
+#define LHD_DEFAULTRPM    3600
+
+/* Most sectors lhd_io bounces through a kernel buffer at once */
+#define LHD_MAXBOUNCE     16
+
+/* Attached disks, for lhd_getunit */
+#define LHD_MAXUNITS      16
+static struct lhd_softc *lhd_units[LHD_MAXUNITS];
+
+/*
+ * Start the next sector of the active request. Called with lh_lock.
  */
 static
 void
-lhd_iodone(struct lhd_softc *lh, int err)
+lhd_startsect(struct lhd_softc *lh)
+{
+	struct lhd_request *req = lh->lh_active;
+	uint32_t statval = LHD_WORKING;
+
+	KASSERT(spinlock_do_i_hold(&lh->lh_lock));
+	KASSERT(req != NULL);
+	KASSERT(req->lr_cur < req->lr_nsect);
+
+	if (req->lr_cur == 0) {
+		gettime(&req->lr_started);
+	}
+
+	/*
+	 * Are we writing? If so, transfer the data to the
+	 * on-card buffer.
+	 */
+	if (req->lr_write) {
+		memcpy(lh->lh_buf,
+		       (char *)req->lr_data + req->lr_cur * LHD_SECTSIZE,
+		       LHD_SECTSIZE);
+		membar_store_store();
+		statval |= LHD_ISWRITE;
+	}
+
+	/* Tell it what sector we want... */
+	lhd_wreg(lh, LHD_REG_SECT, req->lr_sector + req->lr_cur);
+
+	/* and start the operation. */
+	lhd_wreg(lh, LHD_REG_STAT, statval);
+}
+
+/*
+ * Check if time A is before time B.
+ */
+static
+bool
+lhd_before(const struct timespec *a, const struct timespec *b)
 {
-	lh->lh_result = err;
-	V(lh->lh_done);
+	return a->tv_sec < b->tv_sec ||
+		(a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+/*
+ * Take the next request to serve off the queue. Called with lh_lock.
+ */
+static
+struct lhd_request *
+lhd_pick(struct lhd_softc *lh)
+{
+	struct lhd_request *req, **pp, **best;
+	struct timespec now;
+
+	KASSERT(spinlock_do_i_hold(&lh->lh_lock));
+
+	if (lh->lh_queue == NULL) {
+		return NULL;
+	}
+
+	/* Anything overdue? Take whichever has waited longest. */
+	gettime(&now);
+	best = NULL;
+	for (pp = &lh->lh_queue; *pp != NULL; pp = &(*pp)->lr_next) {
+		req = *pp;
+		if (lhd_before(&now, &req->lr_deadline)) {
+			continue;
+		}
+		if (best == NULL ||
+		    lhd_before(&req->lr_deadline, &(*best)->lr_deadline)) {
+			best = pp;
+		}
+	}
+
+	/* If not, the first at or past the head; else the lowest */
+	if (best == NULL) {
+		for (pp = &lh->lh_queue; *pp != NULL; pp = &(*pp)->lr_next) {
+			if ((*pp)->lr_sector >= lh->lh_head) {
+				best = pp;
+				break;
+			}
+		}
+		if (best == NULL) {
+			best = &lh->lh_queue;
+		}
+	}
+
+	req = *best;
+	*best = req->lr_next;
+	req->lr_next = NULL;
+	return req;
+}
+
+/*
+ * Queue a request, starting it right away if the disk is idle.
+ */
+void
+lhd_submit(struct lhd_softc *lh, struct lhd_request *req)
+{
+	struct lhd_request **pp;
+	struct timespec wait;
+
+	KASSERT(req->lr_nsect > 0);
+	KASSERT(req->lr_sector < lh->lh_dev.d_blocks);
+	KASSERT(req->lr_nsect <= lh->lh_dev.d_blocks - req->lr_sector);
+	KASSERT(req->lr_done != NULL);
+
+	req->lr_cur = 0;
+	req->lr_next = NULL;
+	gettime(&req->lr_queued);
+	wait.tv_sec = (lh->lh_revnsecs * LHD_DEADLINEREVS) / 1000000000;
+	wait.tv_nsec = (lh->lh_revnsecs * LHD_DEADLINEREVS) % 1000000000;
+	timespec_add(&req->lr_queued, &wait, &req->lr_deadline);
+
+	devstat_queued(&lh->lh_dev);
+
+	spinlock_acquire(&lh->lh_lock);
+	if (lh->lh_active == NULL) {
+		lh->lh_active = req;
+		lhd_startsect(lh);
+	}
+	else {
+		/* Keep the queue sorted; equal sectors go first come first */
+		pp = &lh->lh_queue;
+		while (*pp != NULL && (*pp)->lr_sector <= req->lr_sector) {
+			pp = &(*pp)->lr_next;
+		}
+		req->lr_next = *pp;
+		*pp = req;
+	}
+	spinlock_release(&lh->lh_lock);
 }
 
 /*
  * Interrupt handler for lhd.
  * Read the status register; if an operation finished, clear the status
- * register and report completion.
+ * register, finish the sector, and start the next one.
  */
 void
 lhd_irq(void *vlh)
 {
 	struct lhd_softc *lh = vlh;
+	struct lhd_request *req, *done;
 	uint32_t val;
+	int err;
+
+	done = NULL;
+	err = 0;
+
+	spinlock_acquire(&lh->lh_lock);
 
 	val = lhd_rdreg(lh, LHD_REG_STAT);
 
@@ -128,9 +292,50 @@ lhd_irq(void *vlh)
 	    case LHD_INVSECT:
 	    case LHD_MEDIA:
 		lhd_wreg(lh, LHD_REG_STAT, 0);
-		lhd_iodone(lh, lhd_code_to_errno(lh, val));
+		err = lhd_code_to_errno(lh, val);
+
+		req = lh->lh_active;
+		if (req == NULL) {
+			kprintf("lhd%d: Spurious completion\n", lh->lh_unit);
+			break;
+		}
+
+		if (err == 0) {
+			/*
+			 * Are we reading? If so, transfer the data
+			 * out of the on-card buffer.
+			 */
+			if (!req->lr_write) {
+				membar_load_load();
+				memcpy((char *)req->lr_data +
+				       req->lr_cur * LHD_SECTSIZE,
+				       lh->lh_buf, LHD_SECTSIZE);
+			}
+			req->lr_cur++;
+			lh->lh_head = req->lr_sector + req->lr_cur;
+		}
+
+		if (err == 0 && req->lr_cur < req->lr_nsect) {
+			lhd_startsect(lh);
+			break;
+		}
+
+		/* This one's finished; on to the next */
+		done = req;
+		lh->lh_active = lhd_pick(lh);
+		if (lh->lh_active != NULL) {
+			lhd_startsect(lh);
+		}
 		break;
 	}
+
+	spinlock_release(&lh->lh_lock);
+
+	if (done != NULL) {
+		devstat_done(&lh->lh_dev, done->lr_write, done->lr_nsect, err,
+			     &done->lr_queued, &done->lr_started);
+		done->lr_done(done, err);
+	}
 }
 
 /*
@@ -179,8 +384,70 @@ lhd_reset(struct lhd_softc *lh)
 }
 #endif
 
+/*
+ * State for lhd_io waiting on a request.
+ */
+struct lhd_syncio {
+	struct lhd_softc *ls_lh;
+	bool ls_done;
+	int ls_result;
+};
+
+/*
+ * Completion function for lhd_io's requests.
+ */
+static
+void
+lhd_syncdone(struct lhd_request *req, int result)
+{
+	struct lhd_syncio *ls = req->lr_arg;
+	struct lhd_softc *lh = ls->ls_lh;
+
+	spinlock_acquire(&lh->lh_lock);
+	ls->ls_result = result;
+	ls->ls_done = true;
+	wchan_wakeall(lh->lh_wchan, &lh->lh_lock);
+	spinlock_release(&lh->lh_lock);
+}
+
+/*
+ * Do a request and wait for it.
+ */
+static
+int
+lhd_dosync(struct lhd_softc *lh, uint32_t sector, uint32_t nsect,
+	   void *data, bool write)
+{
+	struct lhd_request req;
+	struct lhd_syncio ls;
+
+	ls.ls_lh = lh;
+	ls.ls_done = false;
+	ls.ls_result = 0;
+
+	req.lr_sector = sector;
+	req.lr_nsect = nsect;
+	req.lr_data = data;
+	req.lr_write = write;
+	req.lr_done = lhd_syncdone;
+	req.lr_arg = &ls;
+
+	lhd_submit(lh, &req);
+
+	spinlock_acquire(&lh->lh_lock);
+	while (!ls.ls_done) {
+		wchan_sleep(lh->lh_wchan, &lh->lh_lock);
+	}
+	spinlock_release(&lh->lh_lock);
+
+	return ls.ls_result;
+}
+
 /*
  * I/O function (for both reads and writes)
+ *
+ * A kernel buffer in one piece is handed to the disk as is; anything
+ * else goes through a bounce buffer a chunk at a time.
  */
 static
 int
@@ -192,76 +459,88 @@ lhd_io(struct device *d, struct uio *uio)
 	uint32_t sectoff = uio->uio_offset % LHD_SECTSIZE;
 	uint32_t len = uio->uio_resid / LHD_SECTSIZE;
 	uint32_t lenoff = uio->uio_resid % LHD_SECTSIZE;
-	uint32_t i;
-	uint32_t statval = LHD_WORKING;
+	bool write = uio->uio_rw == UIO_WRITE;
+	struct iovec *iov;
+	uint32_t chunk;
+	void *bounce;
 	int result;
 
+	/* Someone else has the disk. */
+	if (lh->lh_claimed) {
+		return EBUSY;
+	}
+
 	/* Don't allow I/O that isn't sector-aligned. */
 	if (sectoff != 0 || lenoff != 0) {
 		return EINVAL;
 	}
 
 	/* Don't allow I/O past the end of the disk. */
-	/* XXX this check can overflow */
-	if (sector+len > lh->lh_dev.d_blocks) {
+	if (sector > lh->lh_dev.d_blocks ||
+	    len > lh->lh_dev.d_blocks - sector) {
 		return EINVAL;
 	}
 
-	/* Set up the value to write into the status register. */
-	if (uio->uio_rw==UIO_WRITE) {
-		statval |= LHD_ISWRITE;
+	if (len == 0) {
+		return 0;
 	}
 
-	/* Loop over all the sectors we were asked to do. */
-	for (i=0; i<len; i++) {
+	iov = uio->uio_iov;
+	if (uio->uio_segflg == UIO_SYSSPACE && uio->uio_iovcnt == 1 &&
+	    iov->iov_len == uio->uio_resid) {
+		result = lhd_dosync(lh, sector, len, iov->iov_kbase, write);
+		if (result) {
+			return result;
+		}
+		iov->iov_kbase = (char *)iov->iov_kbase + uio->uio_resid;
+		iov->iov_len = 0;
+		uio->uio_offset += uio->uio_resid;
+		uio->uio_resid = 0;
+		return 0;
+	}
 
-		/* Wait until nobody else is using the device. */
-		P(lh->lh_clear);
+	chunk = len < LHD_MAXBOUNCE ? len : LHD_MAXBOUNCE;
+	bounce = kmalloc(chunk * LHD_SECTSIZE);
+	if (bounce == NULL) {
+		return ENOMEM;
+	}
 
-		/*
-		 * Are we writing? If so, transfer the data to the
-		 * on-card buffer.
-		 */
-		if (uio->uio_rw == UIO_WRITE) {
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
-			membar_store_store();
+	result = 0;
+	while (len > 0 && result == 0) {
+		chunk = len < LHD_MAXBOUNCE ? len : LHD_MAXBOUNCE;
+		if (write) {
+			result = uiomove(bounce, chunk * LHD_SECTSIZE, uio);
 			if (result) {
-				V(lh->lh_clear);
-				return result;
+				break;
 			}
 		}
-
-		/* Tell it what sector we want... */
-		lhd_wreg(lh, LHD_REG_SECT, sector+i);
-
-		/* and start the operation. */
-		lhd_wreg(lh, LHD_REG_STAT, statval);
-
-		/* Now wait until the interrupt handler tells us we're done. */
-		P(lh->lh_done);
-
-		/* Get the result value saved by the interrupt handler. */
-		result = lh->lh_result;
-
-		/*
-		 * Are we reading? If so, and if we succeeded,
-		 * transfer the data out of the on-card buffer.
-		 */
-		if (result==0 && uio->uio_rw==UIO_READ) {
-			membar_load_load();
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
+		result = lhd_dosync(lh, sector, chunk, bounce, write);
+		if (result == 0 && !write) {
+			result = uiomove(bounce, chunk * LHD_SECTSIZE, uio);
 		}
+		sector += chunk;
+		len -= chunk;
+	}
 
-		/* Tell another thread it's cleared to go ahead. */
-		V(lh->lh_clear);
+	kfree(bounce);
+	return result;
+}
 
-		/* If we failed, return the error. */
-		if (result) {
-			return result;
-		}
+struct lhd_softc *
+lhd_getunit(int unit)
+{
+	if (unit < 0 || unit >= LHD_MAXUNITS) {
+		return NULL;
 	}
+	return lhd_units[unit];
+}
 
-	return 0;
+void
+lhd_claim(struct lhd_softc *lh)
+{
+	KASSERT(!lh->lh_claimed);
+
+	lh->lh_claimed = true;
 }
 
 static const struct device_ops lhd_devops = {
@@ -277,6 +556,8 @@ int
 config_lhd(struct lhd_softc *lh, int lhdno)
 {
 	char name[32];
+	uint32_t rpm;
+	int result;
 
 	/* Figure out what our name is. */
 	snprintf(name, sizeof(name), "lhd%d", lhdno);
@@ -284,17 +565,24 @@ config_lhd(struct lhd_softc *lh, int lhdno)
 	/* Get a pointer to the on-chip buffer. */
 	lh->lh_buf = bus_map_area(lh->lh_busdata, lh->lh_buspos, LHD_BUFFER);
 
-	/* Create the semaphores. */
-	lh->lh_clear = sem_create("lhd-clear", 1);
-	if (lh->lh_clear == NULL) {
+	/* Set up the request queue. */
+	spinlock_init(&lh->lh_lock);
+	lh->lh_active = NULL;
+	lh->lh_queue = NULL;
+	lh->lh_head = 0;
+	lh->lh_claimed = false;
+	lh->lh_wchan = wchan_create("lhd");
+	if (lh->lh_wchan == NULL) {
+		spinlock_cleanup(&lh->lh_lock);
 		return ENOMEM;
 	}
-	lh->lh_done = sem_create("lhd-done", 0);
-	if (lh->lh_done == NULL) {
-		sem_destroy(lh->lh_clear);
-		lh->lh_clear = NULL;
-		return ENOMEM;
+
+	/* and how long a revolution takes, for request deadlines. */
+	rpm = lhd_rdreg(lh, LHD_REG_RPM);
+	if (rpm == 0) {
+		rpm = LHD_DEFAULTRPM;
 	}
+	lh->lh_revnsecs = 60000000000ULL / rpm;
 
 	/* Set up the VFS device structure. */
 	lh->lh_dev.d_ops = &lhd_devops;
@@ -304,5 +592,13 @@ config_lhd(struct lhd_softc *lh, int lhdno)
 	lh->lh_dev.d_data = lh;
 
 	/* Add the VFS device structure to the VFS device list. */
-	return vfs_adddev(name, &lh->lh_dev, 1);
+	result = vfs_adddev(name, &lh->lh_dev, 1);
+	if (result) {
+		return result;
+	}
+
+	if (lhdno < LHD_MAXUNITS) {
+		lhd_units[lhdno] = lh;
+	}
+	return 0;
 }
@@ -31,12 +31,38 @@
 #define _LAMEBUS_LHD_H_
 
 #include <device.h>
+#include <spinlock.h>
+#include <kern/time.h>
+
+struct wchan;	/* in wchan.h */
 
 /*
  * Our sector size
  */
 #define LHD_SECTSIZE  512
 
+/*
+ * An I/O request. The caller fills in the first part and passes it to
+ * lhd_submit, and must leave it and its buffer alone until lr_done is
+ * called. lr_done is called from the interrupt handler, so it must not
+ * sleep.
+ */
+struct lhd_request {
+	uint32_t lr_sector;		/* First sector */
+	uint32_t lr_nsect;		/* Number of sectors */
+	void *lr_data;			/* Kernel buffer of lr_nsect sectors */
+	bool lr_write;			/* Write (otherwise read) */
+	void (*lr_done)(struct lhd_request *, int result);
+	void *lr_arg;			/* For lr_done's use */
+
+	/* Private to the driver */
+	uint32_t lr_cur;		/* Sectors done so far */
+	struct timespec lr_queued;	/* When submitted */
+	struct timespec lr_started;	/* When the disk started on it */
+	struct timespec lr_deadline;	/* Serve by then, whatever the order */
+	struct lhd_request *lr_next;	/* Queue link */
+};
+
 /*
  * Hardware device data associated with lhd (LAMEbus hard disk)
  */
@@ -51,13 +77,29 @@ struct lhd_softc {
 	 */
 
 	void *lh_buf;			/* Pointer to on-card I/O buffer */
-	int lh_result;			/* Result from I/O operation */
-	struct semaphore *lh_clear;	/* Synchronization */
-	struct semaphore *lh_done;
+	uint64_t lh_revnsecs;		/* Nanoseconds per revolution */
+	struct spinlock lh_lock;	/* Protects the rest */
+	struct lhd_request *lh_active;	/* Request the disk is working on */
+	struct lhd_request *lh_queue;	/* Waiting requests, by sector */
+	uint32_t lh_head;		/* Sector after the last one done */
+	struct wchan *lh_wchan;		/* For lhd_io waiting on requests */
+	bool lh_claimed;		/* In use by another driver */
 
 	struct device lh_dev;		/* VFS device structure */
 };
 
+/* Queue a request */
+void lhd_submit(struct lhd_softc *lh, struct lhd_request *req);
+
+/* Get an attached disk by unit number, or NULL */
+struct lhd_softc *lhd_getunit(int unit);
+
+/*
+ * Reserve a disk for another driver (e.g. raid) to use through
+ * lhd_submit. Its own device then refuses I/O with EBUSY.
+ */
+void lhd_claim(struct lhd_softc *lh);
+
 /* Functions called by lower-level drivers */
 void lhd_irq(/*struct lhd_softc*/ void *);	/* Interrupt handler */
 
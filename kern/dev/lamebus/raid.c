@@ -0,0 +1,381 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Striped (RAID-0) disk over lhd disks. See raid.h.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <uio.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <clock.h>
+#include <vfs.h>
+#include <device.h>
+#include <lamebus/lhd.h>
+#include <lamebus/raid.h>
+
+/* Stripes per member queued at once by a long transfer */
+#define RAID_BATCHROWS    2
+/* Pieces a transfer may have and still keep them on the stack */
+#define RAID_STACKPIECES  2
+/* Most sectors raid_io bounces through a kernel buffer at once */
+#define RAID_MAXBOUNCE    64
+
+/* Units made so far; protected by vfs_biglock */
+static unsigned raid_units;
+
+/*
+ * One member request of a transfer.
+ */
+struct raid_piece {
+	struct lhd_request rp_req;
+	struct lhd_softc *rp_disk;
+};
+
+/*
+ * State for raid_dosync waiting on its pieces.
+ */
+struct raid_syncio {
+	struct raid_softc *rio_rs;
+	unsigned rio_pending;
+	int rio_result;
+};
+
+/*
+ * Completion function for member requests. Called from the member's
+ * interrupt handler.
+ */
+static
+void
+raid_piecedone(struct lhd_request *req, int result)
+{
+	struct raid_syncio *rio = req->lr_arg;
+	struct raid_softc *rs = rio->rio_rs;
+
+	spinlock_acquire(&rs->rs_lock);
+	KASSERT(rio->rio_pending > 0);
+	if (result && rio->rio_result == 0) {
+		rio->rio_result = result;
+	}
+	rio->rio_pending--;
+	if (rio->rio_pending == 0) {
+		wchan_wakeall(rs->rs_wchan, &rs->rs_lock);
+	}
+	spinlock_release(&rs->rs_lock);
+}
+
+/*
+ * Transfer NSECT sectors at SECTOR of the raid to or from DATA, a
+ * kernel buffer, and wait for it. The pieces of up to RAID_BATCHROWS
+ * rows of stripes go to the members together.
+ */
+static
+int
+raid_dosync(struct raid_softc *rs, uint32_t sector, uint32_t nsect,
+	    char *data, bool write)
+{
+	struct raid_piece stackpieces[RAID_STACKPIECES];
+	struct raid_piece *pieces, *rp;
+	struct raid_syncio rio;
+	struct timespec queued;
+	uint32_t ss = rs->rs_stripesects;
+	uint32_t total = nsect;
+	uint32_t stripe, off, chunk;
+	unsigned maxpieces, n, i;
+
+	KASSERT(nsect > 0);
+
+	/* Enough pieces for the stripes NSECT sectors can touch */
+	maxpieces = (nsect + ss - 1) / ss + 1;
+	if (maxpieces <= RAID_STACKPIECES) {
+		pieces = stackpieces;
+	}
+	else {
+		if (maxpieces > rs->rs_nmembers * RAID_BATCHROWS) {
+			maxpieces = rs->rs_nmembers * RAID_BATCHROWS;
+		}
+		pieces = kmalloc(maxpieces * sizeof(*pieces));
+		if (pieces == NULL) {
+			return ENOMEM;
+		}
+	}
+
+	gettime(&queued);
+	devstat_queued(&rs->rs_dev);
+
+	rio.rio_rs = rs;
+	rio.rio_result = 0;
+
+	while (nsect > 0 && rio.rio_result == 0) {
+		/* Cut off the next batch, a stripe at a time */
+		for (n = 0; nsect > 0 && n < maxpieces; n++) {
+			stripe = sector / ss;
+			off = sector % ss;
+			chunk = ss - off < nsect ? ss - off : nsect;
+
+			rp = &pieces[n];
+			rp->rp_disk = rs->rs_members[stripe % rs->rs_nmembers];
+			rp->rp_req.lr_sector =
+				(stripe / rs->rs_nmembers) * ss + off;
+			rp->rp_req.lr_nsect = chunk;
+			rp->rp_req.lr_data = data;
+			rp->rp_req.lr_write = write;
+			rp->rp_req.lr_done = raid_piecedone;
+			rp->rp_req.lr_arg = &rio;
+
+			sector += chunk;
+			nsect -= chunk;
+			data += chunk * LHD_SECTSIZE;
+		}
+
+		/* Nothing can finish before it's submitted */
+		rio.rio_pending = n;
+		for (i = 0; i < n; i++) {
+			lhd_submit(pieces[i].rp_disk, &pieces[i].rp_req);
+		}
+
+		spinlock_acquire(&rs->rs_lock);
+		while (rio.rio_pending > 0) {
+			wchan_sleep(rs->rs_wchan, &rs->rs_lock);
+		}
+		spinlock_release(&rs->rs_lock);
+	}
+
+	devstat_done(&rs->rs_dev, write, total, rio.rio_result,
+		     &queued, &queued);
+
+	if (pieces != stackpieces) {
+		kfree(pieces);
+	}
+	return rio.rio_result;
+}
+
+static
+int
+raid_eachopen(struct device *d, int openflags)
+{
+	(void)d;
+	(void)openflags;
+
+	return 0;
+}
+
+static
+int
+raid_ioctl(struct device *d, int op, userptr_t data)
+{
+	(void)d;
+	(void)op;
+	(void)data;
+
+	return EIOCTL;
+}
+
+/*
+ * I/O function (for both reads and writes). As in lhd_io, a kernel
+ * buffer in one piece is used as is and anything else is bounced.
+ */
+static
+int
+raid_io(struct device *d, struct uio *uio)
+{
+	struct raid_softc *rs = d->d_data;
+
+	uint32_t sector = uio->uio_offset / LHD_SECTSIZE;
+	uint32_t sectoff = uio->uio_offset % LHD_SECTSIZE;
+	uint32_t len = uio->uio_resid / LHD_SECTSIZE;
+	uint32_t lenoff = uio->uio_resid % LHD_SECTSIZE;
+	bool write = uio->uio_rw == UIO_WRITE;
+	struct iovec *iov;
+	uint32_t maxchunk, chunk;
+	void *bounce;
+	int result;
+
+	if (sectoff != 0 || lenoff != 0) {
+		return EINVAL;
+	}
+	if (sector > rs->rs_dev.d_blocks ||
+	    len > rs->rs_dev.d_blocks - sector) {
+		return EINVAL;
+	}
+	if (len == 0) {
+		return 0;
+	}
+
+	iov = uio->uio_iov;
+	if (uio->uio_segflg == UIO_SYSSPACE && uio->uio_iovcnt == 1 &&
+	    iov->iov_len == uio->uio_resid) {
+		result = raid_dosync(rs, sector, len, iov->iov_kbase, write);
+		if (result) {
+			return result;
+		}
+		iov->iov_kbase = (char *)iov->iov_kbase + uio->uio_resid;
+		iov->iov_len = 0;
+		uio->uio_offset += uio->uio_resid;
+		uio->uio_resid = 0;
+		return 0;
+	}
+
+	/* Bounce a row of stripes at a time, so all members get some */
+	maxchunk = rs->rs_stripesects * rs->rs_nmembers;
+	if (maxchunk > RAID_MAXBOUNCE) {
+		maxchunk = RAID_MAXBOUNCE;
+	}
+	chunk = len < maxchunk ? len : maxchunk;
+	bounce = kmalloc(chunk * LHD_SECTSIZE);
+	if (bounce == NULL) {
+		return ENOMEM;
+	}
+
+	result = 0;
+	while (len > 0 && result == 0) {
+		chunk = len < maxchunk ? len : maxchunk;
+		if (write) {
+			result = uiomove(bounce, chunk * LHD_SECTSIZE, uio);
+			if (result) {
+				break;
+			}
+		}
+		result = raid_dosync(rs, sector, chunk, bounce, write);
+		if (result == 0 && !write) {
+			result = uiomove(bounce, chunk * LHD_SECTSIZE, uio);
+		}
+		sector += chunk;
+		len -= chunk;
+	}
+
+	kfree(bounce);
+	return result;
+}
+
+static const struct device_ops raid_devops = {
+	.devop_eachopen = raid_eachopen,
+	.devop_io = raid_io,
+	.devop_ioctl = raid_ioctl,
+};
+
+/*
+ * Make a raid. See device.h.
+ */
+int
+raid_create(uint32_t stripesects, const unsigned *units, unsigned nunits,
+	    char *name, size_t len)
+{
+	struct raid_softc *rs;
+	struct lhd_softc *lh;
+	uint32_t minsects, rows;
+	unsigned i, j;
+	int result;
+
+	if (nunits < 2 || nunits > RAID_MAXMEMBERS || stripesects == 0) {
+		return EINVAL;
+	}
+
+	rs = kmalloc(sizeof(*rs));
+	if (rs == NULL) {
+		return ENOMEM;
+	}
+	spinlock_init(&rs->rs_lock);
+	rs->rs_wchan = wchan_create("raid");
+	if (rs->rs_wchan == NULL) {
+		spinlock_cleanup(&rs->rs_lock);
+		kfree(rs);
+		return ENOMEM;
+	}
+
+	/* The biglock keeps two raids from claiming the same disk */
+	vfs_biglock_acquire();
+
+	rs->rs_nmembers = 0;
+	minsects = 0;
+	result = 0;
+	for (i = 0; i < nunits; i++) {
+		lh = lhd_getunit(units[i]);
+		if (lh == NULL) {
+			result = ENXIO;
+			break;
+		}
+		for (j = 0; j < i; j++) {
+			if (rs->rs_members[j] == lh) {
+				result = EINVAL;
+			}
+		}
+		if (result == 0 && lh->lh_claimed) {
+			result = EBUSY;
+		}
+		if (result) {
+			break;
+		}
+		if (i == 0 || lh->lh_dev.d_blocks < minsects) {
+			minsects = lh->lh_dev.d_blocks;
+		}
+		rs->rs_members[rs->rs_nmembers++] = lh;
+	}
+
+	rs->rs_stripesects = stripesects;
+	rows = minsects / rs->rs_stripesects;
+	if (result == 0 && rows == 0) {
+		/* disks smaller than a stripe */
+		result = EINVAL;
+	}
+
+	if (result == 0) {
+		rs->rs_dev.d_ops = &raid_devops;
+		rs->rs_dev.d_blocks = rows * rs->rs_stripesects *
+			rs->rs_nmembers;
+		rs->rs_dev.d_blocksize = LHD_SECTSIZE;
+		rs->rs_dev.d_devnumber = 0; /* assigned by vfs_adddev */
+		rs->rs_dev.d_data = rs;
+
+		snprintf(name, len, "raid%u", raid_units);
+		result = vfs_adddev(name, &rs->rs_dev, 1);
+	}
+	if (result == 0) {
+		raid_units++;
+		for (i = 0; i < rs->rs_nmembers; i++) {
+			lhd_claim(rs->rs_members[i]);
+		}
+	}
+
+	vfs_biglock_release();
+
+	if (result) {
+		wchan_destroy(rs->rs_wchan);
+		spinlock_cleanup(&rs->rs_lock);
+		kfree(rs);
+		return result;
+	}
+
+	kprintf("%s: %u disks, %u-sector stripes, %u sectors\n",
+		name, rs->rs_nmembers, (unsigned)rs->rs_stripesects,
+		(unsigned)rs->rs_dev.d_blocks);
+	return 0;
+}
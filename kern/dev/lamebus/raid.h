@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _LAMEBUS_RAID_H_
+#define _LAMEBUS_RAID_H_
+
+#include <device.h>
+#include <spinlock.h>
+
+struct lhd_softc;	/* in lamebus/lhd.h */
+struct wchan;		/* in wchan.h */
+
+/*
+ * Striped (RAID-0) disk
+ *
+ * Glues lhd disks together into one bigger and faster one, named
+ * raid0, raid1, and so on. The disk is cut into stripes dealt out to
+ * the members in turn, so a long transfer keeps every member busy at
+ * once: each request is split into one lhd request per stripe, all
+ * queued together.
+ *
+ * Only in kernels with "options raid", and then only made when asked
+ * for with the "raid" menu command, which names the member disks and
+ * the stripe size (see raid_create in device.h). The members are
+ * claimed by the raid and can't be used directly any more. Each one
+ * contributes as many whole stripes as fit on the smallest.
+ */
+
+/* Most member disks */
+#define RAID_MAXMEMBERS   8
+
+struct raid_softc {
+	unsigned rs_nmembers;
+	struct lhd_softc *rs_members[RAID_MAXMEMBERS];
+	uint32_t rs_stripesects;	/* Sectors per stripe */
+	struct spinlock rs_lock;	/* For request completion */
+	struct wchan *rs_wchan;		/* For raid_io waiting on members */
+
+	struct device rs_dev;		/* VFS device structure */
+};
+
+#endif /* _LAMEBUS_RAID_H_ */
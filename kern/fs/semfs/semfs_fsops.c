@@ -189,6 +189,8 @@ semfs_create(void)
 
 	semfs->semfs_absfs.fs_data = semfs;
 	semfs->semfs_absfs.fs_ops = &semfs_fsops;
+	semfs->semfs_absfs.fs_dcachemax = 0;
+	semfs->semfs_absfs.fs_dcacheheld = 0;
 	return semfs;
 
  fail_dirlock:
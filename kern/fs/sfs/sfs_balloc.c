@@ -33,11 +33,17 @@
  * Block allocation.
  */
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
+#include <synch.h>
 #include <bitmap.h>
+#include <buf.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
+/* Blocks set aside at a time for a file being appended to */
+#define SFS_PREALLOC 8
+
 /*
  * Zero out a disk block.
  */
@@ -45,47 +51,237 @@ static
 int
 sfs_clearblock(struct sfs_fs *sfs, daddr_t block)
 {
-	/* static -> automatically initialized to zero */
-	static char zeros[SFS_BLOCKSIZE];
+	struct buf *buf;
+	int result;
 
-	return sfs_writeblock(sfs, block, zeros, SFS_BLOCKSIZE);
+	/* No need to read it first */
+	result = buf_get(sfs->sfs_device, block, &buf);
+	if (result) {
+		return result;
+	}
+	bzero(buf_map(buf), SFS_BLOCKSIZE);
+	buf_markdirty(buf);
+	buf_release(buf);
+	return 0;
 }
 
 /*
- * Allocate a block.
+ * Find a free block at or after GOAL and mark it in use. When the
+ * disk is otherwise full, take a block someone has reserved; they'll
+ * notice when they go to use it. Called with the freemap locked.
  */
+static
 int
-sfs_balloc(struct sfs_fs *sfs, daddr_t *diskblock)
+sfs_bfind(struct sfs_fs *sfs, daddr_t goal, daddr_t *diskblock)
 {
+	uint32_t i;
 	int result;
 
-	result = bitmap_alloc(sfs->sfs_freemap, diskblock);
+	KASSERT(lock_do_i_hold(sfs->sfs_freemaplock));
+
+	result = bitmap_alloc_from(sfs->sfs_freemap, goal, diskblock);
+	if (result == ENOSPC) {
+		for (i=0; i<sfs->sfs_sb.sb_nblocks; i++) {
+			if (bitmap_isset(sfs->sfs_resmap, i)) {
+				/* Already marked in the freemap */
+				bitmap_unmark(sfs->sfs_resmap, i);
+				*diskblock = i;
+				result = 0;
+				break;
+			}
+		}
+	}
 	if (result) {
 		return result;
 	}
+
 	sfs->sfs_freemapdirty = true;
+	sfs->sfs_allocnext = *diskblock + 1;
+	sfs_jnewblock(sfs, *diskblock);
+	return 0;
+}
 
-	if (*diskblock >= sfs->sfs_sb.sb_nblocks) {
+/*
+ * Finish allocating a block: check it and clear it. On failure the
+ * block is given back.
+ */
+static
+int
+sfs_bready(struct sfs_fs *sfs, daddr_t diskblock)
+{
+	int result;
+
+	if (diskblock >= sfs->sfs_sb.sb_nblocks) {
 		panic("sfs: %s: balloc: invalid block %u\n",
-		      sfs->sfs_sb.sb_volname, *diskblock);
+		      sfs->sfs_sb.sb_volname, diskblock);
 	}
 
 	/* Clear block before returning it */
-	result = sfs_clearblock(sfs, *diskblock);
+	result = sfs_clearblock(sfs, diskblock);
 	if (result) {
-		bitmap_unmark(sfs->sfs_freemap, *diskblock);
+		lock_acquire(sfs->sfs_freemaplock);
+		bitmap_unmark(sfs->sfs_freemap, diskblock);
+		lock_release(sfs->sfs_freemaplock);
 	}
 	return result;
 }
 
+/*
+ * Allocate a block, at GOAL if possible or else the next free one
+ * after it. A GOAL of 0 means after whatever was allocated last.
+ */
+int
+sfs_balloc(struct sfs_fs *sfs, daddr_t goal, daddr_t *diskblock)
+{
+	int result;
+
+	lock_acquire(sfs->sfs_freemaplock);
+	if (goal == 0) {
+		goal = sfs->sfs_allocnext;
+	}
+	result = sfs_bfind(sfs, goal, diskblock);
+	lock_release(sfs->sfs_freemaplock);
+	if (result) {
+		return result;
+	}
+
+	return sfs_bready(sfs, *diskblock);
+}
+
+/*
+ * Give back the blocks still reserved for a file. Called with the
+ * freemap locked.
+ */
+static
+void
+sfs_unreserve_locked(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	unsigned i;
+	daddr_t block;
+
+	for (i=0; i<sv->sv_rescount; i++) {
+		block = sv->sv_resstart + i;
+		/* Unless someone took it when the disk filled up */
+		if (bitmap_isset(sfs->sfs_resmap, block)) {
+			bitmap_unmark(sfs->sfs_resmap, block);
+			bitmap_unmark(sfs->sfs_freemap, block);
+		}
+	}
+	sv->sv_rescount = 0;
+}
+
+/*
+ * Give back the blocks reserved for a file, when it's truncated or
+ * goes out of memory. Called with the vnode locked.
+ */
+void
+sfs_unreserve(struct sfs_vnode *sv)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
+	if (sv->sv_rescount == 0) {
+		return;
+	}
+	lock_acquire(sfs->sfs_freemaplock);
+	sfs_unreserve_locked(sfs, sv);
+	lock_release(sfs->sfs_freemaplock);
+}
+
+/*
+ * Allocate a block for a file (data or indirect), placing it right
+ * after the file's last one if that's free. APPEND says the file is
+ * growing at the end; then the next few blocks are reserved for it
+ * too, so files written at the same time don't end up interleaved.
+ *
+ * Reserved blocks are marked in both the freemap and sfs_resmap, so
+ * other allocations pass them by, but they aren't written to disk as
+ * in use (see sfs_freemapio) and so can't leak if we crash.
+ */
+int
+sfs_balloc_file(struct sfs_vnode *sv, bool append, daddr_t *diskblock)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	daddr_t goal, block;
+	unsigned i;
+	int result;
+
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
+	lock_acquire(sfs->sfs_freemaplock);
+
+	if (append && sv->sv_rescount > 0 &&
+	    bitmap_isset(sfs->sfs_resmap, sv->sv_resstart)) {
+		/* Next block of the reservation */
+		*diskblock = sv->sv_resstart++;
+		sv->sv_rescount--;
+		bitmap_unmark(sfs->sfs_resmap, *diskblock);
+		sfs->sfs_freemapdirty = true;
+		sfs_jnewblock(sfs, *diskblock);
+	}
+	else {
+		sfs_unreserve_locked(sfs, sv);
+
+		/* Right after the inode, for the first block */
+		goal = sv->sv_goal != 0 ? sv->sv_goal : sv->sv_ino + 1;
+		result = sfs_bfind(sfs, goal, diskblock);
+		if (result) {
+			lock_release(sfs->sfs_freemaplock);
+			return result;
+		}
+
+		if (append) {
+			for (i=1; i<SFS_PREALLOC; i++) {
+				block = *diskblock + i;
+				if (block >= sfs->sfs_sb.sb_nblocks ||
+				    bitmap_isset(sfs->sfs_freemap, block)) {
+					break;
+				}
+				bitmap_mark(sfs->sfs_freemap, block);
+				bitmap_mark(sfs->sfs_resmap, block);
+			}
+			sv->sv_resstart = *diskblock + 1;
+			sv->sv_rescount = i - 1;
+			/* Keep new files from starting inside it */
+			sfs->sfs_allocnext = *diskblock + i;
+		}
+	}
+	sv->sv_goal = *diskblock + 1;
+
+	lock_release(sfs->sfs_freemaplock);
+
+	return sfs_bready(sfs, *diskblock);
+}
+
 /*
  * Free a block.
  */
 void
 sfs_bfree(struct sfs_fs *sfs, daddr_t diskblock)
 {
-	bitmap_unmark(sfs->sfs_freemap, diskblock);
-	sfs->sfs_freemapdirty = true;
+	/*
+	 * Don't bother writing out whatever was cached for it. Do
+	 * this first, while the block is still ours, so we can't
+	 * throw away someone else's newly allocated block.
+	 */
+	buf_drop(sfs->sfs_device, diskblock);
+
+	lock_acquire(sfs->sfs_freemaplock);
+	if (sfs->sfs_journaled) {
+		/*
+		 * The block is still in use as far as the disk is
+		 * concerned until the free commits, so it can't be
+		 * given out again until then.
+		 */
+		bitmap_mark(sfs->sfs_jfreed, diskblock);
+		sfs->sfs_jnfreed++;
+	}
+	else {
+		bitmap_unmark(sfs->sfs_freemap, diskblock);
+		sfs->sfs_freemapdirty = true;
+	}
+	lock_release(sfs->sfs_freemaplock);
 }
 
 /*
@@ -94,10 +290,15 @@ sfs_bfree(struct sfs_fs *sfs, daddr_t diskblock)
 int
 sfs_bused(struct sfs_fs *sfs, daddr_t diskblock)
 {
+	int ret;
+
 	if (diskblock >= sfs->sfs_sb.sb_nblocks) {
 		panic("sfs: %s: sfs_bused called on out of range block %u\n",
 		      sfs->sfs_sb.sb_volname, diskblock);
 	}
-	return bitmap_isset(sfs->sfs_freemap, diskblock);
+	lock_acquire(sfs->sfs_freemaplock);
+	ret = bitmap_isset(sfs->sfs_freemap, diskblock);
+	lock_release(sfs->sfs_freemaplock);
+	return ret;
 }
 
@@ -35,39 +35,167 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <synch.h>
 #include <vfs.h>
+#include <buf.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
+/* File blocks mapped by one indirect block */
+#define SFS_RANGE1 SFS_DBPERIDB
+/* and by one double and one triple indirect block */
+#define SFS_RANGE2 (SFS_RANGE1 * SFS_DBPERIDB)
+#define SFS_RANGE3 (SFS_RANGE2 * SFS_DBPERIDB)
+
+/*
+ * Indirect block cache
+ *
+ * Each vnode remembers the last few leaf (single) indirect blocks it
+ * used, keyed by which run of SFS_DBPERIDB file blocks past the
+ * direct blocks they map, so mapping a block in a big file usually
+ * takes one indirect block read instead of up to three. The entries
+ * are only dropped when blocks are freed, in sfs_itrunc. Protected
+ * by sv_lock.
+ */
+
+static
+bool
+sfs_ibcache_find(struct sfs_vnode *sv, uint32_t key, daddr_t *idblock)
+{
+	unsigned i;
+
+	for (i=0; i<SFS_IBCACHE; i++) {
+		if (sv->sv_ibblock[i] != 0 && sv->sv_ibkey[i] == key) {
+			*idblock = sv->sv_ibblock[i];
+			return true;
+		}
+	}
+	return false;
+}
+
+static
+void
+sfs_ibcache_add(struct sfs_vnode *sv, uint32_t key, daddr_t idblock)
+{
+	sv->sv_ibkey[sv->sv_ibnext] = key;
+	sv->sv_ibblock[sv->sv_ibnext] = idblock;
+	sv->sv_ibnext = (sv->sv_ibnext + 1) % SFS_IBCACHE;
+}
+
+void
+sfs_ibcache_clear(struct sfs_vnode *sv)
+{
+	unsigned i;
+
+	for (i=0; i<SFS_IBCACHE; i++) {
+		sv->sv_ibblock[i] = 0;
+	}
+	sv->sv_ibnext = 0;
+}
+
+/*
+ * Find the inode's pointer to the top indirect block that maps
+ * FILEBLOCK (which is past the direct blocks), and how many levels of
+ * indirect blocks there are under it including itself. FILEBLOCK is
+ * changed to be relative to the first block that one maps.
+ */
+static
+int
+sfs_ibroot(struct sfs_vnode *sv, uint32_t *fileblock, uint32_t **rootp,
+	   unsigned *levels)
+{
+	uint32_t rel = *fileblock - SFS_NDIRECT;
+
+	if (rel < SFS_RANGE1) {
+		*rootp = &sv->sv_i.sfi_indirect;
+		*levels = 1;
+	}
+	else if ((rel -= SFS_RANGE1) < SFS_RANGE2) {
+		*rootp = &sv->sv_i.sfi_dindirect;
+		*levels = 2;
+	}
+	else if ((rel -= SFS_RANGE2) < SFS_RANGE3) {
+		*rootp = &sv->sv_i.sfi_tindirect;
+		*levels = 3;
+	}
+	else {
+		return EFBIG;
+	}
+	*fileblock = rel;
+	return 0;
+}
+
+/*
+ * Get entry IDOFF of indirect block IDBLOCK, allocating a block for
+ * it if there isn't one and DOALLOC is set.
+ */
+static
+int
+sfs_ibentry(struct sfs_vnode *sv, daddr_t idblock, uint32_t idoff,
+	    bool doalloc, bool append, daddr_t *ret)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct buf *buf;
+	uint32_t *idbuf;
+	daddr_t block;
+	int result;
+
+	KASSERT(idoff < SFS_DBPERIDB);
+
+	/* Load the indirect block. */
+	result = buf_read(sfs->sfs_device, idblock, &buf);
+	if (result) {
+		return result;
+	}
+	idbuf = buf_map(buf);
+
+	/* Get the block out of the indirect block buffer */
+	block = idbuf[idoff];
+
+	/* If there's no block there, allocate one */
+	if (block==0 && doalloc) {
+		result = sfs_balloc_file(sv, append, &block);
+		if (result) {
+			buf_release(buf);
+			return result;
+		}
+
+		/* Remember the block we allocated */
+		idbuf[idoff] = block;
+
+		/* The indirect block is now dirty */
+		sfs_jdirty(sfs, buf);
+	}
+	buf_release(buf);
+
+	*ret = block;
+	return 0;
+}
+
 /*
  * Look up the disk block number (from 0 up to the number of blocks on
  * the disk) given a file and the logical block number within that
  * file. If DOALLOC is set, and no such block exists, one will be
- * allocated.
+ * allocated, along with any indirect blocks needed to reach it.
  */
 int
 sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 	 daddr_t *diskblock)
 {
-	/*
-	 * I/O buffer for handling indirect blocks.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
-
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
 	daddr_t block;
 	daddr_t idblock;
-	uint32_t idnum, idoff;
+	uint32_t *rootp;
+	uint32_t rel, key, range;
+	unsigned levels, i;
+	bool append;
 	int result;
 
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
+	KASSERT(SFS_DBPERIDB * sizeof(uint32_t) == SFS_BLOCKSIZE);
+	KASSERT(lock_do_i_hold(sv->sv_lock));
 
-	/* Since we're using a static buffer, we'd better be locked. */
-	KASSERT(vfs_biglock_do_i_hold());
+	/* Growing the file at the end (as opposed to filling a hole)? */
+	append = (uint64_t)fileblock * SFS_BLOCKSIZE >= sv->sv_i.sfi_size;
 
 	/*
 	 * If the block we want is one of the direct blocks...
@@ -82,7 +210,7 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 		 * Do we need to allocate?
 		 */
 		if (block==0 && doalloc) {
-			result = sfs_balloc(sfs, &block);
+			result = sfs_balloc_file(sv, append, &block);
 			if (result) {
 				return result;
 			}
@@ -105,127 +233,261 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 	}
 
 	/*
-	 * It's not a direct block; it must be in the indirect block.
-	 * Subtract off the number of direct blocks, so FILEBLOCK is
-	 * now the offset into the indirect block space.
+	 * It's not a direct block, so it hangs off a leaf indirect
+	 * block. Maybe we know which one already.
 	 */
+	key = (fileblock - SFS_NDIRECT) / SFS_DBPERIDB;
+	if (!sfs_ibcache_find(sv, key, &idblock)) {
+		/* No; walk down to it from the inode */
+		rel = fileblock;
+		result = sfs_ibroot(sv, &rel, &rootp, &levels);
+		if (result) {
+			return result;
+		}
 
-	fileblock -= SFS_NDIRECT;
+		idblock = *rootp;
+		if (idblock==0 && !doalloc) {
+			/*
+			 * Nothing allocated here. We weren't asked to
+			 * allocate anything, so pretend the indirect
+			 * blocks were filled with all zeros.
+			 */
+			*diskblock = 0;
+			return 0;
+		}
+		else if (idblock==0) {
+			result = sfs_balloc_file(sv, append, &idblock);
+			if (result) {
+				return result;
+			}
 
-	/* Get the indirect block number and offset w/i that indirect block */
-	idnum = fileblock / SFS_DBPERIDB;
-	idoff = fileblock % SFS_DBPERIDB;
+			/* Remember it; mark the inode dirty */
+			*rootp = idblock;
+			sv->sv_dirty = true;
 
-	/*
-	 * We only have one indirect block. If the offset we were asked for
-	 * is too large, we can't handle it, so fail.
-	 */
-	if (idnum >= SFS_NINDIRECT) {
-		return EFBIG;
+			/* (sfs_balloc_file cleared the block for us) */
+		}
+
+		/* File blocks mapped by each entry at the top level */
+		range = 1;
+		for (i=1; i<levels; i++) {
+			range *= SFS_DBPERIDB;
+		}
+
+		for (; levels > 1; levels--) {
+			result = sfs_ibentry(sv, idblock, rel / range,
+					     doalloc, append, &idblock);
+			if (result) {
+				return result;
+			}
+			if (idblock == 0) {
+				*diskblock = 0;
+				return 0;
+			}
+			rel %= range;
+			range /= SFS_DBPERIDB;
+		}
+
+		sfs_ibcache_add(sv, key, idblock);
 	}
 
-	/* Get the disk block number of the indirect block. */
-	idblock = sv->sv_i.sfi_indirect;
+	/* Get the block out of the leaf indirect block */
+	result = sfs_ibentry(sv, idblock,
+			     (fileblock - SFS_NDIRECT) % SFS_DBPERIDB,
+			     doalloc, append, &block);
+	if (result) {
+		return result;
+	}
 
-	if (idblock==0 && !doalloc) {
-		/*
-		 * There's no indirect block allocated. We weren't
-		 * asked to allocate anything, so pretend the indirect
-		 * block was filled with all zeros.
-		 */
-		*diskblock = 0;
-		return 0;
+	/* Hand back the result and return. */
+	if (block != 0 && !sfs_bused(sfs, block)) {
+		panic("sfs: %s: Data block %u (block %u of file %u) "
+		      "marked free\n", sfs->sfs_sb.sb_volname,
+		      block, fileblock, sv->sv_ino);
 	}
-	else if (idblock==0) {
-		/*
-		 * There's no indirect block allocated, but we need to
-		 * allocate a block whose number needs to be stored in
-		 * the indirect block. Thus, we need to allocate an
-		 * indirect block.
-		 */
-		result = sfs_balloc(sfs, &idblock);
-		if (result) {
-			return result;
-		}
+	*diskblock = block;
+	return 0;
+}
 
-		/* Remember the block we just allocated */
-		sv->sv_i.sfi_indirect = idblock;
+/*
+ * Write out the blocks mapped by indirect block IDBLOCK, which has
+ * LEVELS levels of indirect blocks under it including itself, then
+ * the indirect block itself.
+ */
+static
+int
+sfs_flushib(struct sfs_fs *sfs, daddr_t idblock, unsigned levels)
+{
+	struct buf *buf;
+	uint32_t *idbuf;
+	unsigned j;
+	int result;
 
-		/* Mark the inode dirty */
-		sv->sv_dirty = true;
+	if (idblock == 0) {
+		return 0;
+	}
 
-		/* Clear the indirect block buffer */
-		bzero(idbuf, sizeof(idbuf));
+	result = buf_read(sfs->sfs_device, idblock, &buf);
+	if (result) {
+		return result;
 	}
-	else {
-		/*
-		 * We already have an indirect block allocated; load it.
-		 */
-		result = sfs_readblock(sfs, idblock, idbuf, sizeof(idbuf));
+	idbuf = buf_map(buf);
+
+	for (j=0; j<SFS_DBPERIDB; j++) {
+		if (idbuf[j] == 0) {
+			continue;
+		}
+		if (levels > 1) {
+			result = sfs_flushib(sfs, idbuf[j], levels - 1);
+		}
+		else {
+			result = buf_flush(sfs->sfs_device, idbuf[j]);
+		}
 		if (result) {
+			buf_release(buf);
 			return result;
 		}
 	}
+	buf_release(buf);
 
-	/* Get the block out of the indirect block buffer */
-	block = idbuf[idoff];
+	return buf_flush(sfs->sfs_device, idblock);
+}
 
-	/* If there's no block there, allocate one */
-	if (block==0 && doalloc) {
-		result = sfs_balloc(sfs, &block);
-		if (result) {
-			return result;
+/*
+ * Write a file's data blocks and indirect blocks out of the buffer
+ * cache, for fsync. Called with the vnode locked.
+ */
+int
+sfs_flushblocks(struct sfs_vnode *sv)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	uint32_t i;
+	daddr_t block;
+	int result;
+
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
+	for (i=0; i<SFS_NDIRECT; i++) {
+		block = sv->sv_i.sfi_direct[i];
+		if (block != 0) {
+			result = buf_flush(sfs->sfs_device, block);
+			if (result) {
+				return result;
+			}
 		}
+	}
 
-		/* Remember the block we allocated */
-		idbuf[idoff] = block;
+	result = sfs_flushib(sfs, sv->sv_i.sfi_indirect, 1);
+	if (result) {
+		return result;
+	}
+	result = sfs_flushib(sfs, sv->sv_i.sfi_dindirect, 2);
+	if (result) {
+		return result;
+	}
+	return sfs_flushib(sfs, sv->sv_i.sfi_tindirect, 3);
+}
 
-		/* The indirect block is now dirty; write it back */
-		result = sfs_writeblock(sfs, idblock, idbuf, sizeof(idbuf));
-		if (result) {
-			return result;
+/*
+ * Free whatever the indirect block *IDBLOCKP maps at or past file
+ * block BLOCKLEN. It has LEVELS levels of indirect blocks under it
+ * including itself, and maps file blocks starting from BASE. If that
+ * leaves it empty, free it too and zero *IDBLOCKP.
+ */
+static
+int
+sfs_itrunc_ib(struct sfs_vnode *sv, uint32_t *idblockp, unsigned levels,
+	      uint32_t base, uint32_t blocklen)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct buf *buf;
+	uint32_t *idbuf;
+	uint32_t range, j, old;
+	bool hasnonzero, iddirty;
+	int result;
+
+	/* File blocks mapped by each entry */
+	range = 1;
+	for (j=1; j<levels; j++) {
+		range *= SFS_DBPERIDB;
+	}
+
+	if (*idblockp == 0 || blocklen >= base + range * SFS_DBPERIDB) {
+		/* Nothing here, or all of it is before the new EOF */
+		return 0;
+	}
+
+	/* Read the indirect block */
+	result = buf_read(sfs->sfs_device, *idblockp, &buf);
+	if (result) {
+		return result;
+	}
+	idbuf = buf_map(buf);
+
+	result = 0;
+	hasnonzero = false;
+	iddirty = false;
+	for (j=0; j<SFS_DBPERIDB && result == 0; j++) {
+		if (idbuf[j] != 0 && levels > 1) {
+			/* Trim what's under it */
+			old = idbuf[j];
+			result = sfs_itrunc_ib(sv, &idbuf[j], levels - 1,
+					       base + j*range, blocklen);
+			if (idbuf[j] != old) {
+				iddirty = true;
+			}
+		}
+		else if (idbuf[j] != 0 && blocklen <= base + j) {
+			/* Discard a block that's past the new EOF */
+			sfs_bfree(sfs, idbuf[j]);
+			idbuf[j] = 0;
+			iddirty = true;
+		}
+		/* Remember if we see any nonzero blocks in here */
+		if (idbuf[j] != 0) {
+			hasnonzero = true;
 		}
 	}
 
-	/* Hand back the result and return. */
-	if (block != 0 && !sfs_bused(sfs, block)) {
-		panic("sfs: %s: Data block %u (block %u of file %u) "
-		      "marked free\n", sfs->sfs_sb.sb_volname,
-		      block, fileblock, sv->sv_ino);
+	if (result == 0 && !hasnonzero) {
+		/* The whole indirect block is empty now; free it */
+		buf_release(buf);
+		sfs_bfree(sfs, *idblockp);
+		*idblockp = 0;
+		return 0;
 	}
-	*diskblock = block;
-	return 0;
+
+	if (iddirty) {
+		sfs_jdirty(sfs, buf);
+	}
+	buf_release(buf);
+	return result;
 }
 
 /*
- * Called for ftruncate() and from sfs_reclaim.
+ * Called for ftruncate() and from sfs_reclaim, with the vnode locked.
  */
 int
 sfs_itrunc(struct sfs_vnode *sv, off_t len)
 {
-	/*
-	 * I/O buffer for handling the indirect block.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
-
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	uint32_t *roots[3];
+	uint32_t ranges[3];
 
 	/* Length in blocks (divide rounding up) */
 	uint32_t blocklen = DIVROUNDUP(len, SFS_BLOCKSIZE);
 
-	uint32_t i, j;
-	daddr_t block, idblock;
-	uint32_t baseblock, highblock;
+	uint32_t i, old, base;
+	daddr_t block;
 	int result;
-	int hasnonzero, iddirty;
 
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
+	/* Whatever was set aside for appending is no use now */
+	sfs_unreserve(sv);
 
-	vfs_biglock_acquire();
+	/* and the indirect blocks we remember may be about to go */
+	sfs_ibcache_clear(sv);
 
 	/*
 	 * Go through the direct blocks. Discard any that are
@@ -240,55 +502,25 @@ sfs_itrunc(struct sfs_vnode *sv, off_t len)
 		}
 	}
 
-	/* Indirect block number */
-	idblock = sv->sv_i.sfi_indirect;
-
-	/* The lowest block in the indirect block */
-	baseblock = SFS_NDIRECT;
-
-	/* The highest block in the indirect block */
-	highblock = baseblock + SFS_DBPERIDB - 1;
-
-	if (blocklen < highblock && idblock != 0) {
-		/* We're past the proposed EOF; may need to free stuff */
-
-		/* Read the indirect block */
-		result = sfs_readblock(sfs, idblock, idbuf, sizeof(idbuf));
-		if (result) {
-			vfs_biglock_release();
-			return result;
-		}
-
-		hasnonzero = 0;
-		iddirty = 0;
-		for (j=0; j<SFS_DBPERIDB; j++) {
-			/* Discard any blocks that are past the new EOF */
-			if (blocklen < baseblock+j && idbuf[j] != 0) {
-				sfs_bfree(sfs, idbuf[j]);
-				idbuf[j] = 0;
-				iddirty = 1;
-			}
-			/* Remember if we see any nonzero blocks in here */
-			if (idbuf[j]!=0) {
-				hasnonzero=1;
-			}
-		}
-
-		if (!hasnonzero) {
-			/* The whole indirect block is empty now; free it */
-			sfs_bfree(sfs, idblock);
-			sv->sv_i.sfi_indirect = 0;
+	/* Then the single, double, and triple indirect blocks */
+	roots[0] = &sv->sv_i.sfi_indirect;
+	roots[1] = &sv->sv_i.sfi_dindirect;
+	roots[2] = &sv->sv_i.sfi_tindirect;
+	ranges[0] = SFS_RANGE1;
+	ranges[1] = SFS_RANGE2;
+	ranges[2] = SFS_RANGE3;
+
+	base = SFS_NDIRECT;
+	for (i=0; i<3; i++) {
+		old = *roots[i];
+		result = sfs_itrunc_ib(sv, roots[i], i+1, base, blocklen);
+		if (*roots[i] != old) {
 			sv->sv_dirty = true;
 		}
-		else if (iddirty) {
-			/* The indirect block is dirty; write it back */
-			result = sfs_writeblock(sfs, idblock, idbuf,
-						sizeof(idbuf));
-			if (result) {
-				vfs_biglock_release();
-				return result;
-			}
+		if (result) {
+			return result;
 		}
+		base += ranges[i];
 	}
 
 	/* Set the file size */
@@ -297,7 +529,5 @@ sfs_itrunc(struct sfs_vnode *sv, off_t len)
 	/* Mark the inode dirty */
 	sv->sv_dirty = true;
 
-	vfs_biglock_release();
 	return 0;
 }
-
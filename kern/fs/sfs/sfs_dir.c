@@ -35,10 +35,38 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <synch.h>
 #include <vfs.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
+/*
+ * In-memory name index for a directory: a hash table from name to
+ * slot and inode number, plus a heap of free slots, so new names
+ * always go in the lowest free slot and the directory stays compact.
+ * It's built the first time the directory is searched and kept up
+ * to date by sfs_dir_link and sfs_dir_unlink. If we run out of
+ * memory while updating it, it's thrown away and rebuilt next time.
+ * Protected by the directory's sv_lock.
+ */
+struct sfs_dirname {
+	struct sfs_dirname *dn_next;	/* hash chain */
+	uint32_t dn_ino;
+	int dn_slot;
+	char dn_name[];
+};
+
+struct sfs_dirindex {
+	struct sfs_dirname **di_table;
+	unsigned di_tablesize;
+	unsigned di_count;		/* names in the table */
+	int *di_free;			/* min-heap of free slots */
+	unsigned di_nfree;
+	unsigned di_maxfree;
+};
+
+#define DIRINDEX_INITSIZE 16
+
 /*
  * Read the directory entry out of slot SLOT of a directory vnode.
  * The "slot" is the index of the directory entry, starting at 0.
@@ -95,14 +123,290 @@ sfs_dir_nentries(struct sfs_vnode *sv)
 	return size / sizeof(struct sfs_direntry);
 }
 
+////////////////////////////////////////////////////////////
+// Name index
+
+static
+unsigned
+dirindex_hash(const char *name)
+{
+	unsigned h = 5381;
+
+	while (*name) {
+		h = h*33 + (unsigned char)*name++;
+	}
+	return h;
+}
+
+static
+struct sfs_dirindex *
+dirindex_create(void)
+{
+	struct sfs_dirindex *di;
+	unsigned i;
+
+	di = kmalloc(sizeof(*di));
+	if (di == NULL) {
+		return NULL;
+	}
+	di->di_table = kmalloc(DIRINDEX_INITSIZE * sizeof(struct sfs_dirname *));
+	if (di->di_table == NULL) {
+		kfree(di);
+		return NULL;
+	}
+	for (i=0; i<DIRINDEX_INITSIZE; i++) {
+		di->di_table[i] = NULL;
+	}
+	di->di_tablesize = DIRINDEX_INITSIZE;
+	di->di_count = 0;
+	di->di_free = NULL;
+	di->di_nfree = 0;
+	di->di_maxfree = 0;
+	return di;
+}
+
 /*
- * Search a directory for a particular filename in a directory, and
- * return its inode number, its slot, and/or the slot number of an
- * empty directory slot if one is found.
+ * Throw away a directory's index, if it has one.
  */
+void
+sfs_dir_dropindex(struct sfs_vnode *sv)
+{
+	struct sfs_dirindex *di = sv->sv_dirindex;
+	struct sfs_dirname *dn;
+	unsigned i;
+
+	if (di == NULL) {
+		return;
+	}
+
+	for (i=0; i<di->di_tablesize; i++) {
+		while ((dn = di->di_table[i]) != NULL) {
+			di->di_table[i] = dn->dn_next;
+			kfree(dn);
+		}
+	}
+	kfree(di->di_table);
+	kfree(di->di_free);
+	kfree(di);
+	sv->sv_dirindex = NULL;
+}
+
+static
+struct sfs_dirname *
+dirindex_find(struct sfs_dirindex *di, const char *name)
+{
+	struct sfs_dirname *dn;
+
+	dn = di->di_table[dirindex_hash(name) % di->di_tablesize];
+	for (; dn != NULL; dn = dn->dn_next) {
+		if (!strcmp(dn->dn_name, name)) {
+			return dn;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Double the hash table. Failing is harmless; chains just get longer.
+ */
+static
+void
+dirindex_grow(struct sfs_dirindex *di)
+{
+	struct sfs_dirname **newtable, *dn;
+	unsigned newsize, i, h;
+
+	newsize = di->di_tablesize * 2;
+	newtable = kmalloc(newsize * sizeof(struct sfs_dirname *));
+	if (newtable == NULL) {
+		return;
+	}
+	for (i=0; i<newsize; i++) {
+		newtable[i] = NULL;
+	}
+
+	for (i=0; i<di->di_tablesize; i++) {
+		while ((dn = di->di_table[i]) != NULL) {
+			di->di_table[i] = dn->dn_next;
+			h = dirindex_hash(dn->dn_name) % newsize;
+			dn->dn_next = newtable[h];
+			newtable[h] = dn;
+		}
+	}
+
+	kfree(di->di_table);
+	di->di_table = newtable;
+	di->di_tablesize = newsize;
+}
+
+static
 int
-sfs_dir_findname(struct sfs_vnode *sv, const char *name,
-		uint32_t *ino, int *slot, int *emptyslot)
+dirindex_add(struct sfs_dirindex *di, const char *name, uint32_t ino,
+	     int slot)
+{
+	struct sfs_dirname *dn;
+	size_t len;
+	unsigned h;
+
+	KASSERT(dirindex_find(di, name) == NULL);
+
+	len = strlen(name);
+	dn = kmalloc(sizeof(*dn) + len + 1);
+	if (dn == NULL) {
+		return ENOMEM;
+	}
+	memcpy(dn->dn_name, name, len + 1);
+	dn->dn_ino = ino;
+	dn->dn_slot = slot;
+
+	if (di->di_count >= 2 * di->di_tablesize) {
+		dirindex_grow(di);
+	}
+
+	h = dirindex_hash(name) % di->di_tablesize;
+	dn->dn_next = di->di_table[h];
+	di->di_table[h] = dn;
+	di->di_count++;
+	return 0;
+}
+
+static
+void
+dirindex_remove(struct sfs_dirindex *di, const char *name)
+{
+	struct sfs_dirname **dnp, *dn;
+
+	dnp = &di->di_table[dirindex_hash(name) % di->di_tablesize];
+	for (; *dnp != NULL; dnp = &(*dnp)->dn_next) {
+		dn = *dnp;
+		if (!strcmp(dn->dn_name, name)) {
+			*dnp = dn->dn_next;
+			kfree(dn);
+			di->di_count--;
+			return;
+		}
+	}
+	panic("sfs: dirindex_remove: %s not in index\n", name);
+}
+
+static
+int
+dirindex_pushfree(struct sfs_dirindex *di, int slot)
+{
+	int *newfree;
+	unsigned newmax, i;
+
+	if (di->di_nfree == di->di_maxfree) {
+		newmax = di->di_maxfree ? di->di_maxfree * 2 : 8;
+		newfree = kmalloc(newmax * sizeof(int));
+		if (newfree == NULL) {
+			return ENOMEM;
+		}
+		if (di->di_nfree > 0) {
+			memcpy(newfree, di->di_free, di->di_nfree * sizeof(int));
+		}
+		kfree(di->di_free);
+		di->di_free = newfree;
+		di->di_maxfree = newmax;
+	}
+
+	/* Sift up */
+	i = di->di_nfree++;
+	while (i > 0 && di->di_free[(i-1)/2] > slot) {
+		di->di_free[i] = di->di_free[(i-1)/2];
+		i = (i-1)/2;
+	}
+	di->di_free[i] = slot;
+	return 0;
+}
+
+/*
+ * Take the lowest free slot, di_free[0], off the heap.
+ */
+static
+void
+dirindex_popfree(struct sfs_dirindex *di)
+{
+	unsigned i, child;
+	int last;
+
+	KASSERT(di->di_nfree > 0);
+
+	/* Sift the last slot down from the top */
+	last = di->di_free[--di->di_nfree];
+	i = 0;
+	while ((child = 2*i + 1) < di->di_nfree) {
+		if (child + 1 < di->di_nfree &&
+		    di->di_free[child + 1] < di->di_free[child]) {
+			child++;
+		}
+		if (di->di_free[child] >= last) {
+			break;
+		}
+		di->di_free[i] = di->di_free[child];
+		i = child;
+	}
+	di->di_free[i] = last;
+}
+
+/*
+ * Read the whole directory into a new index. If there isn't memory
+ * for it, leaves sv_dirindex NULL without failing; callers then fall
+ * back to scanning the directory.
+ */
+static
+int
+sfs_dir_buildindex(struct sfs_vnode *sv)
+{
+	struct sfs_dirindex *di;
+	struct sfs_direntry tsd;
+	int nentries, i, result;
+
+	KASSERT(sv->sv_dirindex == NULL);
+
+	di = dirindex_create();
+	if (di == NULL) {
+		return 0;
+	}
+	sv->sv_dirindex = di;
+
+	nentries = sfs_dir_nentries(sv);
+	for (i=0; i<nentries; i++) {
+		result = sfs_readdir(sv, i, &tsd);
+		if (result) {
+			sfs_dir_dropindex(sv);
+			return result;
+		}
+		if (tsd.sfd_ino == SFS_NOINO) {
+			result = dirindex_pushfree(di, i);
+		}
+		else {
+			/* Ensure null termination, just in case */
+			tsd.sfd_name[sizeof(tsd.sfd_name)-1] = 0;
+			result = dirindex_add(di, tsd.sfd_name,
+					      tsd.sfd_ino, i);
+		}
+		if (result) {
+			/* Out of memory; do without */
+			sfs_dir_dropindex(sv);
+			return 0;
+		}
+	}
+
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// Directory operations
+
+/*
+ * Search a directory for a particular filename by reading every
+ * slot. This is what we do if there's no index.
+ */
+static
+int
+sfs_dir_scan(struct sfs_vnode *sv, const char *name,
+	     uint32_t *ino, int *slot, int *emptyslot)
 {
 	struct sfs_direntry tsd;
 	int found, nentries, i, result;
@@ -146,6 +450,50 @@ sfs_dir_findname(struct sfs_vnode *sv, const char *name,
 	return found ? 0 : ENOENT;
 }
 
+/*
+ * Search a directory for a particular filename in a directory, and
+ * return its inode number, its slot, and/or the slot number of an
+ * empty directory slot if one is found.
+ */
+int
+sfs_dir_findname(struct sfs_vnode *sv, const char *name,
+		uint32_t *ino, int *slot, int *emptyslot)
+{
+	struct sfs_dirindex *di;
+	struct sfs_dirname *dn;
+	int result;
+
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
+	if (sv->sv_dirindex == NULL) {
+		result = sfs_dir_buildindex(sv);
+		if (result) {
+			return result;
+		}
+	}
+
+	di = sv->sv_dirindex;
+	if (di == NULL) {
+		return sfs_dir_scan(sv, name, ino, slot, emptyslot);
+	}
+
+	if (emptyslot != NULL && di->di_nfree > 0) {
+		*emptyslot = di->di_free[0];
+	}
+
+	dn = dirindex_find(di, name);
+	if (dn == NULL) {
+		return ENOENT;
+	}
+	if (slot != NULL) {
+		*slot = dn->dn_slot;
+	}
+	if (ino != NULL) {
+		*ino = dn->dn_ino;
+	}
+	return 0;
+}
+
 /*
  * Create a link in a directory to the specified inode by number, with
  * the specified name, and optionally hand back the slot.
@@ -156,6 +504,7 @@ sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino, int *slot)
 	int emptyslot = -1;
 	int result;
 	struct sfs_direntry sd;
+	struct sfs_dirindex *di;
 
 	/* Look up the name. We want to make sure it *doesn't* exist. */
 	result = sfs_dir_findname(sv, name, NULL, NULL, &emptyslot);
@@ -186,7 +535,22 @@ sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino, int *slot)
 	}
 
 	/* Write the entry. */
-	return sfs_writedir(sv, emptyslot, &sd);
+	result = sfs_writedir(sv, emptyslot, &sd);
+	if (result) {
+		return result;
+	}
+
+	/* Update the index (sfs_dir_findname gave us its lowest free slot) */
+	di = sv->sv_dirindex;
+	if (di != NULL) {
+		if (di->di_nfree > 0 && di->di_free[0] == emptyslot) {
+			dirindex_popfree(di);
+		}
+		if (dirindex_add(di, name, ino, emptyslot)) {
+			sfs_dir_dropindex(sv);
+		}
+	}
+	return 0;
 }
 
 /*
@@ -195,14 +559,36 @@ sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino, int *slot)
 int
 sfs_dir_unlink(struct sfs_vnode *sv, int slot)
 {
-	struct sfs_direntry sd;
+	struct sfs_direntry sd, oldsd;
+	struct sfs_dirindex *di = sv->sv_dirindex;
+	int result;
+
+	/* If there's an index, we need the old name to update it */
+	if (di != NULL) {
+		result = sfs_readdir(sv, slot, &oldsd);
+		if (result) {
+			return result;
+		}
+		oldsd.sfd_name[sizeof(oldsd.sfd_name)-1] = 0;
+	}
 
 	/* Initialize a suitable directory entry... */
 	bzero(&sd, sizeof(sd));
 	sd.sfd_ino = SFS_NOINO;
 
 	/* ... and write it */
-	return sfs_writedir(sv, slot, &sd);
+	result = sfs_writedir(sv, slot, &sd);
+	if (result) {
+		return result;
+	}
+
+	if (di != NULL) {
+		dirindex_remove(di, oldsd.sfd_name);
+		if (dirindex_pushfree(di, slot)) {
+			sfs_dir_dropindex(sv);
+		}
+	}
+	return 0;
 }
 
 /*
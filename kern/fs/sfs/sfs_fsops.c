@@ -36,20 +36,17 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <synch.h>
 #include <array.h>
 #include <bitmap.h>
 #include <uio.h>
 #include <vfs.h>
 #include <device.h>
+#include <buf.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
 
-/* Shortcuts for the size macros in kern/sfs.h */
-#define SFS_FS_NBLOCKS(sfs)        ((sfs)->sfs_sb.sb_nblocks)
-#define SFS_FS_FREEMAPBITS(sfs)    SFS_FREEMAPBITS(SFS_FS_NBLOCKS(sfs))
-#define SFS_FS_FREEMAPBLOCKS(sfs)  SFS_FREEMAPBLOCKS(SFS_FS_NBLOCKS(sfs))
-
 /*
  * Routine for doing I/O (reads or writes) on the free block bitmap.
  * We always do the whole bitmap at once; writing individual sectors
@@ -66,13 +63,16 @@
  *
  * The sectors used by the superblock and the bitmap itself are
  * likewise marked in use by mksfs.
+ *
+ * Blocks reserved for files being appended to (sfs_resmap) are
+ * marked in use in memory but written out as free.
  */
 static
 int
 sfs_freemapio(struct sfs_fs *sfs, enum uio_rw rw)
 {
-	uint32_t j, freemapblocks;
-	char *freemapdata;
+	uint32_t i, j, freemapblocks;
+	char *freemapdata, *resmapdata, *tmp;
 	int result;
 
 	/* Number of blocks in the free block bitmap. */
@@ -81,11 +81,20 @@ sfs_freemapio(struct sfs_fs *sfs, enum uio_rw rw)
 	/* Pointer to our freemap data in memory. */
 	freemapdata = bitmap_getdata(sfs->sfs_freemap);
 
+	resmapdata = tmp = NULL;
+	if (rw == UIO_WRITE) {
+		resmapdata = bitmap_getdata(sfs->sfs_resmap);
+		tmp = kmalloc(SFS_BLOCKSIZE);
+		if (tmp == NULL) {
+			return ENOMEM;
+		}
+	}
+
 	/* For each block in the free block bitmap... */
 	for (j=0; j<freemapblocks; j++) {
 
 		/* Get a pointer to its data */
-		void *ptr = freemapdata + j*SFS_BLOCKSIZE;
+		char *ptr = freemapdata + j*SFS_BLOCKSIZE;
 
 		/* and read or write it. The freemap starts at sector 2. */
 		if (rw == UIO_READ) {
@@ -93,15 +102,21 @@ sfs_freemapio(struct sfs_fs *sfs, enum uio_rw rw)
 					       SFS_BLOCKSIZE);
 		}
 		else {
-			result = sfs_writeblock(sfs, SFS_FREEMAP_START+j, ptr,
+			for (i=0; i<SFS_BLOCKSIZE; i++) {
+				tmp[i] = ptr[i] &
+					~resmapdata[j*SFS_BLOCKSIZE + i];
+			}
+			result = sfs_writeblock(sfs, SFS_FREEMAP_START+j, tmp,
 						SFS_BLOCKSIZE);
 		}
 
 		/* If we failed, stop. */
 		if (result) {
+			kfree(tmp);
 			return result;
 		}
 	}
+	kfree(tmp);
 	return 0;
 }
 
@@ -112,41 +127,110 @@ static
 int
 sfs_sync_vnodes(struct sfs_fs *sfs)
 {
+	struct vnodearray *vnodes;
+	struct vnode *v;
+	struct sfs_vnode *sv;
 	unsigned i, num;
+	int result;
+
+	vnodes = vnodearray_create();
+	if (vnodes == NULL) {
+		return ENOMEM;
+	}
+
+	/*
+	 * Take a reference to each loaded vnode, so we can lock them
+	 * one at a time without holding sfs_vnlock (which comes after
+	 * the vnode locks).
+	 */
+	lock_acquire(sfs->sfs_vnlock);
+	result = vnodearray_setsize(vnodes, sfs->sfs_nvnodes);
+	if (result) {
+		lock_release(sfs->sfs_vnlock);
+		vnodearray_destroy(vnodes);
+		return result;
+	}
+	num = 0;
+	for (i=0; i<sfs->sfs_vnhashsize; i++) {
+		for (sv = sfs->sfs_vnhash[i]; sv != NULL; sv = sv->sv_hashnext) {
+			VOP_INCREF(&sv->sv_absvn);
+			vnodearray_set(vnodes, num++, &sv->sv_absvn);
+		}
+	}
+	KASSERT(num == sfs->sfs_nvnodes);
+	lock_release(sfs->sfs_vnlock);
 
-	/* Go over the array of loaded vnodes, syncing as we go. */
-	num = vnodearray_num(sfs->sfs_vnodes);
+	/*
+	 * Go over them, syncing as we go. This only puts the inodes
+	 * in the buffer cache; sfs_sync writes the buffers out
+	 * afterwards.
+	 */
 	for (i=0; i<num; i++) {
-		struct vnode *v = vnodearray_get(sfs->sfs_vnodes, i);
-		VOP_FSYNC(v);
+		v = vnodearray_get(vnodes, i);
+		sv = v->vn_data;
+		sfs_jbegin(sfs);
+		lock_acquire(sv->sv_lock);
+		sfs_sync_inode(sv);
+		lock_release(sv->sv_lock);
+		sfs_jend(sfs);
+		VOP_DECREF(v);
 	}
+
+	vnodearray_setsize(vnodes, 0);
+	vnodearray_destroy(vnodes);
 	return 0;
 }
 
 /*
- * Sync routine for the freemap.
+ * Sync routine for the freemap. This only puts it in the buffer
+ * cache.
  */
-static
 int
 sfs_sync_freemap(struct sfs_fs *sfs)
 {
 	int result;
 
+	lock_acquire(sfs->sfs_freemaplock);
 	if (sfs->sfs_freemapdirty) {
 		result = sfs_freemapio(sfs, UIO_WRITE);
 		if (result) {
+			lock_release(sfs->sfs_freemaplock);
 			return result;
 		}
 		sfs->sfs_freemapdirty = false;
 	}
+	lock_release(sfs->sfs_freemaplock);
 
 	return 0;
 }
 
 /*
- * Sync routine for the superblock.
+ * Sync the freemap and write its blocks out of the buffer cache now,
+ * for fsync.
+ */
+int
+sfs_flush_freemap(struct sfs_fs *sfs)
+{
+	uint32_t j;
+	int result;
+
+	result = sfs_sync_freemap(sfs);
+	if (result) {
+		return result;
+	}
+	for (j=0; j<SFS_FS_FREEMAPBLOCKS(sfs); j++) {
+		result = buf_flush(sfs->sfs_device, SFS_FREEMAP_START+j);
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Sync routine for the superblock. This too only puts it in the
+ * buffer cache.
  */
-static
 int
 sfs_sync_superblock(struct sfs_fs *sfs)
 {
@@ -174,8 +258,6 @@ sfs_sync(struct fs *fs)
 	struct sfs_fs *sfs;
 	int result;
 
-	vfs_biglock_acquire();
-
 	/*
 	 * Get the sfs_fs from the generic abstract fs.
 	 *
@@ -211,25 +293,24 @@ sfs_sync(struct fs *fs)
 	/* If any vnodes need to be written, write them. */
 	result = sfs_sync_vnodes(sfs);
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
-	/* If the free block map needs to be written, write it. */
-	result = sfs_sync_freemap(sfs);
+	/*
+	 * Commit the journal, which includes writing the freemap and
+	 * the superblock if they need it.
+	 */
+	result = sfs_jcommit(sfs);
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
-	/* If the superblock needs to be written, write it. */
-	result = sfs_sync_superblock(sfs);
+	/* Now write out everything that's dirty in the buffer cache. */
+	result = buf_sync(sfs->sfs_device);
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -243,13 +324,9 @@ const char *
 sfs_getvolname(struct fs *fs)
 {
 	struct sfs_fs *sfs = fs->fs_data;
-	const char *ret;
 
-	vfs_biglock_acquire();
-	ret = sfs->sfs_sb.sb_volname;
-	vfs_biglock_release();
-
-	return ret;
+	/* The superblock doesn't change while mounted; no lock needed */
+	return sfs->sfs_sb.sb_volname;
 }
 
 /*
@@ -262,7 +339,20 @@ sfs_fs_destroy(struct sfs_fs *sfs)
 	if (sfs->sfs_freemap != NULL) {
 		bitmap_destroy(sfs->sfs_freemap);
 	}
-	vnodearray_destroy(sfs->sfs_vnodes);
+	if (sfs->sfs_resmap != NULL) {
+		bitmap_destroy(sfs->sfs_resmap);
+	}
+	sfs_vntable_cleanup(sfs);
+	if (sfs->sfs_jfreed != NULL) {
+		bitmap_destroy(sfs->sfs_jfreed);
+	}
+	kfree(sfs->sfs_jlog);
+	kfree(sfs->sfs_jnew);
+	cv_destroy(sfs->sfs_jcv);
+	lock_destroy(sfs->sfs_jlock);
+	lock_destroy(sfs->sfs_renamelock);
+	lock_destroy(sfs->sfs_freemaplock);
+	lock_destroy(sfs->sfs_vnlock);
 	KASSERT(sfs->sfs_device == NULL);
 	kfree(sfs);
 }
@@ -278,18 +368,21 @@ sfs_unmount(struct fs *fs)
 {
 	struct sfs_fs *sfs = fs->fs_data;
 
-	vfs_biglock_acquire();
-
 	/* Do we have any files open? If so, can't unmount. */
-	if (vnodearray_num(sfs->sfs_vnodes) > 0) {
-		vfs_biglock_release();
+	lock_acquire(sfs->sfs_vnlock);
+	if (sfs->sfs_nvnodes > 0) {
+		lock_release(sfs->sfs_vnlock);
 		return EBUSY;
 	}
+	lock_release(sfs->sfs_vnlock);
 
 	/* We should have just had sfs_sync called. */
 	KASSERT(sfs->sfs_superdirty == false);
 	KASSERT(sfs->sfs_freemapdirty == false);
 
+	/* Forget our blocks, in case the device is written raw */
+	buf_dropdev(sfs->sfs_device);
+
 	/* The vfs layer takes care of the device for us */
 	sfs->sfs_device = NULL;
 
@@ -297,7 +390,6 @@ sfs_unmount(struct fs *fs)
 	sfs_fs_destroy(sfs);
 
 	/* nothing else to do */
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -342,6 +434,8 @@ sfs_fs_create(void)
 	/* abstract vfs-level fs */
 	sfs->sfs_absfs.fs_data = sfs;
 	sfs->sfs_absfs.fs_ops = &sfs_fsops;
+	sfs->sfs_absfs.fs_dcachemax = 0;
+	sfs->sfs_absfs.fs_dcacheheld = 0;
 
 	/* superblock */
 	/* (ignore sfs_super, we'll read in over it shortly) */
@@ -351,17 +445,62 @@ sfs_fs_create(void)
 	sfs->sfs_device = NULL;
 
 	/* vnode table */
-	sfs->sfs_vnodes = vnodearray_create();
-	if (sfs->sfs_vnodes == NULL) {
+	sfs->sfs_vnlock = lock_create("sfs vnode table");
+	if (sfs->sfs_vnlock == NULL) {
 		goto cleanup_object;
 	}
+	if (sfs_vntable_init(sfs)) {
+		goto cleanup_vnlock;
+	}
 
 	/* freemap */
+	sfs->sfs_freemaplock = lock_create("sfs freemap");
+	if (sfs->sfs_freemaplock == NULL) {
+		goto cleanup_vnodes;
+	}
 	sfs->sfs_freemap = NULL;
 	sfs->sfs_freemapdirty = false;
+	sfs->sfs_resmap = NULL;
+	sfs->sfs_allocnext = 0;
+
+	/* rename */
+	sfs->sfs_renamelock = lock_create("sfs rename");
+	if (sfs->sfs_renamelock == NULL) {
+		goto cleanup_freemaplock;
+	}
+
+	/* journal (set up by sfs_jmount) */
+	sfs->sfs_journaled = false;
+	sfs->sfs_jlock = lock_create("sfs journal");
+	if (sfs->sfs_jlock == NULL) {
+		goto cleanup_renamelock;
+	}
+	sfs->sfs_jcv = cv_create("sfs journal");
+	if (sfs->sfs_jcv == NULL) {
+		goto cleanup_jlock;
+	}
+	sfs->sfs_jactive = 0;
+	sfs->sfs_jwaiting = false;
+	sfs->sfs_jcommitting = false;
+	sfs->sfs_jlog = NULL;
+	sfs->sfs_jnew = NULL;
+	sfs->sfs_jnnew = 0;
+	sfs->sfs_jnewlost = false;
+	sfs->sfs_jfreed = NULL;
+	sfs->sfs_jnfreed = 0;
 
 	return sfs;
 
+cleanup_jlock:
+	lock_destroy(sfs->sfs_jlock);
+cleanup_renamelock:
+	lock_destroy(sfs->sfs_renamelock);
+cleanup_freemaplock:
+	lock_destroy(sfs->sfs_freemaplock);
+cleanup_vnodes:
+	sfs_vntable_cleanup(sfs);
+cleanup_vnlock:
+	lock_destroy(sfs->sfs_vnlock);
 cleanup_object:
 	kfree(sfs);
 fail:
@@ -388,8 +527,6 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	int result;
 	struct sfs_fs *sfs;
 
-	vfs_biglock_acquire();
-
 	/* We don't pass any options through mount */
 	(void)options;
 
@@ -402,7 +539,6 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	 * don't do that in sfs.)
 	 */
 	if (dev->d_blocksize != SFS_BLOCKSIZE) {
-		vfs_biglock_release();
 		kprintf("sfs: Cannot mount on device with blocksize %zu\n",
 			dev->d_blocksize);
 		return ENXIO;
@@ -410,20 +546,21 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 
 	sfs = sfs_fs_create();
 	if (sfs == NULL) {
-		vfs_biglock_release();
 		return ENOMEM;
 	}
 
 	/* Set the device so we can use sfs_readblock() */
 	sfs->sfs_device = dev;
 
+	/* Don't trust anything cached from before we were mounted */
+	buf_dropdev(dev);
+
 	/* Load superblock */
 	result = sfs_readblock(sfs, SFS_SUPER_BLOCK, &sfs->sfs_sb,
 			       sizeof(sfs->sfs_sb));
 	if (result) {
 		sfs->sfs_device = NULL;
 		sfs_fs_destroy(sfs);
-		vfs_biglock_release();
 		return result;
 	}
 
@@ -436,7 +573,6 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 			SFS_MAGIC);
 		sfs->sfs_device = NULL;
 		sfs_fs_destroy(sfs);
-		vfs_biglock_release();
 		return EINVAL;
 	}
 
@@ -448,26 +584,43 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	/* Ensure null termination of the volume name */
 	sfs->sfs_sb.sb_volname[sizeof(sfs->sfs_sb.sb_volname)-1] = 0;
 
+	/* Recover from the journal, if there is one */
+	result = sfs_jmount(sfs);
+	if (result) {
+		sfs->sfs_device = NULL;
+		sfs_fs_destroy(sfs);
+		return result;
+	}
+	if (sfs->sfs_journaled) {
+		/* Replay may have changed the superblock */
+		result = sfs_readblock(sfs, SFS_SUPER_BLOCK, &sfs->sfs_sb,
+				       sizeof(sfs->sfs_sb));
+		if (result) {
+			sfs->sfs_device = NULL;
+			sfs_fs_destroy(sfs);
+			return result;
+		}
+		sfs->sfs_sb.sb_volname[sizeof(sfs->sfs_sb.sb_volname)-1] = 0;
+	}
+
 	/* Load free block bitmap */
 	sfs->sfs_freemap = bitmap_create(SFS_FS_FREEMAPBITS(sfs));
-	if (sfs->sfs_freemap == NULL) {
+	sfs->sfs_resmap = bitmap_create(SFS_FS_FREEMAPBITS(sfs));
+	if (sfs->sfs_freemap == NULL || sfs->sfs_resmap == NULL) {
 		sfs->sfs_device = NULL;
 		sfs_fs_destroy(sfs);
-		vfs_biglock_release();
 		return ENOMEM;
 	}
 	result = sfs_freemapio(sfs, UIO_READ);
 	if (result) {
 		sfs->sfs_device = NULL;
 		sfs_fs_destroy(sfs);
-		vfs_biglock_release();
 		return result;
 	}
 
 	/* Hand back the abstract fs */
 	*ret = &sfs->sfs_absfs;
 
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -35,13 +35,139 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <synch.h>
 #include <vfs.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
 
+////////////////////////////////////////////////////////////
+// Table of loaded vnodes
+
 /*
- * Write an on-disk inode structure back out to disk.
+ * The loaded vnodes are kept in a hash table keyed by inode number,
+ * chained through sv_hashnext. The table doubles when the average
+ * chain gets longer than 2. All of this is protected by sfs_vnlock.
+ */
+
+#define SFS_VNHASH_INITSIZE 32
+
+int
+sfs_vntable_init(struct sfs_fs *sfs)
+{
+	unsigned i;
+
+	sfs->sfs_vnhash = kmalloc(SFS_VNHASH_INITSIZE *
+				  sizeof(struct sfs_vnode *));
+	if (sfs->sfs_vnhash == NULL) {
+		return ENOMEM;
+	}
+	for (i=0; i<SFS_VNHASH_INITSIZE; i++) {
+		sfs->sfs_vnhash[i] = NULL;
+	}
+	sfs->sfs_vnhashsize = SFS_VNHASH_INITSIZE;
+	sfs->sfs_nvnodes = 0;
+	return 0;
+}
+
+void
+sfs_vntable_cleanup(struct sfs_fs *sfs)
+{
+	KASSERT(sfs->sfs_nvnodes == 0);
+	kfree(sfs->sfs_vnhash);
+	sfs->sfs_vnhash = NULL;
+}
+
+static
+struct sfs_vnode *
+sfs_vntable_find(struct sfs_fs *sfs, uint32_t ino)
+{
+	struct sfs_vnode *sv;
+
+	sv = sfs->sfs_vnhash[ino & (sfs->sfs_vnhashsize - 1)];
+	for (; sv != NULL; sv = sv->sv_hashnext) {
+		if (sv->sv_ino == ino) {
+			return sv;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Double the table. If we can't get the memory, just keep going
+ * with longer chains.
+ */
+static
+void
+sfs_vntable_grow(struct sfs_fs *sfs)
+{
+	struct sfs_vnode **newhash, *sv;
+	unsigned newsize, i, h;
+
+	newsize = sfs->sfs_vnhashsize * 2;
+	newhash = kmalloc(newsize * sizeof(struct sfs_vnode *));
+	if (newhash == NULL) {
+		return;
+	}
+	for (i=0; i<newsize; i++) {
+		newhash[i] = NULL;
+	}
+
+	for (i=0; i<sfs->sfs_vnhashsize; i++) {
+		while ((sv = sfs->sfs_vnhash[i]) != NULL) {
+			sfs->sfs_vnhash[i] = sv->sv_hashnext;
+			h = sv->sv_ino & (newsize - 1);
+			sv->sv_hashnext = newhash[h];
+			newhash[h] = sv;
+		}
+	}
+
+	kfree(sfs->sfs_vnhash);
+	sfs->sfs_vnhash = newhash;
+	sfs->sfs_vnhashsize = newsize;
+}
+
+static
+void
+sfs_vntable_insert(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	unsigned h;
+
+	if (sfs->sfs_nvnodes >= 2 * sfs->sfs_vnhashsize) {
+		sfs_vntable_grow(sfs);
+	}
+
+	h = sv->sv_ino & (sfs->sfs_vnhashsize - 1);
+	sv->sv_hashnext = sfs->sfs_vnhash[h];
+	sfs->sfs_vnhash[h] = sv;
+	sfs->sfs_nvnodes++;
+}
+
+static
+void
+sfs_vntable_remove(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	struct sfs_vnode **svp;
+
+	svp = &sfs->sfs_vnhash[sv->sv_ino & (sfs->sfs_vnhashsize - 1)];
+	for (; *svp != NULL; svp = &(*svp)->sv_hashnext) {
+		if (*svp == sv) {
+			*svp = sv->sv_hashnext;
+			sv->sv_hashnext = NULL;
+			sfs->sfs_nvnodes--;
+			return;
+		}
+	}
+	panic("sfs: %s: reclaim vnode %u not in vnode table\n",
+	      sfs->sfs_sb.sb_volname, sv->sv_ino);
+}
+
+////////////////////////////////////////////////////////////
+// Inodes
+
+/*
+ * Write an on-disk inode structure back out to disk. The vnode must
+ * be locked.
  */
 int
 sfs_sync_inode(struct sfs_vnode *sv)
@@ -49,6 +175,8 @@ sfs_sync_inode(struct sfs_vnode *sv)
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
 	int result;
 
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
 	if (sv->sv_dirty) {
 		result = sfs_writeblock(sfs, sv->sv_ino, &sv->sv_i,
 					sizeof(sv->sv_i));
@@ -70,122 +198,120 @@ sfs_reclaim(struct vnode *v)
 {
 	struct sfs_vnode *sv = v->vn_data;
 	struct sfs_fs *sfs = v->vn_fs->fs_data;
-	unsigned ix, i, num;
 	int result;
 
-	vfs_biglock_acquire();
+	sfs_jbegin(sfs);
+	lock_acquire(sv->sv_lock);
+	lock_acquire(sfs->sfs_vnlock);
 
 	/*
 	 * Make sure someone else hasn't picked up the vnode since the
-	 * decision was made to reclaim it. (You must also synchronize
-	 * this with sfs_loadvnode.)
+	 * decision was made to reclaim it. New references only come
+	 * from sfs_loadvnode, which holds sfs_vnlock, so once we see
+	 * a refcount of 1 here nobody else can get at it.
 	 */
-	spinlock_acquire(&v->vn_countlock);
-	if (v->vn_refcount != 1) {
-
-		/* consume the reference VOP_DECREF gave us */
-		KASSERT(v->vn_refcount>1);
-		v->vn_refcount--;
-
-		spinlock_release(&v->vn_countlock);
-		vfs_biglock_release();
+	if (vnode_stillbusy(v)) {
+		/* that consumed the reference VOP_DECREF gave us */
+		lock_release(sfs->sfs_vnlock);
+		lock_release(sv->sv_lock);
+		sfs_jend(sfs);
 		return EBUSY;
 	}
-	spinlock_release(&v->vn_countlock);
 
-	/* If there are no on-disk references to the file either, erase it. */
-	if (sv->sv_i.sfi_linkcount == 0) {
-		result = sfs_itrunc(sv, 0);
+	/*
+	 * Sync the inode (into the buffer cache) before it leaves the
+	 * table, so a reload finds the current version.
+	 */
+	if (sv->sv_i.sfi_linkcount > 0) {
+		result = sfs_sync_inode(sv);
 		if (result) {
-			vfs_biglock_release();
+			lock_release(sfs->sfs_vnlock);
+			lock_release(sv->sv_lock);
+			sfs_jend(sfs);
 			return result;
 		}
 	}
 
-	/* Sync the inode to disk */
-	result = sfs_sync_inode(sv);
-	if (result) {
-		vfs_biglock_release();
-		return result;
-	}
+	/* Remove the vnode structure from the table in the struct sfs_fs. */
+	sfs_vntable_remove(sfs, sv);
 
-	/* If there are no on-disk references, discard the inode */
-	if (sv->sv_i.sfi_linkcount==0) {
-		sfs_bfree(sfs, sv->sv_ino);
-	}
+	lock_release(sfs->sfs_vnlock);
 
-	/* Remove the vnode structure from the table in the struct sfs_fs. */
-	num = vnodearray_num(sfs->sfs_vnodes);
-	ix = num;
-	for (i=0; i<num; i++) {
-		struct vnode *v2 = vnodearray_get(sfs->sfs_vnodes, i);
-		struct sfs_vnode *sv2 = v2->vn_data;
-		if (sv2 == sv) {
-			ix = i;
-			break;
+	/*
+	 * If there are no on-disk references to the file either,
+	 * erase it and discard the inode. Nobody can find it any
+	 * more, so it can't fail halfway with someone looking.
+	 */
+	if (sv->sv_i.sfi_linkcount == 0) {
+		result = sfs_itrunc(sv, 0);
+		if (result) {
+			kprintf("sfs: %s: reclaim: inode %u: %s\n",
+				sfs->sfs_sb.sb_volname, sv->sv_ino,
+				strerror(result));
 		}
+		sfs_bfree(sfs, sv->sv_ino);
 	}
-	if (ix == num) {
-		panic("sfs: %s: reclaim vnode %u not in vnode pool\n",
-		      sfs->sfs_sb.sb_volname, sv->sv_ino);
-	}
-	vnodearray_remove(sfs->sfs_vnodes, ix);
 
-	vnode_cleanup(&sv->sv_absvn);
+	sfs_unreserve(sv);
+	sfs_dir_dropindex(sv);
 
-	vfs_biglock_release();
+	lock_release(sv->sv_lock);
+	sfs_jend(sfs);
+
+	vnode_cleanup(&sv->sv_absvn);
+	lock_destroy(sv->sv_lock);
 
 	/* Release the storage for the vnode structure itself. */
 	kfree(sv);
 
-	/* Done */
 	return 0;
 }
 
 /*
  * Function to load a inode into memory as a vnode, or dig up one
- * that's already resident.
+ * that's already resident. Takes sfs_vnlock; the caller may hold
+ * vnode locks.
  */
 int
 sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 		 struct sfs_vnode **ret)
 {
-	struct vnode *v;
 	struct sfs_vnode *sv;
 	const struct vnode_ops *ops;
-	unsigned i, num;
 	int result;
 
-	/* Look in the vnodes table */
-	num = vnodearray_num(sfs->sfs_vnodes);
-
-	/* Linear search. Is this too slow? You decide. */
-	for (i=0; i<num; i++) {
-		v = vnodearray_get(sfs->sfs_vnodes, i);
-		sv = v->vn_data;
+	lock_acquire(sfs->sfs_vnlock);
 
+	/* Look in the vnodes table */
+	sv = sfs_vntable_find(sfs, ino);
+	if (sv != NULL) {
 		/* Every inode in memory must be in an allocated block */
 		if (!sfs_bused(sfs, sv->sv_ino)) {
 			panic("sfs: %s: Found inode %u in unallocated block\n",
 			      sfs->sfs_sb.sb_volname, sv->sv_ino);
 		}
 
-		if (sv->sv_ino==ino) {
-			/* Found */
-
-			/* forcetype is only allowed when creating objects */
-			KASSERT(forcetype==SFS_TYPE_INVAL);
+		/* forcetype is only allowed when creating objects */
+		KASSERT(forcetype==SFS_TYPE_INVAL);
 
-			VOP_INCREF(&sv->sv_absvn);
-			*ret = sv;
-			return 0;
-		}
+		VOP_INCREF(&sv->sv_absvn);
+		lock_release(sfs->sfs_vnlock);
+		*ret = sv;
+		return 0;
 	}
 
 	/* Didn't have it loaded; load it */
 
 	sv = kmalloc(sizeof(struct sfs_vnode));
 	if (sv==NULL) {
+		lock_release(sfs->sfs_vnlock);
+		return ENOMEM;
+	}
+
+	sv->sv_lock = lock_create("sfs vnode");
+	if (sv->sv_lock == NULL) {
+		kfree(sv);
+		lock_release(sfs->sfs_vnlock);
 		return ENOMEM;
 	}
 
@@ -198,13 +324,23 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	/* Read the block the inode is in */
 	result = sfs_readblock(sfs, ino, &sv->sv_i, sizeof(sv->sv_i));
 	if (result) {
+		lock_destroy(sv->sv_lock);
 		kfree(sv);
+		lock_release(sfs->sfs_vnlock);
 		return result;
 	}
 
 	/* Not dirty yet */
 	sv->sv_dirty = false;
 
+	/* Directory index gets built on first lookup */
+	sv->sv_dirindex = NULL;
+	sv->sv_ranext = sv->sv_rawindow = sv->sv_raend = 0;
+	sv->sv_goal = 0;
+	sv->sv_resstart = 0;
+	sv->sv_rescount = 0;
+	sfs_ibcache_clear(sv);
+
 	/*
 	 * FORCETYPE is set if we're creating a new file, because the
 	 * block on disk will have been zeroed out by sfs_balloc and
@@ -235,7 +371,9 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	/* Call the common vnode initializer */
 	result = vnode_init(&sv->sv_absvn, ops, &sfs->sfs_absfs, sv);
 	if (result) {
+		lock_destroy(sv->sv_lock);
 		kfree(sv);
+		lock_release(sfs->sfs_vnlock);
 		return result;
 	}
 
@@ -243,12 +381,9 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	sv->sv_ino = ino;
 
 	/* Add it to our table */
-	result = vnodearray_add(sfs->sfs_vnodes, &sv->sv_absvn, NULL);
-	if (result) {
-		vnode_cleanup(&sv->sv_absvn);
-		kfree(sv);
-		return result;
-	}
+	sfs_vntable_insert(sfs, sv);
+
+	lock_release(sfs->sfs_vnlock);
 
 	/* Hand it back */
 	*ret = sv;
@@ -269,7 +404,7 @@ sfs_makeobj(struct sfs_fs *sfs, int type, struct sfs_vnode **ret)
 	 * number is the block number, so just get a block.)
 	 */
 
-	result = sfs_balloc(sfs, &ino);
+	result = sfs_balloc(sfs, 0, &ino);
 	if (result) {
 		return result;
 	}
@@ -296,25 +431,21 @@ sfs_getroot(struct fs *fs, struct vnode **ret)
 	struct sfs_vnode *sv;
 	int result;
 
-	vfs_biglock_acquire();
-
 	result = sfs_loadvnode(sfs, SFS_ROOTDIR_INO, SFS_TYPE_INVAL, &sv);
 	if (result) {
 		kprintf("sfs: %s: getroot: Cannot load root vnode\n",
 			sfs->sfs_sb.sb_volname);
-		vfs_biglock_release();
 		return result;
 	}
 
+	/* The type never changes once loaded, so no lock needed */
 	if (sv->sv_i.sfi_type != SFS_TYPE_DIR) {
 		kprintf("sfs: %s: getroot: not directory (type %u)\n",
 			sfs->sfs_sb.sb_volname, sv->sv_i.sfi_type);
-		vfs_biglock_release();
+		VOP_DECREF(&sv->sv_absvn);
 		return EINVAL;
 	}
 
-	vfs_biglock_release();
-
 	*ret = &sv->sv_absvn;
 	return 0;
 }
@@ -35,17 +35,33 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <synch.h>
 #include <uio.h>
 #include <vfs.h>
 #include <device.h>
+#include <buf.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
+/* Most blocks to transfer in one device request */
+#define SFS_MAXRUN 64
+
+/* Shorter write runs go through the cache, to be written back later */
+#define SFS_DIRECTWRITE 16
+
+/* Read-ahead window bounds, in blocks */
+#define SFS_RAMIN  4
+#define SFS_RAMAX  32
+
 ////////////////////////////////////////////////////////////
 //
 // Basic block-level I/O routines
 
 /*
+ * Blocks go through the buffer cache. sfs_readblock and
+ * sfs_writeblock copy a whole block in or out of its buffer; code
+ * that works on part of a block uses the buffer directly.
+ *
  * Note: sfs_readblock is used to read the superblock
  * early in mount, before sfs is fully (or even mostly)
  * initialized, and so may not use anything from sfs
@@ -53,67 +69,41 @@
  */
 
 /*
- * Read or write a block, retrying I/O errors.
+ * Read a block.
  */
-static
 int
-sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
+sfs_readblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
 {
+	struct buf *buf;
 	int result;
-	int tries=0;
 
-	KASSERT(vfs_biglock_do_i_hold());
-
-	DEBUG(DB_SFS, "sfs: %s %llu\n",
-	      uio->uio_rw == UIO_READ ? "read" : "write",
-	      uio->uio_offset / SFS_BLOCKSIZE);
+	KASSERT(len == SFS_BLOCKSIZE);
 
- retry:
-	result = DEVOP_IO(sfs->sfs_device, uio);
-	if (result == EINVAL) {
-		/*
-		 * This means the sector we requested was out of range,
-		 * or the seek address we gave wasn't sector-aligned,
-		 * or a couple of other things that are our fault.
-		 */
-		panic("sfs: %s: DEVOP_IO returned EINVAL\n",
-		      sfs->sfs_sb.sb_volname);
-	}
-	if (result == EIO) {
-		if (tries == 0) {
-			tries++;
-			kprintf("sfs: %s: block %llu I/O error, retrying\n",
-				sfs->sfs_sb.sb_volname,
-				uio->uio_offset / SFS_BLOCKSIZE);
-			goto retry;
-		}
-		else if (tries < 10) {
-			tries++;
-			goto retry;
-		}
-		else {
-			kprintf("sfs: %s: block %llu I/O error, giving up "
-				"after %d retries\n",
-				sfs->sfs_sb.sb_volname,
-				uio->uio_offset / SFS_BLOCKSIZE, tries);
-		}
+	result = buf_read(sfs->sfs_device, block, &buf);
+	if (result) {
+		return result;
 	}
-	return result;
+	memcpy(data, buf_map(buf), len);
+	buf_release(buf);
+	return 0;
 }
 
 /*
- * Read a block.
+ * Compare two blocks (the kernel has no memcmp).
  */
-int
-sfs_readblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
+static
+bool
+sfs_samedata(const void *a, const void *b, size_t len)
 {
-	struct iovec iov;
-	struct uio ku;
+	const uint32_t *wa = a, *wb = b;
+	size_t i;
 
-	KASSERT(len == SFS_BLOCKSIZE);
-
-	SFSUIO(&iov, &ku, data, block, UIO_READ);
-	return sfs_rwblock(sfs, &ku);
+	for (i=0; i<len/sizeof(uint32_t); i++) {
+		if (wa[i] != wb[i]) {
+			return false;
+		}
+	}
+	return true;
 }
 
 /*
@@ -122,13 +112,25 @@ sfs_readblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
 int
 sfs_writeblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
 {
-	struct iovec iov;
-	struct uio ku;
+	struct buf *buf;
+	int result;
 
 	KASSERT(len == SFS_BLOCKSIZE);
 
-	SFSUIO(&iov, &ku, data, block, UIO_WRITE);
-	return sfs_rwblock(sfs, &ku);
+	result = buf_get(sfs->sfs_device, block, &buf);
+	if (result) {
+		return result;
+	}
+	if (buf->b_valid && sfs_samedata(buf_map(buf), data, len)) {
+		/* Unchanged; don't make work for the journal */
+		buf_release(buf);
+		return 0;
+	}
+	memcpy(buf_map(buf), data, len);
+	/* Only metadata is written this way */
+	sfs_jdirty(sfs, buf);
+	buf_release(buf);
+	return 0;
 }
 
 ////////////////////////////////////////////////////////////
@@ -150,16 +152,8 @@ int
 sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	      uint32_t skipstart, uint32_t len)
 {
-	/*
-	 * I/O buffer for handling partial sectors.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static char iobuf[SFS_BLOCKSIZE];
-
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct buf *buf;
 	daddr_t diskblock;
 	uint32_t fileblock;
 	int result;
@@ -169,9 +163,6 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 
 	KASSERT(skipstart + len <= SFS_BLOCKSIZE);
 
-	/* We're using a global static buffer; it had better be locked */
-	KASSERT(vfs_biglock_do_i_hold());
-
 	/* Compute the block offset of this block in the file */
 	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
 
@@ -184,40 +175,32 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	if (diskblock == 0) {
 		/*
 		 * There was no block mapped at this point in the file.
-		 * Zero the buffer.
+		 * Read zeros.
 		 */
 		KASSERT(uio->uio_rw == UIO_READ);
-		bzero(iobuf, sizeof(iobuf));
-	}
-	else {
-		/*
-		 * Read the block.
-		 */
-		result = sfs_readblock(sfs, diskblock, iobuf, sizeof(iobuf));
-		if (result) {
-			return result;
-		}
+		return uiomovezeros(len, uio);
 	}
 
 	/*
-	 * Now perform the requested operation into/out of the buffer.
+	 * Get the block from the buffer cache.
 	 */
-	result = uiomove(iobuf+skipstart, len, uio);
+	result = buf_read(sfs->sfs_device, diskblock, &buf);
 	if (result) {
 		return result;
 	}
 
 	/*
-	 * If it was a write, write back the modified block.
+	 * Now perform the requested operation into/out of the buffer.
+	 * If it was a write, the buffer is now dirty, even if we only
+	 * got partway.
 	 */
+	result = uiomove((char *)buf_map(buf) + skipstart, len, uio);
 	if (uio->uio_rw == UIO_WRITE) {
-		result = sfs_writeblock(sfs, diskblock, iobuf, sizeof(iobuf));
-		if (result) {
-			return result;
-		}
+		buf_markdirty(buf);
 	}
+	buf_release(buf);
 
-	return 0;
+	return result;
 }
 
 /*
@@ -228,14 +211,11 @@ int
 sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 {
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct buf *buf;
 	daddr_t diskblock;
 	uint32_t fileblock;
 	int result;
 	bool doalloc = (uio->uio_rw==UIO_WRITE);
-	off_t saveoff;
-	off_t diskoff;
-	off_t saveres;
-	off_t diskres;
 
 	/* Get the block number within the file */
 	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
@@ -257,6 +237,101 @@ sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 		return uiomovezeros(SFS_BLOCKSIZE, uio);
 	}
 
+	KASSERT(uio->uio_resid >= SFS_BLOCKSIZE);
+
+	if (uio->uio_rw == UIO_READ) {
+		result = buf_read(sfs->sfs_device, diskblock, &buf);
+		if (result) {
+			return result;
+		}
+		result = uiomove(buf_map(buf), SFS_BLOCKSIZE, uio);
+		buf_release(buf);
+		return result;
+	}
+
+	/*
+	 * We're overwriting the whole block, so don't bother reading
+	 * it. If the copy fails partway, the buffer is only good if
+	 * it already held the block.
+	 */
+	result = buf_get(sfs->sfs_device, diskblock, &buf);
+	if (result) {
+		return result;
+	}
+	result = uiomove(buf_map(buf), SFS_BLOCKSIZE, uio);
+	if (result == 0 || buf->b_valid) {
+		buf_markdirty(buf);
+	}
+	buf_release(buf);
+
+	return result;
+}
+
+/*
+ * Do I/O of a run of whole blocks, up to MAXBLOCKS of them, and
+ * report how many were done in NDONE. Blocks that are contiguous on
+ * disk are transferred in a single device request straight to or
+ * from the uio; a lone block goes through the buffer cache.
+ */
+static
+int
+sfs_runio(struct sfs_vnode *sv, struct uio *uio, uint32_t maxblocks,
+	  uint32_t *ndone)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	daddr_t diskblock, nextblock;
+	uint32_t fileblock, run;
+	bool doalloc = (uio->uio_rw==UIO_WRITE);
+	off_t saveoff;
+	off_t diskoff;
+	off_t saveres;
+	off_t diskres;
+	int result;
+
+	KASSERT(maxblocks > 0);
+	KASSERT(uio->uio_resid >= maxblocks * SFS_BLOCKSIZE);
+
+	if (maxblocks > SFS_MAXRUN) {
+		maxblocks = SFS_MAXRUN;
+	}
+
+	/* Find out how far the run goes */
+	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
+	result = sfs_bmap(sv, fileblock, doalloc, &diskblock);
+	if (result) {
+		return result;
+	}
+	if (!doalloc && diskblock != 0 &&
+	    buf_cached(sfs->sfs_device, diskblock)) {
+		/* Already read ahead; take it from the cache */
+		maxblocks = 1;
+	}
+	for (run = 1; run < maxblocks && diskblock != 0; run++) {
+		/*
+		 * When writing this allocates the next block even if
+		 * it isn't contiguous. The next run writes it; if the
+		 * write fails first, sfs_io trims it off again. If the
+		 * lookahead fails (e.g. the disk is full), do the run
+		 * found so far; the error comes back on the next call.
+		 */
+		result = sfs_bmap(sv, fileblock + run, doalloc, &nextblock);
+		if (result) {
+			break;
+		}
+		if (nextblock != diskblock + run) {
+			break;
+		}
+		if (!doalloc && buf_cached(sfs->sfs_device, nextblock)) {
+			/* Leave it for the cache */
+			break;
+		}
+	}
+
+	if (run == 1 || (doalloc && run < SFS_DIRECTWRITE)) {
+		*ndone = 1;
+		return sfs_blockio(sv, uio);
+	}
+
 	/*
 	 * Do the I/O directly to the uio region. Save the uio_offset,
 	 * and substitute one that makes sense to the device.
@@ -266,14 +341,13 @@ sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 	uio->uio_offset = diskoff;
 
 	/*
-	 * Temporarily set the residue to be one block size.
+	 * Temporarily set the residue to be the length of the run.
 	 */
-	KASSERT(uio->uio_resid >= SFS_BLOCKSIZE);
 	saveres = uio->uio_resid;
-	diskres = SFS_BLOCKSIZE;
+	diskres = run * SFS_BLOCKSIZE;
 	uio->uio_resid = diskres;
 
-	result = sfs_rwblock(sfs, uio);
+	result = buf_directio(sfs->sfs_device, diskblock, run, uio);
 
 	/*
 	 * Now, restore the original uio_offset and uio_resid and update
@@ -282,6 +356,7 @@ sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 	uio->uio_offset = (uio->uio_offset - diskoff) + saveoff;
 	uio->uio_resid = (uio->uio_resid - diskres) + saveres;
 
+	*ndone = run;
 	return result;
 }
 
@@ -292,10 +367,12 @@ int
 sfs_io(struct sfs_vnode *sv, struct uio *uio)
 {
 	uint32_t blkoff;
-	uint32_t nblocks, i;
+	uint32_t nblocks, done;
 	int result = 0;
 	uint32_t origresid, extraresid = 0;
 
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
 	origresid = uio->uio_resid;
 
 	/*
@@ -352,11 +429,12 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 	 */
 	KASSERT(uio->uio_offset % SFS_BLOCKSIZE == 0);
 	nblocks = uio->uio_resid / SFS_BLOCKSIZE;
-	for (i=0; i<nblocks; i++) {
-		result = sfs_blockio(sv, uio);
+	while (nblocks > 0) {
+		result = sfs_runio(sv, uio, nblocks, &done);
 		if (result) {
 			goto out;
 		}
+		nblocks -= done;
 	}
 
 	/*
@@ -381,6 +459,15 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 		sv->sv_dirty = true;
 	}
 
+	/*
+	 * If a write failed, free whatever it allocated past EOF
+	 * without writing (blocks sfs_runio looked ahead to, or a
+	 * block whose copy faulted) so they don't leak.
+	 */
+	if (result && uio->uio_rw == UIO_WRITE) {
+		(void)sfs_itrunc(sv, sv->sv_i.sfi_size);
+	}
+
 	/* Add in any extra amount we couldn't read because of EOF */
 	uio->uio_resid += extraresid;
 
@@ -388,6 +475,78 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 	return result;
 }
 
+/*
+ * Read-ahead. Called after reading the byte range [START, END) of a
+ * file. If the read picked up where the last one left off, open up
+ * the read-ahead window (doubling it each time, up to SFS_RAMAX) and
+ * ask the buffer cache to prefetch the blocks in it that haven't been
+ * asked for yet; otherwise close the window. Holes and blocks past
+ * EOF are skipped, and nothing is allocated.
+ */
+void
+sfs_readahead(struct sfs_vnode *sv, off_t start, off_t end)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	uint32_t first, last, eof, stop, fileblock;
+	daddr_t diskblock, runstart;
+	unsigned runlen;
+
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
+	if (end <= start) {
+		/* Nothing read (EOF) */
+		return;
+	}
+
+	first = start / SFS_BLOCKSIZE;
+	last = (end - 1) / SFS_BLOCKSIZE;
+
+	if (first == sv->sv_ranext || first + 1 == sv->sv_ranext) {
+		/* Sequential (possibly rereading a partial block) */
+		if (sv->sv_rawindow == 0) {
+			sv->sv_rawindow = SFS_RAMIN;
+		}
+		else if (sv->sv_rawindow < SFS_RAMAX) {
+			sv->sv_rawindow *= 2;
+		}
+	}
+	else {
+		sv->sv_rawindow = 0;
+		sv->sv_raend = 0;
+	}
+	sv->sv_ranext = last + 1;
+
+	if (sv->sv_rawindow == 0) {
+		return;
+	}
+
+	fileblock = sv->sv_raend > last + 1 ? sv->sv_raend : last + 1;
+	stop = last + 1 + sv->sv_rawindow;
+	eof = SFS_ROUNDUP(sv->sv_i.sfi_size, SFS_BLOCKSIZE) / SFS_BLOCKSIZE;
+	if (stop > eof) {
+		stop = eof;
+	}
+
+	/* Hand over runs of contiguous disk blocks */
+	runstart = 0;
+	runlen = 0;
+	for (; fileblock < stop; fileblock++) {
+		if (sfs_bmap(sv, fileblock, false, &diskblock)) {
+			break;
+		}
+		if (runlen > 0 && diskblock == runstart + runlen) {
+			runlen++;
+			continue;
+		}
+		buf_prefetch(sfs->sfs_device, runstart, runlen);
+		runstart = diskblock;
+		runlen = diskblock != 0 ? 1 : 0;
+	}
+	buf_prefetch(sfs->sfs_device, runstart, runlen);
+
+	sv->sv_raend = fileblock;
+}
+
 ////////////////////////////////////////////////////////////
 // Metadata I/O
 
@@ -407,6 +566,8 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 	   enum uio_rw rw)
 {
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct buf *buf;
+	char *ioptr;
 	off_t endpos;
 	uint32_t vnblock;
 	uint32_t blockoffset;
@@ -414,17 +575,7 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 	bool doalloc;
 	int result;
 
-	/*
-	 * I/O buffer for metadata ops.
-	 *
-	 * Note: in real life (and when you've done the fs assignment) you
-	 * would get space from the disk buffer cache for this, not use a
-	 * static area.
-	 */
-	static char metaiobuf[SFS_BLOCKSIZE];
-
-	/* We're using a global static buffer; it had better be locked */
-	KASSERT(vfs_biglock_do_i_hold());
+	KASSERT(lock_do_i_hold(sv->sv_lock));
 
 	/* Figure out which block of the vnode (directory, whatever) this is */
 	vnblock = actualpos / SFS_BLOCKSIZE;
@@ -446,26 +597,23 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 		return 0;
 	}
 
-	/* Read the block */
-	result = sfs_readblock(sfs, diskblock, metaiobuf, sizeof(metaiobuf));
+	/* Get the block */
+	result = buf_read(sfs->sfs_device, diskblock, &buf);
 	if (result) {
 		return result;
 	}
+	ioptr = buf_map(buf);
 
 	if (rw == UIO_READ) {
 		/* Copy out the selected region */
-		memcpy(data, metaiobuf + blockoffset, len);
+		memcpy(data, ioptr + blockoffset, len);
+		buf_release(buf);
 	}
 	else {
 		/* Update the selected region */
-		memcpy(metaiobuf + blockoffset, data, len);
-
-		/* Write the block back */
-		result = sfs_writeblock(sfs, diskblock,
-					metaiobuf, sizeof(metaiobuf));
-		if (result) {
-			return result;
-		}
+		memcpy(ioptr + blockoffset, data, len);
+		sfs_jdirty(sfs, buf);
+		buf_release(buf);
 
 		/* Update the vnode size if needed */
 		endpos = actualpos + len;
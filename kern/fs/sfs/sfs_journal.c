@@ -0,0 +1,630 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * SFS filesystem
+ *
+ * Metadata journal.
+ *
+ * Operations that change metadata (inodes, directories, indirect
+ * blocks, the freemap, the superblock) run between sfs_jbegin and
+ * sfs_jend, and leave their changes in pinned buffers (sfs_jdirty)
+ * that the buffer cache won't write back. A commit waits for all
+ * operations to finish and keeps new ones out, so the pinned buffers
+ * then hold whole operations only. It writes the data blocks
+ * allocated since the last commit, logs the pinned blocks to the
+ * journal followed by a commit block, writes them to their home
+ * locations, and finally advances the journal header so the
+ * transaction won't be replayed. If the system goes down after the
+ * commit block is written but before the header is, mount replays
+ * the transaction; otherwise none of it reached its home locations.
+ *
+ * Blocks freed by an operation stay marked in use until the commit,
+ * so they can't be reallocated and overwritten while the disk still
+ * says they belong to their old owner. The journal only ever holds
+ * one transaction, so there's no need to track freed blocks beyond
+ * that: nothing older than the current transaction is ever replayed.
+ *
+ * Everything pinned has to fit in the journal (and the buffer cache)
+ * at commit time, so no operation may pin more than SFS_JOPMAX blocks,
+ * and sfs_jbegin doesn't start one unless that much room is left for
+ * it and every other running operation; otherwise it commits first.
+ *
+ * Commits happen on sync (including the syncer's periodic one), on
+ * fsync, when an operation ends with sfs_jlimit blocks pinned, and
+ * when sfs_jbegin finds the journal too full.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <synch.h>
+#include <bitmap.h>
+#include <uio.h>
+#include <vfs.h>
+#include <buf.h>
+#include <sfs.h>
+#include "sfsprivate.h"
+
+/* Most newly allocated blocks remembered between commits */
+#define SFS_JNEWMAX      256
+
+/*
+ * Read or write one journal block, bypassing the buffer cache.
+ */
+static
+int
+sfs_jio(struct sfs_fs *sfs, daddr_t block, void *data, enum uio_rw rw)
+{
+	struct iovec iov;
+	struct uio ku;
+
+	SFSUIO(&iov, &ku, data, block, rw);
+	return buf_directio(sfs->sfs_device, block, 1, &ku);
+}
+
+/*
+ * Write the journal header with sequence number SEQ.
+ */
+static
+int
+sfs_jwriteheader(struct sfs_fs *sfs, struct sfs_jblock *jb, uint32_t seq)
+{
+	bzero(jb, sizeof(*jb));
+	jb->jb_magic = SFS_JOURNAL_MAGIC;
+	jb->jb_type = SFS_JB_HEADER;
+	jb->jb_seq = seq;
+	return sfs_jio(sfs, sfs->sfs_sb.sb_journalstart, jb, UIO_WRITE);
+}
+
+/*
+ * Check that a journal block is what we expect.
+ */
+static
+bool
+sfs_jcheck(const struct sfs_jblock *jb, uint32_t type, uint32_t seq)
+{
+	return jb->jb_magic == SFS_JOURNAL_MAGIC && jb->jb_type == type &&
+		jb->jb_seq == seq;
+}
+
+////////////////////////////////////////////////////////////
+// Mount-time recovery
+
+/*
+ * Find the transaction with sequence number SEQ, if it was committed,
+ * and write its blocks home. JB is scratch space.
+ */
+static
+int
+sfs_jreplay(struct sfs_fs *sfs, struct sfs_jblock *jb, uint32_t seq)
+{
+	daddr_t start = sfs->sfs_sb.sb_journalstart;
+	daddr_t end = start + sfs->sfs_sb.sb_journalblocks;
+	daddr_t *homes, pos;
+	struct buf *buf;
+	unsigned n, i;
+	void *data;
+	int result;
+
+	homes = kmalloc(sfs->sfs_sb.sb_journalblocks * sizeof(daddr_t));
+	data = kmalloc(SFS_BLOCKSIZE);
+	if (homes == NULL || data == NULL) {
+		kfree(homes);
+		kfree(data);
+		return ENOMEM;
+	}
+
+	/* Collect the home locations, looking for the commit block */
+	n = 0;
+	pos = start + 1;
+	while (1) {
+		if (pos >= end) {
+			goto none;
+		}
+		result = sfs_jio(sfs, pos, jb, UIO_READ);
+		if (result) {
+			goto out;
+		}
+		if (sfs_jcheck(jb, SFS_JB_COMMIT, seq) && jb->jb_nblocks == n) {
+			break;
+		}
+		if (!sfs_jcheck(jb, SFS_JB_DESC, seq) ||
+		    jb->jb_nblocks > SFS_JB_MAXBLOCKS ||
+		    pos + 1 + jb->jb_nblocks >= end) {
+			goto none;
+		}
+		for (i=0; i<jb->jb_nblocks; i++) {
+			if (jb->jb_blocks[i] >= sfs->sfs_sb.sb_nblocks) {
+				goto none;
+			}
+			homes[n++] = jb->jb_blocks[i];
+		}
+		pos += 1 + jb->jb_nblocks;
+	}
+
+	/* It was committed; write it home, descriptors and all */
+	kprintf("sfs: %s: replaying %u blocks from journal\n",
+		sfs->sfs_sb.sb_volname, n);
+	n = 0;
+	pos = start + 1;
+	while (1) {
+		result = sfs_jio(sfs, pos++, jb, UIO_READ);
+		if (result) {
+			goto out;
+		}
+		if (jb->jb_type == SFS_JB_COMMIT) {
+			break;
+		}
+		for (i=0; i<jb->jb_nblocks; i++) {
+			result = sfs_jio(sfs, pos++, data, UIO_READ);
+			if (result) {
+				goto out;
+			}
+			result = buf_get(sfs->sfs_device, homes[n++], &buf);
+			if (result) {
+				goto out;
+			}
+			memcpy(buf_map(buf), data, SFS_BLOCKSIZE);
+			buf_markdirty(buf);
+			buf_release(buf);
+		}
+	}
+	result = buf_sync(sfs->sfs_device);
+	goto out;
+
+ none:
+	result = 0;
+ out:
+	kfree(homes);
+	kfree(data);
+	return result;
+}
+
+/*
+ * Set up the journal at mount time, after the superblock has been
+ * loaded and before anything else is read. Replays a committed
+ * transaction left over from a crash, which may change the
+ * superblock; the caller must check it again afterwards.
+ */
+int
+sfs_jmount(struct sfs_fs *sfs)
+{
+	struct sfs_jblock *jb;
+	daddr_t start = sfs->sfs_sb.sb_journalstart;
+	uint32_t nblocks = sfs->sfs_sb.sb_journalblocks;
+	uint32_t seq;
+	int result;
+
+	if (start == 0) {
+		/* Unjournaled volume */
+		sfs->sfs_journaled = false;
+		return 0;
+	}
+
+	if (start < SFS_FREEMAP_START + SFS_FS_FREEMAPBLOCKS(sfs) ||
+	    nblocks < SFS_JOURNAL_MINBLOCKS || nblocks > sfs->sfs_sb.sb_nblocks ||
+	    start > sfs->sfs_sb.sb_nblocks - nblocks) {
+		kprintf("sfs: %s: Invalid journal location %u+%u\n",
+			sfs->sfs_sb.sb_volname, start, nblocks);
+		return EINVAL;
+	}
+
+	jb = kmalloc(sizeof(*jb));
+	if (jb == NULL) {
+		return ENOMEM;
+	}
+
+	result = sfs_jio(sfs, start, jb, UIO_READ);
+	if (result) {
+		kfree(jb);
+		return result;
+	}
+	if (jb->jb_magic != SFS_JOURNAL_MAGIC || jb->jb_type != SFS_JB_HEADER) {
+		kprintf("sfs: %s: Bad journal header; run sfsck\n",
+			sfs->sfs_sb.sb_volname);
+		kfree(jb);
+		return EINVAL;
+	}
+	seq = jb->jb_seq;
+
+	result = sfs_jreplay(sfs, jb, seq);
+	if (result) {
+		kfree(jb);
+		return result;
+	}
+
+	/*
+	 * Move on to the next sequence number whether or not we
+	 * replayed anything, so leftovers of an incomplete
+	 * transaction can never be taken for part of a later one.
+	 */
+	seq++;
+	result = sfs_jwriteheader(sfs, jb, seq);
+	kfree(jb);
+	if (result) {
+		return result;
+	}
+
+	sfs->sfs_jlog = kmalloc(nblocks * sizeof(daddr_t));
+	sfs->sfs_jnew = kmalloc(SFS_JNEWMAX * sizeof(daddr_t));
+	sfs->sfs_jfreed = bitmap_create(SFS_FS_FREEMAPBITS(sfs));
+	if (sfs->sfs_jlog == NULL || sfs->sfs_jnew == NULL ||
+	    sfs->sfs_jfreed == NULL) {
+		return ENOMEM;
+	}
+
+	/* Header and commit block, and a descriptor per SFS_JB_MAXBLOCKS */
+	sfs->sfs_jmaxlog = (nblocks - 2) * SFS_JB_MAXBLOCKS /
+		(SFS_JB_MAXBLOCKS + 1);
+
+	/*
+	 * A commit adds the freemap and superblock to what operations
+	 * pinned; and leave half the buffer cache for everything else.
+	 */
+	if (sfs->sfs_jmaxlog < SFS_FS_FREEMAPBLOCKS(sfs) + 1 + 2 * SFS_JOPMAX) {
+		kprintf("sfs: %s: Journal too small\n",
+			sfs->sfs_sb.sb_volname);
+		return EINVAL;
+	}
+	sfs->sfs_jcap = sfs->sfs_jmaxlog - SFS_FS_FREEMAPBLOCKS(sfs) - 1;
+	if (sfs->sfs_jcap > BUF_NBUFS / 2) {
+		sfs->sfs_jcap = BUF_NBUFS / 2;
+	}
+	sfs->sfs_jlimit = sfs->sfs_jcap / 2;
+
+	sfs->sfs_jseq = seq;
+	sfs->sfs_jnnew = 0;
+	sfs->sfs_jnewlost = false;
+	sfs->sfs_jnfreed = 0;
+	sfs->sfs_journaled = true;
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// Operations
+
+/*
+ * Start an operation. Callers mustn't be in one already, or hold
+ * locks an operation might wait for, since this may commit.
+ */
+void
+sfs_jbegin(struct sfs_fs *sfs)
+{
+	unsigned pinned;
+
+	if (!sfs->sfs_journaled) {
+		return;
+	}
+
+	lock_acquire(sfs->sfs_jlock);
+	while (1) {
+		while (sfs->sfs_jwaiting || sfs->sfs_jcommitting) {
+			cv_wait(sfs->sfs_jcv, sfs->sfs_jlock);
+		}
+		/* Room for us and everyone running to pin SFS_JOPMAX? */
+		pinned = buf_pinlist(sfs->sfs_device, NULL, 0);
+		if (pinned + (sfs->sfs_jactive + 1) * SFS_JOPMAX <=
+		    sfs->sfs_jcap) {
+			break;
+		}
+		lock_release(sfs->sfs_jlock);
+		sfs_jcommit(sfs);
+		lock_acquire(sfs->sfs_jlock);
+	}
+	sfs->sfs_jactive++;
+	lock_release(sfs->sfs_jlock);
+}
+
+void
+sfs_jend(struct sfs_fs *sfs)
+{
+	bool commit;
+
+	if (!sfs->sfs_journaled) {
+		return;
+	}
+
+	lock_acquire(sfs->sfs_jlock);
+	KASSERT(sfs->sfs_jactive > 0);
+	sfs->sfs_jactive--;
+	if (sfs->sfs_jactive == 0) {
+		cv_broadcast(sfs->sfs_jcv, sfs->sfs_jlock);
+	}
+	commit = !sfs->sfs_jwaiting && !sfs->sfs_jcommitting;
+	lock_release(sfs->sfs_jlock);
+
+	/* Commit before the transaction gets big */
+	if (commit && buf_pinlist(sfs->sfs_device, NULL, 0) >=
+	    sfs->sfs_jlimit) {
+		sfs_jcommit(sfs);
+	}
+}
+
+/*
+ * Mark a buffer holding metadata dirty. On a journaled volume the
+ * change becomes part of the current transaction.
+ */
+void
+sfs_jdirty(struct sfs_fs *sfs, struct buf *buf)
+{
+	if (sfs->sfs_journaled) {
+		buf_pin(buf);
+	}
+	else {
+		buf_markdirty(buf);
+	}
+}
+
+/*
+ * Note a newly allocated block, so a commit can write its contents
+ * before logging metadata that points to it. Called with the freemap
+ * locked.
+ */
+void
+sfs_jnewblock(struct sfs_fs *sfs, daddr_t block)
+{
+	KASSERT(lock_do_i_hold(sfs->sfs_freemaplock));
+
+	if (!sfs->sfs_journaled) {
+		return;
+	}
+	if (sfs->sfs_jnnew < SFS_JNEWMAX) {
+		sfs->sfs_jnew[sfs->sfs_jnnew++] = block;
+	}
+	else {
+		sfs->sfs_jnewlost = true;
+	}
+}
+
+////////////////////////////////////////////////////////////
+// Commit
+
+/*
+ * Release the blocks freed since the last commit, so the freemap
+ * we're about to log shows them free. No operations are running.
+ */
+static
+void
+sfs_jfreeblocks(struct sfs_fs *sfs)
+{
+	uint32_t i;
+
+	lock_acquire(sfs->sfs_freemaplock);
+	for (i=0; sfs->sfs_jnfreed > 0 && i < SFS_FS_FREEMAPBITS(sfs); i++) {
+		if (bitmap_isset(sfs->sfs_jfreed, i)) {
+			bitmap_unmark(sfs->sfs_jfreed, i);
+			bitmap_unmark(sfs->sfs_freemap, i);
+			sfs->sfs_jnfreed--;
+			sfs->sfs_freemapdirty = true;
+		}
+	}
+	lock_release(sfs->sfs_freemaplock);
+}
+
+/*
+ * Write the new data blocks, so no logged metadata can point at
+ * stale contents. No operations are running.
+ */
+static
+int
+sfs_jflushnew(struct sfs_fs *sfs)
+{
+	unsigned i;
+	int result = 0;
+
+	lock_acquire(sfs->sfs_freemaplock);
+	if (sfs->sfs_jnewlost) {
+		result = buf_sync(sfs->sfs_device);
+	}
+	else {
+		for (i=0; i<sfs->sfs_jnnew && result == 0; i++) {
+			result = buf_flush(sfs->sfs_device, sfs->sfs_jnew[i]);
+		}
+	}
+	if (result == 0) {
+		sfs->sfs_jnnew = 0;
+		sfs->sfs_jnewlost = false;
+	}
+	lock_release(sfs->sfs_freemaplock);
+	return result;
+}
+
+/*
+ * Log the N blocks in sfs_jlog, then write the commit block.
+ */
+static
+int
+sfs_jlogblocks(struct sfs_fs *sfs, struct sfs_jblock *jb, unsigned n)
+{
+	daddr_t pos = sfs->sfs_sb.sb_journalstart + 1;
+	struct buf *buf;
+	unsigned i, j, chunk;
+	int result;
+
+	for (i=0; i<n; i+=chunk) {
+		chunk = n - i;
+		if (chunk > SFS_JB_MAXBLOCKS) {
+			chunk = SFS_JB_MAXBLOCKS;
+		}
+
+		bzero(jb, sizeof(*jb));
+		jb->jb_magic = SFS_JOURNAL_MAGIC;
+		jb->jb_type = SFS_JB_DESC;
+		jb->jb_seq = sfs->sfs_jseq;
+		jb->jb_nblocks = chunk;
+		for (j=0; j<chunk; j++) {
+			jb->jb_blocks[j] = sfs->sfs_jlog[i+j];
+		}
+		result = sfs_jio(sfs, pos++, jb, UIO_WRITE);
+		if (result) {
+			return result;
+		}
+
+		for (j=0; j<chunk; j++) {
+			/* Pinned, so it's in the cache */
+			result = buf_read(sfs->sfs_device, sfs->sfs_jlog[i+j],
+					  &buf);
+			if (result) {
+				return result;
+			}
+			result = sfs_jio(sfs, pos++, buf_map(buf), UIO_WRITE);
+			buf_release(buf);
+			if (result) {
+				return result;
+			}
+		}
+	}
+
+	bzero(jb, sizeof(*jb));
+	jb->jb_magic = SFS_JOURNAL_MAGIC;
+	jb->jb_type = SFS_JB_COMMIT;
+	jb->jb_seq = sfs->sfs_jseq;
+	jb->jb_nblocks = n;
+	return sfs_jio(sfs, pos, jb, UIO_WRITE);
+}
+
+/*
+ * Do the work of a commit. No operations are running.
+ */
+static
+int
+sfs_jdocommit(struct sfs_fs *sfs)
+{
+	struct sfs_jblock *jb;
+	unsigned n, i;
+	int result;
+
+	/* Get the rest of the metadata into pinned buffers */
+	sfs_jfreeblocks(sfs);
+	result = sfs_sync_freemap(sfs);
+	if (result) {
+		return result;
+	}
+	result = sfs_sync_superblock(sfs);
+	if (result) {
+		return result;
+	}
+
+	result = sfs_jflushnew(sfs);
+	if (result) {
+		return result;
+	}
+
+	n = buf_pinlist(sfs->sfs_device, sfs->sfs_jlog,
+			sfs->sfs_sb.sb_journalblocks);
+	if (n == 0) {
+		return 0;
+	}
+
+	jb = kmalloc(sizeof(*jb));
+	if (jb == NULL) {
+		return ENOMEM;
+	}
+
+	/* sfs_jbegin keeps this from happening */
+	if (n > sfs->sfs_jmaxlog) {
+		panic("sfs: %s: %u pinned blocks won't fit in the journal\n",
+		      sfs->sfs_sb.sb_volname, n);
+	}
+
+	result = sfs_jlogblocks(sfs, jb, n);
+	if (result) {
+		kfree(jb);
+		return result;
+	}
+
+	/* Now they can go home */
+	for (i=0; i<n; i++) {
+		buf_unpin(sfs->sfs_device, sfs->sfs_jlog[i]);
+		result = buf_flush(sfs->sfs_device, sfs->sfs_jlog[i]);
+		if (result) {
+			kfree(jb);
+			return result;
+		}
+	}
+
+	/* and the transaction is done with */
+	result = sfs_jwriteheader(sfs, jb, sfs->sfs_jseq + 1);
+	if (result) {
+		kfree(jb);
+		return result;
+	}
+	sfs->sfs_jseq++;
+
+	kfree(jb);
+	return 0;
+}
+
+/*
+ * Commit the current transaction. On an unjournaled volume, just
+ * write the freemap and superblock into the buffer cache.
+ */
+int
+sfs_jcommit(struct sfs_fs *sfs)
+{
+	int result;
+
+	if (!sfs->sfs_journaled) {
+		result = sfs_sync_freemap(sfs);
+		if (result) {
+			return result;
+		}
+		return sfs_sync_superblock(sfs);
+	}
+
+	lock_acquire(sfs->sfs_jlock);
+	if (sfs->sfs_jwaiting || sfs->sfs_jcommitting) {
+		/* Someone else is; that covers everything we've done */
+		while (sfs->sfs_jwaiting || sfs->sfs_jcommitting) {
+			cv_wait(sfs->sfs_jcv, sfs->sfs_jlock);
+		}
+		lock_release(sfs->sfs_jlock);
+		return 0;
+	}
+	sfs->sfs_jwaiting = true;
+	while (sfs->sfs_jactive > 0) {
+		cv_wait(sfs->sfs_jcv, sfs->sfs_jlock);
+	}
+	sfs->sfs_jwaiting = false;
+	sfs->sfs_jcommitting = true;
+	lock_release(sfs->sfs_jlock);
+
+	result = sfs_jdocommit(sfs);
+	if (result) {
+		kprintf("sfs: %s: journal commit: %s\n",
+			sfs->sfs_sb.sb_volname, strerror(result));
+	}
+
+	lock_acquire(sfs->sfs_jlock);
+	sfs->sfs_jcommitting = false;
+	cv_broadcast(sfs->sfs_jcv, sfs->sfs_jlock);
+	lock_release(sfs->sfs_jlock);
+
+	return result;
+}
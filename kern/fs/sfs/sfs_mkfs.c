@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * In-kernel mksfs: make an empty SFS volume on a device, laid out the
+ * same way as userland mksfs does.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <uio.h>
+#include <vfs.h>
+#include <device.h>
+#include <sfs.h>
+
+/* Journal size: 1/MKFS_JOURNALFRAC of the volume, within these limits */
+#define MKFS_JOURNALFRAC       32
+#define MKFS_MINJOURNALBLOCKS  32
+#define MKFS_MAXJOURNALBLOCKS  512
+
+/*
+ * Write one block straight to the device.
+ */
+static
+int
+mkfs_writeblock(struct device *dev, daddr_t block, void *data)
+{
+	struct iovec iov;
+	struct uio ku;
+
+	uio_kinit(&iov, &ku, data, SFS_BLOCKSIZE,
+		  (off_t)block * SFS_BLOCKSIZE, UIO_WRITE);
+	return DEVOP_IO(dev, &ku);
+}
+
+/*
+ * Mark a block allocated in the freemap being built.
+ */
+static
+void
+mkfs_allocblock(unsigned char *freemap, uint32_t block)
+{
+	unsigned char mask = 1 << (block % CHAR_BIT);
+
+	KASSERT((freemap[block / CHAR_BIT] & mask) == 0);
+	freemap[block / CHAR_BIT] |= mask;
+}
+
+/*
+ * Format function for vfs_format.
+ */
+static
+int
+sfs_doformat(void *data, struct device *dev)
+{
+	const char *volname = data;
+	struct sfs_superblock *sb;
+	struct sfs_dinode *sfi;
+	struct sfs_jblock *jb;
+	unsigned char *freemap;
+	void *block;
+	uint32_t nblocks, mapblocks, jstart, jblocks, i;
+	int result;
+
+	if (dev->d_blocksize != SFS_BLOCKSIZE) {
+		return ENXIO;
+	}
+	nblocks = dev->d_blocks;
+	mapblocks = SFS_FREEMAPBLOCKS(nblocks);
+
+	/* The journal goes right after the freemap, if there's room */
+	jstart = SFS_FREEMAP_START + mapblocks;
+	jblocks = nblocks / MKFS_JOURNALFRAC;
+	if (jblocks < MKFS_MINJOURNALBLOCKS) {
+		jstart = jblocks = 0;
+	}
+	else if (jblocks > MKFS_MAXJOURNALBLOCKS) {
+		jblocks = MKFS_MAXJOURNALBLOCKS;
+	}
+	if (SFS_FREEMAP_START + mapblocks + jblocks >= nblocks) {
+		return ENOSPC;
+	}
+
+	freemap = kmalloc(mapblocks * SFS_BLOCKSIZE);
+	if (freemap == NULL) {
+		return ENOMEM;
+	}
+	block = kmalloc(SFS_BLOCKSIZE);
+	if (block == NULL) {
+		kfree(freemap);
+		return ENOMEM;
+	}
+
+	/* Superblock, root inode, freemap, journal, and past the end */
+	bzero(freemap, mapblocks * SFS_BLOCKSIZE);
+	mkfs_allocblock(freemap, SFS_SUPER_BLOCK);
+	mkfs_allocblock(freemap, SFS_ROOTDIR_INO);
+	for (i = 0; i < mapblocks; i++) {
+		mkfs_allocblock(freemap, SFS_FREEMAP_START + i);
+	}
+	for (i = 0; i < jblocks; i++) {
+		mkfs_allocblock(freemap, jstart + i);
+	}
+	for (i = nblocks; i < SFS_FREEMAPBITS(nblocks); i++) {
+		mkfs_allocblock(freemap, i);
+	}
+
+	/* Empty journal: zeros, then the header for transaction 1 */
+	jb = block;
+	bzero(jb, SFS_BLOCKSIZE);
+	result = 0;
+	for (i = 1; i < jblocks && result == 0; i++) {
+		result = mkfs_writeblock(dev, jstart + i, jb);
+	}
+	if (result == 0 && jblocks > 0) {
+		jb->jb_magic = SFS_JOURNAL_MAGIC;
+		jb->jb_type = SFS_JB_HEADER;
+		jb->jb_seq = 1;
+		result = mkfs_writeblock(dev, jstart, jb);
+	}
+
+	for (i = 0; i < mapblocks && result == 0; i++) {
+		result = mkfs_writeblock(dev, SFS_FREEMAP_START + i,
+					 freemap + i * SFS_BLOCKSIZE);
+	}
+
+	if (result == 0) {
+		sfi = block;
+		bzero(sfi, SFS_BLOCKSIZE);
+		sfi->sfi_size = 0;
+		sfi->sfi_type = SFS_TYPE_DIR;
+		sfi->sfi_linkcount = 1;
+		result = mkfs_writeblock(dev, SFS_ROOTDIR_INO, sfi);
+	}
+
+	/* Superblock last, so a failure leaves no valid volume behind */
+	if (result == 0) {
+		sb = block;
+		bzero(sb, SFS_BLOCKSIZE);
+		sb->sb_magic = SFS_MAGIC;
+		sb->sb_nblocks = nblocks;
+		strcpy(sb->sb_volname, volname);
+		sb->sb_journalstart = jstart;
+		sb->sb_journalblocks = jblocks;
+		result = mkfs_writeblock(dev, SFS_SUPER_BLOCK, sb);
+	}
+
+	kfree(block);
+	kfree(freemap);
+	return result;
+}
+
+/*
+ * Make a new SFS volume named VOLNAME on DEVICE.
+ */
+int
+sfs_mkfs(const char *device, const char *volname)
+{
+	if (strlen(volname) == 0 || strlen(volname) >= SFS_VOLNAME_SIZE) {
+		return EINVAL;
+	}
+	if (strchr(volname, ':') != NULL || strchr(volname, '/') != NULL) {
+		return EINVAL;
+	}
+
+	/* vfs_format doesn't change DATA */
+	return vfs_format(device, (void *)volname, sfs_doformat);
+}
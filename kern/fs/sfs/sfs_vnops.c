@@ -37,8 +37,10 @@
 #include <kern/fcntl.h>
 #include <stat.h>
 #include <lib.h>
+#include <synch.h>
 #include <uio.h>
 #include <vfs.h>
+#include <buf.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
@@ -98,34 +100,66 @@ int
 sfs_read(struct vnode *v, struct uio *uio)
 {
 	struct sfs_vnode *sv = v->vn_data;
+	off_t start;
 	int result;
 
 	KASSERT(uio->uio_rw==UIO_READ);
 
-	vfs_biglock_acquire();
+	lock_acquire(sv->sv_lock);
+	start = uio->uio_offset;
 	result = sfs_io(sv, uio);
-	vfs_biglock_release();
+	if (result == 0) {
+		sfs_readahead(sv, start, uio->uio_offset);
+	}
+	lock_release(sv->sv_lock);
 
 	return result;
 }
 
 /*
- * Called for write(). sfs_io() does the work.
+ * Called for write(). sfs_io() does the work. On a journaled volume
+ * each SFS_JCHUNK blocks is its own transaction, so a big write can't
+ * pin more metadata than the journal holds.
  */
 static
 int
 sfs_write(struct vnode *v, struct uio *uio)
 {
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
 	struct sfs_vnode *sv = v->vn_data;
-	int result;
+	size_t rest;
+	int result, result2;
 
 	KASSERT(uio->uio_rw==UIO_WRITE);
 
-	vfs_biglock_acquire();
-	result = sfs_io(sv, uio);
-	vfs_biglock_release();
+	vnode_modify(v);
+	do {
+		rest = 0;
+		if (sfs->sfs_journaled &&
+		    uio->uio_resid > SFS_JCHUNK * SFS_BLOCKSIZE) {
+			rest = uio->uio_resid - SFS_JCHUNK * SFS_BLOCKSIZE;
+			uio->uio_resid -= rest;
+		}
 
-	return result;
+		sfs_jbegin(sfs);
+		lock_acquire(sv->sv_lock);
+		result = sfs_io(sv, uio);
+		/* New blocks and size go in this transaction, even on error */
+		result2 = sfs_sync_inode(sv);
+		lock_release(sv->sv_lock);
+		sfs_jend(sfs);
+
+		if (result == 0) {
+			result = result2;
+		}
+		if (result == 0 && uio->uio_resid > 0) {
+			/* short write (e.g. out of space); stop here */
+			rest = 0;
+		}
+		uio->uio_resid += rest;
+	} while (result == 0 && rest > 0);
+
+	return vnode_modified(v, result);
 }
 
 /*
@@ -164,8 +198,10 @@ sfs_stat(struct vnode *v, struct stat *statbuf)
 		return result;
 	}
 
+	lock_acquire(sv->sv_lock);
 	statbuf->st_size = sv->sv_i.sfi_size;
 	statbuf->st_nlink = sv->sv_i.sfi_linkcount;
+	lock_release(sv->sv_lock);
 
 	/* We don't support this yet */
 	statbuf->st_blocks = 0;
@@ -185,16 +221,13 @@ sfs_gettype(struct vnode *v, uint32_t *ret)
 	struct sfs_vnode *sv = v->vn_data;
 	struct sfs_fs *sfs = v->vn_fs->fs_data;
 
-	vfs_biglock_acquire();
-
+	/* The type never changes once loaded, so no lock needed */
 	switch (sv->sv_i.sfi_type) {
 	case SFS_TYPE_FILE:
 		*ret = S_IFREG;
-		vfs_biglock_release();
 		return 0;
 	case SFS_TYPE_DIR:
 		*ret = S_IFDIR;
-		vfs_biglock_release();
 		return 0;
 	}
 	panic("sfs: %s: gettype: Invalid inode type (inode %u, type %u)\n",
@@ -222,11 +255,41 @@ int
 sfs_fsync(struct vnode *v)
 {
 	struct sfs_vnode *sv = v->vn_data;
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
 	int result;
 
-	vfs_biglock_acquire();
-	result = sfs_sync_inode(sv);
-	vfs_biglock_release();
+	if (sfs->sfs_journaled) {
+		/*
+		 * Write the file's blocks, then commit; the inode
+		 * and everything else it depends on are already in
+		 * the transaction.
+		 */
+		lock_acquire(sv->sv_lock);
+		result = sfs_flushblocks(sv);
+		lock_release(sv->sv_lock);
+		if (result) {
+			return result;
+		}
+		return sfs_jcommit(sfs);
+	}
+
+	/*
+	 * Write out just this file: its blocks first, then the
+	 * freemap so they're allocated, then the inode that points
+	 * at them. Other dirty buffers are left to the syncer.
+	 */
+	lock_acquire(sv->sv_lock);
+	result = sfs_flushblocks(sv);
+	if (result == 0) {
+		result = sfs_flush_freemap(sfs);
+	}
+	if (result == 0) {
+		result = sfs_sync_inode(sv);
+	}
+	if (result == 0) {
+		result = buf_flush(sfs->sfs_device, sv->sv_ino);
+	}
+	lock_release(sv->sv_lock);
 
 	return result;
 }
@@ -249,9 +312,21 @@ static
 int
 sfs_truncate(struct vnode *v, off_t len)
 {
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
 	struct sfs_vnode *sv = v->vn_data;
+	int result;
 
-	return sfs_itrunc(sv, len);
+	vnode_modify(v);
+	sfs_jbegin(sfs);
+	lock_acquire(sv->sv_lock);
+	result = sfs_itrunc(sv, len);
+	if (result == 0) {
+		result = sfs_sync_inode(sv);
+	}
+	lock_release(sv->sv_lock);
+	sfs_jend(sfs);
+
+	return vnode_modified(v, result);
 }
 
 /*
@@ -289,18 +364,21 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 	uint32_t ino;
 	int result;
 
-	vfs_biglock_acquire();
+	sfs_jbegin(sfs);
+	lock_acquire(sv->sv_lock);
 
 	/* Look up the name */
 	result = sfs_dir_findname(sv, name, &ino, NULL, NULL);
 	if (result!=0 && result!=ENOENT) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
+		sfs_jend(sfs);
 		return result;
 	}
 
 	/* If it exists and we didn't want it to, fail */
 	if (result==0 && excl) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
+		sfs_jend(sfs);
 		return EEXIST;
 	}
 
@@ -308,18 +386,21 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 		/* We got something; load its vnode and return */
 		result = sfs_loadvnode(sfs, ino, SFS_TYPE_INVAL, &newguy);
 		if (result) {
-			vfs_biglock_release();
+			lock_release(sv->sv_lock);
+			sfs_jend(sfs);
 			return result;
 		}
 		*ret = &newguy->sv_absvn;
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
+		sfs_jend(sfs);
 		return 0;
 	}
 
 	/* Didn't exist - create it */
 	result = sfs_makeobj(sfs, SFS_TYPE_FILE, &newguy);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
+		sfs_jend(sfs);
 		return result;
 	}
 
@@ -329,20 +410,27 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 	/* Link it into the directory */
 	result = sfs_dir_link(sv, name, newguy->sv_ino, NULL);
 	if (result) {
+		sfs_sync_inode(sv);
+		lock_release(sv->sv_lock);
+		sfs_jend(sfs);
 		VOP_DECREF(&newguy->sv_absvn);
-		vfs_biglock_release();
 		return result;
 	}
 
 	/* Update the linkcount of the new file */
+	lock_acquire(newguy->sv_lock);
 	newguy->sv_i.sfi_linkcount++;
 
 	/* and consequently mark it dirty. */
 	newguy->sv_dirty = true;
+	sfs_sync_inode(newguy);
+	lock_release(newguy->sv_lock);
 
 	*ret = &newguy->sv_absvn;
 
-	vfs_biglock_release();
+	sfs_sync_inode(sv);
+	lock_release(sv->sv_lock);
+	sfs_jend(sfs);
 	return 0;
 }
 
@@ -355,24 +443,30 @@ static
 int
 sfs_link(struct vnode *dir, const char *name, struct vnode *file)
 {
+	struct sfs_fs *sfs = dir->vn_fs->fs_data;
 	struct sfs_vnode *sv = dir->vn_data;
 	struct sfs_vnode *f = file->vn_data;
 	int result;
 
 	KASSERT(file->vn_fs == dir->vn_fs);
 
-	vfs_biglock_acquire();
-
 	/* Hard links to directories aren't allowed. */
 	if (f->sv_i.sfi_type == SFS_TYPE_DIR) {
-		vfs_biglock_release();
 		return EINVAL;
 	}
 
+	/* Directory first, then the file (see sfs.h) */
+	sfs_jbegin(sfs);
+	lock_acquire(sv->sv_lock);
+	lock_acquire(f->sv_lock);
+
 	/* Create the link */
 	result = sfs_dir_link(sv, name, f->sv_ino, NULL);
 	if (result) {
-		vfs_biglock_release();
+		sfs_sync_inode(sv);
+		lock_release(f->sv_lock);
+		lock_release(sv->sv_lock);
+		sfs_jend(sfs);
 		return result;
 	}
 
@@ -380,7 +474,11 @@ sfs_link(struct vnode *dir, const char *name, struct vnode *file)
 	f->sv_i.sfi_linkcount++;
 	f->sv_dirty = true;
 
-	vfs_biglock_release();
+	sfs_sync_inode(f);
+	sfs_sync_inode(sv);
+	lock_release(f->sv_lock);
+	lock_release(sv->sv_lock);
+	sfs_jend(sfs);
 	return 0;
 }
 
@@ -391,17 +489,20 @@ static
 int
 sfs_remove(struct vnode *dir, const char *name)
 {
+	struct sfs_fs *sfs = dir->vn_fs->fs_data;
 	struct sfs_vnode *sv = dir->vn_data;
 	struct sfs_vnode *victim;
 	int slot;
 	int result;
 
-	vfs_biglock_acquire();
+	sfs_jbegin(sfs);
+	lock_acquire(sv->sv_lock);
 
 	/* Look for the file and fetch a vnode for it. */
 	result = sfs_lookonce(sv, name, &victim, &slot);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
+		sfs_jend(sfs);
 		return result;
 	}
 
@@ -409,15 +510,23 @@ sfs_remove(struct vnode *dir, const char *name)
 	result = sfs_dir_unlink(sv, slot);
 	if (result==0) {
 		/* If we succeeded, decrement the link count. */
+		lock_acquire(victim->sv_lock);
 		KASSERT(victim->sv_i.sfi_linkcount > 0);
 		victim->sv_i.sfi_linkcount--;
 		victim->sv_dirty = true;
+		sfs_sync_inode(victim);
+		lock_release(victim->sv_lock);
 	}
 
-	/* Discard the reference that sfs_lookonce got us */
+	lock_release(sv->sv_lock);
+	sfs_jend(sfs);
+
+	/*
+	 * Discard the reference that sfs_lookonce got us. If that
+	 * was the last one, freeing the file is a separate operation.
+	 */
 	VOP_DECREF(&victim->sv_absvn);
 
-	vfs_biglock_release();
 	return result;
 }
 
@@ -438,17 +547,28 @@ sfs_rename(struct vnode *d1, const char *n1,
 	int slot1, slot2;
 	int result, result2;
 
-	vfs_biglock_acquire();
-
 	KASSERT(d1==d2);
 	KASSERT(sv->sv_ino == SFS_ROOTDIR_INO);
 
+	/*
+	 * Rename lock, then the directory, then the file (see sfs.h).
+	 * With only one directory the rename lock isn't strictly
+	 * needed, but it's what keeps renames between directories
+	 * from deadlocking.
+	 */
+	sfs_jbegin(sfs);
+	lock_acquire(sfs->sfs_renamelock);
+	lock_acquire(sv->sv_lock);
+
 	/* Look up the old name of the file and get its inode and slot number*/
 	result = sfs_lookonce(sv, n1, &g1, &slot1);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
+		lock_release(sfs->sfs_renamelock);
+		sfs_jend(sfs);
 		return result;
 	}
+	lock_acquire(g1->sv_lock);
 
 	/* We don't support subdirectories */
 	KASSERT(g1->sv_i.sfi_type == SFS_TYPE_FILE);
@@ -484,10 +604,16 @@ sfs_rename(struct vnode *d1, const char *n1,
 	g1->sv_i.sfi_linkcount--;
 	g1->sv_dirty = true;
 
+	sfs_sync_inode(g1);
+	sfs_sync_inode(sv);
+	lock_release(g1->sv_lock);
+	lock_release(sv->sv_lock);
+	lock_release(sfs->sfs_renamelock);
+	sfs_jend(sfs);
+
 	/* Let go of the reference to g1 */
 	VOP_DECREF(&g1->sv_absvn);
 
-	vfs_biglock_release();
 	return 0;
 
  puke_harder:
@@ -505,9 +631,15 @@ sfs_rename(struct vnode *d1, const char *n1,
 	}
 	g1->sv_i.sfi_linkcount--;
  puke:
+	sfs_sync_inode(g1);
+	sfs_sync_inode(sv);
+	lock_release(g1->sv_lock);
+	lock_release(sv->sv_lock);
+	lock_release(sfs->sfs_renamelock);
+	sfs_jend(sfs);
+
 	/* Let go of the reference to g1 */
 	VOP_DECREF(&g1->sv_absvn);
-	vfs_biglock_release();
 	return result;
 }
 
@@ -525,15 +657,11 @@ sfs_lookparent(struct vnode *v, char *path, struct vnode **ret,
 {
 	struct sfs_vnode *sv = v->vn_data;
 
-	vfs_biglock_acquire();
-
 	if (sv->sv_i.sfi_type != SFS_TYPE_DIR) {
-		vfs_biglock_release();
 		return ENOTDIR;
 	}
 
 	if (strlen(path)+1 > buflen) {
-		vfs_biglock_release();
 		return ENAMETOOLONG;
 	}
 	strcpy(buf, path);
@@ -541,7 +669,6 @@ sfs_lookparent(struct vnode *v, char *path, struct vnode **ret,
 	VOP_INCREF(&sv->sv_absvn);
 	*ret = &sv->sv_absvn;
 
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -559,22 +686,19 @@ sfs_lookup(struct vnode *v, char *path, struct vnode **ret)
 	struct sfs_vnode *final;
 	int result;
 
-	vfs_biglock_acquire();
-
 	if (sv->sv_i.sfi_type != SFS_TYPE_DIR) {
-		vfs_biglock_release();
 		return ENOTDIR;
 	}
 
+	lock_acquire(sv->sv_lock);
 	result = sfs_lookonce(sv, path, &final, NULL);
+	lock_release(sv->sv_lock);
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
 	*ret = &final->sv_absvn;
 
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -32,18 +32,27 @@
 
 #include <uio.h> /* for uio_rw */
 
+struct buf;	/* in <buf.h> */
+
 
 /* ops tables (in sfs_vnops.c) */
 extern const struct vnode_ops sfs_fileops;
 extern const struct vnode_ops sfs_dirops;
 
+/* Shortcuts for the size macros in kern/sfs.h */
+#define SFS_FS_NBLOCKS(sfs)        ((sfs)->sfs_sb.sb_nblocks)
+#define SFS_FS_FREEMAPBITS(sfs)    SFS_FREEMAPBITS(SFS_FS_NBLOCKS(sfs))
+#define SFS_FS_FREEMAPBLOCKS(sfs)  SFS_FREEMAPBLOCKS(SFS_FS_NBLOCKS(sfs))
+
 /* Macro for initializing a uio structure */
 #define SFSUIO(iov, uio, ptr, block, rw) \
     uio_kinit(iov, uio, ptr, SFS_BLOCKSIZE, ((off_t)(block))*SFS_BLOCKSIZE, rw)
 
 
 /* Functions in sfs_balloc.c */
-int sfs_balloc(struct sfs_fs *sfs, daddr_t *diskblock);
+int sfs_balloc(struct sfs_fs *sfs, daddr_t goal, daddr_t *diskblock);
+int sfs_balloc_file(struct sfs_vnode *sv, bool append, daddr_t *diskblock);
+void sfs_unreserve(struct sfs_vnode *sv);
 void sfs_bfree(struct sfs_fs *sfs, daddr_t diskblock);
 int sfs_bused(struct sfs_fs *sfs, daddr_t diskblock);
 
@@ -51,6 +60,8 @@ int sfs_bused(struct sfs_fs *sfs, daddr_t diskblock);
 int sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 		daddr_t *diskblock);
 int sfs_itrunc(struct sfs_vnode *sv, off_t len);
+int sfs_flushblocks(struct sfs_vnode *sv);
+void sfs_ibcache_clear(struct sfs_vnode *sv);
 
 /* Functions in sfs_dir.c */
 int sfs_dir_findname(struct sfs_vnode *sv, const char *name,
@@ -61,8 +72,16 @@ int sfs_dir_unlink(struct sfs_vnode *sv, int slot);
 int sfs_lookonce(struct sfs_vnode *sv, const char *name,
 		struct sfs_vnode **ret,
 		int *slot);
+void sfs_dir_dropindex(struct sfs_vnode *sv);
+
+/* Functions in sfs_fsops.c */
+int sfs_sync_freemap(struct sfs_fs *sfs);
+int sfs_sync_superblock(struct sfs_fs *sfs);
+int sfs_flush_freemap(struct sfs_fs *sfs);
 
 /* Functions in sfs_inode.c */
+int sfs_vntable_init(struct sfs_fs *sfs);
+void sfs_vntable_cleanup(struct sfs_fs *sfs);
 int sfs_sync_inode(struct sfs_vnode *sv);
 int sfs_reclaim(struct vnode *v);
 int sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
@@ -70,10 +89,27 @@ int sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 int sfs_makeobj(struct sfs_fs *sfs, int type, struct sfs_vnode **ret);
 int sfs_getroot(struct fs *fs, struct vnode **ret);
 
+/*
+ * Most metadata blocks one operation may pin. Writes are split into
+ * transactions of SFS_JCHUNK blocks to stay within it: one inode plus
+ * at most two indirect blocks at each level.
+ */
+#define SFS_JOPMAX   8
+#define SFS_JCHUNK   128
+
+/* Functions in sfs_journal.c */
+int sfs_jmount(struct sfs_fs *sfs);
+void sfs_jbegin(struct sfs_fs *sfs);
+void sfs_jend(struct sfs_fs *sfs);
+void sfs_jdirty(struct sfs_fs *sfs, struct buf *buf);
+void sfs_jnewblock(struct sfs_fs *sfs, daddr_t block);
+int sfs_jcommit(struct sfs_fs *sfs);
+
 /* Functions in sfs_io.c */
 int sfs_readblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len);
 int sfs_writeblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len);
 int sfs_io(struct sfs_vnode *sv, struct uio *uio);
+void sfs_readahead(struct sfs_vnode *sv, off_t start, off_t end);
 int sfs_metaio(struct sfs_vnode *sv, off_t pos, void *data, size_t len,
 	       enum uio_rw rw);
 
@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef TMPFS_H
+#define TMPFS_H
+
+#include <fs.h>
+#include <vnode.h>
+
+/*
+ * tmpfs: a filesystem held entirely in kernel memory.
+ *
+ * Each file or directory is a struct tmpfs_node with its vnode built
+ * in. While a node has names (tn_nlink > 0) the namespace holds one
+ * reference to the vnode, so an unused file stays around with a
+ * refcount of 1; removing the last name drops that reference, and the
+ * node goes away at VOP_RECLAIM once nobody has it open either.
+ *
+ * A directory's entries are found by name through a hash table, and
+ * are also kept in an array in the order they were made, for
+ * getdirentry. Each entry gets a cookie, one more than the last one
+ * made in that directory, which is its directory offset; 0 and 1 are
+ * "." and "..". The offset stays good however the directory changes.
+ *
+ * Locking: tf_lock covers the namespace (all directory contents,
+ * tn_nlink, tn_parent, the node list) and is held across lookups.
+ * Each node's tn_lock covers its file contents and size. tf_lock
+ * comes first.
+ */
+
+/* Initial number of hash chains in a directory (doubles as needed) */
+#define TMPFS_DIRHASHSIZE  8
+/* First cookie; the offsets before it are "." and ".." */
+#define TMPFS_FIRSTCOOKIE  2
+/* Largest file */
+#define TMPFS_MAXFILESIZE  ((off_t)0x7fffffff)
+
+/*
+ * Directory entry, on one of the directory's hash chains.
+ */
+struct tmpfs_dirent {
+	struct tmpfs_dirent *td_next;		/* Hash chain */
+	struct tmpfs_node *td_node;		/* What it names */
+	unsigned td_cookie;			/* Directory offset */
+	char td_name[];
+};
+
+/*
+ * Slot in a directory's entry array. Removed entries leave the slot
+ * with its cookie and a null ds_ent until the array is compacted.
+ */
+struct tmpfs_dirslot {
+	unsigned ds_cookie;
+	struct tmpfs_dirent *ds_ent;
+};
+
+struct tmpfs_node {
+	struct vnode tn_vnode;			/* Abstract vnode */
+	struct tmpfs *tn_fs;			/* Back-pointer to fs */
+	mode_t tn_type;				/* S_IFREG or S_IFDIR */
+	unsigned tn_ino;			/* Serial number, for stat */
+	unsigned tn_nlink;			/* Names for us */
+	struct tmpfs_node *tn_prev;		/* List of all nodes */
+	struct tmpfs_node *tn_next;
+
+	/* Regular files */
+	struct lock *tn_lock;			/* Protects the following */
+	off_t tn_size;
+	char **tn_pages;			/* PAGE_SIZE each; NULL is zeros */
+	unsigned tn_maxpages;			/* Length of tn_pages */
+	unsigned tn_npages;			/* Pages allocated */
+
+	/* Directories */
+	struct tmpfs_node *tn_parent;		/* ".." (root: itself) */
+	struct tmpfs_dirent *tn_dirent;		/* Our name in tn_parent */
+	struct tmpfs_dirent **tn_hash;		/* Entries, by name */
+	unsigned tn_hashsize;			/* Number of chains */
+	unsigned tn_nentries;			/* Number of entries */
+	struct tmpfs_dirslot *tn_slots;		/* Entries, by cookie */
+	unsigned tn_maxslots;			/* Length of tn_slots */
+	unsigned tn_nslots;			/* Slots used */
+	unsigned tn_nextcookie;			/* For the next entry */
+};
+
+struct tmpfs {
+	struct fs tf_absfs;			/* Abstract fs object */
+	char *tf_name;				/* Volume name */
+	struct lock *tf_lock;			/* Namespace lock */
+	struct tmpfs_node *tf_root;		/* Root directory */
+	struct tmpfs_node *tf_nodes;		/* All nodes */
+	unsigned tf_nextino;			/* Next serial number */
+};
+
+/* in tmpfs_dir.c */
+int tmpfs_dir_init(struct tmpfs_node *dir);
+void tmpfs_dir_cleanup(struct tmpfs_node *dir);
+struct tmpfs_dirent *tmpfs_dir_find(struct tmpfs_node *dir, const char *name);
+struct tmpfs_dirent *tmpfs_dir_next(struct tmpfs_node *dir, off_t pos);
+int tmpfs_dir_add(struct tmpfs_node *dir, const char *name,
+		  struct tmpfs_node *tn);
+void tmpfs_dir_remove(struct tmpfs_node *dir, const char *name);
+
+/* in tmpfs_vnops.c */
+struct tmpfs_node *tmpfs_node_create(struct tmpfs *tf, mode_t type);
+void tmpfs_node_destroy(struct tmpfs_node *tn);
+
+#endif /* TMPFS_H */
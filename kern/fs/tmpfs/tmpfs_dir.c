@@ -0,0 +1,329 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * tmpfs directories: a hash table of names per directory, and an
+ * array of the entries in cookie order. All of these are called with
+ * tf_lock held.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <stat.h>
+#include <synch.h>
+
+#include "tmpfs.h"
+
+static
+unsigned
+tmpfs_hash(const char *name)
+{
+	unsigned h = 5381;
+
+	while (*name) {
+		h = h*33 + (unsigned char)*name++;
+	}
+	return h;
+}
+
+/*
+ * Set up the (empty) table for a new directory.
+ */
+int
+tmpfs_dir_init(struct tmpfs_node *dir)
+{
+	unsigned i;
+
+	dir->tn_hash = kmalloc(TMPFS_DIRHASHSIZE * sizeof(struct tmpfs_dirent *));
+	if (dir->tn_hash == NULL) {
+		return ENOMEM;
+	}
+	for (i=0; i<TMPFS_DIRHASHSIZE; i++) {
+		dir->tn_hash[i] = NULL;
+	}
+	dir->tn_hashsize = TMPFS_DIRHASHSIZE;
+	dir->tn_nentries = 0;
+	dir->tn_slots = NULL;
+	dir->tn_maxslots = 0;
+	dir->tn_nslots = 0;
+	dir->tn_nextcookie = TMPFS_FIRSTCOOKIE;
+	return 0;
+}
+
+/*
+ * Free a directory's table and whatever entries are left in it.
+ */
+void
+tmpfs_dir_cleanup(struct tmpfs_node *dir)
+{
+	struct tmpfs_dirent *td;
+	unsigned i;
+
+	for (i=0; i<dir->tn_hashsize; i++) {
+		while ((td = dir->tn_hash[i]) != NULL) {
+			dir->tn_hash[i] = td->td_next;
+			kfree(td);
+		}
+	}
+	kfree(dir->tn_hash);
+	dir->tn_hash = NULL;
+	dir->tn_hashsize = 0;
+	dir->tn_nentries = 0;
+	kfree(dir->tn_slots);
+	dir->tn_slots = NULL;
+	dir->tn_maxslots = 0;
+	dir->tn_nslots = 0;
+}
+
+struct tmpfs_dirent *
+tmpfs_dir_find(struct tmpfs_node *dir, const char *name)
+{
+	struct tmpfs_dirent *td;
+
+	KASSERT(dir->tn_type == S_IFDIR);
+
+	td = dir->tn_hash[tmpfs_hash(name) % dir->tn_hashsize];
+	for (; td != NULL; td = td->td_next) {
+		if (!strcmp(td->td_name, name)) {
+			return td;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Index of the first slot with a cookie of at least POS.
+ */
+static
+unsigned
+tmpfs_dir_findslot(struct tmpfs_node *dir, off_t pos)
+{
+	unsigned lo, hi, mid;
+
+	lo = 0;
+	hi = dir->tn_nslots;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if ((off_t)dir->tn_slots[mid].ds_cookie < pos) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+/*
+ * Get the first entry whose cookie is at least POS, for getdirentry.
+ */
+struct tmpfs_dirent *
+tmpfs_dir_next(struct tmpfs_node *dir, off_t pos)
+{
+	unsigned i;
+
+	for (i = tmpfs_dir_findslot(dir, pos); i < dir->tn_nslots; i++) {
+		if (dir->tn_slots[i].ds_ent != NULL) {
+			return dir->tn_slots[i].ds_ent;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Squeeze the removed entries out of the slot array.
+ */
+static
+void
+tmpfs_dir_compact(struct tmpfs_node *dir)
+{
+	unsigned i, j;
+
+	j = 0;
+	for (i=0; i<dir->tn_nslots; i++) {
+		if (dir->tn_slots[i].ds_ent != NULL) {
+			dir->tn_slots[j++] = dir->tn_slots[i];
+		}
+	}
+	KASSERT(j == dir->tn_nentries);
+	dir->tn_nslots = j;
+}
+
+/*
+ * Make room for one more slot, by compacting if a quarter or more of
+ * the slots are dead and otherwise by doubling the array.
+ */
+static
+int
+tmpfs_dir_slotroom(struct tmpfs_node *dir)
+{
+	struct tmpfs_dirslot *newslots;
+	unsigned newmax, i;
+
+	if (dir->tn_nslots < dir->tn_maxslots) {
+		return 0;
+	}
+	if (dir->tn_nslots - dir->tn_nentries >= dir->tn_nslots / 4 &&
+	    dir->tn_nslots > dir->tn_nentries) {
+		tmpfs_dir_compact(dir);
+		return 0;
+	}
+
+	newmax = dir->tn_maxslots ? dir->tn_maxslots * 2 : TMPFS_DIRHASHSIZE;
+	newslots = kmalloc(newmax * sizeof(struct tmpfs_dirslot));
+	if (newslots == NULL) {
+		return ENOMEM;
+	}
+	for (i=0; i<dir->tn_nslots; i++) {
+		newslots[i] = dir->tn_slots[i];
+	}
+	kfree(dir->tn_slots);
+	dir->tn_slots = newslots;
+	dir->tn_maxslots = newmax;
+	return 0;
+}
+
+/*
+ * Double the hash table. Failing is harmless; chains just get longer.
+ */
+static
+void
+tmpfs_dir_grow(struct tmpfs_node *dir)
+{
+	struct tmpfs_dirent **newhash, *td;
+	unsigned newsize, i, h;
+
+	newsize = dir->tn_hashsize * 2;
+	newhash = kmalloc(newsize * sizeof(struct tmpfs_dirent *));
+	if (newhash == NULL) {
+		return;
+	}
+	for (i=0; i<newsize; i++) {
+		newhash[i] = NULL;
+	}
+
+	for (i=0; i<dir->tn_hashsize; i++) {
+		while ((td = dir->tn_hash[i]) != NULL) {
+			dir->tn_hash[i] = td->td_next;
+			h = tmpfs_hash(td->td_name) % newsize;
+			td->td_next = newhash[h];
+			newhash[h] = td;
+		}
+	}
+
+	kfree(dir->tn_hash);
+	dir->tn_hash = newhash;
+	dir->tn_hashsize = newsize;
+}
+
+/*
+ * Enter NAME for TN in DIR. Doesn't touch TN's link count.
+ */
+int
+tmpfs_dir_add(struct tmpfs_node *dir, const char *name,
+	      struct tmpfs_node *tn)
+{
+	struct tmpfs_dirent *td;
+	size_t len;
+	unsigned h;
+	int result;
+
+	KASSERT(tmpfs_dir_find(dir, name) == NULL);
+
+	if (dir->tn_nextcookie == (unsigned)-1) {
+		/* Out of offsets */
+		return ENOSPC;
+	}
+	result = tmpfs_dir_slotroom(dir);
+	if (result) {
+		return result;
+	}
+
+	len = strlen(name);
+	td = kmalloc(sizeof(*td) + len + 1);
+	if (td == NULL) {
+		return ENOMEM;
+	}
+	memcpy(td->td_name, name, len + 1);
+	td->td_node = tn;
+	td->td_cookie = dir->tn_nextcookie++;
+	if (tn->tn_type == S_IFDIR) {
+		tn->tn_dirent = td;
+	}
+
+	/* Cookies only go up, so this keeps the slots in order */
+	dir->tn_slots[dir->tn_nslots].ds_cookie = td->td_cookie;
+	dir->tn_slots[dir->tn_nslots].ds_ent = td;
+	dir->tn_nslots++;
+
+	if (dir->tn_nentries >= 2 * dir->tn_hashsize) {
+		tmpfs_dir_grow(dir);
+	}
+
+	h = tmpfs_hash(name) % dir->tn_hashsize;
+	td->td_next = dir->tn_hash[h];
+	dir->tn_hash[h] = td;
+	dir->tn_nentries++;
+	return 0;
+}
+
+/*
+ * Remove NAME from DIR, which must have it. Doesn't touch the link
+ * count of what it named.
+ */
+void
+tmpfs_dir_remove(struct tmpfs_node *dir, const char *name)
+{
+	struct tmpfs_dirent **tdp, *td;
+	unsigned i;
+
+	tdp = &dir->tn_hash[tmpfs_hash(name) % dir->tn_hashsize];
+	for (; *tdp != NULL; tdp = &(*tdp)->td_next) {
+		td = *tdp;
+		if (!strcmp(td->td_name, name)) {
+			*tdp = td->td_next;
+			i = tmpfs_dir_findslot(dir, td->td_cookie);
+			KASSERT(i < dir->tn_nslots);
+			KASSERT(dir->tn_slots[i].ds_ent == td);
+			dir->tn_slots[i].ds_ent = NULL;
+			if (td->td_node->tn_dirent == td) {
+				td->td_node->tn_dirent = NULL;
+			}
+			kfree(td);
+			dir->tn_nentries--;
+			/* Don't let dead slots outnumber live ones */
+			if (dir->tn_nslots - dir->tn_nentries >
+			    dir->tn_nentries) {
+				tmpfs_dir_compact(dir);
+			}
+			return;
+		}
+	}
+	panic("tmpfs: tmpfs_dir_remove: %s not in directory\n", name);
+}
@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * tmpfs filesystem-level operations and mounting.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <stat.h>
+#include <lib.h>
+#include <synch.h>
+#include <vfs.h>
+#include <fs.h>
+#include <vnode.h>
+
+#include "tmpfs.h"
+
+static
+int
+tmpfs_sync(struct fs *fs)
+{
+	/* Nothing to write back */
+	(void)fs;
+	return 0;
+}
+
+static
+const char *
+tmpfs_getvolname(struct fs *fs)
+{
+	struct tmpfs *tf = fs->fs_data;
+
+	return tf->tf_name;
+}
+
+static
+int
+tmpfs_getroot(struct fs *fs, struct vnode **ret)
+{
+	struct tmpfs *tf = fs->fs_data;
+
+	lock_acquire(tf->tf_lock);
+	VOP_INCREF(&tf->tf_root->tn_vnode);
+	lock_release(tf->tf_lock);
+
+	*ret = &tf->tf_root->tn_vnode;
+	return 0;
+}
+
+/*
+ * Free the fs and all its nodes, which nobody may be using.
+ */
+static
+void
+tmpfs_destroy(struct tmpfs *tf)
+{
+	lock_acquire(tf->tf_lock);
+	while (tf->tf_nodes != NULL) {
+		tmpfs_node_destroy(tf->tf_nodes);
+	}
+	lock_release(tf->tf_lock);
+
+	lock_destroy(tf->tf_lock);
+	kfree(tf->tf_name);
+	kfree(tf);
+}
+
+/*
+ * Unmount: only if every node is held by its names alone, i.e.
+ * nothing is open, nobody's current directory is here, and no
+ * removed file is still open.
+ */
+static
+int
+tmpfs_unmount(struct fs *fs)
+{
+	struct tmpfs *tf = fs->fs_data;
+	struct tmpfs_node *tn;
+	bool busy;
+
+	lock_acquire(tf->tf_lock);
+	busy = false;
+	for (tn = tf->tf_nodes; tn != NULL && !busy; tn = tn->tn_next) {
+		busy = tn->tn_nlink == 0 || tn->tn_vnode.vn_refcount > 1;
+	}
+	lock_release(tf->tf_lock);
+
+	if (busy) {
+		return EBUSY;
+	}
+	tmpfs_destroy(tf);
+	return 0;
+}
+
+static const struct fs_ops tmpfs_fsops = {
+	.fsop_sync = tmpfs_sync,
+	.fsop_getvolname = tmpfs_getvolname,
+	.fsop_getroot = tmpfs_getroot,
+	.fsop_unmount = tmpfs_unmount,
+};
+
+/*
+ * Make an empty tmpfs.
+ */
+static
+struct tmpfs *
+tmpfs_create(const char *name)
+{
+	struct tmpfs *tf;
+	struct tmpfs_node *root;
+
+	tf = kmalloc(sizeof(*tf));
+	if (tf == NULL) {
+		goto fail_total;
+	}
+	tf->tf_name = kstrdup(name);
+	if (tf->tf_name == NULL) {
+		goto fail_tf;
+	}
+	tf->tf_lock = lock_create("tmpfs");
+	if (tf->tf_lock == NULL) {
+		goto fail_name;
+	}
+	tf->tf_nodes = NULL;
+	tf->tf_nextino = 1;
+	tf->tf_absfs.fs_data = tf;
+	tf->tf_absfs.fs_ops = &tmpfs_fsops;
+	tf->tf_absfs.fs_dcachemax = 0;
+	tf->tf_absfs.fs_dcacheheld = 0;
+
+	lock_acquire(tf->tf_lock);
+	root = tmpfs_node_create(tf, S_IFDIR);
+	if (root == NULL) {
+		lock_release(tf->tf_lock);
+		goto fail_lock;
+	}
+	/* The root has no name but is never removed */
+	root->tn_nlink = 1;
+	root->tn_parent = root;
+	tf->tf_root = root;
+	lock_release(tf->tf_lock);
+
+	return tf;
+
+ fail_lock:
+	lock_destroy(tf->tf_lock);
+ fail_name:
+	kfree(tf->tf_name);
+ fail_tf:
+	kfree(tf);
+ fail_total:
+	return NULL;
+}
+
+/*
+ * Mount a new, empty tmpfs as NAME:. There's no device underneath,
+ * so unlike a disk filesystem it's added with vfs_addfs rather than
+ * mounted with vfs_mount, and stays until shutdown.
+ */
+int
+tmpfs_mount(const char *name)
+{
+	struct tmpfs *tf;
+	int result;
+
+	if (strlen(name) == 0 || strchr(name, ':') != NULL ||
+	    strchr(name, '/') != NULL) {
+		return EINVAL;
+	}
+
+	tf = tmpfs_create(name);
+	if (tf == NULL) {
+		return ENOMEM;
+	}
+	result = vfs_addfs(name, &tf->tf_absfs);
+	if (result) {
+		tmpfs_destroy(tf);
+		return result;
+	}
+	kprintf("vfs: Mounted %s: on tmpfs\n", name);
+	return 0;
+}
@@ -0,0 +1,1086 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * tmpfs vnode operations. See tmpfs.h for the reference counting and
+ * locking rules.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <limits.h>
+#include <stat.h>
+#include <lib.h>
+#include <uio.h>
+#include <synch.h>
+#include <vm.h>
+#include <vfs.h>
+#include <vnode.h>
+
+#include "tmpfs.h"
+
+/* Source for reading holes */
+static const char tmpfs_zeros[PAGE_SIZE];
+
+static const struct vnode_ops tmpfs_fileops;
+static const struct vnode_ops tmpfs_dirops;
+
+////////////////////////////////////////////////////////////
+// nodes
+
+/*
+ * Make a new node, with no names. Its vnode starts with the one
+ * reference that its first name will own. Call with tf_lock held.
+ */
+struct tmpfs_node *
+tmpfs_node_create(struct tmpfs *tf, mode_t type)
+{
+	struct tmpfs_node *tn;
+	int result;
+
+	KASSERT(lock_do_i_hold(tf->tf_lock));
+	KASSERT(type == S_IFREG || type == S_IFDIR);
+
+	tn = kmalloc(sizeof(*tn));
+	if (tn == NULL) {
+		return NULL;
+	}
+	tn->tn_fs = tf;
+	tn->tn_type = type;
+	tn->tn_nlink = 0;
+	tn->tn_lock = NULL;
+	tn->tn_size = 0;
+	tn->tn_pages = NULL;
+	tn->tn_maxpages = 0;
+	tn->tn_npages = 0;
+	tn->tn_parent = NULL;
+	tn->tn_dirent = NULL;
+	tn->tn_hash = NULL;
+	tn->tn_hashsize = 0;
+	tn->tn_nentries = 0;
+	tn->tn_slots = NULL;
+	tn->tn_maxslots = 0;
+	tn->tn_nslots = 0;
+	tn->tn_nextcookie = TMPFS_FIRSTCOOKIE;
+
+	if (type == S_IFREG) {
+		tn->tn_lock = lock_create("tmpfs");
+		if (tn->tn_lock == NULL) {
+			kfree(tn);
+			return NULL;
+		}
+	}
+	else {
+		result = tmpfs_dir_init(tn);
+		if (result) {
+			kfree(tn);
+			return NULL;
+		}
+	}
+
+	result = vnode_init(&tn->tn_vnode,
+			    type == S_IFDIR ? &tmpfs_dirops : &tmpfs_fileops,
+			    &tf->tf_absfs, tn);
+	/* vnode_init doesn't actually fail */
+	KASSERT(result == 0);
+
+	tn->tn_ino = tf->tf_nextino++;
+	tn->tn_prev = NULL;
+	tn->tn_next = tf->tf_nodes;
+	if (tf->tf_nodes != NULL) {
+		tf->tf_nodes->tn_prev = tn;
+	}
+	tf->tf_nodes = tn;
+	return tn;
+}
+
+/*
+ * Free a node and everything in it. Call with tf_lock held.
+ */
+void
+tmpfs_node_destroy(struct tmpfs_node *tn)
+{
+	struct tmpfs *tf = tn->tn_fs;
+	unsigned i;
+
+	KASSERT(lock_do_i_hold(tf->tf_lock));
+
+	if (tn->tn_prev != NULL) {
+		tn->tn_prev->tn_next = tn->tn_next;
+	}
+	else {
+		KASSERT(tf->tf_nodes == tn);
+		tf->tf_nodes = tn->tn_next;
+	}
+	if (tn->tn_next != NULL) {
+		tn->tn_next->tn_prev = tn->tn_prev;
+	}
+
+	if (tn->tn_type == S_IFDIR) {
+		tmpfs_dir_cleanup(tn);
+	}
+	else {
+		for (i=0; i<tn->tn_maxpages; i++) {
+			kfree(tn->tn_pages[i]);
+		}
+		kfree(tn->tn_pages);
+		lock_destroy(tn->tn_lock);
+	}
+	vnode_cleanup(&tn->tn_vnode);
+	kfree(tn);
+}
+
+/*
+ * Get page PAGE of a file, allocating it (and room for it) if it's
+ * not there yet. Call with tn_lock held.
+ */
+static
+int
+tmpfs_getpage(struct tmpfs_node *tn, unsigned page, char **ret)
+{
+	char **newpages;
+	unsigned newmax, i;
+
+	KASSERT(lock_do_i_hold(tn->tn_lock));
+
+	if (page >= tn->tn_maxpages) {
+		newmax = tn->tn_maxpages ? tn->tn_maxpages : 4;
+		while (newmax <= page) {
+			newmax *= 2;
+		}
+		newpages = kmalloc(newmax * sizeof(char *));
+		if (newpages == NULL) {
+			return ENOMEM;
+		}
+		for (i=0; i<tn->tn_maxpages; i++) {
+			newpages[i] = tn->tn_pages[i];
+		}
+		for (; i<newmax; i++) {
+			newpages[i] = NULL;
+		}
+		kfree(tn->tn_pages);
+		tn->tn_pages = newpages;
+		tn->tn_maxpages = newmax;
+	}
+
+	if (tn->tn_pages[page] == NULL) {
+		tn->tn_pages[page] = kmalloc(PAGE_SIZE);
+		if (tn->tn_pages[page] == NULL) {
+			return ENOMEM;
+		}
+		bzero(tn->tn_pages[page], PAGE_SIZE);
+		tn->tn_npages++;
+	}
+
+	*ret = tn->tn_pages[page];
+	return 0;
+}
+
+/*
+ * Check a name about to be entered in a directory.
+ */
+static
+int
+tmpfs_checkname(const char *name)
+{
+	if (name[0] == 0) {
+		return EINVAL;
+	}
+	if (!strcmp(name, ".") || !strcmp(name, "..")) {
+		return EEXIST;
+	}
+	if (strlen(name) > NAME_MAX) {
+		return ENAMETOOLONG;
+	}
+	return 0;
+}
+
+/*
+ * Follow PATH, which gets chopped up, from DIR. Hands back the node
+ * without a reference. Call with tf_lock held.
+ */
+static
+int
+tmpfs_walk(struct tmpfs_node *dir, char *path, struct tmpfs_node **ret)
+{
+	struct tmpfs_dirent *td;
+	char *name, *context;
+
+	KASSERT(lock_do_i_hold(dir->tn_fs->tf_lock));
+
+	for (name = strtok_r(path, "/", &context); name != NULL;
+	     name = strtok_r(NULL, "/", &context)) {
+		if (dir->tn_type != S_IFDIR) {
+			return ENOTDIR;
+		}
+		if (!strcmp(name, ".")) {
+			continue;
+		}
+		if (!strcmp(name, "..")) {
+			dir = dir->tn_parent;
+			continue;
+		}
+		td = tmpfs_dir_find(dir, name);
+		if (td == NULL) {
+			return ENOENT;
+		}
+		dir = td->td_node;
+	}
+
+	*ret = dir;
+	return 0;
+}
+
+/*
+ * Take away one of TN's names. Returns true if that was the last
+ * one, in which case the caller must VOP_DECREF the node after
+ * dropping tf_lock, to release the namespace's reference.
+ */
+static
+bool
+tmpfs_unlink(struct tmpfs_node *tn)
+{
+	KASSERT(tn->tn_nlink > 0);
+
+	tn->tn_nlink--;
+	if (tn->tn_nlink > 0) {
+		return false;
+	}
+	if (tn->tn_type == S_IFDIR) {
+		/* Nothing can be looked up in it now; ".." stays put */
+		tn->tn_parent = tn;
+	}
+	return true;
+}
+
+////////////////////////////////////////////////////////////
+// basic ops
+
+static
+int
+tmpfs_eachopen(struct vnode *vn, int openflags)
+{
+	struct tmpfs_node *tn = vn->vn_data;
+
+	if (tn->tn_type == S_IFDIR) {
+		if ((openflags & O_ACCMODE) != O_RDONLY) {
+			return EISDIR;
+		}
+		if (openflags & O_APPEND) {
+			return EISDIR;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Called when the last reference goes away. That's either the
+ * namespace's reference, after the last name was removed, or an open
+ * file's, after that. Until both are gone the node stays.
+ */
+static
+int
+tmpfs_reclaim(struct vnode *vn)
+{
+	struct tmpfs_node *tn = vn->vn_data;
+	struct tmpfs *tf = tn->tn_fs;
+
+	lock_acquire(tf->tf_lock);
+
+	if (vnode_stillbusy(vn)) {
+		/* Someone looked it up again while we were waiting */
+		lock_release(tf->tf_lock);
+		return EBUSY;
+	}
+
+	if (tn->tn_nlink > 0) {
+		/* Linked again; the last reference is the namespace's */
+		lock_release(tf->tf_lock);
+		return 0;
+	}
+
+	tmpfs_node_destroy(tn);
+	lock_release(tf->tf_lock);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// file ops
+
+static
+int
+tmpfs_read(struct vnode *vn, struct uio *uio)
+{
+	struct tmpfs_node *tn = vn->vn_data;
+	const char *src;
+	unsigned page;
+	size_t off, len;
+	int result;
+
+	KASSERT(uio->uio_rw == UIO_READ);
+	KASSERT(uio->uio_offset >= 0);
+
+	lock_acquire(tn->tn_lock);
+	result = 0;
+	while (uio->uio_resid > 0 && uio->uio_offset < tn->tn_size) {
+		page = uio->uio_offset / PAGE_SIZE;
+		off = uio->uio_offset % PAGE_SIZE;
+		len = PAGE_SIZE - off;
+		if (len > tn->tn_size - uio->uio_offset) {
+			len = tn->tn_size - uio->uio_offset;
+		}
+		if (page < tn->tn_maxpages && tn->tn_pages[page] != NULL) {
+			src = tn->tn_pages[page];
+		}
+		else {
+			src = tmpfs_zeros;
+		}
+		/* uiomove doesn't write to the source */
+		result = uiomove((char *)src + off, len, uio);
+		if (result) {
+			break;
+		}
+	}
+	lock_release(tn->tn_lock);
+	return result;
+}
+
+static
+int
+tmpfs_write(struct vnode *vn, struct uio *uio)
+{
+	struct tmpfs_node *tn = vn->vn_data;
+	unsigned page;
+	size_t off;
+	char *data;
+	int result;
+
+	KASSERT(uio->uio_rw == UIO_WRITE);
+	KASSERT(uio->uio_offset >= 0);
+
+	if (uio->uio_offset > TMPFS_MAXFILESIZE ||
+	    uio->uio_resid > TMPFS_MAXFILESIZE - uio->uio_offset) {
+		return EFBIG;
+	}
+
+	vnode_modify(vn);
+	lock_acquire(tn->tn_lock);
+	result = 0;
+	while (uio->uio_resid > 0) {
+		page = uio->uio_offset / PAGE_SIZE;
+		off = uio->uio_offset % PAGE_SIZE;
+		result = tmpfs_getpage(tn, page, &data);
+		if (result) {
+			break;
+		}
+		result = uiomove(data + off, PAGE_SIZE - off, uio);
+		if (uio->uio_offset > tn->tn_size) {
+			tn->tn_size = uio->uio_offset;
+		}
+		if (result) {
+			break;
+		}
+	}
+	lock_release(tn->tn_lock);
+	return vnode_modified(vn, result);
+}
+
+/*
+ * Change a file's size. Everything past the end of the file is kept
+ * zero, so growing it only changes the size.
+ */
+static
+int
+tmpfs_truncate(struct vnode *vn, off_t len)
+{
+	struct tmpfs_node *tn = vn->vn_data;
+	unsigned keep, i;
+	size_t off;
+
+	if (len < 0) {
+		return EINVAL;
+	}
+	if (len > TMPFS_MAXFILESIZE) {
+		return EFBIG;
+	}
+
+	vnode_modify(vn);
+	lock_acquire(tn->tn_lock);
+	if (len < tn->tn_size) {
+		keep = (len + PAGE_SIZE - 1) / PAGE_SIZE;
+		for (i=keep; i<tn->tn_maxpages; i++) {
+			if (tn->tn_pages[i] != NULL) {
+				kfree(tn->tn_pages[i]);
+				tn->tn_pages[i] = NULL;
+				tn->tn_npages--;
+			}
+		}
+		off = len % PAGE_SIZE;
+		if (off != 0 && keep - 1 < tn->tn_maxpages &&
+		    tn->tn_pages[keep - 1] != NULL) {
+			bzero(tn->tn_pages[keep - 1] + off, PAGE_SIZE - off);
+		}
+	}
+	tn->tn_size = len;
+	lock_release(tn->tn_lock);
+	return vnode_modified(vn, 0);
+}
+
+static
+int
+tmpfs_ioctl(struct vnode *vn, int op, userptr_t data)
+{
+	(void)vn;
+	(void)op;
+	(void)data;
+	return EINVAL;
+}
+
+static
+int
+tmpfs_stat(struct vnode *vn, struct stat *buf)
+{
+	struct tmpfs_node *tn = vn->vn_data;
+	struct tmpfs *tf = tn->tn_fs;
+
+	bzero(buf, sizeof(*buf));
+
+	lock_acquire(tf->tf_lock);
+	buf->st_mode = tn->tn_type | 0777;
+	buf->st_nlink = tn->tn_nlink;
+	buf->st_ino = tn->tn_ino;
+	buf->st_blksize = PAGE_SIZE;
+	if (tn->tn_type == S_IFDIR) {
+		buf->st_size = tn->tn_nentries;
+	}
+	else {
+		lock_acquire(tn->tn_lock);
+		buf->st_size = tn->tn_size;
+		buf->st_blocks = tn->tn_npages * (PAGE_SIZE / 512);
+		lock_release(tn->tn_lock);
+	}
+	lock_release(tf->tf_lock);
+	return 0;
+}
+
+static
+int
+tmpfs_gettype(struct vnode *vn, mode_t *ret)
+{
+	struct tmpfs_node *tn = vn->vn_data;
+
+	*ret = tn->tn_type;
+	return 0;
+}
+
+static
+bool
+tmpfs_isseekable(struct vnode *vn)
+{
+	(void)vn;
+	return true;
+}
+
+static
+int
+tmpfs_fsync(struct vnode *vn)
+{
+	/* Nowhere to write it */
+	(void)vn;
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// directory ops
+
+/*
+ * The uio offset is 0 for ".", 1 for "..", and otherwise the cookie
+ * of the next entry to return. Entries made after a reader passes
+ * get bigger cookies, so nothing is skipped or repeated.
+ */
+static
+int
+tmpfs_getdirentry(struct vnode *dirvn, struct uio *uio)
+{
+	struct tmpfs_node *dir = dirvn->vn_data;
+	struct tmpfs *tf = dir->tn_fs;
+	struct tmpfs_dirent *td;
+	const char *name;
+	off_t pos, next;
+	int result;
+
+	KASSERT(uio->uio_offset >= 0);
+	pos = uio->uio_offset;
+
+	lock_acquire(tf->tf_lock);
+	if (pos < TMPFS_FIRSTCOOKIE) {
+		name = pos == 0 ? "." : "..";
+		next = pos + 1;
+	}
+	else {
+		td = tmpfs_dir_next(dir, pos);
+		name = td != NULL ? td->td_name : NULL;
+		next = td != NULL ? (off_t)td->td_cookie + 1 : pos;
+	}
+	if (name == NULL) {
+		/* EOF */
+		result = 0;
+	}
+	else {
+		result = uiomove((char *)name, strlen(name), uio);
+		if (result == 0) {
+			uio->uio_offset = next;
+		}
+	}
+	lock_release(tf->tf_lock);
+	return result;
+}
+
+/*
+ * Name of a directory relative to the root, as "a/b/c", for getcwd.
+ * Built backwards from the end of a buffer, going up the parents.
+ */
+static
+int
+tmpfs_namefile(struct vnode *vn, struct uio *uio)
+{
+	struct tmpfs_node *tn = vn->vn_data;
+	struct tmpfs *tf = tn->tn_fs;
+	struct tmpfs_dirent *td;
+	size_t pos, len;
+	char *buf;
+	int result;
+
+	buf = kmalloc(PATH_MAX);
+	if (buf == NULL) {
+		return ENOMEM;
+	}
+	pos = PATH_MAX;
+
+	lock_acquire(tf->tf_lock);
+	result = 0;
+	while (tn != tf->tf_root) {
+		if (tn->tn_nlink == 0) {
+			result = ENOENT;
+			break;
+		}
+		td = tn->tn_dirent;
+		KASSERT(td != NULL && td->td_node == tn);
+
+		len = strlen(td->td_name);
+		if (len + (pos < PATH_MAX ? 1 : 0) > pos) {
+			result = ENAMETOOLONG;
+			break;
+		}
+		if (pos < PATH_MAX) {
+			buf[--pos] = '/';
+		}
+		pos -= len;
+		memcpy(buf + pos, td->td_name, len);
+		tn = tn->tn_parent;
+	}
+	lock_release(tf->tf_lock);
+
+	if (result == 0) {
+		result = uiomove(buf + pos, PATH_MAX - pos, uio);
+	}
+	kfree(buf);
+	return result;
+}
+
+static
+int
+tmpfs_creat(struct vnode *dirvn, const char *name, bool excl, mode_t mode,
+	    struct vnode **ret)
+{
+	struct tmpfs_node *dir = dirvn->vn_data;
+	struct tmpfs *tf = dir->tn_fs;
+	struct tmpfs_dirent *td;
+	struct tmpfs_node *tn;
+	int result;
+
+	(void)mode;
+
+	result = tmpfs_checkname(name);
+	if (result) {
+		return result;
+	}
+
+	lock_acquire(tf->tf_lock);
+	if (dir->tn_nlink == 0) {
+		lock_release(tf->tf_lock);
+		return ENOENT;
+	}
+
+	td = tmpfs_dir_find(dir, name);
+	if (td != NULL) {
+		if (excl) {
+			result = EEXIST;
+		}
+		else if (td->td_node->tn_type == S_IFDIR) {
+			result = EISDIR;
+		}
+		else {
+			VOP_INCREF(&td->td_node->tn_vnode);
+			*ret = &td->td_node->tn_vnode;
+		}
+		lock_release(tf->tf_lock);
+		return result;
+	}
+
+	tn = tmpfs_node_create(tf, S_IFREG);
+	if (tn == NULL) {
+		lock_release(tf->tf_lock);
+		return ENOMEM;
+	}
+	result = tmpfs_dir_add(dir, name, tn);
+	if (result) {
+		tmpfs_node_destroy(tn);
+		lock_release(tf->tf_lock);
+		return result;
+	}
+	tn->tn_nlink = 1;
+
+	/* One reference for the name, one for the caller */
+	VOP_INCREF(&tn->tn_vnode);
+	lock_release(tf->tf_lock);
+
+	*ret = &tn->tn_vnode;
+	return 0;
+}
+
+static
+int
+tmpfs_mkdir(struct vnode *dirvn, const char *name, mode_t mode)
+{
+	struct tmpfs_node *dir = dirvn->vn_data;
+	struct tmpfs *tf = dir->tn_fs;
+	struct tmpfs_node *tn;
+	int result;
+
+	(void)mode;
+
+	result = tmpfs_checkname(name);
+	if (result) {
+		return result;
+	}
+
+	lock_acquire(tf->tf_lock);
+	if (dir->tn_nlink == 0) {
+		lock_release(tf->tf_lock);
+		return ENOENT;
+	}
+	if (tmpfs_dir_find(dir, name) != NULL) {
+		lock_release(tf->tf_lock);
+		return EEXIST;
+	}
+
+	tn = tmpfs_node_create(tf, S_IFDIR);
+	if (tn == NULL) {
+		lock_release(tf->tf_lock);
+		return ENOMEM;
+	}
+	result = tmpfs_dir_add(dir, name, tn);
+	if (result) {
+		tmpfs_node_destroy(tn);
+		lock_release(tf->tf_lock);
+		return result;
+	}
+	tn->tn_nlink = 1;
+	tn->tn_parent = dir;
+
+	lock_release(tf->tf_lock);
+	return 0;
+}
+
+/*
+ * Hard links, to files only.
+ */
+static
+int
+tmpfs_link(struct vnode *dirvn, const char *name, struct vnode *filevn)
+{
+	struct tmpfs_node *dir = dirvn->vn_data;
+	struct tmpfs *tf = dir->tn_fs;
+	struct tmpfs_node *tn;
+	int result;
+
+	if (filevn->vn_fs != dirvn->vn_fs) {
+		return EXDEV;
+	}
+	tn = filevn->vn_data;
+	if (tn->tn_type == S_IFDIR) {
+		return EISDIR;
+	}
+
+	result = tmpfs_checkname(name);
+	if (result) {
+		return result;
+	}
+
+	lock_acquire(tf->tf_lock);
+	if (dir->tn_nlink == 0) {
+		lock_release(tf->tf_lock);
+		return ENOENT;
+	}
+	if (tmpfs_dir_find(dir, name) != NULL) {
+		lock_release(tf->tf_lock);
+		return EEXIST;
+	}
+	result = tmpfs_dir_add(dir, name, tn);
+	if (result) {
+		lock_release(tf->tf_lock);
+		return result;
+	}
+	if (tn->tn_nlink == 0) {
+		/* Named again after being removed */
+		VOP_INCREF(&tn->tn_vnode);
+	}
+	tn->tn_nlink++;
+
+	lock_release(tf->tf_lock);
+	return 0;
+}
+
+static
+int
+tmpfs_remove(struct vnode *dirvn, const char *name)
+{
+	struct tmpfs_node *dir = dirvn->vn_data;
+	struct tmpfs *tf = dir->tn_fs;
+	struct tmpfs_dirent *td;
+	struct tmpfs_node *tn;
+	bool gone;
+
+	if (!strcmp(name, ".") || !strcmp(name, "..")) {
+		return EINVAL;
+	}
+
+	lock_acquire(tf->tf_lock);
+	td = tmpfs_dir_find(dir, name);
+	if (td == NULL) {
+		lock_release(tf->tf_lock);
+		return ENOENT;
+	}
+	tn = td->td_node;
+	if (tn->tn_type == S_IFDIR) {
+		lock_release(tf->tf_lock);
+		return EISDIR;
+	}
+	tmpfs_dir_remove(dir, name);
+	gone = tmpfs_unlink(tn);
+	lock_release(tf->tf_lock);
+
+	if (gone) {
+		VOP_DECREF(&tn->tn_vnode);
+	}
+	return 0;
+}
+
+static
+int
+tmpfs_rmdir(struct vnode *dirvn, const char *name)
+{
+	struct tmpfs_node *dir = dirvn->vn_data;
+	struct tmpfs *tf = dir->tn_fs;
+	struct tmpfs_dirent *td;
+	struct tmpfs_node *tn;
+	bool gone;
+
+	if (!strcmp(name, ".")) {
+		return EINVAL;
+	}
+	if (!strcmp(name, "..")) {
+		return ENOTEMPTY;
+	}
+
+	lock_acquire(tf->tf_lock);
+	td = tmpfs_dir_find(dir, name);
+	if (td == NULL) {
+		lock_release(tf->tf_lock);
+		return ENOENT;
+	}
+	tn = td->td_node;
+	if (tn->tn_type != S_IFDIR) {
+		lock_release(tf->tf_lock);
+		return ENOTDIR;
+	}
+	if (tn->tn_nentries > 0) {
+		lock_release(tf->tf_lock);
+		return ENOTEMPTY;
+	}
+	tmpfs_dir_remove(dir, name);
+	gone = tmpfs_unlink(tn);
+	KASSERT(gone);
+	lock_release(tf->tf_lock);
+
+	VOP_DECREF(&tn->tn_vnode);
+	return 0;
+}
+
+/*
+ * Rename. If the target exists it's replaced: its entry is pointed at
+ * the source, so nothing needs to be allocated, and otherwise the new
+ * entry is made before the old one is removed; either way a failure
+ * leaves things as they were.
+ */
+static
+int
+tmpfs_rename(struct vnode *dirvn1, const char *name1,
+	     struct vnode *dirvn2, const char *name2)
+{
+	struct tmpfs_node *dir1 = dirvn1->vn_data;
+	struct tmpfs_node *dir2 = dirvn2->vn_data;
+	struct tmpfs *tf = dir1->tn_fs;
+	struct tmpfs_dirent *td1, *td2;
+	struct tmpfs_node *tn, *target, *up;
+	bool gone;
+	int result;
+
+	if (dirvn1->vn_fs != dirvn2->vn_fs) {
+		return EXDEV;
+	}
+	if (!strcmp(name1, ".") || !strcmp(name1, "..")) {
+		return EINVAL;
+	}
+	result = tmpfs_checkname(name2);
+	if (result) {
+		return result == EEXIST ? EINVAL : result;
+	}
+
+	lock_acquire(tf->tf_lock);
+
+	td1 = tmpfs_dir_find(dir1, name1);
+	if (td1 == NULL) {
+		result = ENOENT;
+		goto out;
+	}
+	tn = td1->td_node;
+	if (dir2->tn_nlink == 0) {
+		result = ENOENT;
+		goto out;
+	}
+
+	/* A directory can't go inside itself */
+	if (tn->tn_type == S_IFDIR) {
+		for (up = dir2; up != tf->tf_root; up = up->tn_parent) {
+			if (up == tn) {
+				result = EINVAL;
+				goto out;
+			}
+		}
+	}
+
+	td2 = tmpfs_dir_find(dir2, name2);
+	target = td2 != NULL ? td2->td_node : NULL;
+	if (target == tn) {
+		/* Same thing; nothing to do */
+		result = 0;
+		goto out;
+	}
+	if (target != NULL) {
+		if (tn->tn_type == S_IFDIR && target->tn_type != S_IFDIR) {
+			result = ENOTDIR;
+			goto out;
+		}
+		if (tn->tn_type != S_IFDIR && target->tn_type == S_IFDIR) {
+			result = EISDIR;
+			goto out;
+		}
+		if (target->tn_nentries > 0) {
+			result = ENOTEMPTY;
+			goto out;
+		}
+		td2->td_node = tn;
+		if (tn->tn_type == S_IFDIR) {
+			target->tn_dirent = NULL;
+			tn->tn_dirent = td2;
+		}
+	}
+	else {
+		result = tmpfs_dir_add(dir2, name2, tn);
+		if (result) {
+			goto out;
+		}
+	}
+
+	tmpfs_dir_remove(dir1, name1);
+	if (tn->tn_type == S_IFDIR) {
+		tn->tn_parent = dir2;
+	}
+
+	gone = target != NULL && tmpfs_unlink(target);
+	lock_release(tf->tf_lock);
+
+	if (gone) {
+		VOP_DECREF(&target->tn_vnode);
+	}
+	return 0;
+
+ out:
+	lock_release(tf->tf_lock);
+	return result;
+}
+
+static
+int
+tmpfs_lookup(struct vnode *dirvn, char *path, struct vnode **ret)
+{
+	struct tmpfs_node *dir = dirvn->vn_data;
+	struct tmpfs *tf = dir->tn_fs;
+	struct tmpfs_node *tn;
+	int result;
+
+	lock_acquire(tf->tf_lock);
+	result = tmpfs_walk(dir, path, &tn);
+	if (result == 0) {
+		VOP_INCREF(&tn->tn_vnode);
+		*ret = &tn->tn_vnode;
+	}
+	lock_release(tf->tf_lock);
+	return result;
+}
+
+/*
+ * Split off the last component of PATH into BUF and look up the rest.
+ */
+static
+int
+tmpfs_lookparent(struct vnode *dirvn, char *path, struct vnode **ret,
+		 char *buf, size_t buflen)
+{
+	struct tmpfs_node *dir = dirvn->vn_data;
+	struct tmpfs *tf = dir->tn_fs;
+	struct tmpfs_node *parent;
+	char *name, *s;
+	size_t len;
+	int result;
+
+	len = strlen(path);
+	while (len > 1 && path[len - 1] == '/') {
+		path[--len] = 0;
+	}
+	s = strrchr(path, '/');
+	if (s != NULL) {
+		*s = 0;
+		name = s + 1;
+	}
+	else {
+		name = path;
+	}
+	if (strlen(name) + 1 > buflen) {
+		return ENAMETOOLONG;
+	}
+
+	lock_acquire(tf->tf_lock);
+	parent = dir;
+	result = s != NULL ? tmpfs_walk(dir, path, &parent) : 0;
+	if (result == 0 && parent->tn_type != S_IFDIR) {
+		result = ENOTDIR;
+	}
+	if (result == 0) {
+		VOP_INCREF(&parent->tn_vnode);
+		*ret = &parent->tn_vnode;
+	}
+	lock_release(tf->tf_lock);
+
+	if (result == 0) {
+		strcpy(buf, name);
+	}
+	return result;
+}
+
+////////////////////////////////////////////////////////////
+// vnode ops tables
+
+/*
+ * Vnode ops table for directories.
+ */
+static const struct vnode_ops tmpfs_dirops = {
+	.vop_magic = VOP_MAGIC,
+
+	.vop_eachopen = tmpfs_eachopen,
+	.vop_reclaim = tmpfs_reclaim,
+
+	.vop_read = vopfail_uio_isdir,
+	.vop_readlink = vopfail_uio_isdir,
+	.vop_getdirentry = tmpfs_getdirentry,
+	.vop_write = vopfail_uio_isdir,
+	.vop_ioctl = tmpfs_ioctl,
+	.vop_stat = tmpfs_stat,
+	.vop_gettype = tmpfs_gettype,
+	.vop_isseekable = tmpfs_isseekable,
+	.vop_fsync = tmpfs_fsync,
+	.vop_mmap = vopfail_mmap_isdir,
+	.vop_truncate = vopfail_truncate_isdir,
+	.vop_namefile = tmpfs_namefile,
+
+	.vop_creat = tmpfs_creat,
+	.vop_symlink = vopfail_symlink_nosys,
+	.vop_mkdir = tmpfs_mkdir,
+	.vop_link = tmpfs_link,
+	.vop_remove = tmpfs_remove,
+	.vop_rmdir = tmpfs_rmdir,
+	.vop_rename = tmpfs_rename,
+	.vop_lookup = tmpfs_lookup,
+	.vop_lookparent = tmpfs_lookparent,
+};
+
+/*
+ * Vnode ops table for regular files.
+ */
+static const struct vnode_ops tmpfs_fileops = {
+	.vop_magic = VOP_MAGIC,
+
+	.vop_eachopen = tmpfs_eachopen,
+	.vop_reclaim = tmpfs_reclaim,
+
+	.vop_read = tmpfs_read,
+	.vop_readlink = vopfail_uio_inval,
+	.vop_getdirentry = vopfail_uio_notdir,
+	.vop_write = tmpfs_write,
+	.vop_ioctl = tmpfs_ioctl,
+	.vop_stat = tmpfs_stat,
+	.vop_gettype = tmpfs_gettype,
+	.vop_isseekable = tmpfs_isseekable,
+	.vop_fsync = tmpfs_fsync,
+	.vop_mmap = vopfail_mmap_nosys,
+	.vop_truncate = tmpfs_truncate,
+	.vop_namefile = vopfail_uio_notdir,
+
+	.vop_creat = vopfail_creat_notdir,
+	.vop_symlink = vopfail_symlink_notdir,
+	.vop_mkdir = vopfail_mkdir_notdir,
+	.vop_link = vopfail_link_notdir,
+	.vop_remove = vopfail_string_notdir,
+	.vop_rmdir = vopfail_string_notdir,
+	.vop_rename = vopfail_rename_notdir,
+	.vop_lookup = vopfail_lookup_notdir,
+	.vop_lookparent = vopfail_lookparent_notdir,
+};
@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _BUF_H_
+#define _BUF_H_
+
+#include <types.h>
+
+struct device;
+struct uio;
+
+/*
+ * Buffer cache
+ *
+ * A fixed pool of block buffers sitting between block filesystems and
+ * their devices. Buffers are named by (device, block number), found
+ * through a hash table, and recycled least recently used first.
+ *
+ * A buffer handed out by buf_read or buf_get belongs to the caller
+ * alone (it's "busy") until buf_release; busy buffers are pinned and
+ * never recycled. Modified buffers are marked dirty and written back
+ * when recycled, by buf_sync or buf_flush, or by the syncer thread
+ * once they've been dirty for BUF_MAXAGE seconds or too many buffers
+ * are dirty.
+ *
+ * A journaling filesystem pins the buffers holding its metadata
+ * changes (buf_pin). Pinned buffers are dirty but are never written
+ * back or recycled until the filesystem has logged them and unpins
+ * them (buf_unpin).
+ */
+
+/* Bytes per buffer; devices must have this block size */
+#define BUF_SIZE      512
+/* Number of buffers in the cache */
+#define BUF_NBUFS     128
+/* Number of hash chains */
+#define BUF_HASHSIZE  61
+/* Number of pending read-ahead requests */
+#define BUF_RAQUEUE   16
+/* Seconds a buffer may stay dirty before the syncer writes it */
+#define BUF_MAXAGE    5
+/* Syncer starts writing when this many buffers are dirty... */
+#define BUF_DIRTYHIGH (BUF_NBUFS / 2)
+/* ...and stops when it's down to this many */
+#define BUF_DIRTYLOW  (BUF_NBUFS / 4)
+/* Seconds between full syncs (for metadata held by filesystems) */
+#define BUF_SYNCPERIOD 30
+
+struct buf {
+	struct device *b_dev;		/* Device, or NULL if unused */
+	daddr_t b_block;		/* Block number on b_dev */
+	bool b_valid;			/* b_data holds the block's contents */
+	bool b_dirty;			/* b_data needs writing back */
+	bool b_busy;			/* Held by someone */
+	bool b_pinned;			/* Dirty, and mustn't be written yet */
+	time_t b_dirtysince;		/* When b_dirty was last set */
+	void *b_data;			/* BUF_SIZE bytes */
+	struct buf *b_hashnext;		/* Hash chain */
+	struct buf *b_lruprev;		/* LRU links (idle buffers only) */
+	struct buf *b_lrunext;
+};
+
+/* Call once during system startup */
+void buf_bootstrap(void);
+
+/* Start the read-ahead and syncer threads; call once threads work */
+void buf_startthreads(void);
+
+/* Get the buffer for a block with its contents read in */
+int buf_read(struct device *dev, daddr_t block, struct buf **ret);
+
+/*
+ * Get the buffer for a block without reading it, for callers that
+ * are about to overwrite the whole block. The contents are garbage
+ * unless b_valid is set.
+ */
+int buf_get(struct device *dev, daddr_t block, struct buf **ret);
+
+/*
+ * Check if a block is in the cache (or on its way in). This is only
+ * a hint; it may be out of date as soon as it returns.
+ */
+bool buf_cached(struct device *dev, daddr_t block);
+
+/*
+ * Ask for NBLOCKS blocks starting at BLOCK to be read into the cache
+ * in the background. This is only a hint and may be ignored.
+ */
+void buf_prefetch(struct device *dev, daddr_t block, unsigned nblocks);
+
+/* Get at a buffer's data */
+void *buf_map(struct buf *b);
+
+/* Note that a held buffer's data was changed (and is now valid) */
+void buf_markdirty(struct buf *b);
+
+/* Like buf_markdirty, and also pin the buffer */
+void buf_pin(struct buf *b);
+
+/* Unpin a block's buffer; it stays dirty */
+void buf_unpin(struct device *dev, daddr_t block);
+
+/*
+ * List up to MAX pinned blocks of a device into BLOCKS (which may be
+ * NULL if MAX is 0). Returns the total number pinned.
+ */
+unsigned buf_pinlist(struct device *dev, daddr_t *blocks, unsigned max);
+
+/* Give back a buffer from buf_read or buf_get */
+void buf_release(struct buf *b);
+
+/* Forget a block's contents, e.g. because it was freed */
+void buf_drop(struct device *dev, daddr_t block);
+
+/*
+ * Transfer NBLOCKS blocks starting at BLOCK straight between the
+ * device and UIO, in one device request, without copying through
+ * buffers. Cached copies are kept coherent: dirty ones are written
+ * back first when reading, and all are dropped when writing. The
+ * caller must keep other filesystem I/O off those blocks meanwhile;
+ * read-ahead is kept off them here.
+ */
+int buf_directio(struct device *dev, daddr_t block, unsigned nblocks,
+		 struct uio *uio);
+
+/* Write back all dirty buffers for a device, except pinned ones */
+int buf_sync(struct device *dev);
+
+/* Write back one block now if it's cached, dirty and not pinned */
+int buf_flush(struct device *dev, daddr_t block);
+
+/*
+ * Forget all of a device's buffers; they must be clean. Also cancels
+ * any read-ahead for the device.
+ */
+void buf_dropdev(struct device *dev);
+
+/* Print hit/miss and I/O counts */
+void buf_printstats(void);
+
+#endif /* _BUF_H_ */
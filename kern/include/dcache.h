@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _DCACHE_H_
+#define _DCACHE_H_
+
+#include <types.h>
+
+struct fs;
+struct vnode;
+
+/*
+ * Name lookup cache.
+ *
+ * Remembers what each name in a directory looked up to, so repeated
+ * path lookups don't need to go to the filesystem. vfs_lookup and
+ * vfs_lookparent walk paths a component at a time through it.
+ * Entries can also be negative, recording that a name isn't there.
+ *
+ * An entry holds a reference to its directory and (if positive) to
+ * what the name refers to, so the vnode pointers in the cache stay
+ * valid. The cache has a fixed number of entries, reused least
+ * recently used first, which bounds what it keeps in memory.
+ *
+ * The VFS calls dcache_invalidate both before and after anything that
+ * changes a directory (create, remove, link, rename, mkdir, rmdir),
+ * whether or not it works, and dcache_purgefs before unmounting. A
+ * lookup that went to the filesystem only enters its result if
+ * nothing was invalidated in the meantime, checked with the
+ * generation number from dcache_gen; the second invalidation catches
+ * lookups that got their generation while the change was under way.
+ *
+ * A filesystem can limit how many of its vnodes are held (see
+ * fs_dcachemax in fs.h); past that, a new positive entry there
+ * replaces the least recently used one in the same filesystem.
+ *
+ * "." and "..", names longer than DCACHE_NAMELEN, and lookups in
+ * devices are never cached.
+ */
+
+/* Number of entries */
+#define DCACHE_NENTRIES  256
+/* Number of hash chains */
+#define DCACHE_HASHSIZE  127
+/* Longest name that can be cached */
+#define DCACHE_NAMELEN   31
+
+struct dcache_entry {
+	struct vnode *de_dir;		/* Directory, or NULL if unused */
+	struct vnode *de_vn;		/* What NAME is, or NULL if nothing */
+	char de_name[DCACHE_NAMELEN+1];
+	struct dcache_entry *de_hashnext;	/* Hash chain */
+	struct dcache_entry *de_lruprev;	/* LRU links */
+	struct dcache_entry *de_lrunext;
+};
+
+/* Call once during system startup */
+void dcache_bootstrap(void);
+
+/*
+ * Look NAME up in DIR. Returns false if there's nothing cached.
+ * Otherwise returns true and hands back the vnode, with a reference
+ * added, or NULL if the name is known not to exist.
+ */
+bool dcache_lookup(struct vnode *dir, const char *name, struct vnode **ret);
+
+/* Current generation; get it before going to the filesystem */
+unsigned dcache_gen(void);
+
+/* Remember a lookup result (VN NULL for ENOENT) got since GEN */
+void dcache_enter(struct vnode *dir, const char *name, struct vnode *vn,
+		  unsigned gen);
+
+/* Forget NAME in DIR, and whatever is cached inside what it named */
+void dcache_invalidate(struct vnode *dir, const char *name);
+
+/* Forget everything in filesystem FS */
+void dcache_purgefs(struct fs *fs);
+
+/* Print statistics */
+void dcache_printstats(void);
+
+#endif /* _DCACHE_H_ */
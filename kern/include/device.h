@@ -34,8 +34,21 @@
  * Devices.
  */
 
+#include <spinlock.h>
+#include <kern/iostat.h>
 
 struct uio;  /* in <uio.h> */
+struct timespec;  /* in <kern/time.h> */
+
+/*
+ * I/O statistics. Drivers that queue requests report them with
+ * devstat_queued and devstat_done; the counters are in the form
+ * handed out by the "iostat:" device (is_name is left empty).
+ */
+struct devstat {
+	struct spinlock ds_lock;
+	struct iostat ds_io;
+};
 
 /*
  * Filesystem-namespace-accessible device.
@@ -49,6 +62,8 @@ struct device {
 	dev_t d_devnumber;	/* serial number for this device */
 
 	void *d_data;		/* device-specific data */
+
+	struct devstat d_stat;	/* set up by vfs_adddev */
 };
 
 /*
@@ -79,6 +94,40 @@ void dev_uncreate_vnode(struct vnode *vn);
 
 /* Initialization functions for builtin vfs-level devices. */
 void devnull_create(void);
+void devstat_create(void);
+
+/*
+ * Make a new RAM disk of KBYTES kilobytes, named ramdisk0, ramdisk1,
+ * and so on. Its name is put in NAME (which holds LEN bytes).
+ */
+int ramdisk_create(uint32_t kbytes, char *name, size_t len);
+
+/*
+ * Make a striped disk (options raid) over the lhd disks numbered
+ * UNITS[0] to UNITS[NUNITS-1], in that order, with STRIPESECTS-sector
+ * stripes. It's named raid0, raid1, and so on; the name is put in
+ * NAME (which holds LEN bytes). The member disks mustn't be mounted.
+ */
+int raid_create(uint32_t stripesects, const unsigned *units,
+		unsigned nunits, char *name, size_t len);
+
+/*
+ * I/O statistics.
+ *    devstat_init    - clear the counters; done by vfs_adddev.
+ *    devstat_queued  - note that a request was queued.
+ *    devstat_done    - note that a request finished, given when it
+ *                      was queued and when the device started on it.
+ *                      May be called from an interrupt handler.
+ *    devstat_get     - copy out the counters.
+ *    devstat_printall - print stats for all block devices.
+ */
+void devstat_init(struct device *d);
+void devstat_queued(struct device *d);
+void devstat_done(struct device *d, bool write, uint32_t nsect, int result,
+		  const struct timespec *queued,
+		  const struct timespec *started);
+void devstat_get(struct device *d, struct iostat *ret);
+void devstat_printall(void);
 
 /* Function that kicks off device probe and attach. */
 void dev_bootstrap(void);
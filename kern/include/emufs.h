@@ -37,6 +37,9 @@
 #include <fs.h>
 #include <vnode.h>
 
+/* Most vnodes the name cache may hold on to */
+#define EMUFS_DCACHEMAX  32
+
 /*
  * Our structures
  */
@@ -45,6 +48,28 @@ struct emufs_vnode {
 	struct vnode ev_v;		/* abstract vnode structure */
 	struct emu_softc *ev_emu;	/* device */
 	uint32_t ev_handle;		/* file handle */
+	char *ev_path;			/* path from the root */
+
+	/* Cached size and contents (see emu.c) */
+	struct lock *ev_lock;		/* protects the following */
+	bool ev_sizevalid;		/* ev_size is known */
+	off_t ev_size;			/* file size */
+	unsigned ev_maxpages;		/* length of ev_pages */
+	/* and with e_cachelock, since other files evict pages */
+	struct emufs_page **ev_pages;	/* NULL if not cached */
+	unsigned ev_npages;		/* pages cached */
+};
+
+/*
+ * A cached page of file data, on its device's LRU list.
+ */
+struct emufs_page {
+	char *ep_data;			/* PAGE_SIZE bytes */
+	struct emufs_vnode *ep_vnode;	/* whose it is */
+	unsigned ep_index;		/* which page of the file */
+	unsigned ep_busy;		/* being read from; don't evict */
+	struct emufs_page *ep_prev;	/* LRU list, newest first */
+	struct emufs_page *ep_next;
 };
 
 struct emufs_fs {
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _EXECCACHE_H_
+#define _EXECCACHE_H_
+
+#include <types.h>
+
+struct vnode;
+
+/*
+ * Exec image cache
+ *
+ * Keeps the parsed ELF layout of recently executed files, and when
+ * there is room the file contents of their segments, hanging off
+ * the file's vnode. load_elf uses it to skip header parsing and file
+ * reads on repeat execs. An image is dropped when the file is
+ * written or truncated (see VOP_WRITE and VOP_TRUNCATE) or when the
+ * vnode is reclaimed. Segment data is bounded by EXECCACHE_MAXBYTES
+ * and evicted least recently used first.
+ */
+
+/* Most loadable segments an executable can have and still be cached */
+#define EXECIMAGE_MAXSEGS  8
+/* Total bytes of cached segment contents */
+#define EXECCACHE_MAXBYTES (256 * 1024)
+/* Largest single segment whose contents are cached */
+#define EXECCACHE_MAXSEG   (64 * 1024)
+
+struct execseg {
+	off_t es_offset;	/* Offset in file */
+	vaddr_t es_vaddr;	/* Where it goes in the address space */
+	size_t es_memsize;
+	size_t es_filesize;
+	int es_flags;		/* PF_R, PF_W, PF_X */
+	void *es_data;		/* File contents, or NULL to read the file */
+};
+
+struct execimage {
+	struct vnode *ei_vnode;		/* Vnode cached on; NULL once dropped */
+	unsigned ei_refcount;		/* Vnode's reference plus loaders */
+	bool ei_ready;			/* Fully built and usable */
+	bool ei_failed;			/* Can't be cached (too many segs) */
+	vaddr_t ei_entry;		/* Entry point */
+	unsigned ei_nsegs;
+	struct execseg ei_segs[EXECIMAGE_MAXSEGS];
+	size_t ei_bytes;		/* Bytes of segment data held */
+	struct execimage *ei_prev;	/* LRU links */
+	struct execimage *ei_next;
+};
+
+/* Call once during system startup */
+void execcache_bootstrap(void);
+
+/*
+ * Find the cached image for V. Returns a ready image (BUILD false)
+ * for the caller to load from, or a new empty image (BUILD true) for
+ * the caller to fill in while loading the file normally and then
+ * pass to execcache_done, or NULL if another thread is building one.
+ */
+struct execimage *execcache_get(struct vnode *v, bool *build);
+
+/* Finish building an image; OK false throws it away */
+void execcache_done(struct execimage *img, bool ok);
+
+/* Release a ready image obtained from execcache_get */
+void execcache_release(struct execimage *img);
+
+/* Drop any image cached for V; called when V changes or goes away */
+void execcache_invalidate(struct vnode *v);
+
+#endif /* _EXECCACHE_H_ */
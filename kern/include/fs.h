@@ -37,11 +37,18 @@ struct vnode; /* in vnode.h */
  * Abstract file system. (Or device accessible as a file.)
  *
  * fs_data is a pointer to filesystem-specific data.
+ *
+ * fs_dcachemax limits how many of the filesystem's vnodes the name
+ * cache (dcache.h) may hold references to at once, for filesystems
+ * where an idle vnode is expensive to keep; 0 means no limit.
+ * fs_dcacheheld is the count, kept by the name cache.
  */
 
 struct fs {
 	void *fs_data;
 	const struct fs_ops *fs_ops;
+	unsigned fs_dcachemax;
+	unsigned fs_dcacheheld;
 };
 
 /*
@@ -87,5 +94,8 @@ struct fs_ops {
 /* Initialization functions for builtin fake file systems. */
 void semfs_bootstrap(void);
 
+/* Make a new, empty in-memory filesystem (tmpfs) called NAME:. */
+int tmpfs_mount(const char *name);
+
 
 #endif /* _FS_H_ */
@@ -34,6 +34,12 @@
  * ioctl operation codes
  */
 
-/* (none yet) */
+/* Console input mode; the argument points to an int */
+#define TIOCGMODE   1	/* get mode */
+#define TIOCSMODE   2	/* set mode */
+
+/* Console input modes */
+#define TTY_RAW     0	/* characters as typed, no echo (the default) */
+#define TTY_CANON   1	/* whole lines, edited and echoed by the kernel */
 
 #endif /* _KERN_IOCTL_H_*/
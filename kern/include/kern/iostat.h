@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KERN_IOSTAT_H_
+#define _KERN_IOSTAT_H_
+
+/*
+ * Per-device I/O statistics, as read from the "iostat:" device. Each
+ * read returns whole struct iostat records, one per block device.
+ *
+ * Wait time is from when a request is queued until the device starts
+ * on it; service time is from then until it finishes. The histogram
+ * counts requests by total latency (wait plus service): bucket 0 is
+ * under 2 microseconds, bucket i covers [2^i, 2^(i+1)) microseconds,
+ * and the last bucket also takes everything slower.
+ */
+
+#define IOSTAT_NAMELEN   16
+#define IOSTAT_NBUCKETS  20
+
+struct iostat {
+	char is_name[IOSTAT_NAMELEN];	/* Device name */
+	uint64_t is_reads;		/* Read requests finished */
+	uint64_t is_writes;		/* Write requests finished */
+	uint64_t is_rsectors;		/* Sectors read */
+	uint64_t is_wsectors;		/* Sectors written */
+	uint64_t is_errors;		/* Requests that failed */
+	uint64_t is_waitns;		/* Total wait time */
+	uint64_t is_servicens;		/* Total service time */
+	uint32_t is_depth;		/* Requests queued or in progress now */
+	uint32_t is_maxdepth;		/* Most ever at once */
+	uint32_t is_hist[IOSTAT_NBUCKETS];
+};
+
+#endif /* _KERN_IOSTAT_H_ */
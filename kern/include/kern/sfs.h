@@ -41,14 +41,17 @@
 #define SFS_VOLNAME_SIZE  32            /* max length of volume name */
 #define SFS_NDIRECT       15            /* # of direct blocks in inode */
 #define SFS_NINDIRECT     1             /* # of indirect blocks in inode */
-#define SFS_NDINDIRECT    0             /* # of 2x indirect blocks in inode */
-#define SFS_NTINDIRECT    0             /* # of 3x indirect blocks in inode */
+#define SFS_NDINDIRECT    1             /* # of 2x indirect blocks in inode */
+#define SFS_NTINDIRECT    1             /* # of 3x indirect blocks in inode */
 #define SFS_DBPERIDB      128           /* # direct blks per indirect blk */
 #define SFS_NAMELEN       60            /* max length of filename */
 #define SFS_SUPER_BLOCK   0             /* block the superblock lives in */
 #define SFS_FREEMAP_START 2             /* 1st block of the freemap */
 #define SFS_NOINO         0             /* inode # for free dir entry */
 #define SFS_ROOTDIR_INO   1             /* loc'n of the root dir inode */
+#define SFS_JOURNAL_MAGIC 0x6a6f726e    /* magic number for journal blocks */
+#define SFS_JB_MAXBLOCKS  124           /* # blocks listed per descriptor */
+#define SFS_JOURNAL_MINBLOCKS 32        /* smallest usable journal */
 
 /* Number of bits in a block */
 #define SFS_BITSPERBLOCK (SFS_BLOCKSIZE * CHAR_BIT)
@@ -67,6 +70,11 @@
 #define SFS_TYPE_FILE     1
 #define SFS_TYPE_DIR      2
 
+/* Journal block types for jb_type */
+#define SFS_JB_HEADER     1       /* First block of the journal */
+#define SFS_JB_DESC       2       /* Lists the blocks that follow it */
+#define SFS_JB_COMMIT     3       /* Ends a complete transaction */
+
 /*
  * On-disk superblock
  */
@@ -74,7 +82,9 @@ struct sfs_superblock {
 	uint32_t sb_magic;		/* Magic number; should be SFS_MAGIC */
 	uint32_t sb_nblocks;			/* Number of blocks in fs */
 	char sb_volname[SFS_VOLNAME_SIZE];	/* Name of this volume */
-	uint32_t reserved[118];			/* unused, set to 0 */
+	uint32_t sb_journalstart;		/* First journal block, or 0 */
+	uint32_t sb_journalblocks;		/* Size of journal in blocks */
+	uint32_t reserved[116];			/* unused, set to 0 */
 };
 
 /*
@@ -86,7 +96,9 @@ struct sfs_dinode {
 	uint16_t sfi_linkcount;			/* # hard links to this file */
 	uint32_t sfi_direct[SFS_NDIRECT];	/* Direct blocks */
 	uint32_t sfi_indirect;			/* Indirect block */
-	uint32_t sfi_waste[128-3-SFS_NDIRECT];	/* unused space, set to 0 */
+	uint32_t sfi_dindirect;			/* Double indirect block */
+	uint32_t sfi_tindirect;			/* Triple indirect block */
+	uint32_t sfi_waste[128-5-SFS_NDIRECT];	/* unused space, set to 0 */
 };
 
 /*
@@ -97,5 +109,27 @@ struct sfs_direntry {
 	char sfd_name[SFS_NAMELEN];		/* Filename */
 };
 
+/*
+ * Metadata journal
+ *
+ * The journal is a run of sb_journalblocks blocks starting at
+ * sb_journalstart, marked in use in the freemap. Its first block is
+ * a header whose jb_seq is the sequence number of the transaction
+ * that may follow it. A transaction is one or more descriptor blocks,
+ * each followed by copies of the blocks it lists, and then a commit
+ * block whose jb_nblocks is the total number of blocks logged. All
+ * blocks of a transaction carry its sequence number. A transaction
+ * whose commit block made it to disk is written to the blocks' home
+ * locations at mount time; after that, or after the transaction has
+ * been written home normally, the header's jb_seq is advanced.
+ */
+struct sfs_jblock {
+	uint32_t jb_magic;			/* SFS_JOURNAL_MAGIC */
+	uint32_t jb_type;			/* One of SFS_JB_* above */
+	uint32_t jb_seq;			/* Transaction sequence number */
+	uint32_t jb_nblocks;			/* Blocks listed or logged */
+	uint32_t jb_blocks[SFS_JB_MAXBLOCKS];	/* Home locations */
+};
+
 
 #endif /* _KERN_SFS_H_ */
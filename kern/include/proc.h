@@ -35,10 +35,6 @@
 #define FDINLINE INLINE
 #endif
 
-#ifndef CPINLINE
-#define CPINLINE INLINE
-#endif
-
 /*
  * Definition of a process.
  *
@@ -51,7 +47,7 @@
 
 struct addrspace;
 struct thread;
-struct semaphore;
+struct cv;
 struct vnode;
 struct lock;
 struct fd;
@@ -62,12 +58,6 @@ struct fd;
 DECLARRAY(fd, FDINLINE);
 DEFARRAY(fd, FDINLINE);
 
-/* 
- * Child Processes array
- */
-DECLARRAY_BYTYPE(cparray, struct proc, CPINLINE);
-DEFARRAY_BYTYPE(cparray, struct proc, CPINLINE);
-
 /*
  * Process structure.
  *
@@ -101,8 +91,19 @@ struct proc {
 	/* VFS */
 	struct vnode *p_cwd;		/* current working directory */
 
-	/* Child process array */
-	struct cparray *cps;
+	/* 
+	 * Parent/child links; protected by the proc wait lock.
+	 * A child sits on its parent's p_children list while it 
+	 * runs and moves to p_zombies when it exits. Children are
+	 * looked up by pid through the process table.
+	 */
+	struct proc *p_parent;
+	struct proc *p_sibprev;
+	struct proc *p_sibnext;
+	struct proc *p_children;	/* Live children */
+	struct proc *p_zombies;		/* Exited children not yet waited for */
+	struct cv *p_waitcv;		/* Signalled when a child exits */
+	bool p_orphan;			/* Parent exited; reap self on exit */
 
 	/* File descriptor table */
 	struct fdarray *fds;
@@ -110,7 +111,6 @@ struct proc {
 	/* Handle exit */
 	bool exited;
 	int exit_val;
-	struct semaphore *exit_sem;
 };
 
 /* This is the process structure for the kernel and for kernel-only threads. */
@@ -128,7 +128,7 @@ struct proc *proc_create(const char *name);
 /* Create a fresh process for use by runprogram(). */
 struct proc *proc_create_runprogram(const char *name);
 
-/* Exit a process: leaves barebones for parent proc */
+/* Exit a process: leaves a zombie for the parent proc, or reaps it if orphaned */
 void proc_exit(struct proc *proc);
 
 /* Destroy a process. */
@@ -143,6 +143,12 @@ void proc_remthread(struct thread *t);
 /* Get an available pid from the process table */
 int proc_setpid(struct proc *proc);
 
+/* Make child a child of parent */
+void proc_addchild(struct proc *parent, struct proc *child);
+
+/* Wait for a child to exit and detach it from parent */
+int proc_waitchild(struct proc *parent, pid_t pid, bool nohang, struct proc **ret);
+
 /* Fetch the address space of the current process. */
 struct addrspace *proc_getas(void);
 
@@ -12,6 +12,8 @@ void sys_bootstrap(void);
 int sys_fork(struct trapframe *c_tf, int32_t *ret);
 /* Execv */
 int sys_execv(const_userptr_t progname, userptr_t args);
+/* spawn */
+int sys_spawn(const_userptr_t progname, userptr_t args, const_userptr_t actions, int nactions, int32_t *ret);
 /* waitpid */
 int sys_waitpid(pid_t pid, userptr_t status, int options, int32_t *ret);
 /* _exit */
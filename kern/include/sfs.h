@@ -48,14 +48,65 @@
  */
 #include <kern/sfs.h>
 
+struct lock;	/* in <synch.h> */
+struct cv;	/* in <synch.h> */
+struct sfs_dirindex;	/* in sfs_dir.c */
+
+/*
+ * Locking
+ *
+ * sv_lock protects a vnode's inode (sv_i, sv_dirty) and the file or
+ * directory contents it maps. sfs_vnlock protects the table of loaded
+ * vnodes, sfs_freemaplock the freemap. sfs_renamelock is held across
+ * a whole rename. The superblock doesn't change while mounted.
+ *
+ * On a journaled volume, every operation that changes metadata runs
+ * between sfs_jbegin and sfs_jend, which work like a lock shared by
+ * operations and taken exclusively by a journal commit. Operations
+ * must not nest, and must drop their vnode references after sfs_jend
+ * (reclaiming a vnode is itself an operation). sfs_jlock protects the
+ * rest of the journal state, except sfs_jnew and sfs_jfreed, which go
+ * with the freemap. So do sfs_resmap and sfs_allocnext, and a vnode's
+ * sv_resstart and sv_rescount, which also need its sv_lock to change.
+ *
+ * Lock order:
+ *     journal (sfs_jbegin)
+ *     sfs_renamelock
+ *     directory sv_lock (parent before child; otherwise lower
+ *         inode number first)
+ *     file sv_lock (the directory it's being linked into,
+ *         unlinked from or renamed in comes first)
+ *     sfs_vnlock
+ *     sfs_freemaplock
+ *     sfs_jlock
+ *     buffer cache
+ *
+ * None of this needs vfs_biglock.
+ */
+
+/* Number of indirect blocks each vnode remembers (see sfs_bmap.c) */
+#define SFS_IBCACHE 4
+
 /*
  * In-memory inode
  */
 struct sfs_vnode {
 	struct vnode sv_absvn;          /* abstract vnode structure */
+	struct lock *sv_lock;           /* lock for the rest */
 	struct sfs_dinode sv_i;		/* copy of on-disk inode */
 	uint32_t sv_ino;                /* inode number */
 	bool sv_dirty;                  /* true if sv_i modified */
+	struct sfs_dirindex *sv_dirindex; /* directory name index or NULL */
+	struct sfs_vnode *sv_hashnext;  /* vnode table chain */
+	uint32_t sv_ranext;             /* read-ahead: next expected block */
+	uint32_t sv_rawindow;           /* read-ahead: blocks to stay ahead */
+	uint32_t sv_raend;              /* read-ahead: first block not asked for */
+	daddr_t sv_goal;                /* where to put the next block */
+	daddr_t sv_resstart;            /* blocks reserved for appending */
+	unsigned sv_rescount;
+	uint32_t sv_ibkey[SFS_IBCACHE]; /* recently used indirect blocks */
+	daddr_t sv_ibblock[SFS_IBCACHE];
+	unsigned sv_ibnext;             /* next entry to replace */
 };
 
 /*
@@ -66,9 +117,34 @@ struct sfs_fs {
 	struct sfs_superblock sfs_sb;	/* copy of on-disk superblock */
 	bool sfs_superdirty;            /* true if superblock modified */
 	struct device *sfs_device;      /* device mounted on */
-	struct vnodearray *sfs_vnodes;  /* vnodes loaded into memory */
+	struct lock *sfs_vnlock;        /* lock for the vnode table */
+	struct sfs_vnode **sfs_vnhash;  /* loaded vnodes, hashed by inode # */
+	unsigned sfs_vnhashsize;        /* number of chains (power of 2) */
+	unsigned sfs_nvnodes;           /* number of loaded vnodes */
+	struct lock *sfs_freemaplock;   /* lock for the freemap */
 	struct bitmap *sfs_freemap;     /* blocks in use are marked 1 */
 	bool sfs_freemapdirty;          /* true if freemap modified */
+	struct bitmap *sfs_resmap;      /* blocks reserved for appending */
+	daddr_t sfs_allocnext;          /* where to put the next new file */
+	struct lock *sfs_renamelock;    /* serializes rename */
+
+	/* Journal; see sfs_journal.c */
+	bool sfs_journaled;             /* true if metadata is logged */
+	struct lock *sfs_jlock;         /* lock for the journal state */
+	struct cv *sfs_jcv;             /* for waiting on it */
+	unsigned sfs_jactive;           /* operations in progress */
+	bool sfs_jwaiting;              /* commit waiting for them to end */
+	bool sfs_jcommitting;           /* commit in progress */
+	uint32_t sfs_jseq;              /* sequence number of next commit */
+	unsigned sfs_jmaxlog;           /* most blocks one commit can log */
+	unsigned sfs_jlimit;            /* commit when this many are pinned */
+	unsigned sfs_jcap;              /* most that may ever be pinned */
+	daddr_t *sfs_jlog;              /* blocks being logged */
+	daddr_t *sfs_jnew;              /* blocks allocated since commit */
+	unsigned sfs_jnnew;             /* number of entries in sfs_jnew */
+	bool sfs_jnewlost;              /* sfs_jnew overflowed */
+	struct bitmap *sfs_jfreed;      /* blocks freed since commit */
+	unsigned sfs_jnfreed;           /* number of bits set in sfs_jfreed */
 };
 
 /*
@@ -76,5 +152,10 @@ struct sfs_fs {
  */
 int sfs_mount(const char *device);
 
+/*
+ * Function for making an empty sfs volume (calls vfs_format)
+ */
+int sfs_mkfs(const char *device, const char *volname);
+
 
 #endif /* _SFS_H_ */
@@ -45,6 +45,7 @@ struct uio;    /* kernel or userspace I/O buffer (uio.h) */
 struct device; /* abstract structure for a device (dev.h) */
 struct fs;     /* abstract structure for a filesystem (fs.h) */
 struct vnode;  /* abstract structure for an on-disk file (vnode.h) */
+struct iostat; /* per-device I/O statistics (kern/iostat.h) */
 
 /*
  * VFS layer low-level operations.
@@ -55,6 +56,7 @@ struct vnode;  /* abstract structure for an on-disk file (vnode.h) */
  *    vfs_clearcurdir - change current directory of current thread to "none"
  *    vfs_getcurdir - retrieve vnode of current directory of current thread
  *    vfs_sync      - force all dirty buffers to disk
+ *    vfs_getiostats - copy out I/O stats of block devices
  *    vfs_getroot   - get root vnode for the filesystem named DEVNAME
  *    vfs_getdevname - get mounted device name for the filesystem passed in
  */
@@ -63,6 +65,7 @@ int vfs_setcurdir(struct vnode *dir);
 int vfs_clearcurdir(void);
 int vfs_getcurdir(struct vnode **retdir);
 int vfs_sync(void);
+unsigned vfs_getiostats(struct iostat *stats, unsigned max);
 int vfs_getroot(const char *devname, struct vnode **result);
 const char *vfs_getdevname(struct fs *fs);
 
@@ -156,6 +159,10 @@ int vfs_getcwd(struct uio *buf);
  *    vfs_unmount   - Unmount the filesystem presently mounted on the
  *                    specified device.
  *
+ *    vfs_format    - Look up DEVNAME, which must not be mounted, and
+ *                    pass it along with DATA to FORMATFUNC to put a
+ *                    new filesystem on it.
+ *
  *    vfs_swapon    - Look up DEVNAME and mark it as a swap device,
  *                    returning a vnode. Similar to vfs_mount.
  *
@@ -179,6 +186,8 @@ int vfs_mount(const char *devname, void *data,
 			       struct device *dev,
 			       struct fs **result));
 int vfs_unmount(const char *devname);
+int vfs_format(const char *devname, void *data,
+	       int (*formatfunc)(void *data, struct device *dev));
 int vfs_swapon(const char *devname, struct vnode **result);
 int vfs_swapoff(const char *devname);
 int vfs_unmountall(void);
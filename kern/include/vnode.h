@@ -33,6 +33,7 @@
 #include <spinlock.h>
 struct uio;
 struct stat;
+struct execimage;
 
 
 /*
@@ -49,14 +50,16 @@ struct stat;
  * Note: vn_fs may be null if the vnode refers to a device.
  */
 struct vnode {
-	int vn_refcount;                /* Reference count */
-	struct spinlock vn_countlock;   /* Lock for vn_refcount */
+	volatile unsigned vn_refcount;  /* Reference count (atomic.h) */
+	struct spinlock vn_countlock;   /* Lock for vn_image */
 
 	struct fs *vn_fs;               /* Filesystem vnode belongs to */
 
 	void *vn_data;                  /* Filesystem-specific data */
 
 	const struct vnode_ops *vn_ops; /* Functions on this vnode */
+
+	struct execimage *vn_image;     /* Cached exec image; see execcache.h */
 };
 
 /*
@@ -257,11 +260,30 @@ struct vnode_ops {
  */
 void vnode_check(struct vnode *, const char *op);
 
+/*
+ * Hooks for filesystems to call around changing a regular file's
+ * contents (in their write and truncate operations). They drop any
+ * cached exec image of the file, both before and after the change,
+ * so that an exec running concurrently can't cache a half-written
+ * file. vnode_modified returns RESULT. Devices don't need them.
+ */
+void vnode_modify(struct vnode *);
+int vnode_modified(struct vnode *, int result);
+
 /*
  * Reference count manipulation (handled above filesystem level)
+ *
+ * The count is changed with atomic operations, without a lock. When
+ * the last reference goes, vnode_decref doesn't drop it but passes
+ * it to VOP_RECLAIM, which must call vnode_stillbusy while holding
+ * whatever lock the filesystem hands out new references under. If
+ * someone picked the vnode up again in the meantime, that drops the
+ * passed reference and returns true, and VOP_RECLAIM should return
+ * EBUSY; otherwise the caller has the only reference.
  */
 void vnode_incref(struct vnode *);
 void vnode_decref(struct vnode *);
+bool vnode_stillbusy(struct vnode *);
 
 #define VOP_INCREF(vn) 			vnode_incref(vn)
 #define VOP_DECREF(vn) 			vnode_decref(vn)
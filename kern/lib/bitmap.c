@@ -95,29 +95,86 @@ bitmap_getdata(struct bitmap *b)
         return b->v;
 }
 
+/*
+ * Find the first word from IX up to (not including) END with a clear
+ * bit, or return END. Full words are skipped four at a time; that
+ * only asks whether they're all ones, so it doesn't care about byte
+ * order.
+ */
+static
+unsigned
+bitmap_findword(struct bitmap *b, unsigned ix, unsigned end)
+{
+        while (ix < end) {
+                if (ix % sizeof(uint32_t) == 0 &&
+                    ix + sizeof(uint32_t) <= end &&
+                    *(uint32_t *)&b->v[ix] == 0xffffffff) {
+                        ix += sizeof(uint32_t);
+                        continue;
+                }
+                if (b->v[ix] != WORD_ALLBITS) {
+                        return ix;
+                }
+                ix++;
+        }
+        return end;
+}
+
+/*
+ * Set the first clear bit in word IX at or after bit OFFSET, if any.
+ */
+static
+bool
+bitmap_takebit(struct bitmap *b, unsigned ix, unsigned offset,
+               unsigned *index)
+{
+        for (; offset < BITS_PER_WORD; offset++) {
+                WORD_TYPE mask = ((WORD_TYPE)1) << offset;
+
+                if ((b->v[ix] & mask)==0) {
+                        b->v[ix] |= mask;
+                        *index = (ix*BITS_PER_WORD)+offset;
+                        KASSERT(*index < b->nbits);
+                        return true;
+                }
+        }
+        return false;
+}
+
 int
 bitmap_alloc(struct bitmap *b, unsigned *index)
 {
-        unsigned ix;
+        return bitmap_alloc_from(b, 0, index);
+}
+
+int
+bitmap_alloc_from(struct bitmap *b, unsigned start, unsigned *index)
+{
         unsigned maxix = DIVROUNDUP(b->nbits, BITS_PER_WORD);
-        unsigned offset;
+        unsigned startix, ix;
+
+        if (start >= b->nbits) {
+                start = 0;
+        }
+        startix = start / BITS_PER_WORD;
 
-        for (ix=0; ix<maxix; ix++) {
-                if (b->v[ix]!=WORD_ALLBITS) {
-                        for (offset = 0; offset < BITS_PER_WORD; offset++) {
-                                WORD_TYPE mask = ((WORD_TYPE)1) << offset;
-
-                                if ((b->v[ix] & mask)==0) {
-                                        b->v[ix] |= mask;
-                                        *index = (ix*BITS_PER_WORD)+offset;
-                                        KASSERT(*index < b->nbits);
-                                        return 0;
-                                }
-                        }
-                        KASSERT(0);
+        /* The rest of the starting word */
+        if (bitmap_takebit(b, startix, start % BITS_PER_WORD, index)) {
+                return 0;
+        }
+
+        /* Then on to the end, and around to where we started */
+        ix = bitmap_findword(b, startix + 1, maxix);
+        if (ix == maxix) {
+                ix = bitmap_findword(b, 0, startix + 1);
+                if (ix == startix + 1) {
+                        return ENOSPC;
                 }
         }
-        return ENOSPC;
+        if (!bitmap_takebit(b, ix, 0, index)) {
+                KASSERT(0);
+        }
+        return 0;
 }
 
 static
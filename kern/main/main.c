@@ -49,6 +49,8 @@
 #include <syscall.h>
 #include <proc_syscall.h>
 #include <fhandle.h>
+#include <execcache.h>
+#include <buf.h>
 #include <test.h>
 #include <kern/test161.h>
 #include <version.h>
@@ -134,6 +136,8 @@ boot(void)
 	proctable_bootstrap();
 	oft_bootstrap();
 	sys_bootstrap();
+	execcache_bootstrap();
+	buf_startthreads();
 
 	/* Default bootfs - but ignore failure, in case emu0 doesn't exist */
 	vfs_setbootfs("emu0");
@@ -40,11 +40,17 @@
 #include <thread.h>
 #include <proc.h>
 #include <vfs.h>
+#include <buf.h>
+#include <dcache.h>
+#include <device.h>
+#include <fs.h>
 #include <sfs.h>
 #include <syscall.h>
 #include <test.h>
 #include <prompt.h>
 #include "opt-sfs.h"
+#include "opt-tmpfs.h"
+#include "opt-raid.h"
 #include "opt-net.h"
 #include "opt-synchprobs.h"
 #include "opt-automationtest.h"
@@ -384,6 +390,9 @@ static const struct {
 #if OPT_SFS
 	{ "sfs", sfs_mount },
 #endif
+#if OPT_TMPFS
+	{ "tmpfs", tmpfs_mount },
+#endif
 };
 
 static
@@ -437,6 +446,105 @@ cmd_unmount(int nargs, char **args)
 	return vfs_unmount(device);
 }
 
+/*
+ * Command for making a new filesystem on a device.
+ */
+
+/* Table of filesystem types we can make. */
+static const struct {
+	const char *name;
+	int (*func)(const char *device, const char *volname);
+} mkfstable[] = {
+#if OPT_SFS
+	{ "sfs", sfs_mkfs },
+#endif
+};
+
+static
+int
+cmd_mkfs(int nargs, char **args)
+{
+	char *fstype;
+	char *device;
+	unsigned i;
+
+	if (nargs != 4) {
+		kprintf("Usage: mkfs fstype device: volname\n");
+		return EINVAL;
+	}
+
+	fstype = args[1];
+	device = args[2];
+
+	/* Allow (but do not require) colon after device name */
+	if (device[strlen(device)-1]==':') {
+		device[strlen(device)-1] = 0;
+	}
+
+	for (i=0; i<ARRAYCOUNT(mkfstable); i++) {
+		if (!strcmp(mkfstable[i].name, fstype)) {
+			return mkfstable[i].func(device, args[3]);
+		}
+	}
+	kprintf("Unknown filesystem type %s\n", fstype);
+	return EINVAL;
+}
+
+/*
+ * Command for making a RAM disk.
+ */
+static
+int
+cmd_ramdisk(int nargs, char **args)
+{
+	char name[32];
+	int kbytes, result;
+
+	if (nargs != 2 || (kbytes = atoi(args[1])) <= 0) {
+		kprintf("Usage: ramdisk kbytes\n");
+		return EINVAL;
+	}
+
+	result = ramdisk_create(kbytes, name, sizeof(name));
+	if (result) {
+		return result;
+	}
+	kprintf("%s: %d KB RAM disk\n", name, kbytes);
+	return 0;
+}
+
+#if OPT_RAID
+/*
+ * Command for making a striped disk, e.g. "raid 16 lhd1 lhd2".
+ */
+static
+int
+cmd_raid(int nargs, char **args)
+{
+	unsigned units[MAXMENUARGS];
+	char name[32];
+	const char *s;
+	int stripesects, i;
+
+	if (nargs < 4 || (stripesects = atoi(args[1])) <= 0) {
+		kprintf("Usage: raid stripesectors lhdN lhdN...\n");
+		return EINVAL;
+	}
+	for (i = 2; i < nargs; i++) {
+		/* lhdN, or lhdN: */
+		s = args[i];
+		if (s[0] != 'l' || s[1] != 'h' || s[2] != 'd' ||
+		    s[3] < '0' || s[3] > '9') {
+			kprintf("raid: %s: not an lhd disk\n", s);
+			return EINVAL;
+		}
+		units[i - 2] = atoi(s + 3);
+	}
+
+	return raid_create(stripesects, units, nargs - 2, name, sizeof(name));
+}
+#endif
+
 /*
  * Command to set the "boot fs".
  *
@@ -519,6 +627,42 @@ cmd_kheapdump(int nargs, char **args)
 	return 0;
 }
 
+static
+int
+cmd_bufstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	buf_printstats();
+
+	return 0;
+}
+
+static
+int
+cmd_dcachestats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	dcache_printstats();
+
+	return 0;
+}
+
+static
+int
+cmd_iostat(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	devstat_printall();
+
+	return 0;
+}
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -553,6 +697,11 @@ static const char *opsmenu[] = {
 	"[p]       Other program             ",
 	"[mount]   Mount a filesystem        ",
 	"[unmount] Unmount a filesystem      ",
+	"[mkfs]    Make a filesystem         ",
+	"[ramdisk] Make a RAM disk           ",
+#if OPT_RAID
+	"[raid]    Make a striped disk       ",
+#endif
 	"[bootfs]  Set \"boot\" filesystem     ",
 	"[pf]      Print a file              ",
 	"[cd]      Change directory          ",
@@ -670,6 +819,9 @@ static const char *mainmenu[] = {
 	"[khu] Kernel heap usage             ",
 	"[khgen] Next kernel heap generation ",
 	"[khdump] Dump kernel heap           ",
+	"[bc] Buffer cache stats             ",
+	"[dc] Name cache stats               ",
+	"[iostat] Disk I/O stats             ",
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -708,6 +860,11 @@ static struct {
 	{ "p",		cmd_prog },
 	{ "mount",	cmd_mount },
 	{ "unmount",	cmd_unmount },
+	{ "mkfs",	cmd_mkfs },
+	{ "ramdisk",	cmd_ramdisk },
+#if OPT_RAID
+	{ "raid",	cmd_raid },
+#endif
 	{ "bootfs",	cmd_bootfs },
 	{ "pf",		printfile },
 	{ "cd",		cmd_chdir },
@@ -725,6 +882,9 @@ static struct {
 	{ "khu",        cmd_kheapused },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+	{ "bc",         cmd_bufstats },
+	{ "dc",         cmd_dcachestats },
+	{ "iostat",     cmd_iostat },
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -46,11 +46,11 @@
 #endif
 
 #define FDINLINE
-#define CPINLINE
 
 #include <types.h>
 #include <kern/errno.h>
 #include <kern/fcntl.h>
+#include <kern/wait.h>
 #include <spl.h>
 #include <proc.h>
 #include <current.h>
@@ -77,6 +77,42 @@ static unsigned volatile proc_num;
 static unsigned long volatile pid_ref;
 static struct spinlock proc_spinlock;
 
+/*
+ * Protects the parent/child links of every process and is the lock
+ * used with each parent's p_waitcv.
+ */
+static struct lock *proc_waitlock;
+
+/*
+ * Sibling list helpers; caller must hold proc_waitlock
+ */
+static
+void
+proclist_insert(struct proc **head, struct proc *proc)
+{
+	proc->p_sibprev = NULL;
+	proc->p_sibnext = *head;
+	if (*head != NULL)
+		(*head)->p_sibprev = proc;
+	*head = proc;
+}
+
+static
+void
+proclist_remove(struct proc **head, struct proc *proc)
+{
+	if (proc->p_sibprev != NULL) {
+		proc->p_sibprev->p_sibnext = proc->p_sibnext;
+	}
+	else {
+		KASSERT(*head == proc);
+		*head = proc->p_sibnext;
+	}
+	if (proc->p_sibnext != NULL)
+		proc->p_sibnext->p_sibprev = proc->p_sibprev;
+	proc->p_sibprev = proc->p_sibnext = NULL;
+}
+
 /* 
  * Add process to the proc table
  */
@@ -153,17 +189,8 @@ proc_create(const char *name)
 	}
 
 	/* Handle exit */
-	proc->exit_sem = sem_create("exit sem", 0);
-	if (proc->exit_sem == NULL) {
-		lock_destroy(proc->p_mainlock);
-		kfree(proc->p_name);
-		kfree(proc);
-		return NULL;
-	}
-	/* Child process array */
-	proc->cps = cparray_create();
-	if (proc->cps == NULL) {
-		sem_destroy(proc->exit_sem);
+	proc->p_waitcv = cv_create("wait cv");
+	if (proc->p_waitcv == NULL) {
 		lock_destroy(proc->p_mainlock);
 		kfree(proc->p_name);
 		kfree(proc);
@@ -172,14 +199,19 @@ proc_create(const char *name)
 	/* file descriptor array */
 	proc->fds = fdarray_create();
 	if (proc->fds == NULL) {
-		cparray_destroy(proc->cps);
-		sem_destroy(proc->exit_sem);
+		cv_destroy(proc->p_waitcv);
 		lock_destroy(proc->p_mainlock);
 		kfree(proc->p_name);
 		kfree(proc);
 		return NULL;
 	}
 
+	/* Parent/child links */
+	proc->p_parent = NULL;
+	proc->p_sibprev = proc->p_sibnext = NULL;
+	proc->p_children = proc->p_zombies = NULL;
+	proc->p_orphan = false;
+
 	/* Exit values */
 	proc->exited = false;
 	proc->exit_val = 0;
@@ -201,18 +233,15 @@ proc_create(const char *name)
 }
 
 /*
- * Exit a process
+ * Clean up an exiting process
  *
- * Cleans up process structure but leaves bare bones for
- * parent process to get exit value
+ * Releases everything but the pid, exit value and the links the
+ * parent needs to find it.
  */
+static
 void
-proc_exit(struct proc *proc)
+proc_cleanup(struct proc *proc)
 {
-	/*
-	 * This should only be called by the last process thread
-	 * when it exits
-	 */
 	KASSERT(proc != NULL);
 	KASSERT(proc != kproc);
 
@@ -223,6 +252,10 @@ proc_exit(struct proc *proc)
 	lock_destroy(proc->p_mainlock);
 	proc->p_mainlock = NULL;
 
+	/* Name */
+	kfree(proc->p_name);
+	proc->p_name = NULL;
+
 	/* VFS fields */
 	if (proc->p_cwd) {
 		VOP_DECREF(proc->p_cwd);
@@ -288,21 +321,80 @@ proc_exit(struct proc *proc)
 	}
 	fdarray_destroy(proc->fds);
 	proc->fds = NULL;
-	
-	/*
-	 * Cleanup child process array
-	 */
-	while ((index = cparray_num(proc->cps)) != 0) {
-		cparray_remove(proc->cps, index - 1);
+}
+
+/*
+ * Publish the exit of a cleaned up process
+ *
+ * Live children are orphaned and will reap themselves when they
+ * exit; zombie children are reaped here since nobody is left to 
+ * wait for them. The process then becomes a zombie of its parent, 
+ * or is reaped itself if it was orphaned. A process with neither 
+ * (runprogram, tests) is left to whoever created it.
+ */
+static
+void
+proc_zombify(struct proc *proc)
+{
+	struct proc *child, *reap;
+	bool orphan;
+
+	reap = NULL;
+
+	lock_acquire(proc_waitlock);
+	while ((child = proc->p_children) != NULL) {
+		proclist_remove(&proc->p_children, child);
+		child->p_parent = NULL;
+		child->p_orphan = true;
+	}
+	while ((child = proc->p_zombies) != NULL) {
+		proclist_remove(&proc->p_zombies, child);
+		child->p_parent = NULL;
+		proclist_insert(&reap, child);
 	}
-	cparray_destroy(proc->cps);
-	proc->cps = NULL;
+
+	/* No children left to signal us */
+	cv_destroy(proc->p_waitcv);
+	proc->p_waitcv = NULL;
 
 	/* Let the parent process collect exit status */
 	proc->exited = true;
-	V(proc->exit_sem);
+	orphan = proc->p_orphan;
+	if (proc->p_parent != NULL) {
+		proclist_remove(&proc->p_parent->p_children, proc);
+		proclist_insert(&proc->p_parent->p_zombies, proc);
+		cv_broadcast(proc->p_parent->p_waitcv, proc_waitlock);
+	}
+	lock_release(proc_waitlock);
+
+	while ((child = reap) != NULL) {
+		proclist_remove(&reap, child);
+		proc_destroy(child);
+	}
+
+	if (orphan)
+		proc_destroy(proc);
+}
 
+/*
+ * Exit a process
+ *
+ * Cleans up process structure but leaves bare bones for
+ * parent process to get exit value. If there is no parent
+ * left to do so the process is destroyed.
+ */
+void
+proc_exit(struct proc *proc)
+{
+	/*
+	 * This should only be called by the last process thread
+	 * when it exits, or on a process that never ran
+	 */
+	KASSERT(proc != NULL);
 	KASSERT(proc->p_numthreads == 0);
+
+	proc_cleanup(proc);
+	proc_zombify(proc);
 }
 
 
@@ -311,7 +403,8 @@ proc_exit(struct proc *proc)
 /*
  * Destroy a proc structure.
  *
- * Note: Called by the parent to clean up
+ * Note: Called by the parent to clean up, or on exit when 
+ * the process was orphaned
  */
 void
 proc_destroy(struct proc *proc)
@@ -328,16 +421,26 @@ proc_destroy(struct proc *proc)
 	KASSERT(proc != kproc);
 	/* Ensure proc_exit has been called */
 	KASSERT(proc->p_addrspace == NULL);
-	KASSERT(proc->cps == NULL);
+	KASSERT(proc->p_children == NULL);
+	KASSERT(proc->p_zombies == NULL);
+	KASSERT(proc->p_waitcv == NULL);
 	KASSERT(proc->fds == NULL);
 	KASSERT(proc->exited);
 
 	/*
 	 * We don't take p_lock in here because we must have the only
 	 * reference to this structure. (Otherwise it would be
-	 * incorrect to destroy it.)
+	 * incorrect to destroy it.) The wait lock is held while
+	 * leaving the process table so that proc_waitchild never 
+	 * looks at a process being freed.
 	 */
 
+	lock_acquire(proc_waitlock);
+	if (proc->p_parent != NULL) {
+		/* Never waited for, e.g. fork failed */
+		proclist_remove(&proc->p_parent->p_zombies, proc);
+		proc->p_parent = NULL;
+	}
 	if (proc->pid >= PID_MIN  &&
 		proc->pid <= PID_MAX  && 
 		proctable_get(ptb, (unsigned long)proc->pid) == proc) {
@@ -347,10 +450,9 @@ proc_destroy(struct proc *proc)
 		--proc_num;
 		spinlock_release(&proc_spinlock);
 	}
+	lock_release(proc_waitlock);
 
-	sem_destroy(proc->exit_sem);
 	spinlock_cleanup(&proc->p_lock);
-	kfree(proc->p_name);
 	kfree(proc);
 }
 
@@ -367,6 +469,90 @@ proctable_bootstrap(void)
 	pid_ref = PID_MIN;
 	proc_num = 0;
 	spinlock_init(&proc_spinlock);
+	proc_waitlock = lock_create("proc wait lock");
+	if (proc_waitlock == NULL) {
+		panic("lock_create for proc wait lock failed\n");
+	}
+}
+
+/*
+ * Link a new process to its parent so that it can be waited for.
+ * Must be done before the child starts running.
+ */
+void
+proc_addchild(struct proc *parent, struct proc *child)
+{
+	KASSERT(parent != NULL);
+	KASSERT(child != NULL);
+	KASSERT(child->p_parent == NULL);
+
+	lock_acquire(proc_waitlock);
+	child->p_parent = parent;
+	child->ppid = parent->pid;
+	proclist_insert(&parent->p_children, child);
+	lock_release(proc_waitlock);
+}
+
+/*
+ * Wait for a child of parent to exit.
+ *
+ * PID may be WAIT_ANY, in which case the first zombie child is
+ * taken. The child is found through the process table rather than
+ * by searching the children. If NOHANG is set and no suitable child
+ * has exited, returns 0 with *ret set to NULL. On success the child 
+ * is detached from parent and the caller must proc_destroy it.
+ */
+int
+proc_waitchild(struct proc *parent, pid_t pid, bool nohang, struct proc **ret)
+{
+	KASSERT(parent != NULL);
+	KASSERT(ret != NULL);
+
+	struct proc *child;
+
+	*ret = NULL;
+
+	lock_acquire(proc_waitlock);
+	if (pid == WAIT_ANY) {
+		if (parent->p_children == NULL && parent->p_zombies == NULL) {
+			lock_release(proc_waitlock);
+			return ECHILD;
+		}
+		while ((child = parent->p_zombies) == NULL) {
+			if (nohang) {
+				lock_release(proc_waitlock);
+				return 0;
+			}
+			cv_wait(parent->p_waitcv, proc_waitlock);
+		}
+	}
+	else {
+		KASSERT(pid >= PID_MIN && pid <= PID_MAX);
+		child = proctable_get(ptb, (unsigned long)pid);
+		if (child == NULL) {
+			lock_release(proc_waitlock);
+			return ESRCH;
+		}
+		if (child->p_parent != parent) {
+			lock_release(proc_waitlock);
+			return ECHILD;
+		}
+		while (!child->exited) {
+			if (nohang) {
+				lock_release(proc_waitlock);
+				return 0;
+			}
+			cv_wait(parent->p_waitcv, proc_waitlock);
+		}
+	}
+
+	KASSERT(child->exited);
+	proclist_remove(&parent->p_zombies, child);
+	child->p_parent = NULL;
+	lock_release(proc_waitlock);
+
+	*ret = child;
+	return 0;
 }
 
 /*
@@ -500,6 +686,7 @@ void
 proc_remthread(struct thread *t)
 {
 	struct proc *proc;
+	bool last;
 	int spl;
 
 	proc = t->t_proc;
@@ -508,16 +695,23 @@ proc_remthread(struct thread *t)
 	spinlock_acquire(&proc->p_lock);
 	KASSERT(proc->p_numthreads > 0);
 	proc->p_numthreads--;
+	last = (proc != kproc && proc->p_numthreads == 0);
 	spinlock_release(&proc->p_lock);
 
 	/* Need to remove process if no more threads but leave bare bones */
-	if (proc != kproc &&
-		proc->p_numthreads == 0) 
-		proc_exit(proc);
+	if (last) 
+		proc_cleanup(proc);
 
 	spl = splhigh();
 	t->t_proc = NULL;
 	splx(spl);
+
+	/*
+	 * Only hand the process to its parent (or reap it) once this
+	 * thread no longer refers to it; it may be freed right away.
+	 */
+	if (last)
+		proc_zombify(proc);
 }
 
 /*
@@ -0,0 +1,299 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <synch.h>
+#include <vnode.h>
+#include <execcache.h>
+
+/*
+ * Locking: vn_image in each vnode is protected by that vnode's
+ * vn_countlock so writers can check it cheaply. Everything else
+ * (image refcounts, the LRU list, the byte count) is protected by
+ * ec_lock. The LRU list only holds ready images and runs from most
+ * (ec_head) to least (ec_tail) recently used.
+ */
+static struct lock *ec_lock;
+static struct execimage *ec_head;
+static struct execimage *ec_tail;
+static size_t ec_bytes;
+
+void
+execcache_bootstrap(void)
+{
+	ec_lock = lock_create("exec cache lock");
+	if (ec_lock == NULL) {
+		panic("lock_create for exec cache failed\n");
+	}
+	ec_head = ec_tail = NULL;
+	ec_bytes = 0;
+}
+
+/*
+ * LRU list helpers; caller holds ec_lock
+ */
+static
+void
+lru_remove(struct execimage *img)
+{
+	if (img->ei_prev != NULL)
+		img->ei_prev->ei_next = img->ei_next;
+	else
+		ec_head = img->ei_next;
+	if (img->ei_next != NULL)
+		img->ei_next->ei_prev = img->ei_prev;
+	else
+		ec_tail = img->ei_prev;
+	img->ei_prev = img->ei_next = NULL;
+}
+
+static
+void
+lru_insert(struct execimage *img)
+{
+	img->ei_prev = NULL;
+	img->ei_next = ec_head;
+	if (ec_head != NULL)
+		ec_head->ei_prev = img;
+	else
+		ec_tail = img;
+	ec_head = img;
+}
+
+/*
+ * Free the segment data held by an image; caller holds ec_lock
+ */
+static
+void
+image_freedata(struct execimage *img)
+{
+	unsigned i;
+
+	for (i = 0; i < img->ei_nsegs; i++) {
+		kfree(img->ei_segs[i].es_data);
+		img->ei_segs[i].es_data = NULL;
+	}
+	if (img->ei_ready) {
+		KASSERT(ec_bytes >= img->ei_bytes);
+		ec_bytes -= img->ei_bytes;
+	}
+	img->ei_bytes = 0;
+}
+
+/*
+ * Drop a reference to an image; caller holds ec_lock
+ */
+static
+void
+image_decref(struct execimage *img)
+{
+	KASSERT(img->ei_refcount > 0);
+
+	--img->ei_refcount;
+	if (img->ei_refcount == 0) {
+		KASSERT(img->ei_vnode == NULL);
+		image_freedata(img);
+		kfree(img);
+	}
+}
+
+/*
+ * Detach an image from its vnode after vn_image has been cleared;
+ * caller holds ec_lock
+ */
+static
+void
+image_detach(struct execimage *img)
+{
+	KASSERT(img->ei_vnode != NULL);
+
+	if (img->ei_ready)
+		lru_remove(img);
+	img->ei_vnode = NULL;
+	image_decref(img);
+}
+
+/*
+ * Drop segment data of least recently used idle images until NEED
+ * more bytes fit in the budget. Images are dropped altogether, since
+ * an image without its data is cheap to rebuild. Caller holds ec_lock.
+ */
+static
+bool
+evict(size_t need)
+{
+	struct execimage *img, *prev;
+	struct vnode *v;
+	bool mine;
+
+	for (img = ec_tail; img != NULL && ec_bytes + need > EXECCACHE_MAXBYTES; img = prev) {
+		prev = img->ei_prev;
+		/* Only the vnode's reference: nobody is loading from it */
+		if (img->ei_refcount > 1 || img->ei_bytes == 0)
+			continue;
+
+		v = img->ei_vnode;
+		spinlock_acquire(&v->vn_countlock);
+		mine = (v->vn_image == img);
+		if (mine)
+			v->vn_image = NULL;
+		spinlock_release(&v->vn_countlock);
+
+		/* Otherwise whoever cleared vn_image will detach it */
+		if (mine)
+			image_detach(img);
+	}
+
+	return ec_bytes + need <= EXECCACHE_MAXBYTES;
+}
+
+struct execimage *
+execcache_get(struct vnode *v, bool *build)
+{
+	KASSERT(v != NULL);
+	KASSERT(build != NULL);
+	KASSERT(ec_lock != NULL);
+
+	struct execimage *img;
+
+	lock_acquire(ec_lock);
+	spinlock_acquire(&v->vn_countlock);
+	img = v->vn_image;
+	spinlock_release(&v->vn_countlock);
+
+	if (img != NULL) {
+		if (!img->ei_ready) {
+			/* Someone else is building it */
+			lock_release(ec_lock);
+			return NULL;
+		}
+		++img->ei_refcount;
+		lru_remove(img);
+		lru_insert(img);
+		lock_release(ec_lock);
+		*build = false;
+		return img;
+	}
+
+	/* vn_image is only ever set under ec_lock, so it's still NULL */
+	img = kmalloc(sizeof(*img));
+	if (img != NULL) {
+		bzero(img, sizeof(*img));
+		img->ei_vnode = v;
+		/* The vnode's reference and the builder's */
+		img->ei_refcount = 2;
+		spinlock_acquire(&v->vn_countlock);
+		v->vn_image = img;
+		spinlock_release(&v->vn_countlock);
+	}
+	lock_release(ec_lock);
+
+	*build = true;
+	return img;
+}
+
+void
+execcache_done(struct execimage *img, bool ok)
+{
+	KASSERT(img != NULL);
+	KASSERT(!img->ei_ready);
+
+	struct vnode *v;
+	bool mine;
+	unsigned i;
+
+	lock_acquire(ec_lock);
+	v = img->ei_vnode;
+	if (v == NULL) {
+		/* Invalidated while we were loading */
+		image_decref(img);
+		lock_release(ec_lock);
+		return;
+	}
+
+	if (!ok || img->ei_failed) {
+		spinlock_acquire(&v->vn_countlock);
+		mine = (v->vn_image == img);
+		if (mine)
+			v->vn_image = NULL;
+		spinlock_release(&v->vn_countlock);
+		if (mine)
+			image_detach(img);
+		image_decref(img);
+		lock_release(ec_lock);
+		return;
+	}
+
+	/* Keep the segment data only if it fits */
+	for (i = 0; i < img->ei_nsegs; i++) {
+		if (img->ei_segs[i].es_data != NULL)
+			img->ei_bytes += img->ei_segs[i].es_filesize;
+	}
+	if (img->ei_bytes > 0 && !evict(img->ei_bytes)) {
+		image_freedata(img);
+	}
+
+	img->ei_ready = true;
+	ec_bytes += img->ei_bytes;
+	lru_insert(img);
+	image_decref(img);
+	lock_release(ec_lock);
+}
+
+void
+execcache_release(struct execimage *img)
+{
+	KASSERT(img != NULL);
+	KASSERT(img->ei_ready);
+
+	lock_acquire(ec_lock);
+	image_decref(img);
+	lock_release(ec_lock);
+}
+
+void
+execcache_invalidate(struct vnode *v)
+{
+	KASSERT(v != NULL);
+
+	struct execimage *img;
+
+	spinlock_acquire(&v->vn_countlock);
+	img = v->vn_image;
+	v->vn_image = NULL;
+	spinlock_release(&v->vn_countlock);
+
+	if (img == NULL)
+		return;
+
+	lock_acquire(ec_lock);
+	image_detach(img);
+	lock_release(ec_lock);
+}
@@ -441,3 +441,25 @@ sys___getcwd(userptr_t buf, size_t buflen, int32_t *ret)
 	*ret = buflen - u.uio_resid;
 	return result;
 }
+
+/*
+ * ioctl syscall
+ */
+int
+sys_ioctl(int fd, int code, userptr_t data)
+{
+	KASSERT(curproc != NULL);
+
+	struct proc *proc = curproc;
+	struct fd *fd_ptr;
+
+	/* Check if valid file descriptor */
+	if (fd < 0 || fdarray_num(proc->fds) <= (unsigned)fd)
+		return EBADF;
+
+	fd_ptr = fdarray_get(proc->fds, fd);
+	if (fd_ptr == NULL)
+		return EBADF;
+
+	return VOP_IOCTL(fd_ptr->fh->open_v, code, data);
+}
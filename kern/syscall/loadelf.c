@@ -59,6 +59,7 @@
 #include <addrspace.h>
 #include <vnode.h>
 #include <elf.h>
+#include <execcache.h>
 
 /*
  * Load a segment at virtual address VADDR. The segment in memory
@@ -146,19 +147,166 @@ load_segment(struct addrspace *as, struct vnode *v,
 }
 
 /*
- * Load an ELF executable user program into the current address space.
- *
- * Returns the entry point (initial PC) for the program in ENTRYPOINT.
+ * Load a segment from a cached copy of its file contents. Same as
+ * load_segment except that DATA holds the FILESIZE bytes at the
+ * segment's file offset.
  */
+static
 int
-load_elf(struct vnode *v, vaddr_t *entrypoint)
+load_segment_data(struct addrspace *as, void *data, vaddr_t vaddr,
+		  size_t memsize, size_t filesize,
+		  int is_executable)
+{
+	struct iovec iov;
+	struct uio u;
+
+	if (filesize > memsize) {
+		filesize = memsize;
+	}
+
+	DEBUG(DB_EXEC, "ELF: Loading %lu cached bytes to 0x%lx\n",
+	      (unsigned long) filesize, (unsigned long) vaddr);
+
+	iov.iov_ubase = (userptr_t)vaddr;
+	iov.iov_len = memsize;		 // length of the memory space
+	u.uio_iov = &iov;
+	u.uio_iovcnt = 1;
+	u.uio_resid = filesize;          // amount to copy
+	u.uio_offset = 0;
+	u.uio_segflg = is_executable ? UIO_USERISPACE : UIO_USERSPACE;
+	u.uio_rw = UIO_READ;
+	u.uio_space = as;
+
+	return uiomove(data, filesize, &u);
+}
+
+/*
+ * Read a segment's file contents into a kernel buffer for the exec
+ * cache and then load it from there. Returns the buffer in DATA_RET,
+ * or NULL if the contents weren't kept (and were read directly).
+ */
+static
+int
+load_segment_keep(struct addrspace *as, struct vnode *v,
+		  off_t offset, vaddr_t vaddr,
+		  size_t memsize, size_t filesize,
+		  int is_executable, void **data_ret)
+{
+	struct iovec iov;
+	struct uio ku;
+	void *data;
+	int result;
+
+	*data_ret = NULL;
+
+	if (filesize == 0 || filesize > memsize || filesize > EXECCACHE_MAXSEG ||
+	    (data = kmalloc(filesize)) == NULL) {
+		return load_segment(as, v, offset, vaddr, memsize, filesize,
+				    is_executable);
+	}
+
+	uio_kinit(&iov, &ku, data, filesize, offset, UIO_READ);
+	result = VOP_READ(v, &ku);
+	if (result) {
+		kfree(data);
+		return result;
+	}
+
+	if (ku.uio_resid != 0) {
+		/* short read; problem with executable? */
+		kprintf("ELF: short read on segment - file truncated?\n");
+		kfree(data);
+		return ENOEXEC;
+	}
+
+	result = load_segment_data(as, data, vaddr, memsize, filesize,
+				   is_executable);
+	if (result) {
+		kfree(data);
+		return result;
+	}
+
+	*data_ret = data;
+	return 0;
+}
+
+/*
+ * Load an executable from its cached image. Segments whose contents
+ * aren't cached are still read from the file.
+ */
+static
+int
+load_image(struct vnode *v, struct execimage *img, vaddr_t *entrypoint)
+{
+	struct execseg *seg;
+	struct addrspace *as;
+	unsigned i;
+	int result;
+
+	as = proc_getas();
+
+	for (i=0; i<img->ei_nsegs; i++) {
+		seg = &img->ei_segs[i];
+		result = as_define_region(as,
+					  seg->es_vaddr, seg->es_memsize,
+					  seg->es_flags & PF_R,
+					  seg->es_flags & PF_W,
+					  seg->es_flags & PF_X);
+		if (result) {
+			return result;
+		}
+	}
+
+	result = as_prepare_load(as);
+	if (result) {
+		return result;
+	}
+
+	for (i=0; i<img->ei_nsegs; i++) {
+		seg = &img->ei_segs[i];
+		if (seg->es_data != NULL) {
+			result = load_segment_data(as, seg->es_data,
+						   seg->es_vaddr, seg->es_memsize,
+						   seg->es_filesize,
+						   seg->es_flags & PF_X);
+		}
+		else {
+			result = load_segment(as, v, seg->es_offset,
+					      seg->es_vaddr, seg->es_memsize,
+					      seg->es_filesize,
+					      seg->es_flags & PF_X);
+		}
+		if (result) {
+			return result;
+		}
+	}
+
+	result = as_complete_load(as);
+	if (result) {
+		return result;
+	}
+
+	*entrypoint = img->ei_entry;
+
+	return 0;
+}
+
+/*
+ * Load an ELF executable by parsing the file. If IMG is not NULL,
+ * record the layout and segment contents in it for the exec cache.
+ */
+static
+int
+load_elf_file(struct vnode *v, struct execimage *img, vaddr_t *entrypoint)
 {
 	Elf_Ehdr eh;   /* Executable header */
 	Elf_Phdr ph;   /* "Program header" = segment header */
 	int result, i;
+	unsigned nsegs;
 	struct iovec iov;
 	struct uio ku;
 	struct addrspace *as;
+	struct execseg *seg;
 
 	as = proc_getas();
 
@@ -251,6 +399,20 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 		if (result) {
 			return result;
 		}
+
+		if (img != NULL && !img->ei_failed) {
+			if (img->ei_nsegs == EXECIMAGE_MAXSEGS) {
+				img->ei_failed = true;
+				continue;
+			}
+			seg = &img->ei_segs[img->ei_nsegs++];
+			seg->es_offset = ph.p_offset;
+			seg->es_vaddr = ph.p_vaddr;
+			seg->es_memsize = ph.p_memsz;
+			seg->es_filesize = ph.p_filesz;
+			seg->es_flags = ph.p_flags;
+			seg->es_data = NULL;
+		}
 	}
 
 	result = as_prepare_load(as);
@@ -262,6 +424,7 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 	 * Now actually load each segment.
 	 */
 
+	nsegs = 0;
 	for (i=0; i<eh.e_phnum; i++) {
 		off_t offset = eh.e_phoff + i*eh.e_phentsize;
 		uio_kinit(&iov, &ku, &ph, sizeof(ph), offset, UIO_READ);
@@ -288,9 +451,19 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 			return ENOEXEC;
 		}
 
-		result = load_segment(as, v, ph.p_offset, ph.p_vaddr,
-				      ph.p_memsz, ph.p_filesz,
-				      ph.p_flags & PF_X);
+		if (img != NULL && !img->ei_failed) {
+			KASSERT(nsegs < img->ei_nsegs);
+			seg = &img->ei_segs[nsegs++];
+			result = load_segment_keep(as, v, ph.p_offset, ph.p_vaddr,
+						   ph.p_memsz, ph.p_filesz,
+						   ph.p_flags & PF_X,
+						   &seg->es_data);
+		}
+		else {
+			result = load_segment(as, v, ph.p_offset, ph.p_vaddr,
+					      ph.p_memsz, ph.p_filesz,
+					      ph.p_flags & PF_X);
+		}
 		if (result) {
 			return result;
 		}
@@ -302,6 +475,37 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 	}
 
 	*entrypoint = eh.e_entry;
+	if (img != NULL) {
+		img->ei_entry = eh.e_entry;
+	}
 
 	return 0;
 }
+
+/*
+ * Load an ELF executable user program into the current address space.
+ *
+ * Returns the entry point (initial PC) for the program in ENTRYPOINT.
+ *
+ * Repeat loads of the same file come from the exec cache.
+ */
+int
+load_elf(struct vnode *v, vaddr_t *entrypoint)
+{
+	struct execimage *img;
+	bool build;
+	int result;
+
+	img = execcache_get(v, &build);
+	if (img != NULL && !build) {
+		result = load_image(v, img, entrypoint);
+		execcache_release(img);
+		return result;
+	}
+
+	result = load_elf_file(v, img, entrypoint);
+	if (img != NULL) {
+		execcache_done(img, result == 0);
+	}
+	return result;
+}
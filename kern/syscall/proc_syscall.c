@@ -3,6 +3,7 @@
 #include <kern/errno.h>
 #include <kern/wait.h>
 #include <kern/fcntl.h>
+#include <kern/spawn.h>
 #include <limits.h>
 #include <current.h> 
 #include <proc.h>
@@ -17,15 +18,128 @@
 #include <syscall.h>
 #include <proc_syscall.h>
 
-static char k_buffer[ARG_MAX];
-static struct lock *kb_lock;
+/*
+ * Argument staging buffers for execv
+ *
+ * Each exec borrows one ARG_MAX sized buffer for the duration of
+ * copyargv. Buffers are allocated on demand up to ARGBUF_MAX and
+ * kept around once freed, so concurrent execs only wait on each
+ * other when every buffer is in use.
+ */
+#define ARGBUF_MAX 8
+
+static char *ab_pool[ARGBUF_MAX];
+static unsigned ab_free;   /* Number of cached buffers in ab_pool */
+static unsigned ab_total;  /* Number of buffers handed out or cached */
+static struct lock *ab_lock;
+static struct cv *ab_cv;
 
 void 
 sys_bootstrap()
 {
-	kb_lock = lock_create("Kernel buffer lock");
-	if (kb_lock == NULL)
-		panic("Kernel buffer lock failed\n");
+	ab_lock = lock_create("Arg buffer lock");
+	if (ab_lock == NULL)
+		panic("Arg buffer lock failed\n");
+	ab_cv = cv_create("Arg buffer cv");
+	if (ab_cv == NULL)
+		panic("Arg buffer cv failed\n");
+	ab_free = ab_total = 0;
+}
+
+/*
+ * Get an argument buffer from the pool, waiting if they are all in use
+ */
+static
+char *
+argbuf_get(void)
+{
+	char *buf;
+
+	lock_acquire(ab_lock);
+	while (ab_free == 0 && ab_total == ARGBUF_MAX)
+		cv_wait(ab_cv, ab_lock);
+
+	if (ab_free > 0) {
+		buf = ab_pool[--ab_free];
+		lock_release(ab_lock);
+		return buf;
+	}
+	++ab_total;
+	lock_release(ab_lock);
+
+	buf = kmalloc(ARG_MAX);
+	if (buf == NULL) {
+		lock_acquire(ab_lock);
+		--ab_total;
+		cv_signal(ab_cv, ab_lock);
+		lock_release(ab_lock);
+	}
+	return buf;
+}
+
+/*
+ * Return an argument buffer to the pool
+ */
+static
+void
+argbuf_put(char *buf)
+{
+	KASSERT(buf != NULL);
+
+	lock_acquire(ab_lock);
+	KASSERT(ab_free < ab_total);
+	ab_pool[ab_free++] = buf;
+	cv_signal(ab_cv, ab_lock);
+	lock_release(ab_lock);
+}
+
+/*
+ * Helper function for the fork and spawn syscalls
+ *
+ * Gives the new process a copy of the current process's file
+ * descriptors and current directory.
+ */
+static
+int
+proc_inherit(struct proc *proc, struct proc *newproc)
+{
+	struct fd *fd;
+	int result;
+	unsigned num, index, i;
+
+	/* silence warning */
+	index = 0;
+
+	lock_acquire(proc->p_mainlock);
+	num = fdarray_num(proc->fds);
+	for (i = 0; i < num; i++) {
+		fd = fdarray_get(proc->fds, i);
+		result = fdarray_add(newproc->fds, fd, &index);
+		if (result) { 
+			lock_release(proc->p_mainlock);
+			return result;
+		}
+		KASSERT(i == index);
+		if (fd != NULL)
+			fh_inc(fd);
+	}
+	lock_release(proc->p_mainlock);
+
+	/* VFS fields */
+
+	/*
+	 * Lock the current process to copy its current directory.
+	 * (We don't need to lock the new process, though, as we have
+	 * the only reference to it.)
+	 */
+	spinlock_acquire(&proc->p_lock);
+	if (proc->p_cwd != NULL) {
+		VOP_INCREF(proc->p_cwd);
+		newproc->p_cwd = proc->p_cwd;
+	}
+	spinlock_release(&proc->p_lock);
+
+	return 0;
 }
 
 /*
@@ -40,12 +154,7 @@ sys_fork(struct trapframe *c_tf, int32_t *ret)
 	struct trapframe *h_tf;
 	struct proc *newproc,
 				*proc = curproc;
-	struct fd *fd;
 	int result;
-	unsigned num, index, i;
-
-	/* silence warning */
-	index = 0;
 
 	h_tf = kmalloc(sizeof(*h_tf));
 	if (h_tf == NULL)
@@ -70,55 +179,24 @@ sys_fork(struct trapframe *c_tf, int32_t *ret)
 	if (result)
 		goto fail;
 
-	/* PPID */
-	newproc->ppid = proc->pid;
-
 	/* VM fields */
 	result = as_copy(proc->p_addrspace, &newproc->p_addrspace); 
 	if (result)
 		goto fail;
 
-	lock_acquire(proc->p_mainlock);
-	num = fdarray_num(proc->fds);
-	for (i = 0; i < num; i++) {
-		fd = fdarray_get(proc->fds, i);
-		result = fdarray_add(newproc->fds, fd, &index);
-		if (result) { 
-			lock_release(proc->p_mainlock);
-			goto fail;
-		}
-		KASSERT(i == index);
-		if (fd != NULL)
-			fh_inc(fd);
-	}
-	lock_release(proc->p_mainlock);
-
-	/* VFS fields */
-
-	/*
-	 * Lock the current process to copy its current directory.
-	 * (We don't need to lock the new process, though, as we have
-	 * the only reference to it.)
-	 */
-	spinlock_acquire(&proc->p_lock);
-	if (proc->p_cwd != NULL) {
-		VOP_INCREF(proc->p_cwd);
-		newproc->p_cwd = proc->p_cwd;
-	}
-	spinlock_release(&proc->p_lock);
+	/* File descriptors and VFS fields */
+	result = proc_inherit(proc, newproc);
+	if (result)
+		goto fail;
 	/* End of child process setup */
 
-	/* Add child process to array */
-	result = cparray_add(proc->cps, newproc, &index);
-	if (result) 
-		goto fail;
+	/* PPID; link to parent before the child can run and exit */
+	proc_addchild(proc, newproc);
 
 	/* Fork the thread */
 	result = thread_fork("Forked child thread", newproc, enter_forked_process, (void *)h_tf, 0);
-	if (result) {
-		cparray_remove(proc->cps, cparray_num(proc->cps) - 1);
+	if (result)
 		goto fail;
-	}
 
 	*ret = newproc->pid;
 	return result;
@@ -136,6 +214,11 @@ fail:
  *
  * Copies args from the old address space to the stack of the
  * new address space. 
+ *
+ * The strings are packed from the front of a pooled buffer and
+ * their offsets are stored from the back, one slot per argument
+ * plus a NULL terminator, so the whole argv fits in ARG_MAX and
+ * goes out in two copyouts.
  */
 static
 int
@@ -147,23 +230,17 @@ copyargv(struct addrspace *old_as, struct addrspace *new_as, userptr_t old_args,
 	KASSERT(sp_ptr != NULL);
 	KASSERT(*sp_ptr != 0);
 	KASSERT(proc_getas() == old_as || proc_getas() == new_as);
-	KASSERT(kb_lock != NULL);
-
-	typedef struct arg {
-		size_t len;
-		struct arg *next;
-	} argv_t;
+	KASSERT(ab_lock != NULL);
 
 	int result;
 	unsigned i, count;
-	argv_t *head, *tail;
 	size_t actual, space;
-	char *arg_ptr,
+	char *buf, *arg_ptr,
 		 **old_argv = (char **)old_args; /* Warning: userspace pointer */
-	userptr_t tmp_ptr,
-			  stackptr = (userptr_t)*sp_ptr;
+	vaddr_t *top, *argv, tmp;
+	userptr_t stackptr = (userptr_t)*sp_ptr;
 
-	i = count = 0;
+	count = 0;
 	space = 0;
 
 	if (proc_getas() == new_as) {
@@ -171,90 +248,91 @@ copyargv(struct addrspace *old_as, struct addrspace *new_as, userptr_t old_args,
 		as_activate();
 	}
 
-	/* Setup linked list of new argv */
-	head = kmalloc(sizeof(argv_t));
-	if (head == NULL) {
+	buf = argbuf_get();
+	if (buf == NULL)
 		return ENOMEM;
-	}
-	tail = head;
-	tail->next = NULL;
+	/* Offset slots grow down from the end; top[-1] is the NULL */
+	top = (vaddr_t *)(buf + ARG_MAX);
 
-	lock_acquire(kb_lock);
 	/* Loop through args */
 	while (true) {
 		/* Get pointer to arg */
-		result = copyin((userptr_t)(old_argv +i), &arg_ptr, sizeof(arg_ptr));
+		result = copyin((userptr_t)(old_argv + count), &arg_ptr, sizeof(arg_ptr));
 		if (result) { goto fail; }
-		if (arg_ptr == NULL) { goto success; } 
+		if (arg_ptr == NULL) { break; } 
+
+		/* Keep room for this arg's offset slot and the NULL */
+		if (space + (count+2)*sizeof(vaddr_t) >= ARG_MAX) {
+			result = E2BIG;
+			goto fail;
+		}
 		/* Get argument */
-		result = copyinstr((userptr_t)arg_ptr, k_buffer + space, ARG_MAX - space, &actual);
+		result = copyinstr((userptr_t)arg_ptr, buf + space, 
+						   ARG_MAX - space - (count+2)*sizeof(vaddr_t), &actual);
 		if (result) { 
 			if (result == ENAMETOOLONG)
 				result = E2BIG;
 			goto fail; 
 		}
 
-		/* Add argument pointer to linked listt */
-		tail->len = space;
-		tail->next = kmalloc(sizeof(*tail));
-		if (tail->next == NULL) { goto fail; }
-		tail = tail->next;
-		tail->len = 0;
-		tail->next = NULL;
-
+		top[-2 - (int)count] = space;
 		++count;
 		/* Check if ARG_MAX reached */
 		space += ((actual - actual%4) + 4); // assumes pointers are 4 bytes
-		if (space + (count*4) > ARG_MAX) {
+		if (space + (count+1)*sizeof(vaddr_t) > ARG_MAX) {
 			result = E2BIG;
 			goto fail;
 		}
-
-		++i;
 	}
 
-success:
 	if (proc_getas() == old_as) {
 		proc_setas(new_as);
 		as_activate();
 	}
-	/* Copyout entire buffer */
+
+	/* 
+	 * Offsets were stored in reverse; flip them in place so the 
+	 * slots form argv in order and turn them into user pointers.
+	 */
 	stackptr -= space;
-	result = copyout(k_buffer, stackptr, space);
-	KASSERT(result == 0);
-	lock_release(kb_lock);
-
-	tail = head;
-	for (size_t i = 0; i < count; i++) {
-		tmp_ptr = stackptr + tail->len;
-		result = copyout(&tmp_ptr, stackptr - (count+1-i)*4, 4);
-		KASSERT(result == 0);
-		tail = head->next;
-		kfree(head);
-		head = tail;
+	argv = top - (count+1);
+	for (i = 0; i < count/2; i++) {
+		tmp = argv[i];
+		argv[i] = argv[count-1-i];
+		argv[count-1-i] = tmp;
 	}
-	KASSERT(head->next == NULL);
-	kfree(head);
+	for (i = 0; i < count; i++)
+		argv[i] += (vaddr_t)stackptr;
+	argv[count] = 0;
+
+	/* Copyout strings and then the argv array below them */
+	result = copyout(buf, stackptr, space);
+	KASSERT(result == 0);
+	result = copyout(argv, stackptr - (count+1)*sizeof(vaddr_t), (count+1)*sizeof(vaddr_t));
+	KASSERT(result == 0);
+	argbuf_put(buf);
 
 	*argc = (int)count;
-	*sp_ptr = (vaddr_t)(stackptr - (count+1)*4);
+	*sp_ptr = (vaddr_t)(stackptr - (count+1)*sizeof(vaddr_t));
 	return 0;
 
 fail:
-	lock_release(kb_lock);
-	while (head != NULL) {
-		tail = head->next;	
-		kfree(head);
-		head = tail;
-	}
+	argbuf_put(buf);
 	return result;
 }
 
 /*
- * Execv syscall
+ * Helper function for the execv and spawn syscalls
+ *
+ * Loads program PROGNAME into a fresh address space and copies
+ * ARGS onto its stack. On success the new address space is the
+ * current one and the old one is returned in OLD_AS_RET; on failure
+ * the old address space is left in place.
  */
+static
 int
-sys_execv(const_userptr_t progname, userptr_t args)
+loadprog(const_userptr_t progname, userptr_t args, struct addrspace **old_as_ret,
+		 vaddr_t *entry_ret, vaddr_t *sp_ret, int *argc_ret)
 {
 	struct addrspace *old_as, *new_as;
 	struct vnode *v;
@@ -325,6 +403,35 @@ sys_execv(const_userptr_t progname, userptr_t args)
 	result = copyargv(old_as, new_as, args, &argc, &stackptr);
 	if (result)
 		goto fail;
+
+	*old_as_ret = old_as;
+	*entry_ret = entrypoint;
+	*sp_ret = stackptr;
+	*argc_ret = argc;
+	return 0;
+
+fail:
+	if (proc_getas() == new_as) {
+		proc_setas(old_as);
+		as_activate();
+	}
+	as_destroy(new_as);
+	return result;
+}
+
+/*
+ * Execv syscall
+ */
+int
+sys_execv(const_userptr_t progname, userptr_t args)
+{
+	struct addrspace *old_as;
+	vaddr_t entrypoint, stackptr;
+	int result, argc;
+
+	result = loadprog(progname, args, &old_as, &entrypoint, &stackptr, &argc);
+	if (result)
+		return result;
 	
 	as_destroy(old_as);
 
@@ -334,13 +441,202 @@ sys_execv(const_userptr_t progname, userptr_t args)
 			  stackptr, entrypoint);
 
 	/* Should never get here */
+	panic("enter_new_process returned\n");
+	return EINVAL;
+}
 
-fail:
-	if (proc_getas() == new_as) {
-		proc_setas(old_as);
-		as_activate();
+/*
+ * Where a spawned process starts in user mode; passed on the heap
+ */
+struct spawn_entry {
+	int argc;
+	vaddr_t stackptr;
+	vaddr_t entrypoint;
+};
+
+static
+void
+enter_spawned_process(void *data, unsigned long junk)
+{
+	(void)junk;
+
+	struct spawn_entry se;
+
+	/* Push entry info to new process stack from heap */
+	memcpy(&se, data, sizeof(se));
+	kfree(data);
+
+	enter_new_process(se.argc, (userptr_t)se.stackptr, NULL,
+			  se.stackptr, se.entrypoint);
+}
+
+/*
+ * Helper function for the spawn syscall
+ *
+ * Applies the fd actions in order to the (not yet running) new 
+ * process's file table. Closing an fd that isn't open is ignored.
+ */
+static
+int
+spawn_fdactions(struct proc *newproc, const struct spawn_fdaction *acts, int nacts)
+{
+	struct fd *fd_ptr, *old_ptr;
+	unsigned num, i;
+	int result, fd, newfd;
+
+	for (int j = 0; j < nacts; j++) {
+		fd = acts[j].sfa_fd;
+		newfd = acts[j].sfa_newfd;
+		num = fdarray_num(newproc->fds);
+
+		if (fd < 0 || fd >= OPEN_MAX)
+			return EBADF;
+
+		switch (acts[j].sfa_op) {
+			case SPAWN_FD_CLOSE:
+			if ((unsigned)fd < num && 
+				(fd_ptr = fdarray_get(newproc->fds, fd)) != NULL) {
+				fh_dec(fd_ptr);
+				fdarray_set(newproc->fds, fd, NULL);
+			}
+			break;
+
+			case SPAWN_FD_DUP2:
+			if (newfd < 0 || newfd >= OPEN_MAX)
+				return EBADF;
+			if ((unsigned)fd >= num || 
+				(fd_ptr = fdarray_get(newproc->fds, fd)) == NULL)
+				return EBADF;
+			if (fd == newfd)
+				break;
+			if ((unsigned)newfd >= num) {
+				result = fdarray_setsize(newproc->fds, newfd + 1);
+				if (result)
+					return result;
+				/* Null any new spaces in fdarray */
+				for (i = num; i < (unsigned)newfd; i++)
+					fdarray_set(newproc->fds, i, NULL);
+			}
+			else if ((old_ptr = fdarray_get(newproc->fds, newfd)) != NULL) {
+				fh_dec(old_ptr);
+			}
+			fdarray_set(newproc->fds, newfd, fd_ptr);
+			fh_inc(fd_ptr);
+			break;
+
+			default:
+			return EINVAL;
+		}
 	}
-	as_destroy(new_as);
+
+	return 0;
+}
+
+/*
+ * spawn syscall
+ *
+ * Starts PROGNAME with ARGS in a new child process, as fork followed 
+ * by execv would, but builds the child's address space directly
+ * instead of copying the parent's. The child inherits the parent's
+ * file descriptors with the optional fd ACTIONS applied.
+ */
+int
+sys_spawn(const_userptr_t progname, userptr_t args, const_userptr_t actions, 
+		  int nactions, int32_t *ret)
+{
+	KASSERT(curproc != NULL);
+	KASSERT(curproc != kproc);
+
+	struct proc *newproc,
+				*proc = curproc;
+	struct addrspace *old_as, *new_as;
+	struct spawn_fdaction *acts;
+	struct spawn_entry *se;
+	int result;
+
+	acts = NULL;
+
+	if (nactions < 0 || nactions > SPAWN_FDACTION_MAX)
+		return EINVAL;
+
+	if (nactions > 0) {
+		if (actions == NULL)
+			return EFAULT;
+		acts = kmalloc(sizeof(*acts)*nactions);
+		if (acts == NULL)
+			return ENOMEM;
+		result = copyin(actions, acts, sizeof(*acts)*nactions);
+		if (result) {
+			kfree(acts);
+			return result;
+		}
+	}
+
+	se = kmalloc(sizeof(*se));
+	if (se == NULL) {
+		kfree(acts);
+		return ENOMEM;
+	}
+
+	/* Build the new image, then hand it over and take ours back */
+	result = loadprog(progname, args, &old_as, &se->entrypoint, &se->stackptr, &se->argc);
+	if (result) {
+		kfree(se);
+		kfree(acts);
+		return result;
+	}
+	new_as = proc_setas(old_as);
+	as_activate();
+
+	/*
+	 * New process setup 
+	 */
+
+	/* Create a new proc */
+	newproc = proc_create("Spawned process");
+	if (newproc == NULL) {
+		as_destroy(new_as);
+		kfree(se);
+		kfree(acts);
+		return ENOMEM;
+	}
+
+	/* VM fields */
+	newproc->p_addrspace = new_as;
+
+	/* PID */
+	result = proc_setpid(newproc);
+	if (result)
+		goto fail;
+
+	/* File descriptors and VFS fields */
+	result = proc_inherit(proc, newproc);
+	if (result)
+		goto fail;
+
+	result = spawn_fdactions(newproc, acts, nactions);
+	if (result)
+		goto fail;
+	/* End of child process setup */
+
+	/* PPID; link to parent before the child can run and exit */
+	proc_addchild(proc, newproc);
+
+	/* Fork the thread */
+	result = thread_fork("Spawned child thread", newproc, enter_spawned_process, (void *)se, 0);
+	if (result)
+		goto fail;
+
+	kfree(acts);
+	*ret = newproc->pid;
+	return 0;
+
+fail:
+	KASSERT(newproc->p_numthreads == 0);
+	proc_exit(newproc);
+	proc_destroy(newproc);
+	kfree(se);
+	kfree(acts);
 	return result;
 }
 
@@ -359,6 +655,8 @@ sys__exit(int exitcode) {
 
 /*
  * waitpid 
+ *
+ * Supports WNOHANG and pid == WAIT_ANY (-1)
  */
 int
 sys_waitpid(pid_t pid, userptr_t status, int options, int32_t *ret)
@@ -367,17 +665,16 @@ sys_waitpid(pid_t pid, userptr_t status, int options, int32_t *ret)
 
 	struct proc *childproc,
 				*proc = curproc;
-	unsigned num, i;
 	int result, exit_val;
 
-	i = exit_val = 0;
+	exit_val = 0;
 	
 	/* Check options */
-	if (options != 0)
+	if ((options & ~WNOHANG) != 0)
 		return EINVAL;
 
 	/* Check pid is within std range */
-	if (pid < PID_MIN || pid > PID_MAX)
+	if (pid != WAIT_ANY && (pid < PID_MIN || pid > PID_MAX))
 		return ESRCH;
 
 	/* Check status pointer is valid */
@@ -387,16 +684,16 @@ sys_waitpid(pid_t pid, userptr_t status, int options, int32_t *ret)
 			return result;
 	}
 
-	/* Check pid is child proc */
-	num = cparray_num(proc->cps);
-	while (i < num && pid != (childproc = cparray_get(proc->cps, i))->pid)
-		++i;
-
-	if (i == num)
-		return ECHILD;
+	/* Find child proc and wait for it to exit */
+	result = proc_waitchild(proc, pid, (options & WNOHANG) != 0, &childproc);
+	if (result)
+		return result;
 
-	/* Wait for child proc to exit */
-	P(childproc->exit_sem);
+	/* WNOHANG and nothing has exited yet */
+	if (childproc == NULL) {
+		*ret = 0;
+		return 0;
+	}
 
 	exit_val = childproc->exit_val;
 
@@ -406,7 +703,6 @@ sys_waitpid(pid_t pid, userptr_t status, int options, int32_t *ret)
 	*ret = childproc->pid;
 
 	proc_destroy(childproc);
-	cparray_remove(proc->cps, i); 
 
 	return 0;
 }
@@ -0,0 +1,980 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <synch.h>
+#include <clock.h>
+#include <thread.h>
+#include <uio.h>
+#include <device.h>
+#include <vfs.h>
+#include <buf.h>
+
+/*
+ * Everything here is protected by buf_lock, except the contents of a
+ * busy buffer, which belong to whoever has it. Device I/O is done
+ * without buf_lock held, on a buffer marked busy.
+ *
+ * Buffers that aren't busy sit on the LRU list, most recently used
+ * at the head. Buffers not holding any block (b_dev NULL) and
+ * invalid ones go at the tail so they get reused first. Pinned
+ * buffers stay on the list but are passed over.
+ */
+static struct lock *buf_lock;
+static struct cv *buf_cv;		/* Signalled when a buffer goes idle */
+static struct buf *buf_pool;
+static struct buf *buf_hash[BUF_HASHSIZE];
+static struct buf *lru_head;
+static struct buf *lru_tail;
+static unsigned buf_ndirty;		/* Number of dirty buffers */
+
+/*
+ * Read-ahead requests, a ring buffer also protected by buf_lock. The
+ * read-ahead thread works on one request at a time; ra_curdev is the
+ * device it's working on, or NULL if it's been told to stop.
+ */
+struct buf_rareq {
+	struct device *rr_dev;
+	daddr_t rr_block;
+	unsigned rr_nblocks;
+};
+static struct buf_rareq ra_queue[BUF_RAQUEUE];
+static unsigned ra_head, ra_count;
+static struct device *ra_curdev;
+static struct cv *ra_cv;		/* Signalled when a request arrives */
+
+/*
+ * Direct writes in progress, also protected by buf_lock. The caller
+ * of buf_directio keeps other filesystem I/O off the blocks, but not
+ * the read-ahead thread, which mustn't load these blocks meanwhile or
+ * it could cache what was on disk before the write. Each record lives
+ * on its writer's stack.
+ */
+struct buf_dio {
+	struct device *bd_dev;
+	daddr_t bd_block;
+	unsigned bd_nblocks;
+	struct buf_dio *bd_next;
+};
+static struct buf_dio *dio_list;
+
+/* Statistics */
+static unsigned buf_hits, buf_misses;
+static unsigned buf_reads, buf_writes;
+static unsigned buf_directreads, buf_directwrites;
+static unsigned buf_directblocks;
+static unsigned buf_prefetched, buf_radropped;
+static unsigned buf_syncwrites;
+
+void
+buf_bootstrap(void)
+{
+	unsigned i;
+
+	buf_lock = lock_create("buffer cache lock");
+	buf_cv = cv_create("buffer cache cv");
+	ra_cv = cv_create("read-ahead cv");
+	buf_pool = kmalloc(BUF_NBUFS * sizeof(struct buf));
+	if (buf_lock == NULL || buf_cv == NULL || ra_cv == NULL ||
+	    buf_pool == NULL) {
+		panic("buf_bootstrap: Out of memory\n");
+	}
+	ra_head = ra_count = 0;
+	dio_list = NULL;
+	ra_curdev = NULL;
+
+	for (i = 0; i < BUF_HASHSIZE; i++) {
+		buf_hash[i] = NULL;
+	}
+	lru_head = lru_tail = NULL;
+	buf_ndirty = 0;
+
+	for (i = 0; i < BUF_NBUFS; i++) {
+		struct buf *b = &buf_pool[i];
+
+		b->b_dev = NULL;
+		b->b_block = 0;
+		b->b_valid = false;
+		b->b_dirty = false;
+		b->b_busy = false;
+		b->b_pinned = false;
+		b->b_dirtysince = 0;
+		b->b_hashnext = NULL;
+		b->b_data = kmalloc(BUF_SIZE);
+		if (b->b_data == NULL) {
+			panic("buf_bootstrap: Out of memory\n");
+		}
+
+		/* Append so the list is in pool order */
+		b->b_lrunext = NULL;
+		b->b_lruprev = lru_tail;
+		if (lru_tail != NULL)
+			lru_tail->b_lrunext = b;
+		else
+			lru_head = b;
+		lru_tail = b;
+	}
+}
+
+////////////////////////////////////////////////////////////
+// Hash and LRU helpers; caller holds buf_lock
+
+static
+unsigned
+buf_hashfunc(struct device *dev, daddr_t block)
+{
+	return ((uintptr_t)dev / sizeof(struct device) + block) % BUF_HASHSIZE;
+}
+
+static
+struct buf *
+hash_lookup(struct device *dev, daddr_t block)
+{
+	struct buf *b;
+
+	for (b = buf_hash[buf_hashfunc(dev, block)]; b != NULL; b = b->b_hashnext) {
+		if (b->b_dev == dev && b->b_block == block)
+			return b;
+	}
+	return NULL;
+}
+
+static
+void
+hash_insert(struct buf *b)
+{
+	unsigned h = buf_hashfunc(b->b_dev, b->b_block);
+
+	b->b_hashnext = buf_hash[h];
+	buf_hash[h] = b;
+}
+
+static
+void
+hash_remove(struct buf *b)
+{
+	struct buf **pp;
+
+	pp = &buf_hash[buf_hashfunc(b->b_dev, b->b_block)];
+	while (*pp != b) {
+		KASSERT(*pp != NULL);
+		pp = &(*pp)->b_hashnext;
+	}
+	*pp = b->b_hashnext;
+	b->b_hashnext = NULL;
+}
+
+static
+void
+lru_remove(struct buf *b)
+{
+	if (b->b_lruprev != NULL)
+		b->b_lruprev->b_lrunext = b->b_lrunext;
+	else
+		lru_head = b->b_lrunext;
+	if (b->b_lrunext != NULL)
+		b->b_lrunext->b_lruprev = b->b_lruprev;
+	else
+		lru_tail = b->b_lruprev;
+	b->b_lruprev = b->b_lrunext = NULL;
+}
+
+static
+void
+lru_insert_head(struct buf *b)
+{
+	b->b_lruprev = NULL;
+	b->b_lrunext = lru_head;
+	if (lru_head != NULL)
+		lru_head->b_lruprev = b;
+	else
+		lru_tail = b;
+	lru_head = b;
+}
+
+static
+void
+lru_insert_tail(struct buf *b)
+{
+	b->b_lrunext = NULL;
+	b->b_lruprev = lru_tail;
+	if (lru_tail != NULL)
+		lru_tail->b_lrunext = b;
+	else
+		lru_head = b;
+	lru_tail = b;
+}
+
+/*
+ * Make a busy buffer idle again and wake anyone waiting for it.
+ */
+static
+void
+buf_unbusy(struct buf *b)
+{
+	KASSERT(b->b_busy);
+
+	b->b_busy = false;
+	if (b->b_valid)
+		lru_insert_head(b);
+	else
+		lru_insert_tail(b);
+	cv_broadcast(buf_cv, buf_lock);
+}
+
+/*
+ * Take an idle buffer off the LRU list for our own use.
+ */
+static
+void
+buf_mkbusy(struct buf *b)
+{
+	KASSERT(!b->b_busy);
+
+	lru_remove(b);
+	b->b_busy = true;
+}
+
+/*
+ * Disassociate a buffer from its block.
+ */
+static
+void
+buf_forget(struct buf *b)
+{
+	if (b->b_dev != NULL) {
+		hash_remove(b);
+		b->b_dev = NULL;
+	}
+	b->b_valid = false;
+	b->b_pinned = false;
+	if (b->b_dirty) {
+		KASSERT(buf_ndirty > 0);
+		buf_ndirty--;
+		b->b_dirty = false;
+	}
+}
+
+////////////////////////////////////////////////////////////
+// Device I/O
+
+/*
+ * Read or write a busy buffer, retrying I/O errors. Called without
+ * buf_lock.
+ */
+static
+int
+buf_io(struct buf *b, enum uio_rw rw)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+	int tries = 0;
+
+	KASSERT(b->b_busy);
+	KASSERT(b->b_dev != NULL);
+
+	DEBUG(DB_VFS, "buf: %s %llu\n",
+	      rw == UIO_READ ? "read" : "write",
+	      (unsigned long long) b->b_block);
+
+ retry:
+	uio_kinit(&iov, &ku, b->b_data, BUF_SIZE,
+		  ((off_t)b->b_block) * BUF_SIZE, rw);
+	result = DEVOP_IO(b->b_dev, &ku);
+	if (result == EINVAL) {
+		/*
+		 * The block was out of range or something else
+		 * that's the filesystem's fault.
+		 */
+		panic("buf: block %u: DEVOP_IO returned EINVAL\n",
+		      b->b_block);
+	}
+	if (result == EIO) {
+		if (tries == 0) {
+			kprintf("buf: block %u I/O error, retrying\n",
+				b->b_block);
+		}
+		if (tries < 10) {
+			tries++;
+			goto retry;
+		}
+		kprintf("buf: block %u I/O error, giving up after %d "
+			"retries\n", b->b_block, tries);
+	}
+	return result;
+}
+
+/*
+ * Write a dirty busy buffer back. Called and returns with buf_lock
+ * held, but drops it for the I/O.
+ */
+static
+int
+buf_writeback(struct buf *b)
+{
+	int result;
+
+	KASSERT(b->b_busy);
+	KASSERT(b->b_dirty);
+	KASSERT(!b->b_pinned);
+
+	lock_release(buf_lock);
+	result = buf_io(b, UIO_WRITE);
+	lock_acquire(buf_lock);
+
+	if (result == 0) {
+		KASSERT(buf_ndirty > 0);
+		buf_ndirty--;
+		b->b_dirty = false;
+		buf_writes++;
+	}
+	return result;
+}
+
+////////////////////////////////////////////////////////////
+// Interface
+
+/*
+ * Find or make the buffer for a block and mark it busy. Caller holds
+ * buf_lock.
+ */
+static
+int
+buf_getbusy(struct device *dev, daddr_t block, struct buf **ret)
+{
+	struct buf *b;
+	int result;
+
+	KASSERT(lock_do_i_hold(buf_lock));
+	KASSERT(dev->d_blocksize == BUF_SIZE);
+
+	while (1) {
+		b = hash_lookup(dev, block);
+		if (b != NULL) {
+			if (b->b_busy) {
+				cv_wait(buf_cv, buf_lock);
+				continue;
+			}
+			buf_mkbusy(b);
+			buf_hits++;
+			*ret = b;
+			return 0;
+		}
+
+		b = lru_tail;
+		while (b != NULL && b->b_pinned) {
+			b = b->b_lruprev;
+		}
+		if (b == NULL) {
+			/* Everything is busy or pinned */
+			cv_wait(buf_cv, buf_lock);
+			continue;
+		}
+		buf_mkbusy(b);
+
+		if (b->b_dirty) {
+			/*
+			 * Write it back and start over, since someone
+			 * may have loaded our block meanwhile.
+			 */
+			result = buf_writeback(b);
+			buf_unbusy(b);
+			if (result) {
+				return result;
+			}
+			continue;
+		}
+
+		buf_forget(b);
+		b->b_dev = dev;
+		b->b_block = block;
+		hash_insert(b);
+		buf_misses++;
+		*ret = b;
+		return 0;
+	}
+}
+
+int
+buf_read(struct device *dev, daddr_t block, struct buf **ret)
+{
+	struct buf *b;
+	int result;
+
+	lock_acquire(buf_lock);
+	result = buf_getbusy(dev, block, &b);
+	if (result) {
+		lock_release(buf_lock);
+		return result;
+	}
+
+	if (!b->b_valid) {
+		lock_release(buf_lock);
+		result = buf_io(b, UIO_READ);
+		lock_acquire(buf_lock);
+		if (result) {
+			buf_forget(b);
+			buf_unbusy(b);
+			lock_release(buf_lock);
+			return result;
+		}
+		b->b_valid = true;
+		buf_reads++;
+	}
+	lock_release(buf_lock);
+
+	*ret = b;
+	return 0;
+}
+
+int
+buf_get(struct device *dev, daddr_t block, struct buf **ret)
+{
+	int result;
+
+	lock_acquire(buf_lock);
+	result = buf_getbusy(dev, block, ret);
+	lock_release(buf_lock);
+	return result;
+}
+
+void *
+buf_map(struct buf *b)
+{
+	KASSERT(b->b_busy);
+	return b->b_data;
+}
+
+void
+buf_markdirty(struct buf *b)
+{
+	struct timespec now;
+
+	KASSERT(b->b_busy);
+
+	b->b_valid = true;
+	if (b->b_dirty) {
+		return;
+	}
+
+	/* The buffer is ours, but buf_ndirty isn't */
+	gettime(&now);
+	lock_acquire(buf_lock);
+	b->b_dirty = true;
+	b->b_dirtysince = now.tv_sec;
+	buf_ndirty++;
+	lock_release(buf_lock);
+}
+
+void
+buf_pin(struct buf *b)
+{
+	KASSERT(b->b_busy);
+
+	buf_markdirty(b);
+	lock_acquire(buf_lock);
+	b->b_pinned = true;
+	lock_release(buf_lock);
+}
+
+void
+buf_unpin(struct device *dev, daddr_t block)
+{
+	struct buf *b;
+
+	lock_acquire(buf_lock);
+	while ((b = hash_lookup(dev, block)) != NULL && b->b_busy) {
+		cv_wait(buf_cv, buf_lock);
+	}
+	if (b != NULL) {
+		b->b_pinned = false;
+	}
+	lock_release(buf_lock);
+}
+
+unsigned
+buf_pinlist(struct device *dev, daddr_t *blocks, unsigned max)
+{
+	struct buf *b;
+	unsigned i, n = 0;
+
+	lock_acquire(buf_lock);
+	for (i = 0; i < BUF_NBUFS; i++) {
+		b = &buf_pool[i];
+		if (b->b_dev == dev && b->b_pinned) {
+			if (n < max) {
+				blocks[n] = b->b_block;
+			}
+			n++;
+		}
+	}
+	lock_release(buf_lock);
+	return n;
+}
+
+void
+buf_release(struct buf *b)
+{
+	lock_acquire(buf_lock);
+	buf_unbusy(b);
+	lock_release(buf_lock);
+}
+
+void
+buf_drop(struct device *dev, daddr_t block)
+{
+	struct buf *b;
+
+	lock_acquire(buf_lock);
+	while ((b = hash_lookup(dev, block)) != NULL && b->b_busy) {
+		cv_wait(buf_cv, buf_lock);
+	}
+	if (b != NULL) {
+		buf_forget(b);
+		lru_remove(b);
+		lru_insert_tail(b);
+	}
+	lock_release(buf_lock);
+}
+
+bool
+buf_cached(struct device *dev, daddr_t block)
+{
+	bool ret;
+
+	lock_acquire(buf_lock);
+	ret = hash_lookup(dev, block) != NULL;
+	lock_release(buf_lock);
+	return ret;
+}
+
+////////////////////////////////////////////////////////////
+// Read-ahead
+
+void
+buf_prefetch(struct device *dev, daddr_t block, unsigned nblocks)
+{
+	struct buf_rareq *rr;
+
+	if (nblocks == 0) {
+		return;
+	}
+
+	lock_acquire(buf_lock);
+	if (ra_count == BUF_RAQUEUE) {
+		/* It's only a hint */
+		buf_radropped++;
+		lock_release(buf_lock);
+		return;
+	}
+	rr = &ra_queue[(ra_head + ra_count) % BUF_RAQUEUE];
+	rr->rr_dev = dev;
+	rr->rr_block = block;
+	rr->rr_nblocks = nblocks;
+	ra_count++;
+	cv_signal(ra_cv, buf_lock);
+	lock_release(buf_lock);
+}
+
+/*
+ * Check if a direct write to a block is in progress. Caller holds
+ * buf_lock.
+ */
+static
+bool
+buf_dio_active(struct device *dev, daddr_t block)
+{
+	struct buf_dio *bd;
+
+	for (bd = dio_list; bd != NULL; bd = bd->bd_next) {
+		if (bd->bd_dev == dev && block >= bd->bd_block &&
+		    block < bd->bd_block + bd->bd_nblocks) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Read one block into the cache unless it's already there, or being
+ * written directly. Caller holds buf_lock.
+ */
+static
+int
+buf_readahead_one(struct device *dev, daddr_t block)
+{
+	struct buf *b;
+	int result;
+
+	if (hash_lookup(dev, block) != NULL || buf_dio_active(dev, block)) {
+		return 0;
+	}
+
+	result = buf_getbusy(dev, block, &b);
+	if (result) {
+		return result;
+	}
+	if (!b->b_valid && buf_dio_active(dev, block)) {
+		/* Started while buf_getbusy had the lock dropped */
+		buf_forget(b);
+		buf_unbusy(b);
+		return 0;
+	}
+	if (!b->b_valid) {
+		lock_release(buf_lock);
+		result = buf_io(b, UIO_READ);
+		lock_acquire(buf_lock);
+		if (result) {
+			buf_forget(b);
+		}
+		else {
+			b->b_valid = true;
+			buf_reads++;
+			buf_prefetched++;
+		}
+	}
+	buf_unbusy(b);
+	return result;
+}
+
+/*
+ * Read-ahead thread: work through the queued requests, forever.
+ */
+static
+void
+buf_readahead_thread(void *unused1, unsigned long unused2)
+{
+	struct buf_rareq rr;
+	unsigned i;
+
+	(void)unused1;
+	(void)unused2;
+
+	lock_acquire(buf_lock);
+	while (1) {
+		while (ra_count == 0) {
+			cv_wait(ra_cv, buf_lock);
+		}
+		rr = ra_queue[ra_head];
+		ra_head = (ra_head + 1) % BUF_RAQUEUE;
+		ra_count--;
+
+		/* buf_dropdev clears ra_curdev to stop us */
+		ra_curdev = rr.rr_dev;
+		for (i = 0; i < rr.rr_nblocks && ra_curdev == rr.rr_dev; i++) {
+			if (buf_readahead_one(rr.rr_dev, rr.rr_block + i)) {
+				break;
+			}
+		}
+		ra_curdev = NULL;
+	}
+}
+
+////////////////////////////////////////////////////////////
+// Syncer
+
+/*
+ * Write back idle dirty buffers that are older than BUF_MAXAGE, and
+ * if more than BUF_DIRTYHIGH buffers are dirty, any others needed to
+ * get down to BUF_DIRTYLOW. Caller holds buf_lock.
+ */
+static
+void
+buf_syncer_pass(void)
+{
+	struct timespec now;
+	struct buf *b;
+	bool flushing;
+	unsigned i;
+
+	gettime(&now);
+	flushing = buf_ndirty > BUF_DIRTYHIGH;
+
+	for (i = 0; i < BUF_NBUFS; i++) {
+		b = &buf_pool[i];
+		if (b->b_busy || !b->b_dirty || b->b_pinned) {
+			continue;
+		}
+		if (now.tv_sec - b->b_dirtysince < BUF_MAXAGE &&
+		    !(flushing && buf_ndirty > BUF_DIRTYLOW)) {
+			continue;
+		}
+		buf_mkbusy(b);
+		if (buf_writeback(b) == 0) {
+			buf_syncwrites++;
+		}
+		buf_unbusy(b);
+	}
+}
+
+/*
+ * Syncer thread: once a second write back old dirty buffers, and
+ * every BUF_SYNCPERIOD seconds sync all the filesystems so metadata
+ * they keep outside the cache (inodes, freemaps) gets out too.
+ */
+static
+void
+buf_syncer_thread(void *unused1, unsigned long unused2)
+{
+	unsigned secs = 0;
+
+	(void)unused1;
+	(void)unused2;
+
+	while (1) {
+		clocksleep(1);
+
+		lock_acquire(buf_lock);
+		buf_syncer_pass();
+		lock_release(buf_lock);
+
+		if (++secs == BUF_SYNCPERIOD) {
+			secs = 0;
+			vfs_sync();
+		}
+	}
+}
+
+void
+buf_startthreads(void)
+{
+	int result;
+
+	result = thread_fork("buf read-ahead", NULL, buf_readahead_thread,
+			     NULL, 0);
+	if (result) {
+		panic("buf_startthreads: thread_fork: %s\n",
+		      strerror(result));
+	}
+	result = thread_fork("buf syncer", NULL, buf_syncer_thread,
+			     NULL, 0);
+	if (result) {
+		panic("buf_startthreads: thread_fork: %s\n",
+		      strerror(result));
+	}
+}
+
+////////////////////////////////////////////////////////////
+// Direct I/O
+
+int
+buf_directio(struct device *dev, daddr_t block, unsigned nblocks,
+	     struct uio *uio)
+{
+	struct buf_dio bd, **bdp;
+	struct buf *b;
+	unsigned i;
+	int result;
+
+	KASSERT(dev->d_blocksize == BUF_SIZE);
+	KASSERT(uio->uio_offset == ((off_t)block) * BUF_SIZE);
+	KASSERT(uio->uio_resid == nblocks * BUF_SIZE);
+
+	lock_acquire(buf_lock);
+	if (uio->uio_rw == UIO_WRITE) {
+		/* Keep read-ahead off the blocks until we're done */
+		bd.bd_dev = dev;
+		bd.bd_block = block;
+		bd.bd_nblocks = nblocks;
+		bd.bd_next = dio_list;
+		dio_list = &bd;
+	}
+	for (i = 0; i < nblocks; i++) {
+		while ((b = hash_lookup(dev, block + i)) != NULL && b->b_busy) {
+			cv_wait(buf_cv, buf_lock);
+		}
+		if (b == NULL) {
+			continue;
+		}
+
+		if (uio->uio_rw == UIO_WRITE) {
+			/* About to be overwritten on disk */
+			buf_forget(b);
+			lru_remove(b);
+			lru_insert_tail(b);
+		}
+		else if (b->b_dirty) {
+			/* The disk has to be current before we read it */
+			KASSERT(!b->b_pinned);
+			buf_mkbusy(b);
+			result = buf_writeback(b);
+			buf_unbusy(b);
+			if (result) {
+				lock_release(buf_lock);
+				return result;
+			}
+		}
+	}
+	if (uio->uio_rw == UIO_READ) {
+		buf_directreads++;
+	}
+	else {
+		buf_directwrites++;
+	}
+	buf_directblocks += nblocks;
+	lock_release(buf_lock);
+
+	DEBUG(DB_VFS, "buf: direct %s %u+%u\n",
+	      uio->uio_rw == UIO_READ ? "read" : "write", block, nblocks);
+
+	result = DEVOP_IO(dev, uio);
+	if (result == EINVAL) {
+		panic("buf: blocks %u+%u: DEVOP_IO returned EINVAL\n",
+		      block, nblocks);
+	}
+
+	if (uio->uio_rw == UIO_WRITE) {
+		lock_acquire(buf_lock);
+		for (bdp = &dio_list; *bdp != &bd; bdp = &(*bdp)->bd_next) {
+			KASSERT(*bdp != NULL);
+		}
+		*bdp = bd.bd_next;
+
+		/* Nothing idle in the range can be current; be sure */
+		for (i = 0; i < nblocks; i++) {
+			b = hash_lookup(dev, block + i);
+			if (b != NULL && !b->b_busy && !b->b_dirty) {
+				buf_forget(b);
+				lru_remove(b);
+				lru_insert_tail(b);
+			}
+		}
+		lock_release(buf_lock);
+	}
+	return result;
+}
+
+int
+buf_sync(struct device *dev)
+{
+	struct buf *b;
+	unsigned i;
+	int result, err = 0;
+
+	lock_acquire(buf_lock);
+	for (i = 0; i < BUF_NBUFS; i++) {
+		b = &buf_pool[i];
+		if (b->b_dev != dev || !b->b_dirty || b->b_pinned) {
+			continue;
+		}
+		if (b->b_busy) {
+			/* Wait and look at this one again */
+			cv_wait(buf_cv, buf_lock);
+			i--;
+			continue;
+		}
+		buf_mkbusy(b);
+		result = buf_writeback(b);
+		buf_unbusy(b);
+		if (result && err == 0) {
+			err = result;
+		}
+	}
+	lock_release(buf_lock);
+
+	return err;
+}
+
+int
+buf_flush(struct device *dev, daddr_t block)
+{
+	struct buf *b;
+	int result = 0;
+
+	lock_acquire(buf_lock);
+	while ((b = hash_lookup(dev, block)) != NULL && b->b_busy) {
+		cv_wait(buf_cv, buf_lock);
+	}
+	if (b != NULL && b->b_dirty && !b->b_pinned) {
+		buf_mkbusy(b);
+		result = buf_writeback(b);
+		buf_unbusy(b);
+	}
+	lock_release(buf_lock);
+
+	return result;
+}
+
+void
+buf_dropdev(struct device *dev)
+{
+	struct buf_rareq *rr;
+	struct buf *b;
+	unsigned i;
+
+	lock_acquire(buf_lock);
+
+	/* Cancel read-ahead, queued or in progress */
+	for (i = 0; i < ra_count; i++) {
+		rr = &ra_queue[(ra_head + i) % BUF_RAQUEUE];
+		if (rr->rr_dev == dev) {
+			rr->rr_nblocks = 0;
+		}
+	}
+	if (ra_curdev == dev) {
+		ra_curdev = NULL;
+	}
+
+	for (i = 0; i < BUF_NBUFS; i++) {
+		b = &buf_pool[i];
+		if (b->b_dev != dev) {
+			continue;
+		}
+		if (b->b_busy) {
+			/* Must be read-ahead; wait for it to finish */
+			cv_wait(buf_cv, buf_lock);
+			i--;
+			continue;
+		}
+		KASSERT(!b->b_dirty);
+		buf_forget(b);
+		lru_remove(b);
+		lru_insert_tail(b);
+	}
+	lock_release(buf_lock);
+}
+
+void
+buf_printstats(void)
+{
+	lock_acquire(buf_lock);
+	kprintf("Buffer cache: %u buffers, %u hits, %u misses, "
+		"%u reads, %u writes\n",
+		BUF_NBUFS, buf_hits, buf_misses, buf_reads, buf_writes);
+	kprintf("Direct I/O: %u reads, %u writes, %u blocks\n",
+		buf_directreads, buf_directwrites, buf_directblocks);
+	kprintf("Read-ahead: %u blocks, %u requests dropped\n",
+		buf_prefetched, buf_radropped);
+	kprintf("Write-back: %u dirty now, %u written by syncer\n",
+		buf_ndirty, buf_syncwrites);
+	lock_release(buf_lock);
+}
@@ -0,0 +1,439 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <fs.h>
+#include <vnode.h>
+#include <dcache.h>
+
+/*
+ * Everything here is protected by dcache_lock. It's a spinlock, since
+ * the cache is only ever touched briefly; references are dropped
+ * after letting go of it, as VOP_DECREF can sleep.
+ *
+ * Entries sit on the LRU list, most recently used at the head.
+ * Unused entries go at the tail so they get reused first.
+ */
+static struct spinlock dcache_lock = SPINLOCK_INITIALIZER;
+static struct dcache_entry *dcache_pool;
+static struct dcache_entry *dcache_hash[DCACHE_HASHSIZE];
+static struct dcache_entry *lru_head;
+static struct dcache_entry *lru_tail;
+static unsigned dcache_generation;	/* Bumped by each invalidation */
+
+/* Statistics */
+static unsigned dcache_hits, dcache_neghits, dcache_misses;
+static unsigned dcache_enters, dcache_raced, dcache_invals;
+
+void
+dcache_bootstrap(void)
+{
+	unsigned i;
+
+	dcache_pool = kmalloc(DCACHE_NENTRIES * sizeof(struct dcache_entry));
+	if (dcache_pool == NULL) {
+		panic("dcache_bootstrap: Out of memory\n");
+	}
+
+	for (i = 0; i < DCACHE_HASHSIZE; i++) {
+		dcache_hash[i] = NULL;
+	}
+	lru_head = lru_tail = NULL;
+
+	for (i = 0; i < DCACHE_NENTRIES; i++) {
+		struct dcache_entry *de = &dcache_pool[i];
+
+		de->de_dir = NULL;
+		de->de_vn = NULL;
+		de->de_name[0] = 0;
+		de->de_hashnext = NULL;
+
+		/* Append so the list is in pool order */
+		de->de_lrunext = NULL;
+		de->de_lruprev = lru_tail;
+		if (lru_tail != NULL)
+			lru_tail->de_lrunext = de;
+		else
+			lru_head = de;
+		lru_tail = de;
+	}
+}
+
+////////////////////////////////////////////////////////////
+// Hash and LRU helpers; caller holds dcache_lock
+
+static
+unsigned
+dcache_hashfunc(struct vnode *dir, const char *name)
+{
+	unsigned h = (uintptr_t)dir / sizeof(struct vnode);
+
+	while (*name) {
+		h = h*33 + (unsigned char)*name++;
+	}
+	return h % DCACHE_HASHSIZE;
+}
+
+static
+struct dcache_entry *
+hash_lookup(struct vnode *dir, const char *name)
+{
+	struct dcache_entry *de;
+
+	de = dcache_hash[dcache_hashfunc(dir, name)];
+	for (; de != NULL; de = de->de_hashnext) {
+		if (de->de_dir == dir && !strcmp(de->de_name, name))
+			return de;
+	}
+	return NULL;
+}
+
+static
+void
+hash_insert(struct dcache_entry *de)
+{
+	unsigned h = dcache_hashfunc(de->de_dir, de->de_name);
+
+	de->de_hashnext = dcache_hash[h];
+	dcache_hash[h] = de;
+}
+
+static
+void
+hash_remove(struct dcache_entry *de)
+{
+	struct dcache_entry **pp;
+
+	pp = &dcache_hash[dcache_hashfunc(de->de_dir, de->de_name)];
+	while (*pp != de) {
+		KASSERT(*pp != NULL);
+		pp = &(*pp)->de_hashnext;
+	}
+	*pp = de->de_hashnext;
+	de->de_hashnext = NULL;
+}
+
+static
+void
+lru_remove(struct dcache_entry *de)
+{
+	if (de->de_lruprev != NULL)
+		de->de_lruprev->de_lrunext = de->de_lrunext;
+	else
+		lru_head = de->de_lrunext;
+	if (de->de_lrunext != NULL)
+		de->de_lrunext->de_lruprev = de->de_lruprev;
+	else
+		lru_tail = de->de_lruprev;
+	de->de_lruprev = de->de_lrunext = NULL;
+}
+
+static
+void
+lru_insert_head(struct dcache_entry *de)
+{
+	de->de_lruprev = NULL;
+	de->de_lrunext = lru_head;
+	if (lru_head != NULL)
+		lru_head->de_lruprev = de;
+	else
+		lru_tail = de;
+	lru_head = de;
+}
+
+static
+void
+lru_insert_tail(struct dcache_entry *de)
+{
+	de->de_lrunext = NULL;
+	de->de_lruprev = lru_tail;
+	if (lru_tail != NULL)
+		lru_tail->de_lrunext = de;
+	else
+		lru_head = de;
+	lru_tail = de;
+}
+
+/*
+ * Empty an entry and move it to the tail for reuse. Hands back the
+ * references it held, for the caller to drop after unlocking.
+ */
+static
+void
+dcache_forget(struct dcache_entry *de, struct vnode **dir, struct vnode **vn)
+{
+	KASSERT(de->de_dir != NULL);
+
+	hash_remove(de);
+	if (de->de_vn != NULL) {
+		KASSERT(de->de_dir->vn_fs->fs_dcacheheld > 0);
+		de->de_dir->vn_fs->fs_dcacheheld--;
+	}
+	*dir = de->de_dir;
+	*vn = de->de_vn;
+	de->de_dir = NULL;
+	de->de_vn = NULL;
+	de->de_name[0] = 0;
+	lru_remove(de);
+	lru_insert_tail(de);
+}
+
+/*
+ * Drop the references from dcache_forget.
+ */
+static
+void
+dcache_release(struct vnode *dir, struct vnode *vn)
+{
+	if (vn != NULL) {
+		VOP_DECREF(vn);
+	}
+	if (dir != NULL) {
+		VOP_DECREF(dir);
+	}
+}
+
+static
+bool
+dcache_cacheable(struct vnode *dir, const char *name)
+{
+	if (dir->vn_fs == NULL) {
+		/* device */
+		return false;
+	}
+	if (!strcmp(name, ".") || !strcmp(name, "..")) {
+		return false;
+	}
+	return strlen(name) <= DCACHE_NAMELEN;
+}
+
+/*
+ * Pick the entry for dcache_enter to reuse: normally the least
+ * recently used, but if a positive entry in DIR would go over its
+ * filesystem's limit, the least recently used positive one there.
+ */
+static
+struct dcache_entry *
+dcache_victim(struct vnode *dir, struct vnode *vn)
+{
+	struct fs *fs = dir->vn_fs;
+	struct dcache_entry *de;
+
+	if (vn == NULL || fs->fs_dcachemax == 0 ||
+	    fs->fs_dcacheheld < fs->fs_dcachemax) {
+		return lru_tail;
+	}
+	for (de = lru_tail; de != NULL; de = de->de_lruprev) {
+		if (de->de_dir != NULL && de->de_vn != NULL &&
+		    de->de_dir->vn_fs == fs) {
+			return de;
+		}
+	}
+	panic("dcache: fs_dcacheheld is wrong\n");
+	return NULL;
+}
+
+////////////////////////////////////////////////////////////
+// Interface
+
+bool
+dcache_lookup(struct vnode *dir, const char *name, struct vnode **ret)
+{
+	struct dcache_entry *de;
+
+	if (!dcache_cacheable(dir, name)) {
+		return false;
+	}
+
+	spinlock_acquire(&dcache_lock);
+	de = hash_lookup(dir, name);
+	if (de == NULL) {
+		dcache_misses++;
+		spinlock_release(&dcache_lock);
+		return false;
+	}
+	lru_remove(de);
+	lru_insert_head(de);
+	if (de->de_vn != NULL) {
+		VOP_INCREF(de->de_vn);
+		dcache_hits++;
+	}
+	else {
+		dcache_neghits++;
+	}
+	*ret = de->de_vn;
+	spinlock_release(&dcache_lock);
+	return true;
+}
+
+unsigned
+dcache_gen(void)
+{
+	unsigned gen;
+
+	spinlock_acquire(&dcache_lock);
+	gen = dcache_generation;
+	spinlock_release(&dcache_lock);
+	return gen;
+}
+
+void
+dcache_enter(struct vnode *dir, const char *name, struct vnode *vn,
+	     unsigned gen)
+{
+	struct dcache_entry *de;
+	struct vnode *olddir, *oldvn;
+
+	if (!dcache_cacheable(dir, name)) {
+		return;
+	}
+
+	spinlock_acquire(&dcache_lock);
+	if (gen != dcache_generation) {
+		/* Something changed while it was being looked up */
+		dcache_raced++;
+		spinlock_release(&dcache_lock);
+		return;
+	}
+	if (hash_lookup(dir, name) != NULL) {
+		/* Someone else got here first */
+		spinlock_release(&dcache_lock);
+		return;
+	}
+
+	olddir = oldvn = NULL;
+	de = dcache_victim(dir, vn);
+	if (de->de_dir != NULL) {
+		dcache_forget(de, &olddir, &oldvn);
+	}
+
+	VOP_INCREF(dir);
+	if (vn != NULL) {
+		VOP_INCREF(vn);
+		dir->vn_fs->fs_dcacheheld++;
+	}
+	de->de_dir = dir;
+	de->de_vn = vn;
+	strcpy(de->de_name, name);
+	hash_insert(de);
+	lru_remove(de);
+	lru_insert_head(de);
+	dcache_enters++;
+	spinlock_release(&dcache_lock);
+
+	dcache_release(olddir, oldvn);
+}
+
+/*
+ * Also forgets lookups done in what NAME was, so a removed directory
+ * isn't kept around by its own entries. Lookups in it that aren't
+ * reached that way (because NAME itself wasn't cached) age out.
+ */
+void
+dcache_invalidate(struct vnode *dir, const char *name)
+{
+	struct dcache_entry *de;
+	struct vnode *olddir, *oldvn, *entrydir, *named;
+	unsigned i;
+
+	spinlock_acquire(&dcache_lock);
+	dcache_generation++;
+	dcache_invals++;
+	de = hash_lookup(dir, name);
+	if (de == NULL) {
+		spinlock_release(&dcache_lock);
+		return;
+	}
+	dcache_forget(de, &entrydir, &named);
+	spinlock_release(&dcache_lock);
+
+	if (named != NULL) {
+		/* Our reference keeps NAMED from being reused meanwhile */
+		spinlock_acquire(&dcache_lock);
+		for (i = 0; i < DCACHE_NENTRIES; i++) {
+			de = &dcache_pool[i];
+			if (de->de_dir != named) {
+				continue;
+			}
+			dcache_forget(de, &olddir, &oldvn);
+			spinlock_release(&dcache_lock);
+			dcache_release(olddir, oldvn);
+			spinlock_acquire(&dcache_lock);
+		}
+		spinlock_release(&dcache_lock);
+	}
+
+	dcache_release(entrydir, named);
+}
+
+void
+dcache_purgefs(struct fs *fs)
+{
+	struct dcache_entry *de;
+	struct vnode *olddir, *oldvn;
+	unsigned i;
+
+	KASSERT(fs != NULL);
+
+	spinlock_acquire(&dcache_lock);
+	dcache_generation++;
+	for (i = 0; i < DCACHE_NENTRIES; i++) {
+		de = &dcache_pool[i];
+		if (de->de_dir == NULL || de->de_dir->vn_fs != fs) {
+			continue;
+		}
+		dcache_forget(de, &olddir, &oldvn);
+		spinlock_release(&dcache_lock);
+		dcache_release(olddir, oldvn);
+		spinlock_acquire(&dcache_lock);
+	}
+	spinlock_release(&dcache_lock);
+}
+
+void
+dcache_printstats(void)
+{
+	unsigned used, i;
+
+	spinlock_acquire(&dcache_lock);
+	used = 0;
+	for (i = 0; i < DCACHE_NENTRIES; i++) {
+		if (dcache_pool[i].de_dir != NULL) {
+			used++;
+		}
+	}
+	kprintf("Name cache: %u/%u entries, %u hits, %u negative hits, "
+		"%u misses\n", used, DCACHE_NENTRIES, dcache_hits,
+		dcache_neghits, dcache_misses);
+	kprintf("Name cache: %u entered, %u lost races, %u invalidations\n",
+		dcache_enters, dcache_raced, dcache_invals);
+	spinlock_release(&dcache_lock);
+}
@@ -0,0 +1,307 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Per-device I/O statistics, and the "iostat:" device that hands
+ * them out to userland.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/time.h>
+#include <lib.h>
+#include <clock.h>
+#include <uio.h>
+#include <vfs.h>
+#include <device.h>
+
+void
+devstat_init(struct device *d)
+{
+	KASSERT(d != NULL);
+
+	spinlock_init(&d->d_stat.ds_lock);
+	bzero(&d->d_stat.ds_io, sizeof(d->d_stat.ds_io));
+}
+
+/*
+ * Nanoseconds from FROM to TO, or 0 if TO isn't later.
+ */
+static
+uint64_t
+devstat_nsecs(const struct timespec *from, const struct timespec *to)
+{
+	int64_t ns;
+
+	ns = (int64_t)(to->tv_sec - from->tv_sec) * 1000000000 +
+		((int64_t)to->tv_nsec - from->tv_nsec);
+	return ns > 0 ? (uint64_t)ns : 0;
+}
+
+/*
+ * Histogram bucket for a latency; see <kern/iostat.h>.
+ */
+static
+unsigned
+devstat_bucket(uint64_t ns)
+{
+	uint64_t usecs = ns / 1000;
+	unsigned b = 0;
+
+	while (usecs >= 2 && b < IOSTAT_NBUCKETS - 1) {
+		usecs >>= 1;
+		b++;
+	}
+	return b;
+}
+
+void
+devstat_queued(struct device *d)
+{
+	struct iostat *io = &d->d_stat.ds_io;
+
+	spinlock_acquire(&d->d_stat.ds_lock);
+	io->is_depth++;
+	if (io->is_depth > io->is_maxdepth) {
+		io->is_maxdepth = io->is_depth;
+	}
+	spinlock_release(&d->d_stat.ds_lock);
+}
+
+void
+devstat_done(struct device *d, bool write, uint32_t nsect, int result,
+	     const struct timespec *queued, const struct timespec *started)
+{
+	KASSERT(queued != NULL);
+	KASSERT(started != NULL);
+
+	struct iostat *io = &d->d_stat.ds_io;
+	struct timespec now;
+	uint64_t wait, service;
+
+	gettime(&now);
+	wait = devstat_nsecs(queued, started);
+	service = devstat_nsecs(started, &now);
+
+	spinlock_acquire(&d->d_stat.ds_lock);
+	KASSERT(io->is_depth > 0);
+	io->is_depth--;
+	if (result) {
+		io->is_errors++;
+	}
+	else if (write) {
+		io->is_writes++;
+		io->is_wsectors += nsect;
+	}
+	else {
+		io->is_reads++;
+		io->is_rsectors += nsect;
+	}
+	io->is_waitns += wait;
+	io->is_servicens += service;
+	io->is_hist[devstat_bucket(wait + service)]++;
+	spinlock_release(&d->d_stat.ds_lock);
+}
+
+void
+devstat_get(struct device *d, struct iostat *ret)
+{
+	spinlock_acquire(&d->d_stat.ds_lock);
+	*ret = d->d_stat.ds_io;
+	spinlock_release(&d->d_stat.ds_lock);
+}
+
+/*
+ * Get a snapshot of every block device's stats as a kmalloc'd array.
+ * If there are no block devices, *RET is NULL and *NUM is 0.
+ */
+static
+int
+devstat_snapshot(struct iostat **ret, unsigned *num)
+{
+	struct iostat *stats;
+	unsigned max;
+
+	*ret = NULL;
+	*num = 0;
+
+	max = vfs_getiostats(NULL, 0);
+	if (max == 0) {
+		return 0;
+	}
+	stats = kmalloc(max * sizeof(*stats));
+	if (stats == NULL) {
+		return ENOMEM;
+	}
+	*num = vfs_getiostats(stats, max);
+	if (*num > max) {
+		/* Devices are never removed, but be safe */
+		*num = max;
+	}
+	*ret = stats;
+	return 0;
+}
+
+void
+devstat_printall(void)
+{
+	struct iostat *stats, *io;
+	unsigned num, i, b, last;
+	uint64_t n;
+
+	if (devstat_snapshot(&stats, &num)) {
+		kprintf("iostat: Out of memory\n");
+		return;
+	}
+	if (num == 0) {
+		kprintf("No block devices\n");
+		return;
+	}
+
+	kprintf("%-8s %8s %8s %9s %9s %5s %5s %5s %9s %9s\n",
+		"device", "reads", "writes", "rsectors", "wsectors",
+		"errs", "queue", "max", "wait(us)", "svc(us)");
+	for (i = 0; i < num; i++) {
+		io = &stats[i];
+		n = io->is_reads + io->is_writes + io->is_errors;
+		kprintf("%-8s %8llu %8llu %9llu %9llu %5llu %5u %5u "
+			"%9llu %9llu\n",
+			io->is_name, io->is_reads, io->is_writes,
+			io->is_rsectors, io->is_wsectors, io->is_errors,
+			io->is_depth, io->is_maxdepth,
+			n ? io->is_waitns / n / 1000 : 0,
+			n ? io->is_servicens / n / 1000 : 0);
+	}
+
+	/* Latency histograms, skipping empty buckets */
+	last = IOSTAT_NBUCKETS - 1;
+	for (i = 0; i < num; i++) {
+		io = &stats[i];
+		kprintf("%s latency:", io->is_name);
+		for (b = 0; b < last; b++) {
+			if (io->is_hist[b] != 0) {
+				kprintf(" <%uus:%u", 2U << b, io->is_hist[b]);
+			}
+		}
+		if (io->is_hist[last] != 0) {
+			kprintf(" >=%uus:%u", 1U << last, io->is_hist[last]);
+		}
+		kprintf("\n");
+	}
+
+	kfree(stats);
+}
+
+/*
+ * The iostat device. Reading it gives a struct iostat for each block
+ * device, as of the read; the file offset indexes into that array.
+ */
+
+static
+int
+iostat_eachopen(struct device *dev, int openflags)
+{
+	(void)dev;
+	(void)openflags;
+
+	return 0;
+}
+
+static
+int
+iostat_io(struct device *dev, struct uio *uio)
+{
+	struct iostat *stats;
+	unsigned num;
+	size_t len;
+	int result;
+
+	(void)dev;
+
+	if (uio->uio_rw == UIO_WRITE) {
+		return EINVAL;
+	}
+
+	result = devstat_snapshot(&stats, &num);
+	if (result || num == 0) {
+		return result;
+	}
+
+	len = num * sizeof(*stats);
+	result = 0;
+	if (uio->uio_offset >= 0 && uio->uio_offset < (off_t)len) {
+		result = uiomove((char *)stats + uio->uio_offset,
+				 len - uio->uio_offset, uio);
+	}
+
+	kfree(stats);
+	return result;
+}
+
+static
+int
+iostat_ioctl(struct device *dev, int op, userptr_t data)
+{
+	(void)dev;
+	(void)op;
+	(void)data;
+
+	return EINVAL;
+}
+
+static const struct device_ops iostat_devops = {
+	.devop_eachopen = iostat_eachopen,
+	.devop_io = iostat_io,
+	.devop_ioctl = iostat_ioctl,
+};
+
+/*
+ * Function to create and attach iostat:
+ */
+void
+devstat_create(void)
+{
+	int result;
+	struct device *dev;
+
+	dev = kmalloc(sizeof(*dev));
+	if (dev == NULL) {
+		panic("Could not add iostat device: out of memory\n");
+	}
+
+	dev->d_ops = &iostat_devops;
+	dev->d_blocks = 0;
+	dev->d_blocksize = 1;
+	dev->d_devnumber = 0; /* assigned by vfs_adddev */
+	dev->d_data = NULL;
+
+	result = vfs_adddev("iostat", dev, 0);
+	if (result) {
+		panic("Could not add iostat device: %s\n", strerror(result));
+	}
+}
@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * RAM disk: a block device kept in kernel memory, for scratch
+ * filesystems that should run at memory speed. Its contents are lost
+ * at shutdown. The memory is allocated a page at a time so a big disk
+ * doesn't need a big contiguous piece of memory, and zeroed so that
+ * unwritten blocks read as zeros.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <uio.h>
+#include <vm.h>
+#include <vfs.h>
+#include <device.h>
+
+#define RAMDISK_BLOCKSIZE  512
+#define RAMDISK_PERPAGE    (PAGE_SIZE / RAMDISK_BLOCKSIZE)
+
+struct ramdisk {
+	unsigned rd_npages;
+	char **rd_pages;		/* PAGE_SIZE bytes each */
+	struct device rd_dev;
+};
+
+/* Units made so far; protected by vfs_biglock */
+static unsigned ramdisk_units;
+
+static
+int
+ramdisk_eachopen(struct device *d, int openflags)
+{
+	(void)d;
+	(void)openflags;
+
+	return 0;
+}
+
+static
+int
+ramdisk_io(struct device *d, struct uio *uio)
+{
+	struct ramdisk *rd = d->d_data;
+	struct timespec queued;
+	bool write = uio->uio_rw == UIO_WRITE;
+	uint32_t nblocks, page, off;
+	size_t len;
+	int result;
+
+	if (uio->uio_offset % RAMDISK_BLOCKSIZE != 0 ||
+	    uio->uio_resid % RAMDISK_BLOCKSIZE != 0) {
+		return EINVAL;
+	}
+	nblocks = uio->uio_resid / RAMDISK_BLOCKSIZE;
+	if (uio->uio_offset / RAMDISK_BLOCKSIZE > d->d_blocks ||
+	    nblocks > d->d_blocks - uio->uio_offset / RAMDISK_BLOCKSIZE) {
+		return EINVAL;
+	}
+
+	gettime(&queued);
+	devstat_queued(d);
+
+	/* A page (or what's left of it) at a time */
+	result = 0;
+	while (uio->uio_resid > 0 && result == 0) {
+		page = uio->uio_offset / PAGE_SIZE;
+		off = uio->uio_offset % PAGE_SIZE;
+		len = PAGE_SIZE - off;
+		result = uiomove(rd->rd_pages[page] + off, len, uio);
+	}
+
+	devstat_done(d, write, nblocks, result, &queued, &queued);
+	return result;
+}
+
+static
+int
+ramdisk_ioctl(struct device *d, int op, userptr_t data)
+{
+	(void)d;
+	(void)op;
+	(void)data;
+
+	return EIOCTL;
+}
+
+static const struct device_ops ramdisk_devops = {
+	.devop_eachopen = ramdisk_eachopen,
+	.devop_io = ramdisk_io,
+	.devop_ioctl = ramdisk_ioctl,
+};
+
+static
+void
+ramdisk_destroy(struct ramdisk *rd)
+{
+	unsigned i;
+
+	for (i = 0; i < rd->rd_npages; i++) {
+		kfree(rd->rd_pages[i]);
+	}
+	kfree(rd->rd_pages);
+	kfree(rd);
+}
+
+int
+ramdisk_create(uint32_t kbytes, char *name, size_t len)
+{
+	struct ramdisk *rd;
+	unsigned npages, i;
+	int result;
+
+	npages = (kbytes + PAGE_SIZE / 1024 - 1) / (PAGE_SIZE / 1024);
+	if (npages == 0) {
+		return EINVAL;
+	}
+
+	rd = kmalloc(sizeof(*rd));
+	if (rd == NULL) {
+		return ENOMEM;
+	}
+	rd->rd_npages = 0;
+	rd->rd_pages = kmalloc(npages * sizeof(char *));
+	if (rd->rd_pages == NULL) {
+		kfree(rd);
+		return ENOMEM;
+	}
+	for (i = 0; i < npages; i++) {
+		rd->rd_pages[i] = kmalloc(PAGE_SIZE);
+		if (rd->rd_pages[i] == NULL) {
+			ramdisk_destroy(rd);
+			return ENOMEM;
+		}
+		bzero(rd->rd_pages[i], PAGE_SIZE);
+		rd->rd_npages++;
+	}
+
+	rd->rd_dev.d_ops = &ramdisk_devops;
+	rd->rd_dev.d_blocks = npages * RAMDISK_PERPAGE;
+	rd->rd_dev.d_blocksize = RAMDISK_BLOCKSIZE;
+	rd->rd_dev.d_devnumber = 0; /* assigned by vfs_adddev */
+	rd->rd_dev.d_data = rd;
+
+	vfs_biglock_acquire();
+	snprintf(name, len, "ramdisk%u", ramdisk_units);
+	result = vfs_adddev(name, &rd->rd_dev, 1);
+	if (result == 0) {
+		ramdisk_units++;
+	}
+	vfs_biglock_release();
+
+	if (result) {
+		ramdisk_destroy(rd);
+	}
+	return result;
+}
@@ -43,6 +43,8 @@
 #include <fs.h>
 #include <vnode.h>
 #include <device.h>
+#include <buf.h>
+#include <dcache.h>
 
 /*
  * Structure for a single named device.
@@ -113,7 +115,10 @@ vfs_bootstrap(void)
 	vfs_biglock_depth = 0;
 
 	devnull_create();
+	devstat_create();
 	semfs_bootstrap();
+	buf_bootstrap();
+	dcache_bootstrap();
 }
 
 /*
@@ -190,6 +195,38 @@ vfs_sync(void)
 	return 0;
 }
 
+/*
+ * Copy the I/O stats of up to MAX block devices into STATS. Returns
+ * how many block devices there are.
+ */
+unsigned
+vfs_getiostats(struct iostat *stats, unsigned max)
+{
+	struct knowndev *kd;
+	unsigned i, num, n;
+
+	vfs_biglock_acquire();
+
+	n = 0;
+	num = knowndevarray_num(knowndevs);
+	for (i=0; i<num; i++) {
+		kd = knowndevarray_get(knowndevs, i);
+		if (kd->kd_device == NULL || kd->kd_device->d_blocks == 0) {
+			continue;
+		}
+		if (n < max) {
+			devstat_get(kd->kd_device, &stats[n]);
+			snprintf(stats[n].is_name, sizeof(stats[n].is_name),
+				 "%s", kd->kd_name);
+		}
+		n++;
+	}
+
+	vfs_biglock_release();
+
+	return n;
+}
+
 /*
  * Given a device name (lhd0, emu0, somevolname, null, etc.), hand
  * back an appropriate vnode.
@@ -451,6 +488,7 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 	if (dev != NULL) {
 		/* use index+1 as the device number, so 0 is reserved */
 		dev->d_devnumber = index+1;
+		devstat_init(dev);
 	}
 
 	vfs_biglock_release();
@@ -577,6 +615,37 @@ vfs_mount(const char *devname, void *data,
 	return 0;
 }
 
+/*
+ * Make a new filesystem on an unmounted device by calling FORMATFUNC
+ * on it. The DATA argument is passed through unchanged.
+ */
+int
+vfs_format(const char *devname, void *data,
+	   int (*formatfunc)(void *data, struct device *))
+{
+	struct knowndev *kd;
+	int result;
+
+	vfs_biglock_acquire();
+
+	result = findmount(devname, &kd);
+	if (result) {
+		vfs_biglock_release();
+		return result;
+	}
+
+	if (kd->kd_fs != NULL) {
+		vfs_biglock_release();
+		return EBUSY;
+	}
+	KASSERT(kd->kd_device != NULL);
+
+	result = formatfunc(data, kd->kd_device);
+
+	vfs_biglock_release();
+	return result;
+}
+
 /*
  * Like mount, but for attaching swap. Hands back the raw device
  * vnode. Unlike mount tolerates a trailing colon on the device name,
@@ -654,6 +723,9 @@ vfs_unmount(const char *devname)
 	KASSERT(kd->kd_rawname != NULL);
 	KASSERT(kd->kd_device != NULL);
 
+	/* the name cache holds references to its vnodes */
+	dcache_purgefs(kd->kd_fs);
+
 	/* sync the fs */
 	result = FSOP_SYNC(kd->kd_fs);
 	if (result) {
@@ -745,6 +817,8 @@ vfs_unmountall(void)
 
 		kprintf("vfs: Unmounting %s:\n", dev->kd_name);
 
+		dcache_purgefs(dev->kd_fs);
+
 		result = FSOP_SYNC(dev->kd_fs);
 		if (result) {
 			kprintf("vfs: Warning: sync failed for %s: %s, trying "
@@ -39,6 +39,7 @@
 #include <vfs.h>
 #include <fs.h>
 #include <vnode.h>
+#include <dcache.h>
 
 static struct vnode *bootfs_vnode = NULL;
 
@@ -234,16 +235,82 @@ getdevice(char *path, char **subpath, struct vnode **startvn)
 	return 0;
 }
 
+/*
+ * Look up one name in DIR, through the name cache.
+ */
+static
+int
+lookup_name(struct vnode *dir, const char *name, struct vnode **ret)
+{
+	char buf[NAME_MAX+1];
+	unsigned gen;
+	int result;
+
+	if (dcache_lookup(dir, name, ret)) {
+		return *ret == NULL ? ENOENT : 0;
+	}
+
+	if (strlen(name) >= sizeof(buf)) {
+		return ENAMETOOLONG;
+	}
+	/* VOP_LOOKUP may scribble on its argument */
+	strcpy(buf, name);
+
+	gen = dcache_gen();
+	result = VOP_LOOKUP(dir, buf, ret);
+	if (result == 0) {
+		dcache_enter(dir, name, *ret, gen);
+	}
+	else if (result == ENOENT) {
+		dcache_enter(dir, name, NULL, gen);
+	}
+	return result;
+}
+
+/*
+ * Follow PATH (which gets chopped up) from STARTVN a name at a time.
+ * Hands back the result with a reference.
+ */
+static
+int
+lookup_walk(struct vnode *startvn, char *path, struct vnode **ret)
+{
+	struct vnode *dir, *next;
+	char *name, *context;
+	int result;
+
+	dir = startvn;
+	VOP_INCREF(dir);
+	for (name = strtok_r(path, "/", &context); name != NULL;
+	     name = strtok_r(NULL, "/", &context)) {
+		result = lookup_name(dir, name, &next);
+		VOP_DECREF(dir);
+		if (result) {
+			return result;
+		}
+		dir = next;
+	}
+
+	*ret = dir;
+	return 0;
+}
+
 /*
  * Name-to-vnode translation.
  * (In BSD, both of these are subsumed by namei().)
+ *
+ * Everything up to the last name goes through the name cache a name
+ * at a time; for lookparent the filesystem still gets the last name,
+ * in the directory found.
  */
 
 int
 vfs_lookparent(char *path, struct vnode **retval,
 	       char *buf, size_t buflen)
 {
-	struct vnode *startvn;
+	struct vnode *startvn, *dir;
+	char *s;
+	size_t len;
 	int result;
 
 	vfs_biglock_acquire();
@@ -260,11 +327,29 @@ vfs_lookparent(char *path, struct vnode **retval,
 		 * a context where "lookparent" is the desired
 		 * operation.
 		 */
-		result = EINVAL;
+		VOP_DECREF(startvn);
+		vfs_biglock_release();
+		return EINVAL;
 	}
-	else {
+
+	/* Split off the last name, ignoring trailing slashes */
+	len = strlen(path);
+	while (len > 1 && path[len-1]=='/') {
+		path[--len] = 0;
+	}
+	s = strrchr(path, '/');
+	if (s == NULL) {
 		result = VOP_LOOKPARENT(startvn, path, retval, buf, buflen);
 	}
+	else {
+		*s = 0;
+		result = lookup_walk(startvn, path, &dir);
+		if (result == 0) {
+			result = VOP_LOOKPARENT(dir, s+1, retval,
+						buf, buflen);
+			VOP_DECREF(dir);
+		}
+	}
 
 	VOP_DECREF(startvn);
 
@@ -292,7 +377,7 @@ vfs_lookup(char *path, struct vnode **retval)
 		return 0;
 	}
 
-	result = VOP_LOOKUP(startvn, path, retval);
+	result = lookup_walk(startvn, path, retval);
 
 	VOP_DECREF(startvn);
 	vfs_biglock_release();
@@ -38,6 +38,7 @@
 #include <lib.h>
 #include <vfs.h>
 #include <vnode.h>
+#include <dcache.h>
 
 
 /* Does most of the work for open(). */
@@ -73,7 +74,9 @@ vfs_open(char *path, int openflags, mode_t mode, struct vnode **ret)
 			return result;
 		}
 
+		dcache_invalidate(dir, name);
 		result = VOP_CREAT(dir, name, excl, mode, &vn);
+		dcache_invalidate(dir, name);
 
 		VOP_DECREF(dir);
 	}
@@ -145,7 +148,10 @@ vfs_remove(char *path)
 		return result;
 	}
 
+	/* Before, so nothing stale is found meanwhile, and after */
+	dcache_invalidate(dir, name);
 	result = VOP_REMOVE(dir, name);
+	dcache_invalidate(dir, name);
 	VOP_DECREF(dir);
 
 	return result;
@@ -178,7 +184,11 @@ vfs_rename(char *oldpath, char *newpath)
 		return EXDEV;
 	}
 
+	dcache_invalidate(olddir, oldname);
+	dcache_invalidate(newdir, newname);
 	result = VOP_RENAME(olddir, oldname, newdir, newname);
+	dcache_invalidate(olddir, oldname);
+	dcache_invalidate(newdir, newname);
 
 	VOP_DECREF(newdir);
 	VOP_DECREF(olddir);
@@ -212,7 +222,9 @@ vfs_link(char *oldpath, char *newpath)
 		return EXDEV;
 	}
 
+	dcache_invalidate(newdir, newname);
 	result = VOP_LINK(newdir, newname, oldfile);
+	dcache_invalidate(newdir, newname);
 
 	VOP_DECREF(newdir);
 	VOP_DECREF(oldfile);
@@ -239,7 +251,9 @@ vfs_symlink(const char *contents, char *path)
 		return result;
 	}
 
+	dcache_invalidate(newdir, newname);
 	result = VOP_SYMLINK(newdir, newname, contents);
+	dcache_invalidate(newdir, newname);
 	VOP_DECREF(newdir);
 
 	return result;
@@ -285,7 +299,9 @@ vfs_mkdir(char *path, mode_t mode)
 		return result;
 	}
 
+	dcache_invalidate(parent, name);
 	result = VOP_MKDIR(parent, name, mode);
+	dcache_invalidate(parent, name);
 
 	VOP_DECREF(parent);
 
@@ -307,7 +323,9 @@ vfs_rmdir(char *path)
 		return result;
 	}
 
+	dcache_invalidate(parent, name);
 	result = VOP_RMDIR(parent, name);
+	dcache_invalidate(parent, name);
 
 	VOP_DECREF(parent);
 
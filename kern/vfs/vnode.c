@@ -34,8 +34,11 @@
 #include <kern/errno.h>
 #include <lib.h>
 #include <synch.h>
+#include <membar.h>
+#include <atomic.h>
 #include <vfs.h>
 #include <vnode.h>
+#include <execcache.h>
 
 /*
  * Initialize an abstract vnode.
@@ -52,6 +55,7 @@ vnode_init(struct vnode *vn, const struct vnode_ops *ops,
 	spinlock_init(&vn->vn_countlock);
 	vn->vn_fs = fs;
 	vn->vn_data = fsdata;
+	vn->vn_image = NULL;
 	return 0;
 }
 
@@ -63,6 +67,7 @@ vnode_cleanup(struct vnode *vn)
 {
 	KASSERT(vn->vn_refcount == 1);
 
+	execcache_invalidate(vn);
 	spinlock_cleanup(&vn->vn_countlock);
 
 	vn->vn_ops = NULL;
@@ -72,6 +77,22 @@ vnode_cleanup(struct vnode *vn)
 }
 
 
+/*
+ * Called by filesystems before and after writing or truncating.
+ */
+void
+vnode_modify(struct vnode *vn)
+{
+	execcache_invalidate(vn);
+}
+
+int
+vnode_modified(struct vnode *vn, int result)
+{
+	execcache_invalidate(vn);
+	return result;
+}
+
 /*
  * Increment refcount.
  * Called by VOP_INCREF.
@@ -81,9 +102,7 @@ vnode_incref(struct vnode *vn)
 {
 	KASSERT(vn != NULL);
 
-	spinlock_acquire(&vn->vn_countlock);
-	vn->vn_refcount++;
-	spinlock_release(&vn->vn_countlock);
+	atomic_add(&vn->vn_refcount, 1);
 }
 
 /*
@@ -94,32 +113,49 @@ vnode_incref(struct vnode *vn)
 void
 vnode_decref(struct vnode *vn)
 {
-	bool destroy;
+	unsigned old;
 	int result;
 
 	KASSERT(vn != NULL);
 
-	spinlock_acquire(&vn->vn_countlock);
+	/* Finish with the vnode before someone else can reclaim it */
+	membar_any_store();
+
+	do {
+		old = vn->vn_refcount;
+		KASSERT(old > 0);
+		if (old == 1) {
+			/* Don't decrement; pass the reference to VOP_RECLAIM. */
+			result = VOP_RECLAIM(vn);
+			if (result != 0 && result != EBUSY) {
+				// XXX: lame.
+				kprintf("vfs: Warning: VOP_RECLAIM: %s\n",
+					strerror(result));
+			}
+			return;
+		}
+	} while (atomic_cas(&vn->vn_refcount, old, old - 1) != old);
+}
 
-	KASSERT(vn->vn_refcount > 0);
-	if (vn->vn_refcount > 1) {
-		vn->vn_refcount--;
-		destroy = false;
-	}
-	else {
-		/* Don't decrement; pass the reference to VOP_RECLAIM. */
-		destroy = true;
-	}
-	spinlock_release(&vn->vn_countlock);
-
-	if (destroy) {
-		result = VOP_RECLAIM(vn);
-		if (result != 0 && result != EBUSY) {
-			// XXX: lame.
-			kprintf("vfs: Warning: VOP_RECLAIM: %s\n",
-				strerror(result));
+/*
+ * For VOP_RECLAIM: see whether references were picked up since
+ * vnode_decref decided to reclaim, and if so drop the one it passed.
+ * The caller holds the lock new references are made under, so a
+ * count of 1 can't change.
+ */
+bool
+vnode_stillbusy(struct vnode *vn)
+{
+	unsigned old;
+
+	do {
+		old = vn->vn_refcount;
+		KASSERT(old > 0);
+		if (old == 1) {
+			return false;
 		}
-	}
+	} while (atomic_cas(&vn->vn_refcount, old, old - 1) != old);
+	return true;
 }
 
 /*
@@ -129,6 +165,8 @@ vnode_decref(struct vnode *vn)
 void
 vnode_check(struct vnode *v, const char *opstr)
 {
+	unsigned refcount;
+
 	/* not safe, and not really needed to check constant fields */
 	/*vfs_biglock_acquire();*/
 
@@ -159,20 +197,18 @@ vnode_check(struct vnode *v, const char *opstr)
 		panic("vnode_check: vop_%s: deadbeef fs pointer\n", opstr);
 	}
 
-	spinlock_acquire(&v->vn_countlock);
-
-	if (v->vn_refcount < 0) {
+	refcount = v->vn_refcount;
+	if ((int)refcount < 0) {
 		panic("vnode_check: vop_%s: negative refcount %d\n", opstr,
-		      v->vn_refcount);
+		      (int)refcount);
 	}
-	else if (v->vn_refcount == 0) {
+	else if (refcount == 0) {
 		panic("vnode_check: vop_%s: zero refcount\n", opstr);
 	}
-	else if (v->vn_refcount > 0x100000) {
-		kprintf("vnode_check: vop_%s: warning: large refcount %d\n",
-			opstr, v->vn_refcount);
+	else if (refcount > 0x100000) {
+		kprintf("vnode_check: vop_%s: warning: large refcount %u\n",
+			opstr, refcount);
 	}
 
-	spinlock_release(&v->vn_countlock);
 	/*vfs_biglock_release();*/
 }
@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * iostat - print disk I/O statistics
+ * usage: iostat [-h] [device...]
+ *
+ * Reads the per-device counters from the iostat: device and prints a
+ * line for each block device (or just the ones named): requests and
+ * sectors read and written, failed requests, the current and highest
+ * queue depth, and the average time requests spent waiting in the
+ * queue and being served. -h also prints each device's latency
+ * histogram.
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+#include <kern/iostat.h>
+
+/* Most devices we'll report on */
+#define MAXDEVS 32
+
+static struct iostat stats[MAXDEVS];
+
+/*
+ * Read the stats of all block devices; returns how many.
+ */
+static
+unsigned
+getstats(void)
+{
+	int fd;
+	ssize_t r;
+	size_t got;
+
+	fd = open("iostat:", O_RDONLY);
+	if (fd < 0) {
+		err(1, "open iostat:");
+	}
+	got = 0;
+	while (got < sizeof(stats)) {
+		r = read(fd, (char *)stats + got, sizeof(stats) - got);
+		if (r < 0) {
+			err(1, "read iostat:");
+		}
+		if (r == 0) {
+			break;
+		}
+		got += r;
+	}
+	close(fd);
+
+	return got / sizeof(stats[0]);
+}
+
+static
+int
+wanted(const char *name, int argc, char **argv)
+{
+	int i;
+
+	if (argc == 0) {
+		return 1;
+	}
+	for (i=0; i<argc; i++) {
+		if (!strcmp(argv[i], name)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static
+void
+printstats(const struct iostat *io)
+{
+	uint64_t n;
+
+	n = io->is_reads + io->is_writes + io->is_errors;
+	printf("%-8s %8llu %8llu %9llu %9llu %5llu %5u %5u %9llu %9llu\n",
+	       io->is_name, io->is_reads, io->is_writes,
+	       io->is_rsectors, io->is_wsectors, io->is_errors,
+	       io->is_depth, io->is_maxdepth,
+	       n ? io->is_waitns / n / 1000 : 0,
+	       n ? io->is_servicens / n / 1000 : 0);
+}
+
+static
+void
+printhist(const struct iostat *io)
+{
+	unsigned b, last = IOSTAT_NBUCKETS - 1;
+
+	printf("\n%s latency:\n", io->is_name);
+	for (b=0; b<last; b++) {
+		if (io->is_hist[b] != 0) {
+			printf("  < %7uus %8u\n", 2U << b, io->is_hist[b]);
+		}
+	}
+	if (io->is_hist[last] != 0) {
+		printf("  >=%7uus %8u\n", 1U << last, io->is_hist[last]);
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned num, i;
+	int hist = 0;
+
+	argc--;
+	argv++;
+	if (argc > 0 && !strcmp(argv[0], "-h")) {
+		hist = 1;
+		argc--;
+		argv++;
+	}
+
+	num = getstats();
+
+	printf("%-8s %8s %8s %9s %9s %5s %5s %5s %9s %9s\n",
+	       "device", "reads", "writes", "rsectors", "wsectors",
+	       "errs", "queue", "max", "wait(us)", "svc(us)");
+	for (i=0; i<num; i++) {
+		if (wanted(stats[i].is_name, argc, argv)) {
+			printstats(&stats[i]);
+		}
+	}
+
+	if (hist) {
+		for (i=0; i<num; i++) {
+			if (wanted(stats[i].is_name, argc, argv)) {
+				printhist(&stats[i]);
+			}
+		}
+	}
+
+	return 0;
+}
@@ -421,27 +421,16 @@ docommand(char *buf, struct exitinfo *ei)
 		__time(&startsecs, &startnsecs);
 	}
 
-	pid = fork();
-	switch (pid) {
-		case -1:
-			/* error */
-			warn("fork");
-			exitinfo_exit(ei, 255);
-			return;
-		case 0:
-			/* child */
-			execvp(args[0], args);
-			warn("%s", args[0]);
-			/*
-			 * Use _exit() instead of exit() in the child
-			 * process to avoid calling atexit() functions,
-			 * which would cause hostcompat (if present) to
-			 * reset the tty state and mess up our input
-			 * handling.
-			 */
-			_exit(1);
-		default:
-			break;
+	/*
+	 * Start the command directly rather than with fork and exec,
+	 * so our address space never gets copied just to be thrown
+	 * away.
+	 */
+	pid = spawnvp(args[0], args, NULL, 0);
+	if (pid < 0) {
+		warn("%s", args[0]);
+		exitinfo_exit(ei, 1);
+		return;
 	}
 
 	/* parent */
@@ -474,6 +463,40 @@ docommand(char *buf, struct exitinfo *ei)
 	}
 }
 
+#ifdef TIOCSMODE
+/*
+ * getcmd_canon
+ * reads a line with the console in canonical mode, so the kernel
+ * does the echoing and editing and the whole line comes back from
+ * one read. fails if stdin isn't a console that can do that.
+ */
+static
+int
+getcmd_canon(char *buf, size_t len)
+{
+	int oldmode, mode = TTY_CANON;
+	ssize_t r;
+
+	if (ioctl(STDIN_FILENO, TIOCGMODE, &oldmode) < 0) {
+		return -1;
+	}
+	if (ioctl(STDIN_FILENO, TIOCSMODE, &mode) < 0) {
+		return -1;
+	}
+	r = read(STDIN_FILENO, buf, len-1);
+	ioctl(STDIN_FILENO, TIOCSMODE, &oldmode);
+
+	if (r < 0) {
+		r = 0;
+	}
+	if (r > 0 && buf[r-1] == '\n') {
+		r--;
+	}
+	buf[r] = 0;
+	return 0;
+}
+#endif
+
 /*
  * getcmd
  * pulls valid characters off the console, filling the buffer.
@@ -491,6 +514,12 @@ getcmd(char *buf, size_t len)
 	size_t pos = 0;
 	int done=0, ch;
 
+#ifdef TIOCSMODE
+	if (getcmd_canon(buf, len) == 0) {
+		return;
+	}
+#endif
+
 	/*
 	 * In the absence of a <ctype.h>, assume input is 7-bit ASCII.
 	 */
@@ -42,6 +42,7 @@
 #include <kern/ioctl.h>
 #include <kern/reboot.h>
 #include <kern/seek.h>
+#include <kern/spawn.h>
 #include <kern/time.h>
 #include <kern/unistd.h>
 #include <kern/wait.h>
@@ -145,6 +146,8 @@ ssize_t getdirentry(int filehandle, char *buf, size_t buflen);
 int symlink(const char *target, const char *linkname);
 ssize_t readlink(const char *path, char *buf, size_t buflen);
 int dup2(int filehandle, int newhandle);
+pid_t spawn(const char *prog, char *const *args,
+	    const struct spawn_fdaction *actions, int nactions);
 int pipe(int filehandles[2]);
 int __time(time_t *seconds, unsigned long *nanoseconds);
 ssize_t __getcwd(char *buf, size_t buflen);
@@ -156,6 +159,9 @@ ssize_t __getcwd(char *buf, size_t buflen);
  */
 
 int execvp(const char *prog, char *const *args); /* calls execv */
+pid_t spawnvp(const char *prog, char *const *args,
+	      const struct spawn_fdaction *actions,
+	      int nactions);			/* calls spawn */
 char *getcwd(char *buf, size_t buflen);		/* calls __getcwd */
 time_t time(time_t *seconds);			/* calls __time */
 
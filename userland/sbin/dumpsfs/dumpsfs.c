@@ -163,6 +163,14 @@ dumpsb(void)
 		 SFS_FREEMAPBLOCKS(SWAP32(sb.sb_nblocks)));
 	dumpvalf("Block size", "%u bytes", SFS_BLOCKSIZE);
 	dumplval("Volume name", sb.sb_volname);
+	if (SWAP32(sb.sb_journalstart) != 0) {
+		dumpvalf("Journal start", "%u", SWAP32(sb.sb_journalstart));
+		dumpvalf("Journal size", "%u blocks",
+			 SWAP32(sb.sb_journalblocks));
+	}
+	else {
+		dumplval("Journal", "none");
+	}
 
 	for (i=0; i<ARRAYCOUNT(sb.reserved); i++) {
 		if (sb.reserved[i] != 0) {
@@ -228,10 +236,97 @@ dumpfreemap(uint32_t fsblocks)
 	printf("\n");
 }
 
+static
+const char *
+jbtypestr(uint32_t type)
+{
+	switch (type) {
+	    case SFS_JB_HEADER: return "header";
+	    case SFS_JB_DESC: return "descriptor";
+	    case SFS_JB_COMMIT: return "commit";
+	}
+	return "unknown";
+}
+
+/*
+ * Dump the journal header and whatever transaction follows it. Stops
+ * at the first block that doesn't belong to the header's transaction.
+ */
+static
+void
+dumpjournal(void)
+{
+	struct sfs_superblock sb;
+	struct sfs_jblock jb;
+	uint32_t start, nblocks, seq, pos, n, i;
+
+	diskread(&sb, SFS_SUPER_BLOCK);
+	start = SWAP32(sb.sb_journalstart);
+	nblocks = SWAP32(sb.sb_journalblocks);
+
+	printf("Journal\n");
+	printf("-------\n");
+	if (start == 0) {
+		printf("    No journal\n\n");
+		return;
+	}
+
+	diskread(&jb, start);
+	dumpvalf("Header magic", "0x%8x", SWAP32(jb.jb_magic));
+	dumpvalf("Header type", "%s", jbtypestr(SWAP32(jb.jb_type)));
+	dumpvalf("Sequence", "%u", SWAP32(jb.jb_seq));
+	if (dumppos % 2 == 1) {
+		printf("\n");
+		dumppos++;
+	}
+	if (SWAP32(jb.jb_magic) != SFS_JOURNAL_MAGIC ||
+	    SWAP32(jb.jb_type) != SFS_JB_HEADER) {
+		printf("    Bad journal header\n\n");
+		return;
+	}
+	seq = SWAP32(jb.jb_seq);
+
+	pos = start + 1;
+	while (pos < start + nblocks) {
+		diskread(&jb, pos);
+		if (SWAP32(jb.jb_magic) != SFS_JOURNAL_MAGIC ||
+		    SWAP32(jb.jb_seq) != seq) {
+			printf("    Block %u: not part of transaction %u; "
+			       "transaction incomplete\n", pos, seq);
+			break;
+		}
+		n = SWAP32(jb.jb_nblocks);
+		printf("    Block %u: %s, %u blocks\n", pos,
+		       jbtypestr(SWAP32(jb.jb_type)), n);
+		if (SWAP32(jb.jb_type) != SFS_JB_DESC ||
+		    n > SFS_JB_MAXBLOCKS) {
+			break;
+		}
+		for (i=0; i<n; i++) {
+			if (i % 8 == 0) {
+				printf("       ");
+			}
+			printf(" %u", SWAP32(jb.jb_blocks[i]));
+			if (i % 8 == 7 || i == n-1) {
+				printf("\n");
+			}
+		}
+		pos += 1 + n;
+	}
+	printf("\n");
+}
+
+/*
+ * Dump an indirect block, and for a double or triple indirect block
+ * (LEVEL 2 or 3) the indirect blocks under it.
+ */
 static
 void
-dumpindirect(uint32_t block)
+dumpindirect(uint32_t block, unsigned level)
 {
+	static const char *const names[] = {
+		"", "Indirect", "Double indirect", "Triple indirect",
+	};
 	uint32_t ib[SFS_BLOCKSIZE/sizeof(uint32_t)];
 	char tmp[128];
 	unsigned i;
@@ -239,7 +334,7 @@ dumpindirect(uint32_t block)
 	if (block == 0) {
 		return;
 	}
-	printf("Indirect block %u\n", block);
+	printf("%s block %u\n", names[level], block);
 
 	diskread(ib, block);
 	for (i=0; i<ARRAYCOUNT(ib); i++) {
@@ -253,12 +348,22 @@ dumpindirect(uint32_t block)
 			printf("\n");
 		}
 	}
+
+	if (level > 1) {
+		for (i=0; i<ARRAYCOUNT(ib); i++) {
+			dumpindirect(SWAP32(ib[i]), level - 1);
+		}
+	}
 }
 
+/*
+ * Call DOBLOCK on the blocks mapped by indirect block BLOCK, which is
+ * at LEVEL (1 for single indirect). Returns the next file block.
+ */
 static
 uint32_t
 traverse_ib(uint32_t fileblock, uint32_t numblocks, uint32_t block,
-	    void (*doblock)(uint32_t, uint32_t))
+	    unsigned level, void (*doblock)(uint32_t, uint32_t))
 {
 	uint32_t ib[SFS_BLOCKSIZE/sizeof(uint32_t)];
 	unsigned i;
@@ -270,7 +375,14 @@ traverse_ib(uint32_t fileblock, uint32_t numblocks, uint32_t block,
 		diskread(ib, block);
 	}
 	for (i=0; i<ARRAYCOUNT(ib) && fileblock < numblocks; i++) {
-		doblock(fileblock++, SWAP32(ib[i]));
+		if (level > 1) {
+			fileblock = traverse_ib(fileblock, numblocks,
+						SWAP32(ib[i]), level - 1,
+						doblock);
+		}
+		else {
+			doblock(fileblock++, SWAP32(ib[i]));
+		}
 	}
 	return fileblock;
 }
@@ -291,7 +403,15 @@ traverse(const struct sfs_dinode *sfi, void (*doblock)(uint32_t, uint32_t))
 	}
 	if (fileblock < numblocks) {
 		fileblock = traverse_ib(fileblock, numblocks,
-					SWAP32(sfi->sfi_indirect), doblock);
+					SWAP32(sfi->sfi_indirect), 1, doblock);
+	}
+	if (fileblock < numblocks) {
+		fileblock = traverse_ib(fileblock, numblocks,
+					SWAP32(sfi->sfi_dindirect), 2, doblock);
+	}
+	if (fileblock < numblocks) {
+		fileblock = traverse_ib(fileblock, numblocks,
+					SWAP32(sfi->sfi_tindirect), 3, doblock);
 	}
 	assert(fileblock == numblocks);
 }
@@ -476,6 +596,10 @@ dumpinode(uint32_t ino, const char *name)
 	}
 	printf("    Indirect block: %u (0x%x)\n",
 	       SWAP32(sfi.sfi_indirect), SWAP32(sfi.sfi_indirect));
+	printf("    Double indirect block: %u (0x%x)\n",
+	       SWAP32(sfi.sfi_dindirect), SWAP32(sfi.sfi_dindirect));
+	printf("    Triple indirect block: %u (0x%x)\n",
+	       SWAP32(sfi.sfi_tindirect), SWAP32(sfi.sfi_tindirect));
 	for (i=0; i<ARRAYCOUNT(sfi.sfi_waste); i++) {
 		if (sfi.sfi_waste[i] != 0) {
 			printf("    Word %u in waste area: 0x%x\n",
@@ -484,7 +608,9 @@ dumpinode(uint32_t ino, const char *name)
 	}
 
 	if (doindirect) {
-		dumpindirect(SWAP32(sfi.sfi_indirect));
+		dumpindirect(SWAP32(sfi.sfi_indirect), 1);
+		dumpindirect(SWAP32(sfi.sfi_dindirect), 2);
+		dumpindirect(SWAP32(sfi.sfi_tindirect), 3);
 	}
 
 	if (SWAP16(sfi.sfi_type) == SFS_TYPE_DIR && dodirs) {
@@ -508,12 +634,13 @@ usage(void)
 	warnx("Usage: dumpsfs [options] device/diskfile");
 	warnx("   -s: dump superblock");
 	warnx("   -b: dump free block bitmap");
+	warnx("   -j: dump journal");
 	warnx("   -i ino: dump specified inode");
 	warnx("   -I: dump indirect blocks");
 	warnx("   -f: dump file contents");
 	warnx("   -d: dump directory contents");
 	warnx("   -r: recurse into directory contents");
-	warnx("   -a: equivalent to -sbdfr -i 1");
+	warnx("   -a: equivalent to -sbjdfr -i 1");
 	errx(1, "   Default is -i 1");
 }
 
@@ -522,6 +649,7 @@ main(int argc, char **argv)
 {
 	bool dosb = false;
 	bool dofreemap = false;
+	bool dojournal = false;
 	uint32_t dumpino = 0;
 	const char *dumpdisk = NULL;
 
@@ -540,6 +668,7 @@ main(int argc, char **argv)
 				switch (argv[i][j]) {
 				    case 's': dosb = true; break;
 				    case 'b': dofreemap = true; break;
+				    case 'j': dojournal = true; break;
 				    case 'i':
 					if (argv[i][j+1] == 0) {
 						dumpino = atoi(argv[++i]);
@@ -557,6 +686,7 @@ main(int argc, char **argv)
 				    case 'a':
 					dosb = true;
 					dofreemap = true;
+					dojournal = true;
 					if (dumpino == 0) {
 						dumpino = SFS_ROOTDIR_INO;
 					}
@@ -584,7 +714,7 @@ main(int argc, char **argv)
 		usage();
 	}
 
-	if (!dosb && !dofreemap && dumpino == 0) {
+	if (!dosb && !dofreemap && !dojournal && dumpino == 0) {
 		dumpino = SFS_ROOTDIR_INO;
 	}
 
@@ -597,6 +727,9 @@ main(int argc, char **argv)
 	if (dofreemap) {
 		dumpfreemap(nblocks);
 	}
+	if (dojournal) {
+		dumpjournal();
+	}
 	if (dumpino != 0) {
 		dumpinode(dumpino, NULL);
 	}
@@ -60,9 +60,17 @@
 /* Maximum size of freemap we support */
 #define MAXFREEMAPBLOCKS 32
 
+/* Journal size: 1/JOURNALFRAC of the volume, within these limits */
+#define JOURNALFRAC 32
+#define MINJOURNALBLOCKS 32
+#define MAXJOURNALBLOCKS 512
+
 /* Free block bitmap */
 static char freemapbuf[MAXFREEMAPBLOCKS * SFS_BLOCKSIZE];
 
+/* Where the journal goes; journalblocks is 0 for none */
+static uint32_t journalstart, journalblocks;
+
 /*
  * Assert that the on-disk data structures are correctly sized.
  */
@@ -73,6 +81,7 @@ check(void)
 	assert(sizeof(struct sfs_superblock)==SFS_BLOCKSIZE);
 	assert(sizeof(struct sfs_dinode)==SFS_BLOCKSIZE);
 	assert(SFS_BLOCKSIZE % sizeof(struct sfs_direntry) == 0);
+	assert(sizeof(struct sfs_jblock)==SFS_BLOCKSIZE);
 }
 
 /*
@@ -114,6 +123,11 @@ initfreemap(uint32_t fsblocks)
 		allocblock(SFS_FREEMAP_START + i);
 	}
 
+	/* so must the journal */
+	for (i=0; i<journalblocks; i++) {
+		allocblock(journalstart + i);
+	}
+
 	/* all blocks in the freemap but past the volume end are "in use" */
 	for (i=fsblocks; i<freemapbits; i++) {
 		allocblock(i);
@@ -140,6 +154,10 @@ writesuper(const char *volname, uint32_t nblocks)
 	sb.sb_magic = SWAP32(SFS_MAGIC);
 	sb.sb_nblocks = SWAP32(nblocks);
 	strcpy(sb.sb_volname, volname);
+	if (journalblocks > 0) {
+		sb.sb_journalstart = SWAP32(journalstart);
+		sb.sb_journalblocks = SWAP32(journalblocks);
+	}
 
 	/* and write it out. */
 	diskwrite(&sb, SFS_SUPER_BLOCK);
@@ -164,6 +182,52 @@ writefreemap(uint32_t fsblocks)
 	}
 }
 
+/*
+ * Decide where the journal goes: right after the freemap. Volumes
+ * too small to spare the space don't get one.
+ */
+static
+void
+placejournal(uint32_t fsblocks)
+{
+	journalstart = SFS_FREEMAP_START + SFS_FREEMAPBLOCKS(fsblocks);
+	journalblocks = fsblocks / JOURNALFRAC;
+	if (journalblocks < MINJOURNALBLOCKS) {
+		journalblocks = 0;
+		journalstart = 0;
+		return;
+	}
+	if (journalblocks > MAXJOURNALBLOCKS) {
+		journalblocks = MAXJOURNALBLOCKS;
+	}
+}
+
+/*
+ * Write out an empty journal: a header for transaction 1, and zeros
+ * so nothing left on the disk looks like a transaction.
+ */
+static
+void
+writejournal(void)
+{
+	struct sfs_jblock jb;
+	uint32_t i;
+
+	if (journalblocks == 0) {
+		return;
+	}
+
+	bzero((void *)&jb, sizeof(jb));
+	for (i=1; i<journalblocks; i++) {
+		diskwrite(&jb, journalstart + i);
+	}
+
+	jb.jb_magic = SWAP32(SFS_JOURNAL_MAGIC);
+	jb.jb_type = SWAP32(SFS_JB_HEADER);
+	jb.jb_seq = SWAP32(1);
+	diskwrite(&jb, journalstart);
+}
+
 /*
  * Write out the root directory inode.
  */
@@ -229,9 +293,11 @@ main(int argc, char **argv)
 	size = diskblocks();
 
 	/* Write out the on-disk structures */
+	placejournal(size);
 	initfreemap(size);
 	writesuper(volname, size);
 	writefreemap(size);
+	writejournal();
 	writerootdir();
 
 	closedisk();
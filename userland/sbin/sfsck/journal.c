@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <err.h>
+
+#include "compat.h"
+#include <kern/sfs.h>
+
+#include "disk.h"
+#include "utils.h"
+#include "sfs.h"
+#include "sb.h"
+#include "journal.h"
+#include "main.h"
+
+/*
+ * Write an empty journal with header sequence number SEQ.
+ */
+static
+void
+journal_reset(uint32_t seq)
+{
+	struct sfs_jblock jb;
+	uint32_t start, i;
+
+	start = sb_journalstart();
+
+	/* Clear it first, so nothing old looks like a transaction */
+	bzero(&jb, sizeof(jb));
+	for (i=1; i<sb_journalblocks(); i++) {
+		sfs_writejblock(start+i, &jb);
+	}
+
+	jb.jb_magic = SFS_JOURNAL_MAGIC;
+	jb.jb_type = SFS_JB_HEADER;
+	jb.jb_seq = seq;
+	sfs_writejblock(start, &jb);
+}
+
+/*
+ * Check if a journal block belongs to transaction SEQ.
+ */
+static
+int
+journal_match(const struct sfs_jblock *jb, uint32_t type, uint32_t seq)
+{
+	return jb->jb_magic == SFS_JOURNAL_MAGIC && jb->jb_type == type &&
+		jb->jb_seq == seq;
+}
+
+/*
+ * Look for a complete transaction SEQ. Returns the number of blocks
+ * logged in it, or 0 if it isn't there or never committed.
+ */
+static
+uint32_t
+journal_scan(uint32_t seq)
+{
+	struct sfs_jblock jb;
+	uint32_t pos, end, n, i;
+
+	pos = sb_journalstart() + 1;
+	end = sb_journalstart() + sb_journalblocks();
+	n = 0;
+	while (pos < end) {
+		sfs_readjblock(pos, &jb);
+		if (journal_match(&jb, SFS_JB_COMMIT, seq)) {
+			return jb.jb_nblocks == n ? n : 0;
+		}
+		if (!journal_match(&jb, SFS_JB_DESC, seq) ||
+		    jb.jb_nblocks > SFS_JB_MAXBLOCKS ||
+		    pos + 1 + jb.jb_nblocks >= end) {
+			return 0;
+		}
+		for (i=0; i<jb.jb_nblocks; i++) {
+			if (jb.jb_blocks[i] >= sb_totalblocks()) {
+				return 0;
+			}
+		}
+		n += jb.jb_nblocks;
+		pos += 1 + jb.jb_nblocks;
+	}
+	return 0;
+}
+
+int
+journal_replay(void)
+{
+	struct sfs_jblock jb;
+	uint8_t data[SFS_BLOCKSIZE];
+	uint32_t seq, n, pos, i;
+
+	if (sb_journalstart() == 0) {
+		return 0;
+	}
+
+	sfs_readjblock(sb_journalstart(), &jb);
+	if (jb.jb_magic != SFS_JOURNAL_MAGIC || jb.jb_type != SFS_JB_HEADER) {
+		warnx("Bad journal header (fixed)");
+		setbadness(EXIT_RECOV);
+		journal_reset(1);
+		return 0;
+	}
+	seq = jb.jb_seq;
+
+	n = journal_scan(seq);
+	if (n == 0) {
+		return 0;
+	}
+
+	warnx("Replaying %lu blocks from journal (transaction %lu)",
+	      (unsigned long) n, (unsigned long) seq);
+	setbadness(EXIT_RECOV);
+
+	pos = sb_journalstart() + 1;
+	while (1) {
+		sfs_readjblock(pos++, &jb);
+		if (jb.jb_type == SFS_JB_COMMIT) {
+			break;
+		}
+		for (i=0; i<jb.jb_nblocks; i++) {
+			diskread(data, pos++);
+			diskwrite(data, jb.jb_blocks[i]);
+		}
+	}
+
+	/* Done with it; the kernel won't replay it again */
+	journal_reset(seq + 1);
+	return 1;
+}
@@ -39,6 +39,7 @@
 #include "sb.h"
 #include "freemap.h"
 #include "inode.h"
+#include "journal.h"
 #include "passes.h"
 #include "main.h"
 
@@ -78,6 +79,11 @@ main(int argc, char **argv)
 	sfs_setup();
 	sb_load();
 	sb_check();
+	if (journal_replay()) {
+		/* The superblock may have been part of it */
+		sb_load();
+		sb_check();
+	}
 	freemap_setup();
 
 	printf("Phase 1 -- check blocks and sizes\n");
@@ -51,6 +51,7 @@ sfs_setup(void)
 	assert(sizeof(struct sfs_superblock)==SFS_BLOCKSIZE);
 	assert(sizeof(struct sfs_dinode)==SFS_BLOCKSIZE);
 	assert(SFS_BLOCKSIZE % sizeof(struct sfs_direntry) == 0);
+	assert(sizeof(struct sfs_jblock)==SFS_BLOCKSIZE);
 }
 
 ////////////////////////////////////////////////////////////
@@ -62,6 +63,23 @@ swapsb(struct sfs_superblock *sb)
 {
 	sb->sb_magic = SWAP32(sb->sb_magic);
 	sb->sb_nblocks = SWAP32(sb->sb_nblocks);
+	sb->sb_journalstart = SWAP32(sb->sb_journalstart);
+	sb->sb_journalblocks = SWAP32(sb->sb_journalblocks);
+}
+
+static
+void
+swapjblock(struct sfs_jblock *jb)
+{
+	unsigned i;
+
+	jb->jb_magic = SWAP32(jb->jb_magic);
+	jb->jb_type = SWAP32(jb->jb_type);
+	jb->jb_seq = SWAP32(jb->jb_seq);
+	jb->jb_nblocks = SWAP32(jb->jb_nblocks);
+	for (i=0; i<SFS_JB_MAXBLOCKS; i++) {
+		jb->jb_blocks[i] = SWAP32(jb->jb_blocks[i]);
+	}
 }
 
 static
@@ -206,6 +224,26 @@ sfs_writesb(uint32_t blocknum, struct sfs_superblock *sb)
 	swapsb(sb);
 }
 
+/*
+ * journal header, descriptor, and commit blocks - blocknum is a disk
+ * block number.
+ */
+
+void
+sfs_readjblock(uint32_t blocknum, struct sfs_jblock *jb)
+{
+	diskread(jb, blocknum);
+	swapjblock(jb);
+}
+
+void
+sfs_writejblock(uint32_t blocknum, struct sfs_jblock *jb)
+{
+	swapjblock(jb);
+	diskwrite(jb, blocknum);
+	swapjblock(jb);
+}
+
 /*
  * freemap blocks - whichblock is a block number within the free block
  * bitmap.
@@ -41,6 +41,7 @@
 struct sfs_superblock;
 struct sfs_dinode;
 struct sfs_direntry;
+struct sfs_jblock;
 
 /* Call this before anything else in this module */
 void sfs_setup(void);
@@ -53,6 +54,10 @@ void sfs_setup(void);
 void sfs_readsb(uint32_t blocknum, struct sfs_superblock *sb);
 void sfs_writesb(uint32_t blocknum, struct sfs_superblock *sb);
 
+/* journal blocks */
+void sfs_readjblock(uint32_t blocknum, struct sfs_jblock *jb);
+void sfs_writejblock(uint32_t blocknum, struct sfs_jblock *jb);
+
 /* freemap blocks; whichblock is the freemap block number (starts at 0) */
 void sfs_readfreemapblock(uint32_t whichblock, uint8_t *bits);
 void sfs_writefreemapblock(uint32_t whichblock, uint8_t *bits);
@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * deepfile - exercise the double and triple indirect blocks.
+ *
+ * Writes blocks on both sides of each indirect boundary, out past the
+ * end of what the double indirect block maps, and reads them back.
+ * Then truncates the file to inside the direct blocks and checks that
+ * the rest reads back as zeros when the file is extended again.
+ *
+ * Afterwards, unmount (or shut down) and run sfsck on the volume; it
+ * should find nothing to fix.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+
+/*
+ * XXX hardwired from SFS, as in frack
+ */
+#define BLOCKSIZE /*SFS_BLOCKSIZE*/ 512
+#define NDB       /*SFS_NDIRECT*/   15
+#define DBPERIDB  /*SFS_DBPERIDB*/  128
+
+#define DIND      (NDB + DBPERIDB)                      /* first dindirect */
+#define TIND      (DIND + DBPERIDB * DBPERIDB)          /* first tindirect */
+
+static const unsigned blocks[] = {
+	0, NDB - 1,                     /* direct */
+	NDB, DIND - 1,                  /* indirect */
+	DIND, DIND + DBPERIDB, TIND - 1,        /* double */
+	TIND, TIND + DBPERIDB,                  /* triple */
+	TIND + DBPERIDB * DBPERIDB + 5,
+};
+static const unsigned nblocks = sizeof(blocks) / sizeof(blocks[0]);
+
+/* where to truncate: partway into a direct block */
+#define TRUNCBLOCK 10
+#define TRUNCBYTES 100
+
+static char buf[BLOCKSIZE];
+
+static
+void
+fill(unsigned block)
+{
+	unsigned i;
+
+	for (i=0; i<BLOCKSIZE; i++) {
+		buf[i] = 'a' + (block * 7 + i) % 26;
+	}
+}
+
+static
+void
+check(const char *filename, unsigned block, size_t len, int zeros)
+{
+	char expected;
+	unsigned i;
+
+	for (i=0; i<len; i++) {
+		expected = zeros ? 0 : 'a' + (block * 7 + i) % 26;
+		if (buf[i] != expected) {
+			errx(1, "%s: block %u byte %u: found %d, expected %d",
+			     filename, block, i, buf[i], expected);
+		}
+	}
+}
+
+static
+void
+doseek(int fd, const char *filename, unsigned block)
+{
+	if (lseek(fd, (off_t)block * BLOCKSIZE, SEEK_SET) == -1) {
+		err(1, "%s: lseek to block %u", filename, block);
+	}
+}
+
+static
+void
+readblock(int fd, const char *filename, unsigned block, size_t len,
+	  int zeros)
+{
+	ssize_t r;
+
+	doseek(fd, filename, block);
+	r = read(fd, buf, BLOCKSIZE);
+	if (r < 0) {
+		err(1, "%s: read block %u", filename, block);
+	}
+	if ((size_t)r != len) {
+		errx(1, "%s: read block %u: got %zd bytes, expected %zu",
+		     filename, block, r, len);
+	}
+	check(filename, block, len, zeros);
+}
+
+static
+void
+checksize(int fd, const char *filename, off_t size)
+{
+	struct stat st;
+
+	if (fstat(fd, &st) < 0) {
+		err(1, "%s: fstat", filename);
+	}
+	if (st.st_size != size) {
+		errx(1, "%s: size is %lld, expected %lld", filename,
+		     (long long)st.st_size, (long long)size);
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *filename;
+	unsigned i, last;
+	off_t bigsize, smallsize;
+	ssize_t r;
+	int fd;
+
+	if (argc != 2) {
+		errx(1, "Usage: deepfile <filename>");
+	}
+	filename = argv[1];
+
+	last = blocks[nblocks - 1];
+	bigsize = (off_t)(last + 1) * BLOCKSIZE;
+	smallsize = (off_t)TRUNCBLOCK * BLOCKSIZE + TRUNCBYTES;
+
+	fd = open(filename, O_RDWR|O_CREAT|O_TRUNC);
+	if (fd < 0) {
+		err(1, "%s: create", filename);
+	}
+
+	tprintf("Writing %u blocks up to block %u\n", nblocks, last);
+	for (i=0; i<nblocks; i++) {
+		fill(blocks[i]);
+		doseek(fd, filename, blocks[i]);
+		r = write(fd, buf, BLOCKSIZE);
+		if (r < 0) {
+			err(1, "%s: write block %u", filename, blocks[i]);
+		}
+		if (r != BLOCKSIZE) {
+			errx(1, "%s: write block %u: short count %zd",
+			     filename, blocks[i], r);
+		}
+	}
+	checksize(fd, filename, bigsize);
+
+	tprintf("Reading them back\n");
+	for (i=0; i<nblocks; i++) {
+		readblock(fd, filename, blocks[i], BLOCKSIZE, 0);
+	}
+	/* and some of the holes */
+	readblock(fd, filename, NDB + 1, BLOCKSIZE, 1);
+	readblock(fd, filename, TIND + 1, BLOCKSIZE, 1);
+
+	tprintf("Truncating to %lld bytes\n", (long long)smallsize);
+	if (ftruncate(fd, smallsize) < 0) {
+		err(1, "%s: ftruncate", filename);
+	}
+	checksize(fd, filename, smallsize);
+	readblock(fd, filename, 0, BLOCKSIZE, 0);
+	readblock(fd, filename, TRUNCBLOCK, TRUNCBYTES, 1);
+	readblock(fd, filename, NDB, 0, 1);
+
+	tprintf("Extending to %lld bytes again\n", (long long)bigsize);
+	if (ftruncate(fd, bigsize) < 0) {
+		err(1, "%s: ftruncate", filename);
+	}
+	checksize(fd, filename, bigsize);
+	for (i=0; i<nblocks; i++) {
+		if (blocks[i] > TRUNCBLOCK) {
+			readblock(fd, filename, blocks[i], BLOCKSIZE, 1);
+		}
+	}
+
+	if (close(fd) < 0) {
+		err(1, "%s: close", filename);
+	}
+
+	tprintf("Passed. Now run sfsck on the volume.\n");
+	return 0;
+}
@@ -57,6 +57,8 @@ static const struct workload workloads[] = {
 	WLA(fillhole, size),
 	WLA(truncfill, size),
 	WLA(append, size),
+	WLA(interleave, size),
+	WLA(truncreuse, size),
 	WLA(trunczero, size),
 	WLA(trunconeblock, size),
 	WLA(truncsmallersize, size),
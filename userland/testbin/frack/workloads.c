@@ -470,6 +470,63 @@ wl_append(const char *size)
 	op_close(f);
 }
 
+/*
+ * Write several files at once, a little of each at a time, without
+ * syncing. With a journal this makes lots of commits, each holding
+ * indirect blocks of several files, so wherever it crashes there's
+ * some transaction to replay.
+ */
+void
+wl_interleave(const char *size)
+{
+	unsigned testcode = 13;
+	enum sizes sz;
+	struct file *f[4];
+	unsigned i;
+	off_t pos, len, amount;
+
+	sz = strtosize(size);
+	len = sizebytes(sz);
+
+	for (i=0; i<4; i++) {
+		f[i] = op_open(testcode, i/*filenum*/, O_CREAT|O_EXCL);
+	}
+	for (pos = 0; pos < len; pos += amount) {
+		amount = BLOCKSIZE * 8;
+		if (amount > len - pos) {
+			amount = len - pos;
+		}
+		for (i=0; i<4; i++) {
+			op_write(f[i], pos, amount);
+		}
+	}
+	for (i=0; i<4; i++) {
+		op_close(f[i]);
+	}
+}
+
+/*
+ * Truncate a file and write another one right away, so the second
+ * gets the first one's freed blocks (indirect blocks included) as
+ * data. Replaying the journal must not write old metadata over it.
+ */
+void
+wl_truncreuse(const char *size)
+{
+	unsigned testcode = 14; /* and 15 */
+	enum sizes sz;
+	struct file *f;
+
+	sz = strtosize(size);
+
+	writenewfile(testcode, 0/*filenum*/, sz);
+	op_sync();
+	f = op_open(testcode, 0/*filenum*/, 0);
+	op_truncate(f, 0);
+	op_close(f);
+	writenewfile(testcode + 1, 1/*filenum*/, sz);
+}
+
 ////////////////////////////////////////////////////////////
 // truncating
 
@@ -74,6 +74,8 @@ void wl_makehole(const char *size);
 void wl_fillhole(const char *size);
 void wl_truncfill(const char *size);
 void wl_append(const char *size);
+void wl_interleave(const char *size);
+void wl_truncreuse(const char *size);
 
 /*
  * truncating
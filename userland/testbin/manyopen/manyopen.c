@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * manyopen - time opening files while thousands of others are open.
+ *
+ * Creates a directory full of files and times opening and closing
+ * each of them, first with nothing else open and then while all of
+ * them are held open. In the second case every open finds the file's
+ * vnode already loaded, so it measures how the file system's table of
+ * loaded vnodes copes with a lot of entries.
+ *
+ * OPEN_MAX limits what one process can hold, so the files are held
+ * by a chain of processes: each opens its share, forks the next, and
+ * waits for it. The last one does the timing.
+ *
+ * Run it on kernels before and after a change to the vnode table and
+ * compare the per-open times.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <err.h>
+
+#define TESTDIR   "manyopen.d"
+#define DEFFILES  2048
+#define MAXFILES  8192
+#define PERPROC   (OPEN_MAX - 8)	/* leave room for stdin and friends */
+#define NPASSES   4
+
+static unsigned nfiles;
+static int fds[PERPROC];
+
+static
+void
+filename(unsigned i, char *buf, size_t len)
+{
+	snprintf(buf, len, "%s/f%u", TESTDIR, i);
+}
+
+static
+void
+createfiles(void)
+{
+	char name[32];
+	unsigned i;
+	int fd;
+
+	if (mkdir(TESTDIR, 0775) < 0) {
+		err(1, "%s: mkdir", TESTDIR);
+	}
+	for (i=0; i<nfiles; i++) {
+		filename(i, name, sizeof(name));
+		fd = open(name, O_WRONLY|O_CREAT|O_EXCL, 0664);
+		if (fd < 0) {
+			err(1, "%s: create", name);
+		}
+		close(fd);
+	}
+}
+
+static
+void
+removefiles(void)
+{
+	char name[32];
+	unsigned i;
+
+	for (i=0; i<nfiles; i++) {
+		filename(i, name, sizeof(name));
+		if (remove(name) < 0) {
+			warn("%s: remove", name);
+		}
+	}
+	if (rmdir(TESTDIR) < 0) {
+		warn("%s: rmdir", TESTDIR);
+	}
+}
+
+/*
+ * Open and close every file NPASSES times and report how long it
+ * took.
+ */
+static
+void
+timeopens(const char *what)
+{
+	char name[32];
+	time_t startsecs, endsecs;
+	unsigned long startnsecs, endnsecs, usecs;
+	unsigned pass, i;
+	int fd;
+
+	__time(&startsecs, &startnsecs);
+	for (pass=0; pass<NPASSES; pass++) {
+		for (i=0; i<nfiles; i++) {
+			filename(i, name, sizeof(name));
+			fd = open(name, O_RDONLY);
+			if (fd < 0) {
+				err(1, "%s: open", name);
+			}
+			close(fd);
+		}
+	}
+	__time(&endsecs, &endnsecs);
+
+	usecs = (endsecs - startsecs) * 1000000;
+	usecs = usecs + endnsecs / 1000 - startnsecs / 1000;
+	printf("%s: %u opens in %lu.%06lu seconds, %lu us each\n",
+	       what, NPASSES * nfiles, usecs / 1000000, usecs % 1000000,
+	       usecs / (NPASSES * nfiles));
+}
+
+/*
+ * Hold open files FIRST onward, PERPROC of them here and the rest in
+ * child processes, and time opens from the last process in the chain.
+ * Returns nonzero if something went wrong.
+ */
+static
+int
+holdfiles(unsigned first)
+{
+	char name[32];
+	unsigned i, n;
+	pid_t pid;
+	int status;
+
+	if (first >= nfiles) {
+		timeopens("all held");
+		return 0;
+	}
+
+	n = nfiles - first;
+	if (n > PERPROC) {
+		n = PERPROC;
+	}
+	for (i=0; i<n; i++) {
+		filename(first + i, name, sizeof(name));
+		fds[i] = open(name, O_RDONLY);
+		if (fds[i] < 0) {
+			err(1, "%s: open", name);
+		}
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		/* We hold our own share; the parent keeps these open */
+		for (i=0; i<n; i++) {
+			close(fds[i]);
+		}
+		exit(holdfiles(first + n));
+	}
+
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	for (i=0; i<n; i++) {
+		close(fds[i]);
+	}
+	return !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	int bad;
+
+	if (argc > 2) {
+		errx(1, "Usage: manyopen [nfiles]");
+	}
+	nfiles = argc == 2 ? (unsigned)atoi(argv[1]) : DEFFILES;
+	if (nfiles == 0 || nfiles > MAXFILES) {
+		errx(1, "nfiles must be between 1 and %u", MAXFILES);
+	}
+
+	printf("Creating %u files in %s\n", nfiles, TESTDIR);
+	createfiles();
+
+	timeopens("none held");
+	bad = holdfiles(0);
+
+	printf("Removing files\n");
+	removefiles();
+
+	if (bad) {
+		errx(1, "FAILED");
+	}
+	printf("Passed.\n");
+	return 0;
+}
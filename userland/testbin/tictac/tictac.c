@@ -58,6 +58,7 @@ bool ask_yesno(const char *msg);
 bool do_move(int player);
 void initialize_board(void);
 bool is_win(int x, int y);
+int  read_canon(char *buf, int length);
 int  read_string(char *buf, int length);
 void print_board(void);
 void print_instructions(void);
@@ -353,12 +354,49 @@ initialize_board(void)
 			board[i][j] = EMPTY;
 }
 
+/*
+ * Read a line with the console in canonical mode, so the kernel
+ * echoes and edits it. Returns -2 if the console can't do that.
+ */
+int
+read_canon(char *buf, int length)
+{
+	int	oldmode, mode;
+	int	len;
+	char	ch;
+
+	if (ioctl(STDIN_FILENO, TIOCGMODE, &oldmode) < 0)
+		return(-2);
+	mode = TTY_CANON;
+	if (ioctl(STDIN_FILENO, TIOCSMODE, &mode) < 0)
+		return(-2);
+
+	len = read(STDIN_FILENO, buf, length - 1);
+	if (len == length - 1 && buf[len - 1] != NEWLINE) {
+		/* Too long; throw away the rest of the line */
+		while (read(STDIN_FILENO, &ch, 1) == 1 && ch != NEWLINE)
+			;
+	}
+	ioctl(STDIN_FILENO, TIOCSMODE, &oldmode);
+
+	if (len <= 0)
+		return(-1);
+	if (buf[len - 1] == NEWLINE)
+		len--;
+	buf[len] = 0;
+	return(len);
+}
+
 int
 read_string(char *buf, int length)
 {
 	int	char_read;
 	int	i;
 
+	i = read_canon(buf, length);
+	if (i != -2)
+		return(i);
+
 	i = 0;
 	while ((char_read = getchar()) != EOF && char_read != NEWLINE &&
 	    i < length) {